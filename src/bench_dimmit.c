@@ -0,0 +1,440 @@
+/* Benchmarks for the daemon's hot path: key presses posted into the display
+ * controller and written out by a worker thread, against the in-memory mock
+ * backend with a simulated bus latency per display. The worker here is the one
+ * in dimmitd.c in miniature (a condvar kicked per press, concurrent writes,
+ * sleeping until a ramp's next frame), so a change to the locking or the
+ * scheduling shows up in these numbers the way it would in the daemon.
+ *
+ * Each scenario prints one line of key=value pairs, so runs can be diffed or
+ * collected by a script:
+ *
+ *     bench scenario=hold displays=8 bus_ms=40 ramp_ms=0 presses=60 writes=...
+ *
+ * with presses and writes per display, writes_per_s across all displays,
+ * coalesce (presses per write), the post latency input sees (controller_adjust
+ * plus the kick), and press_to_write -- from a batch's first press to the write
+ * that applied it (controller_stats) -- over every display. Latencies are in
+ * microseconds, as percentiles of stats.h's histograms (so within a factor of
+ * two).
+ *
+ * Each pattern runs against 1, 8 and MOCK_MAX_DISPLAYS displays. hold_slow is
+ * hold with display 0's writes taking three write budgets: its press_to_write
+ * is over the other displays, which a slow one must not hold back, and a second
+ * line gives the slow display's own worst. Then
+ * scenario=pass times a single press landing on 3 and MOCK_MAX_DISPLAYS
+ * displays, one write after another and all at once. Last, scenario=server
+ * times commands through the command server, alone and beside idle clients,
+ * and scenario=ring one step over a fresh socket against one over the shared
+ * command ring (neither on Windows).
+ *
+ * Usage: dimmit_bench [duration_ms [bus_ms [ramp_ms]]]   (default 1000 40 0) */
+#define _POSIX_C_SOURCE 200809L   /* clock_gettime, nanosleep */
+#include "display_controller.h"
+#include "command_server.h"
+#include "stats.h"
+#include "platform/backlight/backlight.h"
+#include "platform/ddc/in_memory_mock.h"
+#include "platform/ring/ring.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#ifdef _WIN32
+#include <windows.h>   /* Sleep */
+#else
+#include <sched.h>
+#endif
+
+/* A key held down autorepeats at about this rate. */
+#define AUTOREPEAT_HZ 30
+
+/* Idle time between taps: long enough that each lands on an idle worker. */
+#define TAP_INTERVAL_MS 250
+
+static display_controller *ctrl;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+static int kicked = 0;
+static int running = 0;
+static stats_histogram post_us;
+
+static void sleep_us(long long us) {
+    if (us <= 0) return;
+#ifdef _WIN32
+    Sleep((DWORD)((us + 999) / 1000));
+#else
+    struct timespec ts = { (time_t)(us / 1000000), (long)(us % 1000000) * 1000L };
+    nanosleep(&ts, NULL);
+#endif
+}
+
+/* dimmitd's post_fraction(): post, then wake the worker. */
+static void press(int dir) {
+    long long t0 = stats_now_us();
+    controller_adjust(ctrl, dir * (1.0/16.0));
+    pthread_mutex_lock(&lock);
+    kicked = 1;
+    pthread_cond_signal(&cond);
+    pthread_mutex_unlock(&lock);
+    stats_record(&post_us, stats_now_us() - t0);
+}
+
+/* dimmitd's brightness_worker(), less reconcile and acks. */
+static void *worker(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&lock);
+    while (running) {
+        pthread_mutex_unlock(&lock);
+        int applied = controller_service(ctrl);
+        pthread_mutex_lock(&lock);
+        if (applied > 0) continue;
+        long wait = controller_next_frame(ctrl);
+        if (wait < 0 || wait > 250) wait = 250;
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_nsec += wait * 1000000L;
+        ts.tv_sec += ts.tv_nsec / 1000000000L;
+        ts.tv_nsec %= 1000000000L;
+        if (!kicked && running)
+            pthread_cond_timedwait(&cond, &lock, &ts);
+        kicked = 0;
+    }
+    pthread_mutex_unlock(&lock);
+    return NULL;
+}
+
+/* One input source: presses at `hz` for `duration_ms`, in the direction
+ * `pattern` picks for the nth press. */
+typedef struct {
+    int hz;
+    long duration_ms;
+    int (*pattern)(int n, unsigned *seed);
+    unsigned seed;
+    int presses;
+} input_thread;
+
+/* A tap now and then, each a lone press: four up, then four back down. */
+static int pattern_tap(int n, unsigned *seed) {
+    (void)seed;
+    return (n / 4) % 2 ? -1 : 1;
+}
+
+/* A held key, released and held the other way every half second so it never
+ * sits at a rail (where presses stop producing writes). */
+static int pattern_hold(int n, unsigned *seed) {
+    (void)seed;
+    return (n / (AUTOREPEAT_HZ / 2)) % 2 ? -1 : 1;
+}
+
+/* Up and down at random, as from two keys mashed together. */
+static int pattern_mixed(int n, unsigned *seed) {
+    (void)n;
+    *seed = *seed * 1103515245u + 12345u;
+    return (*seed >> 16) & 1 ? 1 : -1;
+}
+
+static void *input_run(void *arg) {
+    input_thread *in = (input_thread*)arg;
+    long long period = 1000000LL / in->hz;
+    long long start = stats_now_us(), end = start + in->duration_ms * 1000LL;
+    for (long long next = start; next < end; next += period) {
+        sleep_us(next - stats_now_us());   /* on schedule, not drifting by the post time */
+        press(in->pattern(in->presses++, &in->seed));
+    }
+    return NULL;
+}
+
+typedef struct {
+    const char *name;
+    int (*pattern)(int n, unsigned *seed);
+    int hz;
+    int inputs;      /* threads pressing at once (the HID thread and a socket client, say) */
+    int slow_ms;     /* display 0's writes take this long instead of bus_ms (0: they don't) */
+} scenario;
+
+static void run(const scenario *sc, int displays, long duration_ms, int bus_ms, int ramp_ms) {
+    int cur[MOCK_MAX_DISPLAYS], max[MOCK_MAX_DISPLAYS];
+    for (int i = 0; i < MOCK_MAX_DISPLAYS; i++) { cur[i] = 50; max[i] = 100; }
+    if (displays < 1 || displays > MOCK_MAX_DISPLAYS) {
+        fprintf(stderr, "%d displays: the mock has 1 to %d\n", displays, MOCK_MAX_DISPLAYS);
+        exit(1);
+    }
+    mock_reset(displays, cur, max);
+    for (int i = 0; i < displays; i++) mock_set_latency(i, bus_ms);
+    if (sc->slow_ms) mock_set_latency(0, sc->slow_ms);
+    ctrl = controller_open();
+    if (!ctrl) {
+        fprintf(stderr, "controller_open failed\n");
+        exit(1);
+    }
+    controller_set_concurrent(ctrl, 1);
+    controller_set_ramp(ctrl, ramp_ms);
+    memset(&post_us, 0, sizeof(post_us));
+
+    running = 1;
+    pthread_t w, t[2];
+    input_thread in[2];
+    pthread_create(&w, NULL, worker, NULL);
+    long long start = stats_now_us();
+    for (int i = 0; i < sc->inputs; i++) {
+        in[i] = (input_thread){ sc->hz, duration_ms, sc->pattern, 12345u + (unsigned)i, 0 };
+        pthread_create(&t[i], NULL, input_run, &in[i]);
+    }
+    int presses = 0;
+    for (int i = 0; i < sc->inputs; i++) {
+        pthread_join(t[i], NULL);
+        presses += in[i].presses;
+    }
+    /* Let the last presses land (a ramp may still be under way). */
+    sleep_us((long long)(bus_ms + sc->slow_ms + ramp_ms) * 2000LL + 50000LL);
+    double secs = (double)(stats_now_us() - start) / 1e6;
+    pthread_mutex_lock(&lock);
+    running = 0;
+    pthread_cond_signal(&cond);
+    pthread_mutex_unlock(&lock);
+    pthread_join(w, NULL);
+
+    stats_histogram waited, slow_waited;
+    memset(&waited, 0, sizeof(waited));
+    memset(&slow_waited, 0, sizeof(slow_waited));
+    unsigned long writes = 0, failures = 0;
+    for (int i = 0; i < displays; i++) {
+        display_stats st;
+        if (controller_stats(ctrl, i, &st) != 0) continue;   /* gone: nothing to add */
+        writes += st.writes;
+        failures += st.failures;
+        stats_add(i == 0 && sc->slow_ms ? &slow_waited : &waited, &st.press_to_write_us);
+    }
+    controller_close(ctrl);
+
+    printf("bench scenario=%s displays=%d bus_ms=%d ramp_ms=%d presses=%d writes=%lu"
+           " failures=%lu writes_per_s=%.1f coalesce=%.2f"
+           " post_us_p50=%lu post_us_p99=%lu post_us_max=%lu"
+           " press_to_write_us_p50=%lu press_to_write_us_p90=%lu"
+           " press_to_write_us_p99=%lu press_to_write_us_max=%lu\n",
+           sc->name, displays, bus_ms, ramp_ms, presses, writes / (unsigned long)displays,
+           failures, (double)writes / secs,
+           writes ? (double)presses * displays / (double)writes : 0.0,
+           stats_percentile(&post_us, 50), stats_percentile(&post_us, 99), post_us.max_us,
+           stats_percentile(&waited, 50), stats_percentile(&waited, 90),
+           stats_percentile(&waited, 99), waited.max_us);
+    if (sc->slow_ms)
+        printf("bench scenario=%s displays=%d slow_ms=%d slow_press_to_write_us_max=%lu\n",
+               sc->name, displays, sc->slow_ms, slow_waited.max_us);
+    fflush(stdout);
+}
+
+/* One press across `displays` displays whose writes take bus_ms/2 to bus_ms,
+ * serviced until it has landed everywhere: one pass after another, and
+ * concurrent passes. Sequential pays about the sum of the round trips;
+ * concurrent about the slowest. */
+static void run_pass(int displays, int bus_ms) {
+    int cur[MOCK_MAX_DISPLAYS], max[MOCK_MAX_DISPLAYS];
+    for (int i = 0; i < MOCK_MAX_DISPLAYS; i++) { cur[i] = 50; max[i] = 100; }
+    const mock_timing jitter = { bus_ms / 2, bus_ms, 0, 0, 0 };
+    double took_ms[2];
+    for (int concurrent = 0; concurrent < 2; concurrent++) {
+        mock_reset(displays, cur, max);
+        mock_seed(1);
+        for (int i = 0; i < displays; i++) mock_set_timing(i, MOCK_SET, &jitter);
+        ctrl = controller_open();
+        if (!ctrl) {
+            fprintf(stderr, "controller_open failed\n");
+            exit(1);
+        }
+        controller_set_concurrent(ctrl, concurrent);
+        long long t0 = stats_now_us();
+        unsigned long ticket = controller_adjust(ctrl, 1.0/16.0);
+        while (controller_committed(ctrl) != ticket) controller_service(ctrl);
+        took_ms[concurrent] = (double)(stats_now_us() - t0) / 1000.0;
+        controller_close(ctrl);
+    }
+    printf("bench scenario=pass displays=%d bus_ms=%d-%d sequential_ms=%.1f concurrent_ms=%.1f\n",
+           displays, bus_ms / 2, bus_ms, took_ms[0], took_ms[1]);
+    fflush(stdout);
+}
+
+#ifndef _WIN32
+/* The command server, on a real socket: a client's "up" lines, each timed from
+ * send until the server has applied it -- alone, then with `idle` more clients
+ * connected, half of them silent and half stalled partway through a line. */
+#define SERVER_COMMANDS 300
+#define SERVER_IDLE_CLIENTS 16
+
+static int server_applied = 0;   /* atomic */
+static int server_stop = 0;      /* atomic */
+
+static int server_authorize(dimmit_sock_t client) { (void)client; return 1; }
+
+static unsigned long server_apply(int dir) {
+    (void)dir;
+    return (unsigned long)__atomic_add_fetch(&server_applied, 1, __ATOMIC_SEQ_CST);
+}
+
+static void *server_run(void *arg) {
+    command_server *s = arg;
+    while (!__atomic_load_n(&server_stop, __ATOMIC_SEQ_CST))
+        command_server_poll(s, 10);
+    return NULL;
+}
+
+static dimmit_sock_t server_socket(const char *path, int listening) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    dimmit_sock_t fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd == DIMMIT_BAD_SOCK) return fd;
+    int ok = listening
+        ? bind(fd, (struct sockaddr*)&addr, sizeof(addr)) == 0 && listen(fd, 64) == 0
+        : connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == 0;
+    if (!ok) {
+        net_close(fd);
+        fd = DIMMIT_BAD_SOCK;
+    }
+    return fd;
+}
+
+static void run_server(int idle) {   /* idle: 0 to SERVER_IDLE_CLIENTS */
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/dimmit-bench-%ld.sock", (long)getpid());
+    unlink(path);
+    dimmit_sock_t listener = server_socket(path, 1);
+    const command_handlers h = { server_authorize, server_apply, NULL, NULL };
+    command_server *s = listener == DIMMIT_BAD_SOCK ? NULL
+                      : command_server_open(listener, idle + 1, &h);
+    dimmit_sock_t active = s ? server_socket(path, 0) : DIMMIT_BAD_SOCK;
+    if (active == DIMMIT_BAD_SOCK) {
+        fprintf(stderr, "command server on %s failed\n", path);
+        exit(1);
+    }
+    __atomic_store_n(&server_stop, 0, __ATOMIC_SEQ_CST);
+    pthread_t t;
+    pthread_create(&t, NULL, server_run, s);
+    dimmit_sock_t others[SERVER_IDLE_CLIENTS];
+    for (int i = 0; i < idle; i++) {
+        others[i] = server_socket(path, 0);
+        if (others[i] != DIMMIT_BAD_SOCK && i % 2) send(others[i], "do", 2, 0);
+    }
+    while (command_server_clients(s) < idle + 1) sleep_us(1000);
+
+    stats_histogram applied_us;
+    memset(&applied_us, 0, sizeof(applied_us));
+    for (int i = 0; i < SERVER_COMMANDS; i++) {
+        int before = __atomic_load_n(&server_applied, __ATOMIC_SEQ_CST);
+        long long t0 = stats_now_us();
+        if (send(active, "up\n", 3, 0) != 3) break;
+        while (__atomic_load_n(&server_applied, __ATOMIC_SEQ_CST) == before) sched_yield();
+        stats_record(&applied_us, stats_now_us() - t0);
+    }
+
+    __atomic_store_n(&server_stop, 1, __ATOMIC_SEQ_CST);
+    pthread_join(t, NULL);
+    command_server_close(s);
+    for (int i = 0; i < idle; i++)
+        if (others[i] != DIMMIT_BAD_SOCK) net_close(others[i]);
+    net_close(active);
+    net_close(listener);
+    unlink(path);
+    printf("bench scenario=server idle_clients=%d commands=%d"
+           " applied_us_p50=%lu applied_us_p99=%lu applied_us_max=%lu\n",
+           idle, SERVER_COMMANDS, stats_percentile(&applied_us, 50),
+           stats_percentile(&applied_us, 99), applied_us.max_us);
+    fflush(stdout);
+}
+
+/* One step, press to applied: dimmit-up/down's one-shot socket (connect, send,
+ * close) against one posted to the shared command ring. Where the platform has
+ * no ring, just the socket. */
+static void run_ring(void) {
+    char path[64];
+    snprintf(path, sizeof(path), "/tmp/dimmit-bench-%ld.sock", (long)getpid());
+    unlink(path);
+    dimmit_sock_t listener = server_socket(path, 1);
+    const command_handlers h = { server_authorize, server_apply, NULL, NULL };
+    command_server *s = listener == DIMMIT_BAD_SOCK ? NULL : command_server_open(listener, 4, &h);
+    if (!s) {
+        fprintf(stderr, "command server on %s failed\n", path);
+        exit(1);
+    }
+    ring_host *host = ring_host_open();
+    command_server_set_ring(s, host);
+    __atomic_store_n(&server_stop, 0, __ATOMIC_SEQ_CST);
+    pthread_t t;
+    pthread_create(&t, NULL, server_run, s);
+
+    stats_histogram socket_us, ring_us;
+    memset(&socket_us, 0, sizeof(socket_us));
+    memset(&ring_us, 0, sizeof(ring_us));
+    for (int i = 0; i < SERVER_COMMANDS; i++) {
+        int before = __atomic_load_n(&server_applied, __ATOMIC_SEQ_CST);
+        long long t0 = stats_now_us();
+        dimmit_sock_t c = server_socket(path, 0);
+        if (c == DIMMIT_BAD_SOCK) break;
+        int sent = send(c, "up\n", 3, 0) == 3;
+        net_close(c);
+        if (!sent) break;
+        while (__atomic_load_n(&server_applied, __ATOMIC_SEQ_CST) == before) sched_yield();
+        stats_record(&socket_us, stats_now_us() - t0);
+    }
+    dimmit_sock_t fd = server_socket(path, 0);
+    ring_client *rc = fd == DIMMIT_BAD_SOCK ? NULL : ring_client_attach(fd);
+    if (fd != DIMMIT_BAD_SOCK) net_close(fd);
+    for (int i = 0; rc && i < SERVER_COMMANDS; i++) {
+        int before = __atomic_load_n(&server_applied, __ATOMIC_SEQ_CST);
+        long long t0 = stats_now_us();
+        if (ring_client_post(rc, i % 2 ? -1 : 1) < 0) break;
+        while (__atomic_load_n(&server_applied, __ATOMIC_SEQ_CST) == before) sched_yield();
+        stats_record(&ring_us, stats_now_us() - t0);
+    }
+    int ringed = rc != NULL;
+    if (rc) ring_client_close(rc);
+
+    __atomic_store_n(&server_stop, 1, __ATOMIC_SEQ_CST);
+    pthread_join(t, NULL);
+    command_server_close(s);
+    ring_host_close(host);
+    net_close(listener);
+    unlink(path);
+    printf("bench scenario=ring steps=%d socket_us_p50=%lu socket_us_p99=%lu",
+           SERVER_COMMANDS, stats_percentile(&socket_us, 50), stats_percentile(&socket_us, 99));
+    if (ringed)
+        printf(" ring_us_p50=%lu ring_us_p99=%lu",
+               stats_percentile(&ring_us, 50), stats_percentile(&ring_us, 99));
+    printf("\n");
+    fflush(stdout);
+}
+#endif
+
+int main(int argc, char **argv) {
+    long duration_ms = argc > 1 ? atol(argv[1]) : 1000;
+    int bus_ms = argc > 2 ? atoi(argv[2]) : 40;
+    int ramp_ms = argc > 3 ? atoi(argv[3]) : 0;
+    if (duration_ms <= 0 || bus_ms < 0 || ramp_ms < 0) {
+        fprintf(stderr, "usage: %s [duration_ms [bus_ms [ramp_ms]]]\n", argv[0]);
+        return 2;
+    }
+    backlight_set_sysfs_root("");   /* the mock's displays only, not this machine's panel */
+    const scenario scenarios[] = {
+        { "tap",       pattern_tap,   1000 / TAP_INTERVAL_MS, 1, 0 },
+        { "hold",      pattern_hold,  AUTOREPEAT_HZ,          1, 0 },
+        { "mixed",     pattern_mixed, AUTOREPEAT_HZ,          2, 0 },
+        { "hold_slow", pattern_hold,  AUTOREPEAT_HZ,          1, 3 * CONTROLLER_WRITE_BUDGET_MS },
+    };
+    const int displays[] = { 1, 8, MOCK_MAX_DISPLAYS };
+    for (size_t d = 0; d < sizeof(displays) / sizeof(displays[0]); d++)
+        for (size_t s = 0; s < sizeof(scenarios) / sizeof(scenarios[0]); s++)
+            if (!scenarios[s].slow_ms || displays[d] > 1)   /* needs the others to compare */
+                run(&scenarios[s], displays[d], duration_ms, bus_ms, ramp_ms);
+    const int pass_displays[] = { 3, MOCK_MAX_DISPLAYS };
+    for (size_t d = 0; d < sizeof(pass_displays) / sizeof(pass_displays[0]); d++)
+        run_pass(pass_displays[d], bus_ms);
+#ifndef _WIN32
+    run_server(0);
+    run_server(SERVER_IDLE_CLIENTS);
+    run_ring();
+#endif
+    return 0;
+}
@@ -1,10 +1,87 @@
 #include "brightness.h"
+#include "platform/backlight/backlight.h"
 #include "platform/ddc/abstraction.h"
 #include <stdlib.h>
+#include <string.h>
 
 int brightness_enumerate(brightness_source **out, int *count) {
-    /* Phase 1 has a single provider. Phase 2 concatenates internal providers. */
-    return ddc_enumerate_sources(out, count);
+    int changed = 0;
+    return brightness_enumerate_changes(NULL, 0, out, count, &changed);
+}
+
+/* The entries of `known` whose id starts with `prefix`, copied into `out`. */
+static int known_with_prefix(const brightness_source *known, int known_count,
+                             const char *prefix, brightness_source *out) {
+    int n = 0;
+    for (int i = 0; i < known_count; i++)
+        if (strncmp(known[i].id, prefix, strlen(prefix)) == 0) out[n++] = known[i];
+    return n;
+}
+
+/* Undo one provider's result: close what it newly opened (anything whose ctx
+ * isn't a known one's, which the caller still owns) and free the array. */
+static void discard(brightness_source *arr, int n, const brightness_source *known, int known_count) {
+    for (int i = 0; i < n; i++) {
+        int kept = 0;
+        for (int k = 0; k < known_count && !kept; k++) kept = arr[i].ctx == known[k].ctx;
+        if (!kept && arr[i].ops && arr[i].ops->close) arr[i].ops->close(arr[i].ctx);
+    }
+    free(arr);
+}
+
+int brightness_enumerate_changes(const brightness_source *known, int known_count,
+                                 brightness_source **out, int *count, int *changed) {
+    *out = NULL; *count = 0; *changed = 0;
+
+    /* Each provider gets its own share of `known`, by id prefix. */
+    brightness_source *bl_known = NULL, *ddc_known = NULL;
+    if (known_count > 0) {
+        bl_known = (brightness_source*)malloc((size_t)known_count * sizeof(*bl_known));
+        ddc_known = (brightness_source*)malloc((size_t)known_count * sizeof(*ddc_known));
+        if (!bl_known || !ddc_known) { free(bl_known); free(ddc_known); return -1; }
+    }
+    int bl_known_n = known_with_prefix(known, known_count, "backlight:", bl_known);
+    int ddc_known_n = known_with_prefix(known, known_count, "ddc:", ddc_known);
+
+    /* The backlight class first: a monitor the ddcci kernel driver exposes there
+     * is driven through it (an open file, no DDC/CI exchange of our own), and the
+     * DDC provider leaves it alone. */
+    brightness_source *bl = NULL, *ddc = NULL;
+    int bl_n = 0, ddc_n = 0, bl_changed = 0, ddc_changed = 0;
+    int rc = backlight_enumerate_sources(bl_known, bl_known_n, &bl, &bl_n, &bl_changed);
+    if (rc == 0) {
+        const brightness_source *claimed = bl_changed ? bl : bl_known;
+        int claimed_n = bl_changed ? bl_n : bl_known_n;
+        rc = ddc_enumerate_sources(ddc_known, ddc_known_n, claimed, claimed_n,
+                                   &ddc, &ddc_n, &ddc_changed);
+    }
+
+    /* A provider with no change contributes its known sources as they are. */
+    if (rc == 0 && (bl_changed || ddc_changed)) {
+        if (!bl_changed) { bl_n = bl_known_n; }
+        if (!ddc_changed) { ddc_n = ddc_known_n; }
+        int n = bl_n + ddc_n;
+        brightness_source *arr = n ? (brightness_source*)malloc((size_t)n * sizeof(*arr)) : NULL;
+        if (n && !arr) {
+            rc = -1;
+        } else {
+            if (bl_n) memcpy(arr, bl_changed ? bl : bl_known, (size_t)bl_n * sizeof(*arr));
+            if (ddc_n) memcpy(arr + bl_n, ddc_changed ? ddc : ddc_known, (size_t)ddc_n * sizeof(*arr));
+            *out = arr; *count = n; *changed = 1;
+            free(bl);
+            free(ddc);
+            bl = ddc = NULL;
+        }
+    }
+    if (bl) discard(bl, bl_changed ? bl_n : 0, bl_known, bl_known_n);
+    if (ddc) discard(ddc, ddc_changed ? ddc_n : 0, ddc_known, ddc_known_n);
+    free(bl_known);
+    free(ddc_known);
+    return rc;
+}
+
+int brightness_retry_due(void) {
+    return backlight_retry_due() || ddc_retry_due();
 }
 
 void brightness_free(brightness_source *sources, int count) {
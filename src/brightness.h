@@ -1,22 +1,41 @@
 #ifndef BRIGHTNESS_H
 #define BRIGHTNESS_H
 
+#include "display_db.h"   /* DISPLAY_DB_ID_MAX */
+
 /* A generic, technology-independent handle to one controllable display's
- * brightness. Providers (DDC today; sysfs/WMI in Phase 2) each enumerate zero or
- * more of these; the controller treats them uniformly. Brightness is a plain
- * integer in [0, max] -- no VCP here (that lives inside the DDC provider). */
+ * brightness. Providers (the OS's backlight class, then DDC; see brightness.c)
+ * each enumerate zero or more of these; the controller treats them uniformly.
+ * Brightness is a plain integer in [0, max] -- no VCP here (that lives inside
+ * the DDC provider). */
+
+/* Controls a display may have besides its brightness, which the controller can
+ * step along with it (controller_link_feature). Named, not numbered: the
+ * provider maps each to its own (for DDC, a VCP code). */
+typedef enum {
+    BRIGHTNESS_CONTRAST = 0,
+    BRIGHTNESS_FEATURES            /* how many */
+} brightness_feature;
 
 typedef struct {
     int  (*get)(void *ctx, int *current, int *max); /* 0 on success */
     int  (*set)(void *ctx, int value);              /* 0 on success */
     void (*close)(void *ctx);                        /* release ctx */
+    /* Optional (NULL: brightness only), as get/set for feature `f`; a display
+     * without that control fails the get. */
+    int  (*get_feature)(void *ctx, brightness_feature f, int *current, int *max);
+    int  (*set_feature)(void *ctx, brightness_feature f, int value);
 } brightness_ops;
 
 typedef struct {
     const brightness_ops *ops;
     void *ctx;          /* provider-private per-display state */
-    char  id[64];       /* stable-ish key for reconcile (provisional in Phase 1) */
+    char  id[64];       /* stable-ish key for reconcile; "<provider>:..." */
     char  label[64];    /* human-readable, for logs */
+    /* The monitor itself, across ports and restarts (display_db.h); "" if the
+     * provider can't tell. */
+    char  identity[DISPLAY_DB_ID_MAX];
+    long long open_us;  /* how long the provider took to open (and probe) it */
 } brightness_source;
 
 /* Enumerate every controllable display across all registered providers.
@@ -24,6 +43,22 @@ typedef struct {
  * Returns 0 on success (count may be 0), -1 on allocation failure. */
 int  brightness_enumerate(brightness_source **out, int *count);
 
+/* Incremental enumerate for reconcile, against the caller's live `known` set.
+ * A display whose id is already known is neither reopened nor probed: its entry
+ * in *out is a copy of the known source, sharing its ctx (which the caller still
+ * owns). When the ids found are exactly the known ones, *changed is 0 and no
+ * array is returned -- the idle path, which probes nothing. Otherwise
+ * *changed is 1 and *out is as for brightness_enumerate. Returns 0 on success,
+ * -1 on allocation failure. */
+int  brightness_enumerate_changes(const brightness_source *known, int known_count,
+                                  brightness_source **out, int *count, int *changed);
+
+/* 1 if a display that failed its probe or open is due another try (see
+ * platform/ddc/abstraction.h and platform/backlight/backlight.h), so a
+ * reconcile pass is worth running even with no hotplug event. Call from the
+ * enumerating thread. */
+int  brightness_retry_due(void);
+
 /* Close every source (calls ops->close on each ctx) and free the array. */
 void brightness_free(brightness_source *sources, int count);
 
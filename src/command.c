@@ -1,5 +1,6 @@
 #include "command.h"
 
+#include <stdlib.h>
 #include <string.h>
 
 int parse_command(const char *cmd) {
@@ -8,6 +9,61 @@ int parse_command(const char *cmd) {
     return 0;
 }
 
+/* Parse a decimal sequence number ending at a space or the end of the line. */
+static int parse_seq(const char *p, unsigned long *seq, const char **end) {
+    if (*p < '0' || *p > '9') return 0;
+    char *e;
+    *seq = strtoul(p, &e, 10);
+    if (*e != ' ' && *e != '\0') return 0;
+    *end = e;
+    return 1;
+}
+
+int parse_request(const char *line, command_request *req) {
+    memset(req, 0, sizeof(*req));
+    if (line[0] != 'v' || line[1] < '0' || line[1] > '9') {
+        req->dir = parse_command(line);
+        return req->dir != 0;
+    }
+
+    const char *p;
+    char *e;
+    req->version = (int)strtol(line + 1, &e, 10);
+    if (*e != ' ' || !parse_seq(e + 1, &req->seq, &p)) {
+        req->seq = 0;
+        req->error = "bad-request";
+        return 0;
+    }
+    if (req->version != COMMAND_PROTOCOL_VERSION) {
+        req->error = "version";
+        return 0;
+    }
+
+    char verb[8];
+    size_t n = 0;
+    if (*p == ' ') p++;
+    while (p[n] && p[n] != ' ' && n < sizeof(verb) - 1) n++;
+    memcpy(verb, p, n);
+    verb[n] = '\0';
+    p += n;
+    if (strcmp(verb, "ring") == 0 && *p == '\0') {
+        req->ring = 1;
+        return 1;
+    }
+    if (strcmp(verb, "stats") == 0 && *p == '\0') {
+        req->stats = 1;
+        return 1;
+    }
+    req->dir = parse_command(verb);
+    if (strcmp(p, " ack") == 0) req->ack = 1;
+    else if (*p != '\0') req->dir = 0;
+    if (req->dir == 0) {
+        req->error = "bad-request";
+        return 0;
+    }
+    return 1;
+}
+
 int read_command(dimmit_sock_t fd) {
     char buf[16];
     int n = (int)recv(fd, buf, sizeof(buf) - 1, 0);
@@ -18,3 +74,52 @@ int read_command(dimmit_sock_t fd) {
 
     return parse_command(buf);
 }
+
+void command_reader_init(command_reader *r) {
+    r->len = 0;
+    r->discarding = 0;
+    r->eof = 0;
+}
+
+int command_reader_fill(command_reader *r, dimmit_sock_t fd) {
+    /* Never full in practice: callers pop every line after a fill, leaving at
+     * most one partial line (< COMMAND_LINE_MAX) behind. */
+    int room = (int)sizeof(r->buf) - r->len;
+    if (room <= 0) return -1;
+    int n = (int)recv(fd, r->buf + r->len, room, 0);
+    if (n == 0) r->eof = 1;
+    if (n > 0) r->len += n;
+    return n;
+}
+
+/* Drop the first `n` buffered bytes. */
+static void reader_consume(command_reader *r, int n) {
+    memmove(r->buf, r->buf + n, (size_t)(r->len - n));
+    r->len -= n;
+}
+
+int command_reader_next(command_reader *r, char *line) {
+    for (;;) {
+        char *nl = (char*)memchr(r->buf, '\n', (size_t)r->len);
+        int end = nl ? (int)(nl - r->buf) : r->len;
+
+        if (!nl && !r->eof) {
+            /* Incomplete. An overlong one can never fit: start discarding it. */
+            if (r->len >= COMMAND_LINE_MAX) { r->discarding = 1; r->len = 0; }
+            return 0;
+        }
+        if (!nl && r->len == 0) return 0;            /* eof, nothing left */
+
+        int skip = nl ? end + 1 : end;
+        if (r->discarding || end >= COMMAND_LINE_MAX) {
+            r->discarding = 0;                        /* tail of an overlong line */
+            reader_consume(r, skip);
+            continue;
+        }
+        if (end > 0 && r->buf[end - 1] == '\r') end--;
+        memcpy(line, r->buf, (size_t)end);
+        line[end] = '\0';
+        reader_consume(r, skip);
+        return 1;
+    }
+}
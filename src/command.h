@@ -17,4 +17,69 @@ int parse_command(const char *cmd);
  * is ignored. */
 int read_command(dimmit_sock_t fd);
 
+/* Streaming: a client may keep its connection open and send many
+ * newline-delimited commands. A command_reader buffers one connection's bytes
+ * across recv() calls, so a command split over two reads, or several arriving
+ * in one, each come out as exactly one line. */
+#define COMMAND_LINE_MAX 64    /* longer lines are discarded whole */
+
+typedef struct {
+    char buf[4 * COMMAND_LINE_MAX];
+    int  len;                  /* bytes buffered, not yet returned as a line */
+    int  discarding;           /* inside an overlong line: drop until newline */
+    int  eof;                  /* peer closed; the last line may lack "\n" */
+} command_reader;
+
+void command_reader_init(command_reader *r);
+
+/* One recv() into the buffer. Returns the byte count, 0 when the peer has closed
+ * (sets eof), or -1 on error (including would-block on a non-blocking socket;
+ * check the platform error to tell them apart). */
+int  command_reader_fill(command_reader *r, dimmit_sock_t fd);
+
+/* Pop the next complete line (without its "\n" or "\r\n") into `line`, which
+ * must hold COMMAND_LINE_MAX bytes. Returns 1 if a line was produced, 0 if more
+ * input is needed (or, after eof, none is left). */
+int  command_reader_next(command_reader *r, char *line);
+
+/* Framed requests (protocol version 1). A line of the form
+ *
+ *     v1 <seq> up|down [ack]
+ *
+ * carries a client-chosen sequence number (decimal). With "ack", the daemon
+ * replies once the step has been written to the displays:
+ *
+ *     v1 <seq> ok <level>/<max> ...     one pair per display, in display order
+ *
+ * and a malformed framed request, or one in a version we don't speak, gets
+ *
+ *     v1 <seq> err <reason>             (seq 0 if it couldn't be parsed)
+ *
+ * whether or not it asked for an ack. "v1 <seq> ring" asks for the shared
+ * command ring (platform/ring/ring.h); the reply "v1 <seq> ok ring" carries its
+ * descriptors, or else it's "v1 <seq> err unsupported". "v1 <seq> stats" asks
+ * for the daemon's counters and latency histograms:
+ *
+ *     v1 <seq> ok stats <n>             then <n> lines of the report
+ *
+ * (see command_server.h for the report's format). Replies on one connection
+ * come back in request order, so a client can pipeline. Bare "up"/"down" lines
+ * are version 0: applied as before, never answered. */
+#define COMMAND_PROTOCOL_VERSION 1
+
+typedef struct {
+    int           version;     /* 0 = bare text, else the framed version */
+    unsigned long seq;         /* framed only */
+    int           dir;         /* +1 up, -1 down, 0 unrecognized */
+    int           ack;         /* framed only: reply once committed */
+    int           ring;        /* framed only: a request for the shared ring */
+    int           stats;       /* framed only: a request for the stats report */
+    const char   *error;       /* framed only: why it was refused, or NULL */
+} command_request;
+
+/* Parse one line (as produced by command_reader_next). Returns 1 if `req` is a
+ * step to apply (or a ring or stats request), 0 if not (an unrecognized bare
+ * line, or a framed request with req->error set). */
+int parse_request(const char *line, command_request *req);
+
 #endif /* COMMAND_H */
@@ -0,0 +1,41 @@
+#include "command_ring.h"
+
+void command_ring_init(command_ring *r) {
+    r->magic = COMMAND_RING_MAGIC;
+    __atomic_store_n(&r->head, 0, __ATOMIC_RELEASE);
+    for (unsigned i = 0; i < COMMAND_RING_SLOTS; i++)
+        __atomic_store_n(&r->slots[i].seq, i, __ATOMIC_RELEASE);
+}
+
+int command_ring_push(command_ring *r, int dir) {
+    unsigned pos = __atomic_load_n(&r->head, __ATOMIC_RELAXED);
+    for (;;) {
+        command_ring_slot *s = &r->slots[pos % COMMAND_RING_SLOTS];
+        unsigned seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+        int diff = (int)(seq - pos);
+        if (diff == 0) {
+            /* Free for this lap: claim it (on failure pos is reloaded). */
+            if (__atomic_compare_exchange_n(&r->head, &pos, pos + 1, 1,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                s->dir = dir;
+                __atomic_store_n(&s->seq, pos + 1, __ATOMIC_RELEASE);
+                return 0;
+            }
+        } else if (diff < 0) {
+            return -1;   /* still holds last lap's step: full */
+        } else {
+            pos = __atomic_load_n(&r->head, __ATOMIC_RELAXED);   /* lost a race */
+        }
+    }
+}
+
+int command_ring_pop(command_ring *r, unsigned *pos, int *dir) {
+    command_ring_slot *s = &r->slots[*pos % COMMAND_RING_SLOTS];
+    if (__atomic_load_n(&s->seq, __ATOMIC_ACQUIRE) != *pos + 1)
+        return 0;
+    int d = s->dir;
+    *dir = d > 0 ? 1 : d < 0 ? -1 : 0;
+    __atomic_store_n(&s->seq, *pos + COMMAND_RING_SLOTS, __ATOMIC_RELEASE);
+    (*pos)++;
+    return 1;
+}
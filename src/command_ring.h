@@ -0,0 +1,40 @@
+#ifndef COMMAND_RING_H
+#define COMMAND_RING_H
+
+/* A fixed-size multi-producer, single-consumer queue of brightness steps laid
+ * out to live in memory shared between the daemon and its local clients (see
+ * platform/ring). Producers claim a slot with one compare-and-swap and publish it
+ * with one store; the daemon pops in order. Every slot carries a sequence number
+ * (a bounded queue in the style of Vyukov's), so a slow producer only delays the
+ * slots behind its own and never exposes a half-written one.
+ *
+ * The daemon keeps its read position privately rather than trusting the shared
+ * copy, and clamps every popped step, so a client that scribbles over the ring
+ * can at worst stall it or send presses -- which it could do over the socket. */
+
+#define COMMAND_RING_MAGIC 0x64696d72u   /* "dimr" */
+#define COMMAND_RING_SLOTS 256           /* power of two */
+
+typedef struct {
+    unsigned seq;              /* == position + 1 once published */
+    int      dir;              /* +1 up, -1 down */
+} command_ring_slot;
+
+typedef struct {
+    unsigned         magic;
+    unsigned         head;     /* next position a producer claims (atomic) */
+    command_ring_slot slots[COMMAND_RING_SLOTS];
+} command_ring;
+
+/* Daemon: format an empty ring in place. */
+void command_ring_init(command_ring *r);
+
+/* Any process/thread, lock-free: enqueue one step. Returns 0, or -1 if the ring
+ * is full (the daemon is behind by COMMAND_RING_SLOTS steps). */
+int  command_ring_push(command_ring *r, int dir);
+
+/* The single consumer: pop the step at *pos into *dir and advance *pos. Returns
+ * 1, or 0 if the next slot isn't published yet. *pos starts at 0. */
+int  command_ring_pop(command_ring *r, unsigned *pos, int *dir);
+
+#endif /* COMMAND_RING_H */
@@ -0,0 +1,339 @@
+#include "command_server.h"
+#include "command.h"
+#include "platform/ring/ring.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#endif
+
+#ifdef MSG_NOSIGNAL
+#define SEND_FLAGS MSG_NOSIGNAL
+#else
+#define SEND_FLAGS 0   /* macOS: dimmitd ignores SIGPIPE; Windows has none */
+#endif
+
+/* A framed request's reply, queued until it can be sent in request order: an
+ * error goes as soon as it reaches the head, an ack once its ticket commits. */
+typedef struct {
+    unsigned long seq;
+    unsigned long ticket;
+    const char   *error;       /* NULL: an ack (or a ring hand-out) */
+    int           ring;        /* hand out the shared ring with this reply */
+    int           stats;       /* the statistics report, formatted when sent */
+} pending_reply;
+
+typedef struct {
+    dimmit_sock_t  fd;
+    command_reader reader;
+    pending_reply  replies[COMMAND_SERVER_MAX_ACKS];   /* ring */
+    int            head, queued;
+} client_conn;
+
+struct command_server {
+    dimmit_sock_t        listener;
+    command_handlers     h;
+    int                  max_clients;
+    int                  count;     /* written only by the polling thread */
+    client_conn         *clients;   /* [0, count) open */
+    struct pollfd       *pfds;      /* fixed entries + one per client, rebuilt per poll */
+    int                  fixed;     /* listener, the wake pipe where there is one, ... */
+    ring_host           *ring;      /* ... and the ring's doorbell once one is set */
+    char                *report;    /* COMMAND_SERVER_REPORT_MAX, for stats replies */
+#ifndef _WIN32
+    int                  wake[2];   /* self-pipe: command_server_wake() -> poll() */
+#endif
+};
+
+command_server *command_server_open(dimmit_sock_t listener, int max_clients,
+                                    const command_handlers *handlers) {
+    if (max_clients < 1) max_clients = 1;
+    command_server *s = calloc(1, sizeof(*s));
+    if (!s) return NULL;
+    s->clients = calloc((size_t)max_clients, sizeof(*s->clients));
+    s->pfds = calloc((size_t)max_clients + 3, sizeof(*s->pfds));
+    s->report = malloc(COMMAND_SERVER_REPORT_MAX);
+    if (!s->clients || !s->pfds || !s->report) {
+        free(s->clients);
+        free(s->pfds);
+        free(s->report);
+        free(s);
+        return NULL;
+    }
+    s->listener = listener;
+    s->h = *handlers;
+    s->max_clients = max_clients;
+    s->fixed = 1;
+#ifndef _WIN32
+    if (pipe(s->wake) == 0) {
+        for (int i = 0; i < 2; i++) {
+            net_set_nonblocking(s->wake[i]);
+            fcntl(s->wake[i], F_SETFD, FD_CLOEXEC);
+        }
+        s->fixed = 2;
+    }
+#endif
+    /* Non-blocking so a connection that vanishes between poll() and accept()
+     * can't park the whole loop in accept(). */
+    net_set_nonblocking(listener);
+    return s;
+}
+
+/* Drain the accept queue. Returns -1 only if the listener is broken. */
+static int accept_ready(command_server *s) {
+    for (;;) {
+        dimmit_sock_t fd = accept(s->listener, NULL, NULL);
+        if (fd == DIMMIT_BAD_SOCK) {
+            if (net_would_block() || net_interrupted()) return 0;
+            perror("accept");
+            return -1;
+        }
+        if (!s->h.authorize(fd)) {
+            fprintf(stderr, "Access denied\n");
+            net_close(fd);
+            continue;
+        }
+        if (s->count == s->max_clients) {
+            fprintf(stderr, "Too many connections (%d); refusing one\n", s->max_clients);
+            net_close(fd);
+            continue;
+        }
+        if (net_set_nonblocking(fd) < 0) {
+            perror("net_set_nonblocking");
+            net_close(fd);
+            continue;
+        }
+        client_conn *c = &s->clients[s->count];
+        c->fd = fd;
+        command_reader_init(&c->reader);
+        c->head = c->queued = 0;
+        __atomic_store_n(&s->count, s->count + 1, __ATOMIC_RELEASE);
+    }
+}
+
+/* Queue a framed reply behind any still awaiting their ack. Returns -1 if the
+ * client already has COMMAND_SERVER_MAX_ACKS outstanding. */
+static int queue_reply(client_conn *c, unsigned long seq, unsigned long ticket,
+                       const char *error, int ring, int stats) {
+    if (c->queued == COMMAND_SERVER_MAX_ACKS) return -1;
+    pending_reply *r = &c->replies[(c->head + c->queued++) % COMMAND_SERVER_MAX_ACKS];
+    r->seq = seq;
+    r->ticket = ticket;
+    r->error = error;
+    r->ring = ring;
+    r->stats = stats;
+    return 0;
+}
+
+/* Send the statistics report, headed by its line count. */
+static int send_report(command_server *s, client_conn *c, unsigned long seq) {
+    char *report = s->report;
+    int len = s->h.stats(report, COMMAND_SERVER_REPORT_MAX);
+    if (len < 0) len = 0;
+    if (len >= COMMAND_SERVER_REPORT_MAX) {   /* cut short: keep whole lines */
+        len = COMMAND_SERVER_REPORT_MAX - 1;
+        while (len > 0 && report[len - 1] != '\n') len--;
+    }
+    int lines = 0;
+    for (int i = 0; i < len; i++) lines += report[i] == '\n';
+    char head[64];
+    int n = snprintf(head, sizeof(head), "v%d %lu ok stats %d\n", COMMAND_PROTOCOL_VERSION, seq, lines);
+    if ((int)send(c->fd, head, n, SEND_FLAGS) != n) return -1;
+    return len == 0 || (int)send(c->fd, report, len, SEND_FLAGS) == len ? 0 : -1;
+}
+
+/* Has ticket `t` been committed? (Tickets wrap.) */
+static int ticket_done(unsigned long t, unsigned long committed) {
+    return (long)(committed - t) >= 0;
+}
+
+/* Send every ready reply at the head of the client's queue. The committed
+ * ticket and levels are fetched on first need and shared across one poll
+ * round's clients. Returns -1 if the client has gone or isn't reading. */
+static int flush_replies(command_server *s, client_conn *c,
+                         int *have, unsigned long *committed, char *levels, size_t len) {
+    while (c->queued > 0) {
+        pending_reply *r = &c->replies[c->head];
+        char msg[32 + 4 * COMMAND_LINE_MAX];
+        if (r->error) {
+            snprintf(msg, sizeof(msg), "v%d %lu err %s\n",
+                     COMMAND_PROTOCOL_VERSION, r->seq, r->error);
+        } else if (r->stats) {
+            if (send_report(s, c, r->seq) < 0) return -1;
+            c->head = (c->head + 1) % COMMAND_SERVER_MAX_ACKS;
+            c->queued--;
+            continue;
+        } else if (r->ring) {
+            snprintf(msg, sizeof(msg), "v%d %lu ok ring\n", COMMAND_PROTOCOL_VERSION, r->seq);
+        } else {
+            if (!*have) {
+                *committed = s->h.committed(levels, len);
+                *have = 1;
+            }
+            if (!ticket_done(r->ticket, *committed)) break;
+            snprintf(msg, sizeof(msg), "v%d %lu ok%s%s\n",
+                     COMMAND_PROTOCOL_VERSION, r->seq, levels[0] ? " " : "", levels);
+        }
+        int n = (int)strlen(msg);
+        if (r->ring && !r->error) {
+            if (ring_host_hand_out(s->ring, c->fd, msg) < 0) return -1;
+        } else if ((int)send(c->fd, msg, n, SEND_FLAGS) != n) {
+            return -1;
+        }
+        c->head = (c->head + 1) % COMMAND_SERVER_MAX_ACKS;
+        c->queued--;
+    }
+    return 0;
+}
+
+/* Apply and/or queue the reply for one line. Returns -1 to drop the client
+ * (it has pipelined past COMMAND_SERVER_MAX_ACKS without reading replies). */
+static int handle_line(command_server *s, client_conn *c, const char *line) {
+    command_request req;
+    int ok = parse_request(line, &req);
+    if (req.version == 0) {
+        if (ok) {
+            s->h.apply(req.dir);
+        } else {
+            fprintf(stderr, "Ignoring empty or unknown command\n");
+        }
+        return 0;
+    }
+    if (!ok)
+        return queue_reply(c, req.seq, 0, req.error, 0, 0);
+    if (req.ring)
+        return queue_reply(c, req.seq, 0, s->ring ? NULL : "unsupported", 1, 0);
+    if (req.stats)
+        return queue_reply(c, req.seq, 0, s->h.stats ? NULL : "unsupported", 0, 1);
+    if (req.ack && !s->h.committed)
+        return queue_reply(c, req.seq, 0, "unsupported", 0, 0);
+    if (req.ack && c->queued == COMMAND_SERVER_MAX_ACKS)
+        return -1;
+    unsigned long ticket = s->h.apply(req.dir);
+    return req.ack ? queue_reply(c, req.seq, ticket, NULL, 0, 0) : 0;
+}
+
+/* Read what client `i` has sent and apply every complete line. Returns 0 to
+ * keep the connection, -1 once it's closed or broken. */
+static int service_client(command_server *s, int i) {
+    client_conn *c = &s->clients[i];
+    char line[COMMAND_LINE_MAX];
+    int n = command_reader_fill(&c->reader, c->fd);
+    int retry = n < 0 && (net_would_block() || net_interrupted());
+    while (command_reader_next(&c->reader, line)) {   /* after eof: the last, unterminated line */
+        if (handle_line(s, c, line) < 0) return -1;
+    }
+    return (n > 0 || retry) ? 0 : -1;
+}
+
+static void drop_client(command_server *s, int i) {
+    net_close(s->clients[i].fd);
+    s->clients[i] = s->clients[s->count - 1];
+    __atomic_store_n(&s->count, s->count - 1, __ATOMIC_RELEASE);
+}
+
+int command_server_poll(command_server *s, int timeout_ms) {
+    int awaiting = 0;   /* any reply outstanding? */
+    s->pfds[0].fd = s->listener;
+    s->pfds[0].events = POLLIN;
+    s->pfds[0].revents = 0;
+#ifndef _WIN32
+    if (s->fixed == 2) {
+        s->pfds[1].fd = s->wake[0];
+        s->pfds[1].events = POLLIN;
+        s->pfds[1].revents = 0;
+    }
+#endif
+    int bell = -1;
+    if (s->ring) {
+        bell = s->fixed;
+        s->pfds[bell].fd = (dimmit_sock_t)ring_host_doorbell(s->ring);
+        s->pfds[bell].events = POLLIN;
+        s->pfds[bell].revents = 0;
+    }
+    int base = s->fixed + (s->ring ? 1 : 0);
+    for (int i = 0; i < s->count; i++) {
+        struct pollfd *p = &s->pfds[base + i];
+        p->fd = s->clients[i].fd;
+        p->events = POLLIN;
+        p->revents = 0;
+        awaiting |= s->clients[i].queued > 0;
+    }
+    int polled = s->count;
+    if (awaiting && s->fixed == 1 && (timeout_ms < 0 || timeout_ms > 1))
+        timeout_ms = 1;   /* no wake pipe: look for commits ourselves */
+
+    int ready = net_poll(s->pfds, (unsigned)(base + polled), timeout_ms);
+    if (ready < 0) {
+        if (net_interrupted()) return 0;
+        perror("poll");
+        return -1;
+    }
+#ifndef _WIN32
+    if (s->fixed == 2 && (s->pfds[1].revents & POLLIN)) {
+        char drain[64];
+        while (read(s->wake[0], drain, sizeof(drain)) > 0) {}
+    }
+#endif
+    if (bell >= 0 && (s->pfds[bell].revents & POLLIN))
+        ring_host_drain(s->ring, s->h.apply);
+
+    /* Clients first, walking backwards so closing one (swap in the last) never
+     * skips another; connections accepted below weren't polled this round. Each
+     * then gets whatever replies are ready: new errors, and acks whose ticket
+     * the worker has committed since we last looked. */
+    int have = 0;
+    unsigned long committed = 0;
+    char levels[4 * COMMAND_LINE_MAX] = "";
+    for (int i = polled - 1; i >= 0; i--) {
+        client_conn *c = &s->clients[i];
+        if ((s->pfds[base + i].revents & (POLLIN | POLLHUP | POLLERR)) &&
+            service_client(s, i) < 0) {
+            drop_client(s, i);
+            continue;
+        }
+        if (c->queued > 0 &&
+            flush_replies(s, c, &have, &committed, levels, sizeof(levels)) < 0)
+            drop_client(s, i);
+    }
+    if (ready > 0 && (s->pfds[0].revents & POLLIN))
+        return accept_ready(s);
+    return 0;
+}
+
+void command_server_set_ring(command_server *s, ring_host *ring) {
+    s->ring = ring;
+}
+
+void command_server_wake(command_server *s) {
+#ifndef _WIN32
+    char b = 0;
+    if (s->fixed == 2 && write(s->wake[1], &b, 1) < 0) {
+        /* pipe full: a wake is already pending */
+    }
+#else
+    (void)s;
+#endif
+}
+
+int command_server_clients(const command_server *s) {
+    return __atomic_load_n(&s->count, __ATOMIC_ACQUIRE);
+}
+
+void command_server_close(command_server *s) {
+    if (!s) return;
+    for (int i = 0; i < s->count; i++)
+        net_close(s->clients[i].fd);
+#ifndef _WIN32
+    if (s->fixed == 2) {
+        close(s->wake[0]);
+        close(s->wake[1]);
+    }
+#endif
+    free(s->clients);
+    free(s->pfds);
+    free(s->report);
+    free(s);
+}
@@ -0,0 +1,74 @@
+#ifndef COMMAND_SERVER_H
+#define COMMAND_SERVER_H
+
+#include <stddef.h>
+#include "platform/compat/net.h"  /* dimmit_sock_t */
+
+/* The daemon's socket front end: one thread multiplexes the listening socket and
+ * every client connection with poll(). Client sockets are non-blocking and each
+ * has its own command_reader, so a client that connects and never writes (or
+ * stops mid-line) costs a slot and nothing else -- the other clients' commands
+ * are applied as soon as they arrive. Framed requests that ask for an ack (see
+ * command.h) are answered from here once the worker has committed them. */
+
+/* Default cap on concurrently open client connections. */
+#define COMMAND_SERVER_MAX_CLIENTS 32
+
+/* Most framed replies one connection may have outstanding. A client that
+ * pipelines past this without reading its replies is disconnected. */
+#define COMMAND_SERVER_MAX_ACKS 64
+
+/* Largest statistics report (see command_handlers.stats); a longer one is cut
+ * at its last whole line. */
+#define COMMAND_SERVER_REPORT_MAX 16384
+
+/* What the server calls back into. All run on the polling thread. */
+typedef struct {
+    /* May a just-accepted client send commands? (nonzero = yes) */
+    int (*authorize)(dimmit_sock_t client);
+    /* Apply one step (+1 up, -1 down); returns its ticket (controller_adjust). */
+    unsigned long (*apply)(int dir);
+    /* The highest committed ticket (controller_committed), with the displays'
+     * levels as of that commit formatted into `levels` as "<level>/<max> ...".
+     * NULL if this server can't ack: acks are then answered "err unsupported". */
+    unsigned long (*committed)(char *levels, size_t len);
+    /* Format the statistics report into `report`: newline-terminated lines of
+     * "<scope> <metric> key=value ...", e.g.
+     *     input lock_wait_us n=3 p50=1 p90=2 p99=2 max=2 buckets=1,1,1,0,...
+     *     display 0 write_us n=9 p50=65535 ...
+     * Returns its length, as snprintf. NULL: stats are answered "err
+     * unsupported". */
+    int (*stats)(char *report, size_t len);
+} command_handlers;
+
+typedef struct command_server command_server;
+
+/* Serve `listener` (already bound and listening; made non-blocking here) with at
+ * most `max_clients` connections open at once; further connections are accepted
+ * and closed straight away so they fail fast instead of waiting in the backlog.
+ * Returns NULL on allocation failure. */
+command_server *command_server_open(dimmit_sock_t listener, int max_clients,
+                                    const command_handlers *handlers);
+
+/* Wait up to `timeout_ms` for activity, then accept, read, and apply everything
+ * that is ready. Returns 0, or -1 if the listener itself failed. */
+int  command_server_poll(command_server *s, int timeout_ms);
+
+/* Also serve the shared command ring (platform/ring/ring.h): poll its doorbell,
+ * apply what clients queue on it, and hand it out on request. The ring stays
+ * the caller's; NULL stops serving it. */
+struct ring_host;
+void command_server_set_ring(command_server *s, struct ring_host *ring);
+
+/* Any thread: the committed ticket may have moved, so send the acks now due.
+ * (On Windows, which can't poll a pipe, the server instead polls briefly while
+ * any ack is outstanding.) */
+void command_server_wake(command_server *s);
+
+/* Client connections currently open. Safe to call from any thread. */
+int  command_server_clients(const command_server *s);
+
+/* Close every client connection and free. The listener is the caller's. */
+void command_server_close(command_server *s);
+
+#endif /* COMMAND_SERVER_H */
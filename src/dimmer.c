@@ -13,6 +13,27 @@ void dimmer_init(dimmer_t *d, int current, int max) {
     d->current = current;
     d->max = max;
     d->pending_delta = 0;
+    d->inbox = 0;
+    d->ramp_ms = 0;
+    d->ramp_from = d->ramp_to = current;
+    d->ramp_start = d->ramp_last = 0;
+    d->srtt_ms = d->rttvar_ms = d->samples = 0;
+    d->failures = 0;
+    d->retry_at = 0;
+    d->step = 1;
+}
+
+/* The inbox is the only field shared with input threads. GCC/Clang __atomic
+ * builtins rather than <stdatomic.h>, which the Mavericks-era toolchain lacks. */
+void dimmer_post(dimmer_t *d, int delta) {
+    __atomic_fetch_add(&d->inbox, delta, __ATOMIC_RELEASE);
+}
+
+int dimmer_drain(dimmer_t *d) {
+    int posted = __atomic_exchange_n(&d->inbox, 0, __ATOMIC_ACQUIRE);
+    if (posted == 0) return 0;
+    dimmer_adjust(d, posted);
+    return 1;
 }
 
 void dimmer_adjust(dimmer_t *d, int delta) {
@@ -24,21 +45,146 @@ void dimmer_adjust(dimmer_t *d, int delta) {
     d->pending_delta = projected - d->current;
 }
 
+/* The nearest level on the display's step grid, where max (which needn't be
+ * a multiple of the step) counts as on it. */
+static int snap(const dimmer_t *d, int value) {
+    if (d->step <= 1 || value <= 0 || value >= d->max) return value;
+    int snapped = (value + d->step / 2) / d->step * d->step;
+    if (snapped > d->max || d->max - value < value - snapped) return d->max;
+    return snapped;
+}
+
+/* `value` snapped, but never back past `from` against the change from `from`
+ * to `value`: from an off-grid level (one the display was read at, say), a
+ * nearest grid level can lie the other way, and then there's no step to take
+ * yet -- `from` itself comes back. */
+static int snap_toward(const dimmer_t *d, int from, int value) {
+    int snapped = snap(d, value);
+    if ((value > from && snapped < from) || (value < from && snapped > from)) return from;
+    return snapped;
+}
+
 int dimmer_due(const dimmer_t *d, int *target_out) {
     if (d->pending_delta == 0) return 0;
 
-    int target = clamp_brightness(d->current + d->pending_delta, d->max);
+    int target = snap_toward(d, d->current, clamp_brightness(d->current + d->pending_delta, d->max));
     if (target == d->current) return 0;
 
     *target_out = target;
     return 1;
 }
 
+void dimmer_set_step(dimmer_t *d, int step) {
+    d->step = step > 1 ? step : 1;
+    /* Put the level assumed on the grid, keeping the target where it was, so
+     * the next write lands the display on it too. */
+    int on_grid = snap(d, d->current);
+    if (on_grid == d->current) return;
+    if (d->ramp_to == d->current) d->ramp_from = d->ramp_to = on_grid;
+    d->pending_delta += d->current - on_grid;
+    d->current = on_grid;
+}
+
+void dimmer_set_ramp(dimmer_t *d, int ms) {
+    d->ramp_ms = ms > 0 ? ms : 0;
+}
+
+void dimmer_observe_latency(dimmer_t *d, int ms) {
+    if (ms < 0) ms = 0;
+    if (d->samples++ == 0) {
+        /* The first sample seeds both, as RFC 6298 does. */
+        d->srtt_ms = ms;
+        d->rttvar_ms = ms / 2;
+        return;
+    }
+    /* rttvar += (|srtt - sample| - rttvar) / 4, then srtt += (sample - srtt) / 8,
+     * in integer ms, rounded. */
+    int err = d->srtt_ms > ms ? d->srtt_ms - ms : ms - d->srtt_ms;
+    d->rttvar_ms = (3 * d->rttvar_ms + err + 2) / 4;
+    d->srtt_ms = (7 * d->srtt_ms + ms + 4) / 8;
+}
+
+void dimmer_seed_latency(dimmer_t *d, int srtt_ms, int rttvar_ms) {
+    d->srtt_ms = srtt_ms > 0 ? srtt_ms : 0;
+    d->rttvar_ms = rttvar_ms > 0 ? rttvar_ms : 0;
+    d->samples = 1;
+}
+
+int dimmer_resync(dimmer_t *d, int current, int max) {
+    int target;
+    if (dimmer_due(d, &target)) return 0;   /* presses short of a step stay pending */
+    if (max < 1) max = 1;
+    if (current < 0) current = 0;
+    if (current > max) current = max;
+    d->current = d->ramp_from = d->ramp_to = current;
+    __atomic_store_n(&d->max, max, __ATOMIC_RELAXED);
+    return 1;
+}
+
+void dimmer_failed(dimmer_t *d, long now) {
+    dimmer_settled(d);
+    long backoff = (long)d->srtt_ms + 4L * d->rttvar_ms;
+    if (backoff < DIMMER_MIN_FRAME_MS) backoff = DIMMER_MIN_FRAME_MS;
+    for (int i = 0; i < d->failures && backoff < DIMMER_MAX_BACKOFF_MS; i++) backoff *= 2;
+    if (backoff > DIMMER_MAX_BACKOFF_MS) backoff = DIMMER_MAX_BACKOFF_MS;
+    d->failures++;
+    d->retry_at = now + backoff;
+}
+
+int dimmer_frame(dimmer_t *d, long now, int *target_out, long *wait_out) {
+    int goal;
+    *wait_out = -1;
+    if (!dimmer_due(d, &goal)) {
+        d->ramp_to = d->current;   /* nothing pending: no ramp */
+        return 0;
+    }
+    if (d->failures && now < d->retry_at) {
+        *wait_out = d->retry_at - now;   /* backing off a failing display */
+        return 0;
+    }
+    int frame = d->srtt_ms > DIMMER_MIN_FRAME_MS ? d->srtt_ms : DIMMER_MIN_FRAME_MS;
+    if (d->ramp_ms == 0 || frame >= d->ramp_ms) {
+        *target_out = goal;
+        return 1;
+    }
+
+    if (d->ramp_to == d->current) {
+        /* Starting from rest: the first frame may go at once. */
+        d->ramp_last = now - frame;
+    }
+    if (goal != d->ramp_to) {
+        /* New or changed target: (re)start from where the display is now. */
+        d->ramp_from = d->current;
+        d->ramp_to = goal;
+        d->ramp_start = now;
+    }
+    long since = now - d->ramp_last;
+    if (since < frame) {
+        *wait_out = frame - since;
+        return 0;
+    }
+
+    /* Aim where the ramp should be when this write lands, one frame from now. */
+    long ahead = now - d->ramp_start + frame;
+    int target = goal;
+    if (ahead < d->ramp_ms)
+        target = snap_toward(d, d->current,
+                             d->ramp_from + (int)lround((double)(goal - d->ramp_from) * (double)ahead / d->ramp_ms));
+    if (target == d->current) {
+        *wait_out = frame;       /* too slow a ramp to move yet */
+        return 0;
+    }
+    d->ramp_last = now;
+    *target_out = target;
+    return 1;
+}
+
 void dimmer_commit(dimmer_t *d, int applied) {
     /* Subtract only what we actually applied; deltas accumulated during the
      * (slow, lock-released) write stay pending for the next cycle. */
     d->pending_delta -= (applied - d->current);
     d->current = applied;
+    d->failures = 0;
 }
 
 void dimmer_settled(dimmer_t *d) {
@@ -46,7 +192,7 @@ void dimmer_settled(dimmer_t *d) {
 }
 
 int dimmer_max(const dimmer_t *d) {
-    return d->max;
+    return __atomic_load_n(&d->max, __ATOMIC_RELAXED);
 }
 
 int dimmer_delta_for_fraction(int max, double fraction) {
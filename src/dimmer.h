@@ -8,14 +8,43 @@
  * There is no time-based debounce. The daemon's single worker writes to DDC
  * synchronously (a slow, self-rate-limiting bus), so presses that arrive while
  * a write is in flight accumulate into pending_delta and are coalesced into the
- * next write -- leading-edge response with natural backpressure, no timer. */
+ * next write -- leading-edge response with natural backpressure, no timer.
+ *
+ * Input threads never touch that state directly: they dimmer_post() into a
+ * lock-free inbox (one atomic add), and the worker dimmer_drain()s it before
+ * deciding what is due. So a press never waits on a write in progress. Every
+ * other function here is worker-side only.
+ *
+ * Ramps: with a ramp duration set, dimmer_frame() spreads a change over that
+ * long instead of jumping, one intermediate write ("frame") at a time. There is
+ * still no clock in here: the caller passes the time in, so a ramp is as
+ * deterministic to test as everything else. */
 
 typedef struct {
     int current;             /* last-applied brightness */
     int max;                 /* display maximum */
     int pending_delta;       /* accumulated, clamp-projected, not yet applied */
+    int inbox;               /* posted, not yet drained (atomic; dimmer_post) */
+    int  ramp_ms;            /* 0: jump straight to the target */
+    int  ramp_from;          /* level the active ramp started from */
+    int  ramp_to;            /* its goal; == current when no ramp is active */
+    long ramp_start;         /* when it started (caller's monotonic ms) */
+    long ramp_last;          /* when its last frame was handed out */
+    int  srtt_ms;            /* smoothed round trip (dimmer_observe_latency) */
+    int  rttvar_ms;          /* its mean deviation */
+    int  samples;            /* round trips observed */
+    int  failures;           /* consecutive failed writes */
+    long retry_at;           /* after a failure: no write before this time */
+    int  step;               /* resolution (dimmer_set_step); 1: every level */
 } dimmer_t;
 
+/* Frames are never closer together than this (about 60 Hz), however fast the
+ * display takes a write. */
+#define DIMMER_MIN_FRAME_MS 16
+
+/* Ceiling on the wait before retrying a display whose writes keep failing. */
+#define DIMMER_MAX_BACKOFF_MS 5000
+
 /* Initialize with the display's current/max brightness and no pending change. */
 void dimmer_init(dimmer_t *d, int current, int max);
 
@@ -23,14 +52,73 @@ void dimmer_init(dimmer_t *d, int current, int max);
  * holding a key can't run past a boundary). */
 void dimmer_adjust(dimmer_t *d, int delta);
 
-/* Pure: is a write due? Returns 1 and sets *target_out to the clamped target
- * when a delta is pending and the target differs from current; else 0. Does
- * not mutate. */
+/* Any thread, lock-free: add `delta` to the inbox for the worker to drain. The
+ * clamp is applied at drain time, so presses posted between two drains are
+ * summed first (up+down at a rail nets to zero rather than clamping twice). */
+void dimmer_post(dimmer_t *d, int delta);
+
+/* Worker: take everything posted so far and dimmer_adjust() it into
+ * pending_delta. Returns 1 if anything was drained, 0 if the inbox was empty. */
+int dimmer_drain(dimmer_t *d);
+
+/* Pure: is a write due? Returns 1 and sets *target_out to the clamped target,
+ * snapped to the step (dimmer_set_step), when a delta is pending and that
+ * differs from current; else 0. Does not mutate. */
 int dimmer_due(const dimmer_t *d, int *target_out);
 
+/* The display's effective resolution: it only really changes every `step`
+ * levels (many report a max of 100 but have a handful of luminance steps).
+ * Targets -- and a ramp's frames -- are then snapped to the nearest multiple
+ * of it (or to 0 or max), never back against the change, so a change that
+ * wouldn't show isn't written at all: the presses behind it stay pending until
+ * enough add up to reach the next step. The level assumed is put on the grid
+ * at once (the next write lands the display there). 1 (the default) or less:
+ * every level. */
+void dimmer_set_step(dimmer_t *d, int step);
+
+/* Spread each change over `ms` (0, the default, jumps straight to the target). */
+void dimmer_set_ramp(dimmer_t *d, int ms);
+
+/* Fold one measured round trip (a get or a set, successful or not) into the
+ * display's latency estimate: a smoothed mean and mean deviation, as TCP keeps
+ * for its round-trip time (RFC 6298). The mean sets the ramp's frame interval --
+ * a slow display gets fewer, bigger frames, since a frame is only worth sending
+ * as often as the display can take one -- and mean plus four deviations sets
+ * how long a failing display is left alone (dimmer_failed). */
+void dimmer_observe_latency(dimmer_t *d, int ms);
+
+/* Start the estimate from one learned earlier (say, before a restart), as if
+ * from a single round trip: the next dimmer_observe_latency() smooths into it
+ * rather than replacing it. */
+void dimmer_seed_latency(dimmer_t *d, int srtt_ms, int rttvar_ms);
+
+/* The display's level and max as read back from it, for a dimmer started from
+ * remembered values (or one whose writes the display may have rounded):
+ * adopted if no change is under way (none due, so no ramp either), since then
+ * the display is simply where it says. Presses short of a step stay pending,
+ * relative to the level adopted. Returns 1 if adopted, 0 if a change is under
+ * way (it lands from the level assumed, and the read is moot). The max is
+ * stored atomically, since input threads read it (dimmer_max). */
+int dimmer_resync(dimmer_t *d, int current, int max);
+
+/* A write failed at time `now`: drop its batch (as dimmer_settled) and hold the
+ * display off until a retry timeout has passed, doubling with each consecutive
+ * failure up to DIMMER_MAX_BACKOFF_MS. Presses meanwhile are coalesced into one
+ * write at the end of it, rather than each stalling on the broken bus. */
+void dimmer_failed(dimmer_t *d, long now);
+
+/* What to write at time `now` (monotonic ms). Returns 1 and sets *target_out to
+ * the next frame -- the final target, with no ramp set, once the ramp has run
+ * its course, or when the display is too slow to animate -- or 0 if nothing is
+ * due now, with *wait_out set to how many ms until the next frame (-1 if no
+ * change is pending at all). Nothing is due during a failure backoff. A change
+ * that arrives mid-ramp retargets it from the current level, so no frame toward
+ * a superseded target is ever written. Mutates only the ramp bookkeeping. */
+int dimmer_frame(dimmer_t *d, long now, int *target_out, long *wait_out);
+
 /* Record a successfully applied brightness (call only after a successful write).
  * Subtracts just the applied step from pending_delta, so any presses that landed
- * during the write are preserved for the next cycle. */
+ * during the write are preserved for the next cycle. Ends any failure backoff. */
 void dimmer_commit(dimmer_t *d, int applied);
 
 /* Drop the pending delta without applying it. Called when a write fails, to
@@ -38,7 +126,7 @@ void dimmer_commit(dimmer_t *d, int applied);
 void dimmer_settled(dimmer_t *d);
 
 /* The display's maximum brightness (for input backends that step by a fraction
- * of the range). */
+ * of the range). Any thread. */
 int dimmer_max(const dimmer_t *d);
 
 /* Convert a signed fraction of the full range into an integer delta, rounding
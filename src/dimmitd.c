@@ -1,5 +1,6 @@
 #define _POSIX_C_SOURCE 200809L
 
+#include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -15,14 +16,17 @@
   #include <unistd.h>
   #include <signal.h>
   #include <sys/stat.h>
-  #include <sys/time.h>
 #endif
 
 #include "display_controller.h"
+#include "display_db.h"
 #include "platform/access-control/access-control.h"
 #include "platform/logging/logging.h"
 #include "platform/input/input.h"
-#include "command.h"
+#include "platform/hotplug/hotplug.h"
+#include "platform/ring/ring.h"
+#include "command_server.h"
+#include "stats.h"
 #include "config.h"
 
 #define ACCEPT_BACKLOG 5
@@ -37,20 +41,87 @@
  * not gate brightness latency -- presses wake the worker immediately. */
 #define WORKER_POLL_MS 250
 
+/* How often the reconciler re-enumerates displays to catch hotplug on platforms
+ * with no display-change events (see platform/hotplug). Where hotplug_start()
+ * succeeds, the reconciler instead sleeps until an event asks for a pass, and
+ * this interval only bounds how long shutdown goes unnoticed and how late a
+ * rejected display's retry runs. */
+#define RECONCILE_INTERVAL_MS 1000
+
+/* Displays reported in an ack's level list, and in the stats report. */
+#define ACK_MAX_DISPLAYS 16
+
+/* The socket loop's poll() timeout; like WORKER_POLL_MS, only a shutdown check. */
+#define SERVER_POLL_MS 1000
+
+/* Default brightness ramp: long enough to read as a fade rather than a snap,
+ * short enough that holding a key still feels direct. DIMMIT_RAMP_MS overrides
+ * (0 = jump). */
+#define DEFAULT_RAMP_MS 150
+
+static int get_ramp_ms(void) {
+    const char *ms = getenv("DIMMIT_RAMP_MS");
+    return ms ? atoi(ms) : DEFAULT_RAMP_MS;
+}
+
+/* How far contrast follows each brightness step, as a share of it
+ * (controller_link_feature). DIMMIT_LINK_CONTRAST; unset or 0 leaves it be. */
+static double get_link_contrast(void) {
+    const char *scale = getenv("DIMMIT_LINK_CONTRAST");
+    return scale ? atof(scale) : 0.0;
+}
+
 static const char* get_sock_path(void) {
     const char *path = getenv("DIMMIT_SOCK");
     return path ? path : DIMMIT_SOCK_DEFAULT;
 }
 
+/* Where what's learned about each monitor is kept (display_db.h); DIMMIT_DB
+ * overrides, and an empty DIMMIT_DB keeps it in memory only. A leading "~/" is
+ * the user's home (the macOS default: dimmitd runs as the user there). */
+static const char* get_db_path(void) {
+    static char expanded[1024];
+    const char *path = getenv("DIMMIT_DB");
+    if (!path) path = DIMMIT_DB_DEFAULT;
+    const char *home = getenv("HOME");
+    if (strncmp(path, "~/", 2) != 0 || !home) return path;
+    snprintf(expanded, sizeof(expanded), "%s/%s", home, path + 2);
+    return expanded;
+}
+
 static volatile int running = 1;
 
 /* All brightness state lives in the display controller (one dimmer per display).
- * The mutex guards the controller against the worker thread; controller_service()
- * performs the slow writes and is called under the lock (writes are serialized
- * across displays anyway). */
+ * Presses are posted into each dimmer's lock-free inbox, so the input side never
+ * waits on a write or a reconcile. Threads:
+ *   worker     -- the only caller of controller_service() (slow writes, in
+ *                 concurrent mode) and of controller_reconcile_publish().
+ *   reconciler -- controller_reconcile_prepare() (slow enumeration) with no lock
+ *                 held, on a hotplug event or a poll tick, then offers the new
+ *                 set to the worker and waits for it to be adopted.
+ * `lock` guards only the handoff state below and is never held across a DDC
+ * transaction, so input (post + wake the worker) returns promptly. */
 static display_controller *ctrl = NULL;
 static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
-static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;         /* wakes the worker */
+static pthread_cond_t adopted = PTHREAD_COND_INITIALIZER;      /* wakes the reconciler */
+static int kicked = 0;                /* a press was posted since the worker last looked */
+static display_set *offered = NULL;   /* prepared set awaiting publish by the worker */
+static command_server *server = NULL;
+static int event_driven = 0;          /* hotplug events are flowing: reconcile on events only */
+static int reconcile_requested = 1;   /* a pass is wanted now (from the start: the first enumeration) */
+static unsigned long acked_ticket = 0;        /* last committed ticket, for acks ... */
+static char acked_levels[ACK_MAX_DISPLAYS * 12];   /* ... and the levels it left ("l/m ...") */
+
+/* The stats report's inputs. Input threads record how long they wait on `lock`;
+ * the worker copies each display's counters out after every pass (the
+ * controller's own are for the servicing thread only), under `stats_lock` so
+ * the copy never adds to that wait. */
+static stats_histogram lock_wait;
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static int stats_count = 0;                                /* under stats_lock */
+static display_stats stats_displays[ACK_MAX_DISPLAYS];     /* under stats_lock */
+static display_latency stats_latency[ACK_MAX_DISPLAYS];    /* under stats_lock */
 
 #ifdef _WIN32
 static BOOL WINAPI console_ctrl_handler(DWORD ctrl_type) {
@@ -65,62 +136,306 @@ static void sighandler(int sig) {
 }
 #endif
 
+/* The startup timeline: each phase as it's reached, stamped with the time since
+ * main() began, so time-to-first-write can be read off the log. */
+static long long started_us;
+
+static void timeline(const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    printf("startup +%.1f ms: ", (double)(stats_now_us() - started_us) / 1000.0);
+    vprintf(fmt, ap);
+    printf("\n");
+    fflush(stdout);
+    va_end(ap);
+}
+
+/* The controller starts empty, so input is taken before any display is found:
+ * the reconciler's first pass enumerates, and what's pressed meanwhile is
+ * replayed once that set is published (controller_open_deferred). */
 static int init_monitor(void) {
-    ctrl = controller_open();
+    ctrl = controller_open_deferred();
     if (!ctrl) {
         fprintf(stderr, "Failed to initialize displays\n");
         return -1;
     }
-    printf("Controlling %d display(s)\n", controller_count(ctrl));
+    controller_set_concurrent(ctrl, 1);
+    controller_set_ramp(ctrl, get_ramp_ms());
+    controller_link_feature(ctrl, BRIGHTNESS_CONTRAST, get_link_contrast());
     return 0;   /* 0 displays is fine; hotplug may add some */
 }
 
+/* Worker: the boot set is in. Log each display and what opening it cost. */
+static void announce_displays(void) {
+    int n = controller_count(ctrl);
+    for (int i = 0; i < n; i++) {
+        display_latency l;
+        if (controller_latency(ctrl, i, &l) != 0) continue;
+        timeline("display %d online: %s (open %d ms%s)", i, l.label, l.open_ms,
+                 l.remembered ? ", remembered" : "");
+    }
+    timeline("controlling %d display(s)", n);
+}
+
+/* Absolute CLOCK_REALTIME deadline `ms` from now, for pthread_cond_timedwait. */
+static void deadline_in(struct timespec *ts, long ms) {
+    clock_gettime(CLOCK_REALTIME, ts);
+    ts->tv_sec += ms / 1000;
+    ts->tv_nsec += (ms % 1000) * 1000000L;
+    if (ts->tv_nsec >= 1000000000L) {
+        ts->tv_sec++;
+        ts->tv_nsec -= 1000000000L;
+    }
+}
+
+/* Worker: after a service pass, record what it committed for the command
+ * server's acks and wake the server to send them. The levels are read here, on
+ * the servicing thread, and only the formatted copy crosses to the server. */
+static void announce_commit(void) {
+    static unsigned long announced = 0;
+    unsigned long ticket = controller_committed(ctrl);
+    if (ticket == announced) return;
+    announced = ticket;
+
+    int cur[ACK_MAX_DISPLAYS], max[ACK_MAX_DISPLAYS];
+    int n = controller_levels(ctrl, cur, max, ACK_MAX_DISPLAYS);
+    if (n > ACK_MAX_DISPLAYS) n = ACK_MAX_DISPLAYS;
+    char levels[sizeof(acked_levels)];
+    size_t len = 0;
+    levels[0] = '\0';
+    for (int i = 0; i < n && len < sizeof(levels); i++)
+        len += (size_t)snprintf(levels + len, sizeof(levels) - len, "%s%d/%d",
+                                i ? " " : "", cur[i], max[i]);
+
+    pthread_mutex_lock(&lock);
+    acked_ticket = ticket;
+    memcpy(acked_levels, levels, sizeof(levels));
+    pthread_mutex_unlock(&lock);
+    command_server *srv = __atomic_load_n(&server, __ATOMIC_ACQUIRE);
+    if (srv) command_server_wake(srv);
+}
+
+/* Worker: refresh the stats report's copy of every display's counters. */
+static void snapshot_stats(void) {
+    static display_stats ds[ACK_MAX_DISPLAYS];
+    static display_latency dl[ACK_MAX_DISPLAYS];
+    int n = controller_count(ctrl);
+    if (n > ACK_MAX_DISPLAYS) n = ACK_MAX_DISPLAYS;
+    for (int i = 0; i < n; i++) {
+        controller_stats(ctrl, i, &ds[i]);
+        controller_latency(ctrl, i, &dl[i]);
+    }
+    pthread_mutex_lock(&stats_lock);
+    stats_count = n;
+    memcpy(stats_displays, ds, (size_t)n * sizeof(ds[0]));
+    memcpy(stats_latency, dl, (size_t)n * sizeof(dl[0]));
+    pthread_mutex_unlock(&stats_lock);
+}
+
 static void* brightness_worker(void* arg) {
     (void)arg;
 
-    pthread_mutex_lock(&lock);
     while (running) {
-        /* Service every due display (the slow writes happen here, under the lock;
-         * writes are serialized across displays anyway). If anything was applied,
-         * loop again to drain deltas before going back to wait. */
-        if (controller_service(ctrl) > 0)
+        /* Adopt a freshly reconciled display set, if one is on offer. Publishing
+         * is a pointer swap plus a wait for in-flight posts (nanoseconds). */
+        pthread_mutex_lock(&lock);
+        display_set *next = offered;
+        pthread_mutex_unlock(&lock);
+        if (next) {
+            int booting = controller_booting(ctrl);
+            controller_reconcile_publish(ctrl, next);
+            if (booting) announce_displays();
+            pthread_mutex_lock(&lock);
+            offered = NULL;
+            pthread_cond_signal(&adopted);
+            pthread_mutex_unlock(&lock);
+        }
+
+        /* Drain posted presses and service every due display. The slow writes
+         * happen here with no lock held, so input keeps posting meanwhile. If
+         * anything was applied, loop again to pick up what arrived mid-write. */
+        int applied = controller_service(ctrl);
+        announce_commit();
+        snapshot_stats();
+        static int written = 0;
+        if (applied > 0 && !written) {
+            written = 1;
+            timeline("first write");
+        }
+        if (applied > 0)
             continue;
 
+        /* Idle: read back a display that started from the display database,
+         * one per pass, so a press never waits behind more than one read. */
+        if (controller_next_frame(ctrl) < 0 && controller_verify(ctrl))
+            continue;
+
+        /* Mid-ramp, sleep only until the next frame is due. */
+        long wait = controller_next_frame(ctrl);
         struct timespec ts;
-        clock_gettime(CLOCK_REALTIME, &ts);
-        ts.tv_nsec += WORKER_POLL_MS * 1000000L;
-        if (ts.tv_nsec >= 1000000000L) {
-            ts.tv_sec++;
-            ts.tv_nsec -= 1000000000L;
-        }
-        pthread_cond_timedwait(&cond, &lock, &ts);
+        deadline_in(&ts, (wait >= 0 && wait < WORKER_POLL_MS) ? wait : WORKER_POLL_MS);
+        pthread_mutex_lock(&lock);
+        if (!kicked && !offered && running)
+            pthread_cond_timedwait(&cond, &lock, &ts);
+        kicked = 0;
+        pthread_mutex_unlock(&lock);
+    }
+
+    return NULL;
+}
+
+/* Poll for hotplugged/unplugged displays. The enumeration runs here with no lock
+ * held and is incremental: an unchanged display list probes nothing and yields
+ * no set, and a change opens and probes only the new displays. Event-driven, a
+ * pass also runs when a display that failed its probe is due a retry. Only a
+ * finished set is handed to the worker, which swaps it in between writes. */
+static void* reconcile_worker(void* arg) {
+    (void)arg;
+
+    pthread_mutex_lock(&lock);
+    while (running) {
+        struct timespec ts;
+        deadline_in(&ts, RECONCILE_INTERVAL_MS);
+        if (!reconcile_requested)
+            pthread_cond_timedwait(&adopted, &lock, &ts);
+        if (!running) break;
+        /* Whatever the backends learned since the last pass goes to disk here,
+         * off the worker's path and not under the lock. */
+        pthread_mutex_unlock(&lock);
+        display_db_flush();
+        pthread_mutex_lock(&lock);
+        if (!running) break;
+        if (event_driven && !reconcile_requested && !brightness_retry_due()) continue;
+        reconcile_requested = 0;
+        pthread_mutex_unlock(&lock);
+
+        int booting = controller_booting(ctrl);
+        if (booting) timeline("enumerating displays");
+        display_set *next = controller_reconcile_prepare(ctrl);
+        if (booting) timeline("enumerated");
+
+        pthread_mutex_lock(&lock);
+        if (!next) continue;
+        offered = next;
+        kicked = 1;
+        pthread_cond_signal(&cond);
+        while (offered && running)
+            pthread_cond_wait(&adopted, &lock);
     }
     pthread_mutex_unlock(&lock);
 
     return NULL;
 }
 
+/* hotplug_fn: a connector changed (called on the hotplug backend's thread). */
+static void request_reconcile(void) {
+    pthread_mutex_lock(&lock);
+    reconcile_requested = 1;
+    pthread_cond_signal(&adopted);
+    pthread_mutex_unlock(&lock);
+}
+
+/* hotplug_fn: the event source failed; poll again from here on. */
+static void hotplug_lost(void) {
+    pthread_mutex_lock(&lock);
+    event_driven = 0;
+    reconcile_requested = 1;   /* whatever changed meanwhile went unseen */
+    pthread_cond_signal(&adopted);
+    pthread_mutex_unlock(&lock);
+    fprintf(stderr, "Lost display-change events; polling for display changes\n");
+}
+
 /* Fan a signed fraction step out to every display (each by that fraction of its
- * own max, so offsets are preserved) and wake the worker to apply it. Matches
- * input_adjust_fn; the socket path passes dir * DIMMIT_SOCKET_FRACTION. */
-static void adjust_fraction(double frac) {
+ * own max, so offsets are preserved) and wake the worker to apply it. Returns the
+ * step's ticket (see controller_adjust). The post is lock-free (an atomic add per
+ * display), and `lock` is never held across a write or an enumeration, so this
+ * returns promptly whatever the bus is doing. */
+static unsigned long post_fraction(double frac) {
+    unsigned long ticket = controller_adjust(ctrl, frac);
+    long long t0 = stats_now_us();
     pthread_mutex_lock(&lock);
-    controller_adjust(ctrl, frac);
+    stats_record(&lock_wait, stats_now_us() - t0);
+    kicked = 1;
     pthread_cond_signal(&cond);
     pthread_mutex_unlock(&lock);
+    return ticket;
+}
+
+/* input_adjust_fn; the socket path posts dir * DIMMIT_SOCKET_FRACTION. */
+static void adjust_fraction(double frac) {
+    post_fraction(frac);
+}
+
+/* command_server callbacks. */
+static int authorize_client(dimmit_sock_t client) {
+    return access_control_is_authorized((int)client);
+}
+
+static unsigned long apply_command(int dir) {
+    return post_fraction(dir * DIMMIT_SOCKET_FRACTION);
+}
+
+static unsigned long committed_levels(char *levels, size_t len) {
+    pthread_mutex_lock(&lock);
+    unsigned long ticket = acked_ticket;
+    snprintf(levels, len, "%s", acked_levels);
+    pthread_mutex_unlock(&lock);
+    return ticket;
+}
+
+/* Append one "<scope> <metric> <histogram>" line to the report. */
+static int report_histogram(char *buf, size_t len, const char *scope, const char *metric,
+                            const stats_histogram *h) {
+    int n = snprintf(buf, len, "%s %s ", scope, metric);
+    size_t at = (size_t)n < len ? (size_t)n : len;
+    n += stats_format(buf + at, len - at, h);
+    at = (size_t)n < len ? (size_t)n : len;
+    return n + snprintf(buf + at, len - at, "\n");
+}
+
+/* command_server stats callback: the lock wait, then per display its counters
+ * and histograms (see command_handlers.stats for the format). Displays are
+ * numbered as in an ack's level list. */
+static int format_stats(char *buf, size_t len) {
+    stats_histogram waited;
+    stats_snapshot(&lock_wait, &waited);
+    int n = report_histogram(buf, len, "input", "lock_wait_us", &waited);
+    pthread_mutex_lock(&stats_lock);
+    for (int i = 0; i < stats_count; i++) {
+        const display_stats *d = &stats_displays[i];
+        const display_latency *l = &stats_latency[i];
+        char scope[24];
+        snprintf(scope, sizeof(scope), "display %d", i);
+        size_t at = (size_t)n < len ? (size_t)n : len;
+        n += snprintf(buf + at, len - at,
+                      "%s counters id=%s presses=%lu writes=%lu failures=%lu coalesce=%.2f"
+                      " srtt_ms=%d rttvar_ms=%d backoff=%d step=%d\n",
+                      scope, d->id, d->presses, d->writes, d->failures,
+                      d->writes ? (double)d->presses / (double)d->writes : 0.0,
+                      l->srtt_ms, l->rttvar_ms, l->failures, l->step);
+        at = (size_t)n < len ? (size_t)n : len;
+        n += report_histogram(buf + at, len - at, scope, "write_us", &d->write_us);
+        at = (size_t)n < len ? (size_t)n : len;
+        n += report_histogram(buf + at, len - at, scope, "press_to_write_us", &d->press_to_write_us);
+    }
+    pthread_mutex_unlock(&stats_lock);
+    return n;
 }
 
 int main(void) {
-    dimmit_sock_t sock = DIMMIT_BAD_SOCK, client;
+    dimmit_sock_t sock = DIMMIT_BAD_SOCK;
+    ring_host *ring = NULL;
     struct sockaddr_un addr;
-    pthread_t worker;
-    int worker_started = 0;
+    pthread_t worker, reconciler;
+    int worker_started = 0, reconciler_started = 0;
     int bound = 0;
     const char *sock_path = get_sock_path();
 
+    started_us = stats_now_us();
     if (logging_init() < 0) {
         fprintf(stderr, "Warning: logging not redirected; continuing\n");
     }
+    timeline("logging initialized");
 
 #ifdef _WIN32
     if (net_startup() != 0) {
@@ -131,13 +446,20 @@ int main(void) {
 #else
     signal(SIGINT, sighandler);
     signal(SIGTERM, sighandler);
+    signal(SIGPIPE, SIG_IGN);   /* a client hanging up before its ack: just EPIPE */
 #endif
 
     if (access_control_before_bind() < 0) {
         return 1;
     }
 
+    if (display_db_open(get_db_path()) < 0) {
+        fprintf(stderr, "Warning: could not read the display database; starting afresh\n");
+    }
+    timeline("display database loaded");
+
     if (init_monitor() < 0) {
+        display_db_close();
         return 1;
     }
 
@@ -147,6 +469,20 @@ int main(void) {
     }
     worker_started = 1;
 
+    /* Display-change events where the platform has them; otherwise the
+     * reconciler polls every RECONCILE_INTERVAL_MS. */
+    event_driven = 1;   /* first: the backend may clear it (hotplug_lost) once started */
+    if (hotplug_start(request_reconcile, hotplug_lost) == 0)
+        printf("Watching for display changes\n");
+    else
+        event_driven = 0;
+
+    if (pthread_create(&reconciler, NULL, reconcile_worker, NULL) != 0) {
+        perror("pthread_create");
+        goto cleanup;
+    }
+    reconciler_started = 1;
+
     /* Optional in-process brightness-key capture (macOS HID); non-fatal -- the
      * socket clients remain the input if it's unsupported or denied. */
     input_start(adjust_fraction);
@@ -181,63 +517,57 @@ int main(void) {
         fprintf(stderr, "Warning: could not apply socket access policy\n");
     }
 
-    printf("Listening on %s\n", sock_path);
+    timeline("listening on %s", sock_path);
 
-    while (running) {
-        fd_set fds;
-        struct timeval tv = {1, 0};
-
-        FD_ZERO(&fds);
-        FD_SET(sock, &fds);
+    const command_handlers handlers = { authorize_client, apply_command, committed_levels,
+                                        format_stats };
+    command_server *srv = command_server_open(sock, COMMAND_SERVER_MAX_CLIENTS, &handlers);
+    __atomic_store_n(&server, srv, __ATOMIC_RELEASE);   /* the worker wakes it */
+    if (!srv) {
+        fprintf(stderr, "Failed to start the command server\n");
+        goto cleanup;
+    }
 
-        if (select(sock + 1, &fds, NULL, NULL, &tv) <= 0) {
-            /* Idle tick: poll for hotplugged/unplugged displays. Phase 3 replaces
-             * this with per-platform display-change events. */
-            pthread_mutex_lock(&lock);
-            controller_reconcile(ctrl);
-            pthread_mutex_unlock(&lock);
-            continue;
-        }
+    /* The shared command ring, where the platform has one: clients that ask for
+     * it post steps without a connection per press. */
+    ring = ring_host_open();
+    if (ring) {
+        command_server_set_ring(server, ring);
+        printf("Offering the shared command ring\n");
+    }
+    timeline("ready");
 
-        client = accept(sock, NULL, NULL);
-        if (client == DIMMIT_BAD_SOCK) {
-#ifndef _WIN32
-            if (errno == EINTR) continue;
-#endif
-            perror("accept");
+    /* Every client is served from this one loop; the timeout only bounds how
+     * long shutdown (running=0) goes unnoticed. */
+    while (running) {
+        if (command_server_poll(server, SERVER_POLL_MS) < 0)
             break;
-        }
-
-        if (!access_control_is_authorized((int)client)) {
-            fprintf(stderr, "Access denied\n");
-            net_close(client);
-            continue;
-        }
-
-        int dir = read_command(client);
-        if (dir != 0) {
-            adjust_fraction(dir * DIMMIT_SOCKET_FRACTION);
-        } else {
-            fprintf(stderr, "Ignoring empty or unknown command\n");
-        }
-
-        net_close(client);
     }
 
 cleanup:
     /* Reached on normal shutdown and on every error path. Stop and join the
-     * worker if it was started, then release the socket and display. */
+     * threads that were started, then release the socket and display. */
     running = 0;
     input_stop();
-    if (worker_started) {
-        pthread_cond_signal(&cond);
-        pthread_join(worker, NULL);
+    hotplug_stop();
+    pthread_mutex_lock(&lock);
+    pthread_cond_signal(&cond);
+    pthread_cond_signal(&adopted);
+    pthread_mutex_unlock(&lock);
+    if (reconciler_started) pthread_join(reconciler, NULL);
+    if (worker_started) pthread_join(worker, NULL);
+    if (offered) {
+        controller_reconcile_discard(offered);   /* prepared but never adopted */
+        offered = NULL;
     }
+    command_server_close(server);
+    ring_host_close(ring);
     if (sock != DIMMIT_BAD_SOCK) net_close(sock);
     if (bound) unlink(sock_path);
     if (ctrl) {
         controller_close(ctrl);
     }
+    display_db_close();
     net_cleanup();
 
     return 0;
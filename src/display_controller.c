@@ -1,106 +1,879 @@
+#define _POSIX_C_SOURCE 200809L   /* clock_gettime */
 #include "display_controller.h"
 #include "dimmer.h"
+#include "display_db.h"
+#include "stats.h"
+#include <pthread.h>
+#include <sched.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
-typedef struct { brightness_source src; dimmer_t dim; } managed_display;
+/* One display's write: its brightness and any linked features that have a
+ * frame due, back to back. In concurrent mode the sets run on `thread`; the
+ * outcomes land in `rc` and `linked_rc`, `done` is raised (under the owner's
+ * lock), and the write is committed after the join -- by the pass that started
+ * it, or, if it ran past its budget, by whichever later pass finds it done. */
+typedef struct {
+    const brightness_source *src;
+    int level_due;
+    int target;
+    int rc;
+    int linked_due[BRIGHTNESS_FEATURES];
+    int linked_target[BRIGHTNESS_FEATURES];
+    int linked_rc[BRIGHTNESS_FEATURES];
+    long (*clock)(void);
+    long took_ms;      /* the write's round trip, for the ramp's frame rate */
+    long long took_us; /* ... and finer, for the write-time histogram */
+    long long started_us;
+    int done;
+    display_controller *owner;
+    pthread_t thread;
+} write_job;
 
-struct display_controller {
-    brightness_source *sources;   /* owned array from brightness_enumerate */
+/* What controller_stats() reports. `presses` and `waiting_since` are written by
+ * controller_adjust() callers (atomically); the rest only by the servicing
+ * thread. */
+typedef struct {
+    unsigned long   presses;         /* steps posted */
+    long long       waiting_since;   /* us: the oldest press not yet drained, 0 if none */
+    long long       batch_since;     /* us: the oldest drained press not yet written */
+    unsigned long   writes;          /* landed */
+    unsigned long   failures;        /* failed (all time, unlike dimmer_t.failures) */
+    stats_histogram write_us;        /* every set's round trip, failures included */
+    stats_histogram press_to_write_us;
+} display_counters;
+
+typedef struct {
+    brightness_source src;
+    dimmer_t dim;
+    dimmer_t linked[BRIGHTNESS_FEATURES];   /* max 0: the display hasn't that control
+                                               (or it isn't linked) */
+    write_job job;
+    display_counters counters;
+    int inherited;     /* src.ctx is borrowed from the live set (unpublished sets only) */
+    int unverified;    /* started from the display database; not yet read back */
+    int verify_tries;  /* read-backs failed so far */
+    int queued;        /* has a change under way ... */
+    long due_since;    /* ... since this (caller's ms), or was last served then:
+                          its place in the queue */
+    int in_flight;     /* its write's thread is still to be joined */
+    int step_known;    /* its step is set (told, or learned): see learn_step() */
+    int readback;      /* ... if not, a write has landed since the last read-back */
+    int step_samples;  /* read-backs so far */
+    int step_gcd;      /* of the levels they found */
+    int step_snapped;  /* one found a level other than the one written */
+} managed_display;
+
+/* One generation of the display set. Immutable in shape once published: a
+ * reconcile builds a whole new set and swaps the pointer (see below). */
+struct display_set {
     int count;
-    managed_display *displays;     /* parallel to sources */
+    managed_display *displays;
+    int *order;        /* scratch for a pass: display indexes, most overdue first */
+    int boot;          /* the placeholder controller_open_deferred() starts with */
 };
 
-display_controller *controller_open(void) {
+/* The published set is read lock-free by controller_adjust() (input threads) and
+ * replaced by controller_reconcile_publish() (the servicing thread), RCU-style:
+ * a reader registers in the current epoch's counter before loading the pointer,
+ * and the publisher, after swapping the pointer, flips the epoch and waits for
+ * the old epoch's readers to leave before it frees the old set. A reader
+ * re-checks the epoch after registering, and starts over if it moved: else one
+ * that read the epoch just before a flip could register in the counter that
+ * publish has already waited out, and hold on to the new set into the next
+ * publish, which waits only on the other counter. Read sections are a handful
+ * of atomic adds, so that wait is negligible. */
+struct display_controller {
+    display_set *set;              /* published set; swapped atomically */
+    int readers[2];                /* controller_adjust() calls in flight, per epoch */
+    int epoch;                     /* written only by the publisher */
+    int concurrent;                /* controller_set_concurrent() */
+    unsigned long posted;          /* last ticket handed out by controller_adjust() */
+    unsigned long committed;       /* last ticket controller_service() finished */
+    int ramp_ms;                   /* controller_set_ramp() */
+    long (*clock)(void);           /* monotonic ms; controller_set_clock() */
+    long next_wait;                /* controller_next_frame(), from the last pass */
+    long long intent;              /* posted while booting, in millionths of the range (atomic) */
+    int link_ppm[BRIGHTNESS_FEATURES];   /* controller_link_feature(), in millionths (atomic) */
+    pthread_mutex_t lock;          /* guards write_job.done ... */
+    pthread_cond_t written;        /* ... signalled as each concurrent write ends */
+};
+
+static long monotonic_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long)ts.tv_sec * 1000L + ts.tv_nsec / 1000000L;
+}
+
+static display_set *set_alloc(int count) {
+    display_set *s = (display_set*)calloc(1, sizeof(*s));
+    if (!s) return NULL;
+    if (count > 0) {
+        s->displays = (managed_display*)calloc((size_t)count, sizeof(managed_display));
+        s->order = (int*)calloc((size_t)count, sizeof(int));
+        if (!s->displays || !s->order) { free(s->displays); free(s->order); free(s); return NULL; }
+    }
+    s->count = count;
+    return s;
+}
+
+/* Close every source the set owns and free it. */
+static void set_free(display_set *s) {
+    if (!s) return;
+    for (int i = 0; i < s->count; i++) {
+        brightness_source *src = &s->displays[i].src;
+        if (!s->displays[i].inherited && src->ops && src->ops->close) src->ops->close(src->ctx);
+    }
+    free(s->displays);
+    free(s->order);
+    free(s);
+}
+
+static int set_find(const display_set *s, const char *id) {
+    for (int i = 0; s && i < s->count; i++)
+        if (strcmp(s->displays[i].src.id, id) == 0) return i;
+    return -1;
+}
+
+/* Remember a display's level and max, and how long it takes, in the display
+ * database (under its identity, if it has one) for the next startup. */
+static void remember_level(const managed_display *m) {
+    if (!m->src.identity[0]) return;
+    display_db_set_long(m->src.identity, "level", m->dim.current);
+    display_db_set_long(m->src.identity, "max", dimmer_max(&m->dim));
+}
+
+static void remember_timing(const managed_display *m) {
+    if (!m->src.identity[0]) return;
+    display_db_set_long(m->src.identity, "srtt_ms", m->dim.srtt_ms);
+    display_db_set_long(m->src.identity, "rttvar_ms", m->dim.rttvar_ms);
+}
+
+/* Start `m`'s linked feature `f` from the display's own reading, if it has
+ * that control. Its dimmer is still untouched (zeroed): either the set is
+ * unpublished, or no link to `f` is live yet, so no input thread reads it. */
+static void read_feature(managed_display *m, brightness_feature f) {
+    int cur = 0, max = 0;
+    const brightness_ops *ops = m->src.ops;
+    if (dimmer_max(&m->linked[f]) > 0 || !ops->get_feature || !ops->set_feature ||
+        ops->get_feature(m->src.ctx, f, &cur, &max) != 0 || max < 1)
+        return;
+    dimmer_resync(&m->linked[f], cur, max);
+}
+
+/* The step the display database has for `m` -- told, or learned on an earlier
+ * run -- if any. */
+static void recall_step(managed_display *m) {
+    long step;
+    if (!m->src.identity[0] || !display_db_get_long(m->src.identity, "step", &step) ||
+        step < 1 || step > dimmer_max(&m->dim))
+        return;
+    dimmer_set_step(&m->dim, (int)step);
+    m->step_known = 1;
+}
+
+static int gcd(int a, int b) {
+    while (b) { int t = a % b; a = b; b = t; }
+    return a;
+}
+
+/* A read-back, while `m`'s step isn't known, of the level last written. A
+ * display that reports a level other than the one written has snapped it to
+ * its own grid, and then every level it reports is on that grid. So after
+ * CONTROLLER_STEP_SAMPLES read-backs (off the rails, which needn't be on it)
+ * its step is the largest that divides them all -- or 1 if none was snapped --
+ * and is remembered. */
+static void learn_step(managed_display *m, int level, int max) {
+    m->readback = 0;
+    if (level != m->dim.current) {
+        m->step_snapped = 1;
+        if (dimmer_resync(&m->dim, level, max)) remember_level(m);
+    }
+    if (level <= 0 || level >= max) return;
+    m->step_gcd = gcd(m->step_gcd, level);
+    if (++m->step_samples < CONTROLLER_STEP_SAMPLES) return;
+    int step = m->step_snapped ? m->step_gcd : 1;
+    dimmer_set_step(&m->dim, step);
+    m->step_known = 1;
+    if (m->src.identity[0]) display_db_set_long(m->src.identity, "step", step);
+}
+
+/* Start `m` from what the display database remembers of it, if that's a level
+ * and a max. Returns 1 if so (it's then unverified), else 0. */
+static int recall(managed_display *m) {
+    long level, max, srtt, rttvar;
+    const char *id = m->src.identity;
+    if (!id[0] || !display_db_get_long(id, "level", &level) || !display_db_get_long(id, "max", &max) ||
+        max < 1 || max > 0xFFFF || level < 0 || level > max)
+        return 0;
+    dimmer_init(&m->dim, (int)level, (int)max);
+    if (display_db_get_long(id, "srtt_ms", &srtt) && display_db_get_long(id, "rttvar_ms", &rttvar) &&
+        srtt >= 0 && srtt <= 60000 && rttvar >= 0 && rttvar <= 60000)
+        dimmer_seed_latency(&m->dim, (int)srtt, (int)rttvar);
+    m->unverified = 1;
+    return 1;
+}
+
+/* Enumerate into a new set, incrementally against `known`: displays already in
+ * it keep their open source (marked inherited) and skip the initial read, since
+ * publish carries their dimmer over; new ones are opened and start from what
+ * the display database remembers of them (read back later by
+ * controller_verify), or failing that from their own current (that read timed
+ * to seed the latency estimate). Returns 0 and a new set in *out, 0 and NULL if
+ * nothing changed, or -1 on failure. */
+static int set_enumerate(const display_controller *c, const display_set *known, display_set **out) {
+    *out = NULL;
+    int known_n = known ? known->count : 0;
+    brightness_source *known_src = NULL;
+    if (known_n > 0) {
+        known_src = (brightness_source*)malloc((size_t)known_n * sizeof(*known_src));
+        if (!known_src) return -1;
+        for (int i = 0; i < known_n; i++) known_src[i] = known->displays[i].src;
+    }
+    brightness_source *fresh = NULL; int fresh_n = 0, changed = 0;
+    int rc = brightness_enumerate_changes(known_src, known_n, &fresh, &fresh_n, &changed);
+    free(known_src);
+    if (rc != 0) return -1;
+    if (!changed && known && !known->boot) return 0;   /* booting: even none is news */
+
+    display_set *s = set_alloc(fresh_n);
+    if (!s) {
+        for (int i = 0; i < fresh_n; i++)   /* close only what this call opened */
+            if (set_find(known, fresh[i].id) < 0 && fresh[i].ops->close) fresh[i].ops->close(fresh[i].ctx);
+        free(fresh);
+        return -1;
+    }
+    for (int i = 0; i < fresh_n; i++) {
+        managed_display *m = &s->displays[i];
+        m->src = fresh[i];
+        if (set_find(known, m->src.id) >= 0) { m->inherited = 1; continue; }
+        for (int f = 0; f < BRIGHTNESS_FEATURES; f++)
+            if (__atomic_load_n(&c->link_ppm[f], __ATOMIC_ACQUIRE)) read_feature(m, (brightness_feature)f);
+        if (recall(m)) { recall_step(m); continue; }
+        int cur = 0, max = 100;
+        long start = c->clock();
+        int rc = m->src.ops->get(m->src.ctx, &cur, &max);
+        if (rc != 0) { cur = 0; max = 100; }
+        long took = c->clock() - start;
+        dimmer_init(&m->dim, cur, max);
+        dimmer_observe_latency(&m->dim, (int)took);
+        if (rc == 0) remember_level(m);
+        remember_timing(m);
+        recall_step(m);
+    }
+    free(fresh);   /* array shell only; the contexts now belong to the set */
+    *out = s;
+    return 0;
+}
+
+/* A controller with no set yet. */
+static display_controller *controller_new(void) {
     display_controller *c = (display_controller*)calloc(1, sizeof(*c));
     if (!c) return NULL;
-    if (brightness_enumerate(&c->sources, &c->count) != 0) { free(c); return NULL; }
-    if (c->count > 0) {
-        c->displays = (managed_display*)calloc((size_t)c->count, sizeof(managed_display));
-        if (!c->displays) { brightness_free(c->sources, c->count); free(c); return NULL; }
-        for (int i = 0; i < c->count; i++) {
-            c->displays[i].src = c->sources[i];
-            int cur = 0, max = 100;
-            if (c->sources[i].ops->get(c->sources[i].ctx, &cur, &max) != 0) { cur = 0; max = 100; }
-            dimmer_init(&c->displays[i].dim, cur, max);
+    c->clock = monotonic_ms;
+    c->next_wait = -1;
+    pthread_mutex_init(&c->lock, NULL);
+    pthread_cond_init(&c->written, NULL);
+    return c;
+}
+
+static void controller_free(display_controller *c) {
+    pthread_cond_destroy(&c->written);
+    pthread_mutex_destroy(&c->lock);
+    free(c);
+}
+
+display_controller *controller_open(void) {
+    display_controller *c = controller_new();
+    if (!c) return NULL;
+    if (set_enumerate(c, NULL, &c->set) != 0) { controller_free(c); return NULL; }
+    if (!c->set && !(c->set = set_alloc(0))) { controller_free(c); return NULL; }
+    return c;
+}
+
+display_controller *controller_open_deferred(void) {
+    display_controller *c = controller_new();
+    if (!c) return NULL;
+    if (!(c->set = set_alloc(0))) { controller_free(c); return NULL; }
+    c->set->boot = 1;
+    return c;
+}
+
+/* Enter a read section (see struct display_controller): returns its epoch,
+ * for read_unlock(). */
+static int read_lock(display_controller *c) {
+    for (;;) {
+        int e = __atomic_load_n(&c->epoch, __ATOMIC_SEQ_CST);
+        __atomic_fetch_add(&c->readers[e], 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&c->epoch, __ATOMIC_SEQ_CST) == e) return e;
+        __atomic_fetch_sub(&c->readers[e], 1, __ATOMIC_SEQ_CST);
+    }
+}
+
+static void read_unlock(display_controller *c, int e) {
+    __atomic_fetch_sub(&c->readers[e], 1, __ATOMIC_SEQ_CST);
+}
+
+int controller_booting(const display_controller *c) {
+    if (!c) return 0;
+    display_controller *rc = (display_controller*)c;   /* only the counters change */
+    int e = read_lock(rc);
+    int boot = __atomic_load_n(&rc->set, __ATOMIC_SEQ_CST)->boot;
+    read_unlock(rc, e);
+    return boot;
+}
+
+int controller_count(const display_controller *c) { return c ? c->set->count : 0; }
+
+unsigned long controller_adjust(display_controller *c, double fraction) {
+    if (!c) return 0;
+    int e = read_lock(c);
+    display_set *s = __atomic_load_n(&c->set, __ATOMIC_SEQ_CST);
+    /* No displays yet: keep the step as a fraction, for publish to replay onto
+     * each display once it's online. Inside the read section, so publish's
+     * grace period covers it. */
+    if (s->boot) {
+        long long millionths = (long long)(fraction * 1e6 + (fraction < 0 ? -0.5 : 0.5));
+        __atomic_fetch_add(&c->intent, millionths, __ATOMIC_RELAXED);
+    }
+    long long now = 0;
+    int ppm[BRIGHTNESS_FEATURES];
+    for (int f = 0; f < BRIGHTNESS_FEATURES; f++) ppm[f] = __atomic_load_n(&c->link_ppm[f], __ATOMIC_ACQUIRE);
+    for (int i = 0; i < s->count; i++) {
+        managed_display *m = &s->displays[i];
+        int delta = dimmer_delta_for_fraction(dimmer_max(&m->dim), fraction);
+        dimmer_post(&m->dim, delta);
+        for (int f = 0; f < BRIGHTNESS_FEATURES; f++) {
+            int max = ppm[f] ? dimmer_max(&m->linked[f]) : 0;
+            if (max > 0) dimmer_post(&m->linked[f], dimmer_delta_for_fraction(max, fraction * ppm[f] / 1e6));
+        }
+        __atomic_fetch_add(&m->counters.presses, 1, __ATOMIC_RELAXED);
+        /* Only the first press of a batch reads the clock. */
+        long long none = 0;
+        if (__atomic_load_n(&m->counters.waiting_since, __ATOMIC_RELAXED) == 0) {
+            if (!now) now = stats_now_us();
+            __atomic_compare_exchange_n(&m->counters.waiting_since, &none, now, 0,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED);
         }
     }
-    return c;
+    read_unlock(c, e);
+    /* Taken after posting, so a service pass that sees this ticket also drains
+     * the step (or finds it already carried into a newer set by publish). */
+    return __atomic_add_fetch(&c->posted, 1, __ATOMIC_SEQ_CST);
+}
+
+void controller_set_ramp(display_controller *c, int ms) {
+    if (!c) return;
+    c->ramp_ms = ms;
+    for (int i = 0; i < c->set->count; i++) {
+        managed_display *m = &c->set->displays[i];
+        dimmer_set_ramp(&m->dim, ms);
+        for (int f = 0; f < BRIGHTNESS_FEATURES; f++) dimmer_set_ramp(&m->linked[f], ms);
+    }
+}
+
+void controller_link_feature(display_controller *c, brightness_feature f, double scale) {
+    if (!c || f < 0 || f >= BRIGHTNESS_FEATURES) return;
+    int ppm = (int)(scale * 1e6 + (scale < 0 ? -0.5 : 0.5));
+    /* Read it off the displays already open before the first step can reach
+     * them: input threads only look at a linked dimmer once this is stored. */
+    if (ppm && !c->link_ppm[f])
+        for (int i = 0; i < c->set->count; i++) read_feature(&c->set->displays[i], f);
+    __atomic_store_n(&c->link_ppm[f], ppm, __ATOMIC_RELEASE);
+}
+
+void controller_set_clock(display_controller *c, long (*now_ms)(void)) {
+    if (c) c->clock = now_ms ? now_ms : monotonic_ms;
+}
+
+long controller_next_frame(const display_controller *c) {
+    return c ? c->next_wait : -1;
+}
+
+static void *write_job_run(void *arg) {
+    write_job *job = (write_job*)arg;
+    long start = job->clock();
+    long long start_us = stats_now_us();
+    job->rc = job->level_due ? job->src->ops->set(job->src->ctx, job->target) : 0;
+    for (int f = 0; f < BRIGHTNESS_FEATURES; f++)
+        if (job->linked_due[f])
+            job->linked_rc[f] = job->src->ops->set_feature(job->src->ctx, (brightness_feature)f,
+                                                           job->linked_target[f]);
+    job->took_us = stats_now_us() - start_us;
+    job->took_ms = job->clock() - start;
+    pthread_mutex_lock(&job->owner->lock);
+    __atomic_store_n(&job->done, 1, __ATOMIC_RELEASE);
+    pthread_cond_broadcast(&job->owner->written);
+    pthread_mutex_unlock(&job->owner->lock);
+    return NULL;
+}
+
+/* Land one finished write: for each control it set, commit only the applied
+ * step (presses that arrived meanwhile stay pending), or drop the batch and back
+ * off on failure. Either way the round trip feeds the display's latency
+ * estimate -- a failure that sat through the provider's retry timeouts is
+ * exactly what it should learn -- and the display goes to the back of the
+ * queue. Returns 1 if anything landed. */
+static int write_job_finish(display_controller *c, managed_display *m) {
+    display_counters *k = &m->counters;
+    long now = c->clock();
+    int landed = 0, failed = 0;
+    dimmer_observe_latency(&m->dim, (int)m->job.took_ms);
+    remember_timing(m);
+    stats_record(&k->write_us, m->job.took_us);
+    m->due_since = now;
+    if (m->job.level_due) {
+        if (m->job.rc == 0) {
+            dimmer_commit(&m->dim, m->job.target);
+            remember_level(m);
+            m->readback = !m->step_known;
+            landed = 1;
+        } else {
+            dimmer_failed(&m->dim, now);  /* isolate the failure, drop its batch */
+            failed = 1;
+        }
+    }
+    for (int f = 0; f < BRIGHTNESS_FEATURES; f++) {
+        dimmer_t *d = &m->linked[f];
+        if (!m->job.linked_due[f]) continue;
+        if (m->job.linked_rc[f] == 0) {
+            dimmer_commit(d, m->job.linked_target[f]);
+            landed = 1;
+        } else {
+            dimmer_failed(d, now);
+            failed = 1;
+        }
+    }
+    if (landed) {
+        k->writes++;
+        if (k->batch_since) stats_record(&k->press_to_write_us, stats_now_us() - k->batch_since);
+    }
+    if (failed) k->failures++;
+    k->batch_since = 0;   /* later frames of a ramp aren't a press's first write */
+    return landed;
 }
 
-int controller_count(const display_controller *c) { return c ? c->count : 0; }
+/* Join and land every write still in flight (concurrent mode), however long it
+ * takes: before the set is swapped or closed, or the mode changes. */
+static void settle_writes(display_controller *c, display_set *s) {
+    for (int i = 0; i < s->count; i++) {
+        managed_display *m = &s->displays[i];
+        if (!m->in_flight) continue;
+        pthread_join(m->job.thread, NULL);
+        m->in_flight = 0;
+        write_job_finish(c, m);
+    }
+}
 
-void controller_adjust(display_controller *c, double fraction) {
+void controller_set_concurrent(display_controller *c, int on) {
     if (!c) return;
-    for (int i = 0; i < c->count; i++) {
-        int delta = dimmer_delta_for_fraction(dimmer_max(&c->displays[i].dim), fraction);
-        dimmer_adjust(&c->displays[i].dim, delta);
+    settle_writes(c, c->set);
+    c->concurrent = on ? 1 : 0;
+}
+
+static void fold_wait(display_controller *c, long wait) {
+    if (wait >= 0 && (c->next_wait < 0 || wait < c->next_wait)) c->next_wait = wait;
+}
+
+/* Is a frame due for `m` now -- for its brightness or any linked feature? If
+ * so, set up its write job with every one that is, so they share the slot; if
+ * not, fold how long until its next frame into c->next_wait. */
+static int frame_due(display_controller *c, managed_display *m, long now) {
+    long wait;
+    int due = m->job.level_due = dimmer_frame(&m->dim, now, &m->job.target, &wait);
+    fold_wait(c, wait);
+    for (int f = 0; f < BRIGHTNESS_FEATURES; f++) {
+        /* Paced by the display's one estimate, so frames that start together
+         * stay together. */
+        m->linked[f].srtt_ms = m->dim.srtt_ms;
+        m->linked[f].rttvar_ms = m->dim.rttvar_ms;
+        m->linked[f].samples = m->dim.samples;
+        m->job.linked_due[f] = dimmer_frame(&m->linked[f], now, &m->job.linked_target[f], &wait);
+        due |= m->job.linked_due[f];
+        fold_wait(c, wait);
     }
+    if (!due) return 0;
+    m->job.src = &m->src;
+    m->job.clock = c->clock;
+    m->job.owner = c;
+    m->job.done = 0;
+    m->job.started_us = stats_now_us();
+    return 1;
 }
 
-int controller_service(display_controller *c) {
-    if (!c) return 0;
+/* Is any of `m`'s controls off its target? */
+static int display_due(const managed_display *m) {
+    int target;
+    if (dimmer_due(&m->dim, &target)) return 1;
+    for (int f = 0; f < BRIGHTNESS_FEATURES; f++)
+        if (dimmer_due(&m->linked[f], &target)) return 1;
+    return 0;
+}
+
+/* How far `m` is from its target, in thousandths of its range (the furthest
+ * of its controls). */
+static int dimmer_lag(const dimmer_t *d) {
+    int target, max = dimmer_max(d);
+    if (!dimmer_due(d, &target) || max <= 0) return 0;
+    int diff = target > d->current ? target - d->current : d->current - target;
+    return (int)((long long)diff * 1000 / max);
+}
+
+static int lag(const managed_display *m) {
+    int worst = dimmer_lag(&m->dim);
+    for (int f = 0; f < BRIGHTNESS_FEATURES; f++) {
+        int l = dimmer_lag(&m->linked[f]);
+        if (l > worst) worst = l;
+    }
+    return worst;
+}
+
+/* Does `a` go before `b`: waiting since longer, or, as long, further behind? */
+static int more_overdue(const managed_display *a, const managed_display *b) {
+    if (a->due_since != b->due_since) return a->due_since < b->due_since;
+    return lag(a) > lag(b);
+}
+
+/* Fill s->order with the displays that have a change under way and no write
+ * in flight, most overdue first; returns how many. */
+static int queue_displays(display_set *s) {
+    int n = 0;
+    for (int i = 0; i < s->count; i++) {
+        const managed_display *m = &s->displays[i];
+        if (!m->queued || m->in_flight) continue;
+        int j = n++;
+        for (; j > 0 && more_overdue(m, &s->displays[s->order[j - 1]]); j--)
+            s->order[j] = s->order[j - 1];
+        s->order[j] = i;
+    }
+    return n;
+}
+
+/* Concurrent: wait until every write in flight has finished or has had its
+ * CONTROLLER_WRITE_BUDGET_MS. (Real time, whatever clock the controller was
+ * given: this is how long the pass actually blocks.) */
+static void await_writes(display_controller *c, display_set *s) {
+    pthread_mutex_lock(&c->lock);
+    for (;;) {
+        long long now = stats_now_us(), until = 0;
+        for (int i = 0; i < s->count; i++) {
+            const managed_display *m = &s->displays[i];
+            if (!m->in_flight || m->job.done) continue;
+            long long end = m->job.started_us + CONTROLLER_WRITE_BUDGET_MS * 1000LL;
+            if (end > now && (!until || end < until)) until = end;
+        }
+        if (!until) break;
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        long long ns = ts.tv_nsec + (until - now) * 1000LL;
+        ts.tv_sec += (time_t)(ns / 1000000000LL);
+        ts.tv_nsec = (long)(ns % 1000000000LL);
+        pthread_cond_timedwait(&c->written, &c->lock, &ts);
+    }
+    pthread_mutex_unlock(&c->lock);
+}
+
+/* Write due displays, most overdue first: the sequential or concurrent half of
+ * a pass. Either way no one display holds up the rest for more than
+ * CONTROLLER_WRITE_BUDGET_MS. */
+static int service_writes(display_controller *c, display_set *s) {
     int applied = 0;
-    for (int i = 0; i < c->count; i++) {
-        int target = -1;
-        if (!dimmer_due(&c->displays[i].dim, &target)) continue;
-        if (c->displays[i].src.ops->set(c->displays[i].src.ctx, target) == 0) {
-            dimmer_commit(&c->displays[i].dim, target);
-            applied++;
+    long now = c->clock();
+    long long pass_start = stats_now_us();
+    c->next_wait = -1;
+    int queued = queue_displays(s);
+    if (!c->concurrent) {
+        /* Once the pass has spent its budget, the rest wait for the next one --
+         * at the front of the queue, ahead of what was just written. */
+        for (int q = 0; q < queued; q++) {
+            managed_display *m = &s->displays[s->order[q]];
+            if (stats_now_us() - pass_start >= CONTROLLER_WRITE_BUDGET_MS * 1000LL) {
+                c->next_wait = 0;
+                break;
+            }
+            if (!frame_due(c, m, now)) continue;
+            write_job_run(&m->job);
+            applied += write_job_finish(c, m);
+        }
+        return applied;
+    }
+
+    /* Concurrent: capture every due target, then start all the writes at once.
+     * Each display sits on its own bus, so the pass costs about the slowest
+     * round trip rather than the sum -- up to the budget. A write still on the
+     * bus after that is left in flight, and a later pass lands it, so a display
+     * that hangs (or retries through its timeouts) doesn't hold the others'
+     * next writes back. One that can't get a thread runs inline. */
+    for (int q = 0; q < queued; q++) {
+        managed_display *m = &s->displays[s->order[q]];
+        if (!frame_due(c, m, now)) continue;
+        if (pthread_create(&m->job.thread, NULL, write_job_run, &m->job) == 0) {
+            m->in_flight = 1;
         } else {
-            dimmer_settled(&c->displays[i].dim);  /* isolate the failure, drop its batch */
+            write_job_run(&m->job);
+            applied += write_job_finish(c, m);
+        }
+    }
+    await_writes(c, s);
+    for (int i = 0; i < s->count; i++) {
+        managed_display *m = &s->displays[i];
+        if (!m->in_flight) continue;
+        if (!__atomic_load_n(&m->job.done, __ATOMIC_ACQUIRE)) {
+            /* Check back about when it should be done. */
+            long left = m->dim.srtt_ms - (long)((stats_now_us() - m->job.started_us) / 1000);
+            if (left < DIMMER_MIN_FRAME_MS) left = DIMMER_MIN_FRAME_MS;
+            if (c->next_wait < 0 || left < c->next_wait) c->next_wait = left;
+            continue;
         }
+        pthread_join(m->job.thread, NULL);
+        m->in_flight = 0;
+        applied += write_job_finish(c, m);
     }
     return applied;
 }
 
-void controller_reconcile(display_controller *c) {
-    if (!c) return;
-    brightness_source *fresh = NULL; int fresh_n = 0;
-    if (brightness_enumerate(&fresh, &fresh_n) != 0) return;   /* keep current set on failure */
+/* Does any display still have a change under way (a ramp between frames, a
+ * write held off by a backoff or still in flight)? A display with none has
+ * written every press it is going to, so any press left unwritten (one that
+ * only pushed against a rail) stops counting towards press-to-write. */
+static int changes_pending(display_set *s) {
+    int pending = 0;
+    for (int i = 0; i < s->count; i++) {
+        managed_display *m = &s->displays[i];
+        if (m->in_flight || display_due(m)) {
+            pending = 1;
+        } else {
+            m->counters.batch_since = 0;
+            m->queued = 0;
+        }
+    }
+    return pending;
+}
 
-    managed_display *next = fresh_n > 0
-        ? (managed_display*)calloc((size_t)fresh_n, sizeof(managed_display)) : NULL;
-    if (fresh_n > 0 && !next) { brightness_free(fresh, fresh_n); return; }
+int controller_service(display_controller *c) {
+    if (!c) return 0;
+    display_set *s = c->set;   /* the servicing thread is the only publisher */
+    /* Every ticket up to here was posted before this drain, and each write below
+     * either lands or is dropped, so they are all finished when the pass ends --
+     * unless a ramp still has frames to go, or a write is still in flight. */
+    unsigned long ticket = __atomic_load_n(&c->posted, __ATOMIC_SEQ_CST);
+    long now = c->clock();
+    for (int i = 0; i < s->count; i++) {
+        managed_display *m = &s->displays[i];
+        /* Taken before the drain, so a press is never drained ahead of its
+         * stamp. (One racing in between gets its stamp pinned to the next
+         * batch instead, overstating that batch a little; it's a statistic.) */
+        long long since = __atomic_exchange_n(&m->counters.waiting_since, 0, __ATOMIC_RELAXED);
+        if (since && !m->counters.batch_since) m->counters.batch_since = since;
+        dimmer_drain(&m->dim);
+        for (int f = 0; f < BRIGHTNESS_FEATURES; f++) dimmer_drain(&m->linked[f]);
+        if (!m->queued && display_due(m)) {
+            m->queued = 1;
+            m->due_since = now;
+        }
+    }
+    int applied = service_writes(c, s);
+    /* Mid-ramp, a step isn't finished until its last frame lands; while
+     * booting, none is until it has been replayed. */
+    if (!changes_pending(s) && !s->boot)
+        __atomic_store_n(&c->committed, ticket, __ATOMIC_RELEASE);
+    return applied;
+}
 
-    for (int i = 0; i < fresh_n; i++) {
-        int matched = -1;
-        for (int j = 0; j < c->count; j++) {
-            if (strcmp(fresh[i].id, c->sources[j].id) == 0) { matched = j; break; }
+int controller_verify(display_controller *c) {
+    if (!c) return 0;
+    display_set *s = c->set;
+    for (int i = 0; i < s->count; i++) {
+        managed_display *m = &s->displays[i];
+        if (!(m->unverified || m->readback) || m->in_flight || display_due(m)) continue;
+        int cur = 0, max = 0;
+        long start = c->clock();
+        int rc = m->src.ops->get(m->src.ctx, &cur, &max);
+        dimmer_observe_latency(&m->dim, (int)(c->clock() - start));
+        remember_timing(m);
+        if (!m->unverified) {
+            if (rc == 0 && max > 0) learn_step(m, cur, max);
+            else m->readback = 0;   /* the next write's read-back will do */
+        } else if (rc == 0 && max > 0) {
+            m->unverified = 0;
+            if (dimmer_resync(&m->dim, cur, max)) remember_level(m);
+        } else if (++m->verify_tries >= CONTROLLER_VERIFY_TRIES) {
+            /* Go on from the remembered state (writes fail and back off on
+             * their own if it's really gone), but probe it afresh next time. */
+            m->unverified = 0;
+            if (m->src.identity[0]) display_db_set_long(m->src.identity, "controllable", 0);
         }
-        next[i].src = fresh[i];
-        if (matched >= 0) {
-            next[i].dim = c->displays[matched].dim;   /* preserve level + pending */
-        } else {
-            int cur = 0, max = 100;
-            if (fresh[i].ops->get(fresh[i].ctx, &cur, &max) != 0) { cur = 0; max = 100; }
-            dimmer_init(&next[i].dim, cur, max);
+        return 1;
+    }
+    return 0;
+}
+
+display_set *controller_reconcile_prepare(display_controller *c) {
+    if (!c) return NULL;
+    display_set *next = NULL;
+    set_enumerate(c, c->set, &next);   /* NULL if unchanged or on failure: keep the current set */
+    return next;
+}
+
+/* A surviving display's dimmer, into the new set. Field by field: the old
+ * inbox may still be posted to (moved after the grace period). */
+static void carry_dimmer(dimmer_t *to, const dimmer_t *from) {
+    to->current = from->current;
+    to->max = from->max;
+    to->pending_delta = from->pending_delta;
+    to->ramp_from = from->ramp_from;
+    to->ramp_to = from->ramp_to;
+    to->ramp_start = from->ramp_start;
+    to->ramp_last = from->ramp_last;
+    to->srtt_ms = from->srtt_ms;
+    to->rttvar_ms = from->rttvar_ms;
+    to->samples = from->samples;
+    to->failures = from->failures;
+    to->retry_at = from->retry_at;
+    to->step = from->step;
+}
+
+/* Move what was posted to `from` since the carry over to `to`. */
+static void carry_inbox(dimmer_t *to, dimmer_t *from) {
+    int posted = __atomic_exchange_n(&from->inbox, 0, __ATOMIC_ACQUIRE);
+    if (posted) dimmer_post(to, posted);
+}
+
+void controller_reconcile_publish(display_controller *c, display_set *next) {
+    if (!c || !next) return;
+    display_set *old = c->set;
+    settle_writes(c, old);   /* every write lands in the set that started it */
+
+    /* Surviving displays keep their level and pending batch. */
+    for (int i = 0; i < next->count; i++) {
+        int j = set_find(old, next->displays[i].src.id);
+        if (j < 0) continue;
+        carry_dimmer(&next->displays[i].dim, &old->displays[j].dim);
+        for (int f = 0; f < BRIGHTNESS_FEATURES; f++)
+            carry_dimmer(&next->displays[i].linked[f], &old->displays[j].linked[f]);
+        next->displays[i].unverified = old->displays[j].unverified;
+        next->displays[i].queued = old->displays[j].queued;
+        next->displays[i].due_since = old->displays[j].due_since;
+        next->displays[i].verify_tries = old->displays[j].verify_tries;
+        next->displays[i].step_known = old->displays[j].step_known;
+        next->displays[i].readback = old->displays[j].readback;
+        next->displays[i].step_samples = old->displays[j].step_samples;
+        next->displays[i].step_gcd = old->displays[j].step_gcd;
+        next->displays[i].step_snapped = old->displays[j].step_snapped;
+        /* The servicing thread's counters; the posted ones move after the
+         * grace period, with the inbox. */
+        const display_counters *kf = &old->displays[j].counters;
+        display_counters *kt = &next->displays[i].counters;
+        kt->batch_since = kf->batch_since;
+        kt->writes = kf->writes;
+        kt->failures = kf->failures;
+        kt->write_us = kf->write_us;
+        kt->press_to_write_us = kf->press_to_write_us;
+    }
+    for (int i = 0; i < next->count; i++) {
+        dimmer_set_ramp(&next->displays[i].dim, c->ramp_ms);
+        for (int f = 0; f < BRIGHTNESS_FEATURES; f++) dimmer_set_ramp(&next->displays[i].linked[f], c->ramp_ms);
+    }
+
+    __atomic_store_n(&c->set, next, __ATOMIC_SEQ_CST);
+    int e = c->epoch;
+    __atomic_store_n(&c->epoch, !e, __ATOMIC_SEQ_CST);
+    while (__atomic_load_n(&c->readers[e], __ATOMIC_SEQ_CST) != 0)
+        sched_yield();
+
+    /* Grace period over: the old inboxes are final. Carry them across; the
+     * surviving sources' handles now belong to `next`. */
+    for (int i = 0; i < next->count; i++) {
+        int j = set_find(old, next->displays[i].src.id);
+        if (j < 0) continue;
+        carry_inbox(&next->displays[i].dim, &old->displays[j].dim);
+        for (int f = 0; f < BRIGHTNESS_FEATURES; f++)
+            carry_inbox(&next->displays[i].linked[f], &old->displays[j].linked[f]);
+        display_counters *kf = &old->displays[j].counters, *kt = &next->displays[i].counters;
+        __atomic_fetch_add(&kt->presses, kf->presses, __ATOMIC_RELAXED);
+        long long none = 0;
+        if (kf->waiting_since)
+            __atomic_compare_exchange_n(&kt->waiting_since, &none, kf->waiting_since, 0,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+        next->displays[i].inherited = 0;
+        old->displays[j].inherited = 1;
+    }
+    /* The first real set: replay what was pressed while there was none onto
+     * every display, each by that fraction of its own range. */
+    long long intent = old->boot ? __atomic_exchange_n(&c->intent, 0, __ATOMIC_RELAXED) : 0;
+    for (int i = 0; intent && i < next->count; i++) {
+        managed_display *m = &next->displays[i];
+        dimmer_post(&m->dim, dimmer_delta_for_fraction(dimmer_max(&m->dim), (double)intent / 1e6));
+        for (int f = 0; f < BRIGHTNESS_FEATURES; f++) {
+            int max = c->link_ppm[f] ? dimmer_max(&m->linked[f]) : 0;
+            if (max > 0)
+                dimmer_post(&m->linked[f], dimmer_delta_for_fraction(max, (double)intent / 1e6 * c->link_ppm[f] / 1e6));
         }
+        long long none = 0;
+        __atomic_compare_exchange_n(&m->counters.waiting_since, &none, stats_now_us(), 0,
+                                    __ATOMIC_RELAXED, __ATOMIC_RELAXED);
     }
+    set_free(old);   /* closes only the displays that vanished */
+}
+
+void controller_reconcile_discard(display_set *next) {
+    set_free(next);
+}
+
+void controller_reconcile(display_controller *c) {
+    controller_reconcile_publish(c, controller_reconcile_prepare(c));
+}
 
-    /* Close only the sources that did NOT survive into the new set. */
-    for (int j = 0; j < c->count; j++) {
-        int survived = 0;
-        for (int i = 0; i < fresh_n; i++) if (strcmp(fresh[i].id, c->sources[j].id) == 0) { survived = 1; break; }
-        if (!survived && c->sources[j].ops && c->sources[j].ops->close)
-            c->sources[j].ops->close(c->sources[j].ctx);
+unsigned long controller_committed(const display_controller *c) {
+    return c ? __atomic_load_n(&c->committed, __ATOMIC_ACQUIRE) : 0;
+}
+
+int controller_levels(const display_controller *c, int *current, int *max, int cap) {
+    if (!c) return 0;
+    const display_set *s = c->set;
+    for (int i = 0; i < s->count && i < cap; i++) {
+        current[i] = s->displays[i].dim.current;
+        max[i] = dimmer_max(&s->displays[i].dim);
     }
-    free(c->sources);     /* free old array shell; surviving ctx now owned via `fresh` */
-    free(c->displays);
-    c->sources = fresh;   /* NOTE: fresh[i].ctx for a matched display is a *new* open;
-                             the old matched ctx was closed above. */
-    c->count = fresh_n;
-    c->displays = next;
+    return s->count;
+}
+
+int controller_latency(const display_controller *c, int i, display_latency *out) {
+    if (!c || i < 0 || i >= c->set->count) return -1;
+    const managed_display *m = &c->set->displays[i];
+    memcpy(out->id, m->src.id, sizeof(out->id));
+    memcpy(out->label, m->src.label, sizeof(out->label));
+    out->srtt_ms = m->dim.srtt_ms;
+    out->rttvar_ms = m->dim.rttvar_ms;
+    out->samples = m->dim.samples;
+    out->failures = m->dim.failures;
+    out->open_ms = (int)(m->src.open_us / 1000);
+    out->remembered = m->unverified;
+    out->step = m->dim.step;
+    return 0;
+}
+
+int controller_stats(const display_controller *c, int i, display_stats *out) {
+    if (!c || i < 0 || i >= c->set->count) return -1;
+    const managed_display *m = &c->set->displays[i];
+    memcpy(out->id, m->src.id, sizeof(out->id));
+    out->presses = __atomic_load_n(&m->counters.presses, __ATOMIC_RELAXED);
+    out->writes = m->counters.writes;
+    out->failures = m->counters.failures;
+    out->write_us = m->counters.write_us;
+    out->press_to_write_us = m->counters.press_to_write_us;
+    return 0;
 }
 
 int controller_current(const display_controller *c, int i) {
-    if (!c || i < 0 || i >= c->count) return -1;
-    return c->displays[i].dim.current;
+    if (!c || i < 0 || i >= c->set->count) return -1;
+    return c->set->displays[i].dim.current;
 }
 
 void controller_close(display_controller *c) {
     if (!c) return;
-    brightness_free(c->sources, c->count);  /* calls ops->close on each */
-    free(c->displays);
-    free(c);
+    settle_writes(c, c->set);
+    set_free(c->set);
+    controller_free(c);
 }
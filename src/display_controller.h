@@ -2,35 +2,189 @@
 #define DISPLAY_CONTROLLER_H
 
 #include "brightness.h"
+#include "stats.h"
 
 /* Owns the live set of controllable displays, one dimmer per display, and applies
  * a relative fraction step to all of them (each by that fraction of its own max,
  * so offsets between displays are preserved). Thread-agnostic: dimmitd owns the
- * mutex/worker and calls controller_service() to perform the (slow) writes. */
+ * mutex/worker and calls controller_service() to perform the (slow) writes; the
+ * concurrent mode only fans one pass's writes out to short-lived threads. */
 
 typedef struct display_controller display_controller;
 
 /* Enumerate + open every controllable display and read its current brightness.
  * Returns NULL only on allocation failure; a valid controller with 0 displays is
- * fine (a monitor may appear later). */
+ * fine (a monitor may appear later).
+ *
+ * A display the display database remembers (by its identity; see display_db.h)
+ * skips those reads: it starts from the level, max and round-trip time last
+ * recorded for it, and controller_verify() reads it back later. Every read and
+ * write keeps the database's record of it current. */
 display_controller *controller_open(void);
 
+/* Startup without waiting on the displays: an empty controller, ready for
+ * input at once, whose first controller_reconcile_prepare() does the initial
+ * enumeration. Until that set is published, controller_adjust() keeps every
+ * step as a fraction of the range (an intent), and publish replays their sum
+ * onto each display as it comes online -- so a key pressed during boot lands
+ * once there is something to land on. Those steps aren't committed until then
+ * either, so acks wait for the displays too. NULL on allocation failure. */
+display_controller *controller_open_deferred(void);
+
+/* Is the controller still waiting for its first set (see above)? Any thread. */
+int  controller_booting(const display_controller *c);
+
 int  controller_count(const display_controller *c);
 
 /* Fan a relative step out to every display: for display d,
- * dimmer_adjust(dimmer_delta_for_fraction(d.max, fraction)). */
-void controller_adjust(display_controller *c, double fraction);
+ * dimmer_post(dimmer_delta_for_fraction(d.max, fraction)). Lock-free: input
+ * threads may call it while a write or a reconcile is in flight.
+ * Returns the step's ticket: once controller_committed() reaches it, the step
+ * has been through a controller_service() pass and written (or, for a display
+ * whose write failed, dropped). Tickets increase by one per call. */
+unsigned long controller_adjust(display_controller *c, double fraction);
 
-/* Apply every due write (dimmer_due -> source set -> dimmer_commit, or
- * dimmer_settled on failure). Returns the number of displays written. */
+/* Drain every display's posted presses, then apply due writes (dimmer_due ->
+ * source set -> dimmer_commit, or dimmer_settled on failure). Returns the number
+ * of displays written.
+ *
+ * Displays are served most overdue first: the one whose change has waited
+ * longest since it arrived or since the display was last written, and among
+ * those the one furthest from its target -- so after a write a display goes to
+ * the back of the queue, and no position in the set is favoured. And no one
+ * display holds up the others for more than CONTROLLER_WRITE_BUDGET_MS: a
+ * sequential pass starts no further write once it has spent that long (those
+ * left wait at the front of the queue; controller_next_frame() is then 0), and
+ * a concurrent pass waits that long at most for any one write (see
+ * controller_set_concurrent). */
+#define CONTROLLER_WRITE_BUDGET_MS 100
 int  controller_service(display_controller *c);
 
+/* Servicing thread, when idle: read back one display that started from the
+ * display database and has no change under way, adopting the level and max it
+ * reports. A display that fails CONTROLLER_VERIFY_TRIES read-backs keeps the
+ * remembered values, and is probed afresh at the next startup.
+ *
+ * The same read-back learns each display's effective resolution (its "step";
+ * see dimmer_set_step), which the display database can also be told (key
+ * "step"). Until a display's step is known, each write it takes is read back
+ * here once it's idle, up to CONTROLLER_STEP_SAMPLES times: one that snaps the
+ * levels written to a coarser grid gets that grid's step, and from then on a
+ * change too small to reach the next level isn't written. The result is
+ * remembered, so this happens once per monitor.
+ *
+ * Returns 1 if a display was read (call again for the next), 0 if none is
+ * waiting. */
+#define CONTROLLER_VERIFY_TRIES 3
+#define CONTROLLER_STEP_SAMPLES 4
+int  controller_verify(display_controller *c);
+
+/* Ramps (off by default): spread each change over `ms`, one frame per pass, as
+ * dimmer_frame() paces them by each display's measured write latency. A pass
+ * with no frame due yet writes nothing; controller_next_frame() then says how
+ * many ms until one is (-1: nothing pending), so the caller can sleep until
+ * then. The clock is monotonic ms; tests inject their own. */
+void controller_set_ramp(display_controller *c, int ms);
+
+/* Linked features (off by default): step feature `f` (say, contrast) along
+ * with brightness, each step moving it by `scale` times the step's fraction of
+ * its own range (0 unlinks it; negative moves it the other way). Displays
+ * without that control are left as they are. Each linked feature has its own
+ * dimmer -- presses coalesce per control, and each ramps and backs off on its
+ * own -- but a display's controls share its service slot: whatever has a frame
+ * due is written back to back in one write, so a combined step costs one
+ * scheduling cycle rather than one per control. Servicing thread (or before
+ * input starts): reads the control's level from each display already open
+ * that hasn't been read yet; later displays are read as they're enumerated. */
+void controller_link_feature(display_controller *c, brightness_feature f, double scale);
+void controller_set_clock(display_controller *c, long (*now_ms)(void));
+long controller_next_frame(const display_controller *c);
+
+/* The highest ticket whose step every display has finished with (for a ramp,
+ * its last frame). Any thread. */
+unsigned long controller_committed(const display_controller *c);
+
+/* Servicing thread: copy up to `cap` displays' last-applied level and max into
+ * the arrays, in display order. Returns the number of displays. */
+int  controller_levels(const display_controller *c, int *current, int *max, int cap);
+
+/* Concurrent service mode (off by default): controller_service() starts every
+ * due display's write on its own thread and returns once all have finished, so
+ * a pass costs roughly the slowest display's round trip rather than the sum.
+ * Targets are captured before the writes start and committed after they end,
+ * exactly as in the sequential pass. A write still running after
+ * CONTROLLER_WRITE_BUDGET_MS is left in flight rather than waited for: the
+ * pass returns, the other displays go on being written, and a later pass
+ * commits it once it ends (controller_next_frame() says when to look). Its
+ * steps aren't committed before then; reconcile publish and close wait for
+ * it. */
+void controller_set_concurrent(display_controller *c, int on);
+
 /* Re-enumerate the display set. Displays whose id still matches keep their dimmer
- * (and level); new displays are opened and initialized from their own current;
- * vanished displays are closed and dropped. Phase 1 calls this on a timer; Phase 3
- * replaces the trigger with per-platform display-change events. */
+ * (level, pending batch and any presses posted meanwhile); new displays are
+ * opened and initialized from their own current; vanished displays are closed
+ * and dropped. Phase 1 triggers this on a timer; Phase 3 replaces the trigger
+ * with per-platform display-change events.
+ *
+ * Reconcile is incremental: surviving displays keep their open source (no
+ * close/reopen/probe), only new ones are opened and probed, and when the ids are
+ * unchanged nothing is built at all -- so an idle reconcile costs no display I/O.
+ *
+ * Split in two so the slow half never blocks input or writes:
+ *   prepare -- enumerate and probe into a new, unpublished set. Any thread, no
+ *              lock; the current set stays live meanwhile. NULL if nothing
+ *              changed or on failure (either way: keep the current set).
+ *   publish -- adopt it: carry surviving dimmers over, swap the set pointer
+ *              (controller_adjust() callers move to the new set without
+ *              blocking), then close and free the old set once no adjust is
+ *              still reading it. Call on the controller_service() thread.
+ * Calls to prepare/publish must not overlap each other (one reconciler). An
+ * unpublished set is released with controller_reconcile_discard().
+ * controller_reconcile() is prepare + publish on the calling thread. */
+typedef struct display_set display_set;
+
+display_set *controller_reconcile_prepare(display_controller *c);
+void controller_reconcile_publish(display_controller *c, display_set *next);
+void controller_reconcile_discard(display_set *next);
 void controller_reconcile(display_controller *c);
 
+/* Each display's learned round-trip time: every get and set is timed (failures
+ * included) into a smoothed mean and deviation, which pace its ramp frames and
+ * its retries after a failure (see dimmer_observe_latency). Servicing thread;
+ * copies out, so the result outlives a reconcile. Returns 0, or -1 if `i` is out
+ * of range. */
+typedef struct {
+    char id[64];
+    char label[64];
+    int  srtt_ms;        /* smoothed round trip */
+    int  rttvar_ms;      /* its mean deviation */
+    int  samples;        /* round trips measured */
+    int  failures;       /* consecutive failed writes (backing off while > 0) */
+    int  open_ms;        /* how long the provider took to open (and probe) it */
+    int  remembered;     /* started from the display database, not yet read back */
+    int  step;           /* effective resolution, as told or learned (1 until then) */
+} display_latency;
+
+int  controller_latency(const display_controller *c, int i, display_latency *out);
+
+/* Each display's running totals since it was first enumerated: presses posted
+ * to it, writes landed and failed, how long each write took (failures
+ * included), and how long each batch of presses waited from its first press to
+ * the write that applied it. presses / writes is how well presses coalesce.
+ * Recording costs input one relaxed atomic add per display (and a clock read
+ * when a press starts a batch), and the servicing thread a few more per write.
+ * Servicing thread; copies out. Returns 0, or -1 if `i` is out of range. */
+typedef struct {
+    char            id[64];
+    unsigned long   presses;
+    unsigned long   writes;
+    unsigned long   failures;
+    stats_histogram write_us;
+    stats_histogram press_to_write_us;
+} display_stats;
+
+int  controller_stats(const display_controller *c, int i, display_stats *out);
+
 /* Test accessor: last-applied brightness of display i, or -1 if out of range. */
 int  controller_current(const display_controller *c, int i);
 
@@ -0,0 +1,332 @@
+#define _POSIX_C_SOURCE 200809L   /* strdup, mkstemp */
+#include "display_db.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifndef _WIN32
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#define DISPLAY_DB_KEY_MAX  24
+#define DISPLAY_DB_LINE_MAX 2048
+#define DISPLAY_DB_HEADER   "# dimmit display database v1"
+
+typedef struct {
+    char key[DISPLAY_DB_KEY_MAX];
+    char value[DISPLAY_DB_VALUE_MAX];
+} db_field;
+
+typedef struct {
+    char identity[DISPLAY_DB_ID_MAX];
+    int nfields;
+    db_field fields[DISPLAY_DB_MAX_KEYS];
+} db_entry;
+
+static pthread_mutex_t db_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t flush_lock = PTHREAD_MUTEX_INITIALIZER;  /* one flush at a time */
+static char *db_path = NULL;        /* NULL: in memory only */
+static db_entry *db_entries = NULL; /* DISPLAY_DB_MAX_ENTRIES of them, allocated on first use */
+static int db_count = 0;
+static int db_dirty = 0;
+
+/* A single word that fits in `max` (with its NUL). */
+static int is_word(const char *s, size_t max) {
+    if (!s || !*s) return 0;
+    size_t n = 0;
+    for (; s[n]; n++)
+        if (!isgraph((unsigned char)s[n])) return 0;
+    return n < max;
+}
+
+static int is_key(const char *s) {
+    return is_word(s, DISPLAY_DB_KEY_MAX) && !strchr(s, '=');
+}
+
+/* The entry for `identity`, or (if `create`) a new one; NULL if there's none,
+ * or no room. Under db_lock. */
+static db_entry *find_entry(const char *identity, int create) {
+    for (int i = 0; i < db_count; i++)
+        if (strcmp(db_entries[i].identity, identity) == 0) return &db_entries[i];
+    if (!create || !is_word(identity, DISPLAY_DB_ID_MAX)) return NULL;
+    if (!db_entries) {
+        db_entries = (db_entry*)calloc(DISPLAY_DB_MAX_ENTRIES, sizeof(db_entry));
+        if (!db_entries) return NULL;
+    }
+    if (db_count == DISPLAY_DB_MAX_ENTRIES) return NULL;
+    db_entry *e = &db_entries[db_count++];
+    memset(e, 0, sizeof(*e));
+    strcpy(e->identity, identity);
+    return e;
+}
+
+/* Set a field; returns 1 if that changed anything. Under db_lock. */
+static int set_field(db_entry *e, const char *key, const char *value) {
+    for (int i = 0; i < e->nfields; i++) {
+        if (strcmp(e->fields[i].key, key) != 0) continue;
+        if (strcmp(e->fields[i].value, value) == 0) return 0;
+        strcpy(e->fields[i].value, value);
+        return 1;
+    }
+    if (e->nfields == DISPLAY_DB_MAX_KEYS) return 0;
+    db_field *f = &e->fields[e->nfields++];
+    strcpy(f->key, key);
+    strcpy(f->value, value);
+    return 1;
+}
+
+/* Split off the next whitespace-separated word of *s, in place. */
+static char *next_word(char **s) {
+    char *p = *s;
+    while (*p && isspace((unsigned char)*p)) p++;
+    if (!*p) return NULL;
+    char *w = p;
+    while (*p && !isspace((unsigned char)*p)) p++;
+    if (*p) *p++ = '\0';
+    *s = p;
+    return w;
+}
+
+/* One line of the file: "<identity> <key>=<value> ...". Under db_lock. */
+static void load_line(char *line) {
+    char *id = next_word(&line);
+    if (!id || id[0] == '#') return;
+    db_entry *e = find_entry(id, 1);
+    if (!e) return;
+    for (char *w; (w = next_word(&line)) != NULL; ) {
+        char *eq = strchr(w, '=');
+        if (!eq) continue;
+        *eq = '\0';
+        if (is_key(w) && is_word(eq + 1, DISPLAY_DB_VALUE_MAX)) set_field(e, w, eq + 1);
+    }
+}
+
+int display_db_open(const char *path) {
+    pthread_mutex_lock(&db_lock);
+    free(db_path);
+    db_path = (path && *path) ? strdup(path) : NULL;
+    db_count = 0;
+    db_dirty = 0;
+    int rc = 0;
+    FILE *f = db_path ? fopen(db_path, "r") : NULL;
+    if (f) {
+        char *line = (char*)malloc(DISPLAY_DB_LINE_MAX);
+        if (line) {
+            while (fgets(line, DISPLAY_DB_LINE_MAX, f)) load_line(line);
+            free(line);
+        }
+        if (ferror(f) || !line) {
+            db_count = 0;
+            rc = -1;
+        }
+        fclose(f);
+    }
+    pthread_mutex_unlock(&db_lock);
+    return rc;
+}
+
+int display_db_get(const char *identity, const char *key, char *value, size_t len) {
+    if (!identity || !key || !value || len == 0) return 0;
+    int found = 0;
+    pthread_mutex_lock(&db_lock);
+    db_entry *e = find_entry(identity, 0);
+    for (int i = 0; e && i < e->nfields && !found; i++) {
+        if (strcmp(e->fields[i].key, key) != 0) continue;
+        snprintf(value, len, "%s", e->fields[i].value);
+        found = 1;
+    }
+    pthread_mutex_unlock(&db_lock);
+    return found;
+}
+
+int display_db_get_long(const char *identity, const char *key, long *value) {
+    char buf[DISPLAY_DB_VALUE_MAX], *end;
+    if (!value || !display_db_get(identity, key, buf, sizeof(buf))) return 0;
+    long v = strtol(buf, &end, 10);
+    if (*end) return 0;
+    *value = v;
+    return 1;
+}
+
+void display_db_set(const char *identity, const char *key, const char *value) {
+    if (!identity || !is_key(key) || !is_word(value, DISPLAY_DB_VALUE_MAX)) return;
+    pthread_mutex_lock(&db_lock);
+    db_entry *e = find_entry(identity, 1);
+    if (e && set_field(e, key, value)) db_dirty = 1;
+    pthread_mutex_unlock(&db_lock);
+}
+
+void display_db_set_long(const char *identity, const char *key, long value) {
+    char buf[24];
+    snprintf(buf, sizeof(buf), "%ld", value);
+    display_db_set(identity, key, buf);
+}
+
+/* Write `count` entries to `f`, and close it. */
+static int write_entries(FILE *f, const db_entry *entries, int count) {
+    fprintf(f, "%s\n", DISPLAY_DB_HEADER);
+    for (int i = 0; i < count; i++) {
+        const db_entry *e = &entries[i];
+        fputs(e->identity, f);
+        for (int k = 0; k < e->nfields; k++)
+            fprintf(f, " %s=%s", e->fields[k].key, e->fields[k].value);
+        fputc('\n', f);
+    }
+    int rc = ferror(f) ? -1 : 0;
+    if (fclose(f) != 0) rc = -1;
+    return rc;
+}
+
+#ifndef _WIN32
+/* Create the directory `path` is in, if it's missing (one level: the state
+ * directory itself, under a system directory that exists). */
+static void make_parent(const char *path) {
+    char *dir = strdup(path);
+    char *slash = dir ? strrchr(dir, '/') : NULL;
+    if (slash && slash != dir) {
+        *slash = '\0';
+        mkdir(dir, 0755);
+    }
+    free(dir);
+}
+#endif
+
+/* Write the database to a new file beside `path` and rename it into place, so
+ * a crash mid-write (or a reader at the wrong moment) sees the old file or the
+ * new, never half of one. The new file gets a name no one can guess and is
+ * created exclusively (mkstemp): dimmitd runs as root, and a fixed name could
+ * be planted as a symlink to make it overwrite any file. */
+static int write_file(const char *path, const db_entry *entries, int count) {
+    size_t n = strlen(path) + sizeof(".XXXXXX");
+    char *tmp = (char*)malloc(n);
+    if (!tmp) return -1;
+    int rc = -1;
+#ifdef _WIN32
+    snprintf(tmp, n, "%s.tmp", path);
+    FILE *f = fopen(tmp, "w");
+    if (f) {
+        rc = write_entries(f, entries, count);
+        if (rc == 0) remove(path);   /* rename() won't replace a file here */
+        if (rc == 0 && rename(tmp, path) != 0) rc = -1;
+        if (rc != 0) remove(tmp);
+    }
+#else
+    snprintf(tmp, n, "%s.XXXXXX", path);
+    int fd = mkstemp(tmp);
+    if (fd < 0 && errno == ENOENT) {
+        make_parent(path);
+        snprintf(tmp, n, "%s.XXXXXX", path);
+        fd = mkstemp(tmp);
+    }
+    if (fd >= 0) {
+        FILE *f = fdopen(fd, "w");
+        if (!f) {
+            close(fd);
+        } else {
+            rc = write_entries(f, entries, count);
+            if (rc == 0 && rename(tmp, path) != 0) rc = -1;
+        }
+        if (rc != 0) unlink(tmp);
+    }
+#endif
+    free(tmp);
+    return rc;
+}
+
+/* The file is written from a copy taken under db_lock, not under it: a set
+ * (every brightness write makes some) never waits on the disk. */
+int display_db_flush(void) {
+    pthread_mutex_lock(&flush_lock);
+    pthread_mutex_lock(&db_lock);
+    int rc = 0, count = db_count;
+    char *path = NULL;
+    db_entry *copy = NULL;
+    if (db_dirty && db_path) {
+        path = strdup(db_path);
+        copy = count ? (db_entry*)malloc((size_t)count * sizeof(*copy)) : NULL;
+        if (!path || (count && !copy)) {
+            rc = -1;
+        } else {
+            if (count) memcpy(copy, db_entries, (size_t)count * sizeof(*copy));
+            db_dirty = 0;   /* sets from here on dirty it again */
+        }
+    }
+    pthread_mutex_unlock(&db_lock);
+
+    if (rc == 0 && path && write_file(path, copy, count) != 0) {
+        rc = -1;
+        pthread_mutex_lock(&db_lock);
+        db_dirty = 1;   /* try again next time */
+        pthread_mutex_unlock(&db_lock);
+    }
+    free(copy);
+    free(path);
+    pthread_mutex_unlock(&flush_lock);
+    return rc;
+}
+
+void display_db_close(void) {
+    display_db_flush();
+    pthread_mutex_lock(&db_lock);
+    free(db_path);
+    db_path = NULL;
+    free(db_entries);
+    db_entries = NULL;
+    db_count = 0;
+    db_dirty = 0;
+    pthread_mutex_unlock(&db_lock);
+}
+
+int display_db_identity(char *out, size_t len, const char *maker, const char *model,
+                        const char *serial) {
+    if (!out || len == 0) return -1;
+    const char *parts[3] = { maker ? maker : "", model ? model : "", serial ? serial : "" };
+    /* No serial, no identity: two of the same model would share one record. */
+    const char *sn = parts[2] + strspn(parts[2], " ");
+    if (!sn[0] || strspn(sn, "0 ") == strlen(sn)) {
+        out[0] = '\0';
+        return -1;
+    }
+    snprintf(out, len, "%s:%s:%s", parts[0], parts[1], parts[2]);
+    for (char *p = out; *p; p++)
+        if (!isgraph((unsigned char)*p)) *p = '_';
+    return 0;
+}
+
+/* The text of the EDID display descriptor tagged `tag` (0xFC name, 0xFF
+ * serial), up to its newline; "" if there's none. */
+static void edid_text(const unsigned char *edid, unsigned char tag, char out[14]) {
+    out[0] = '\0';
+    for (int d = 54; d <= 108; d += 18) {
+        const unsigned char *p = edid + d;
+        if (p[0] || p[1] || p[2] || p[3] != tag) continue;
+        int n = 0;
+        while (n < 13 && p[5 + n] != 0x0A) { out[n] = (char)p[5 + n]; n++; }
+        while (n > 0 && out[n - 1] == ' ') n--;   /* padding, where the newline is missing */
+        out[n] = '\0';
+        return;
+    }
+}
+
+int display_db_identity_from_edid(char *out, size_t len, const unsigned char *edid,
+                                  size_t edid_len) {
+    static const unsigned char header[8] = { 0x00, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x00 };
+    if (!out || len == 0) return -1;
+    out[0] = '\0';
+    if (!edid || edid_len < 128 || memcmp(edid, header, sizeof(header)) != 0) return -1;
+    char maker[4], model[14], serial[14];
+    maker[0] = (char)('A' - 1 + ((edid[8] >> 2) & 0x1F));
+    maker[1] = (char)('A' - 1 + (((edid[8] & 0x03) << 3) | (edid[9] >> 5)));
+    maker[2] = (char)('A' - 1 + (edid[9] & 0x1F));
+    maker[3] = '\0';
+    edid_text(edid, 0xFC, model);
+    edid_text(edid, 0xFF, serial);
+    unsigned long sn = (unsigned long)edid[12] | (unsigned long)edid[13] << 8 |
+                       (unsigned long)edid[14] << 16 | (unsigned long)edid[15] << 24;
+    if (!serial[0] && sn) snprintf(serial, sizeof(serial), "%lu", sn);
+    return display_db_identity(out, len, maker, model, serial);
+}
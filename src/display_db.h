@@ -0,0 +1,64 @@
+#ifndef DISPLAY_DB_H
+#define DISPLAY_DB_H
+
+#include <stddef.h>
+
+/* What dimmitd has learned about each monitor, kept across restarts: a small
+ * text file with one line per monitor,
+ *
+ *     <identity> <key>=<value> <key>=<value> ...
+ *
+ * keyed by a stable identity built from the monitor itself (its EDID maker,
+ * model and serial; see display_db_identity), not from where it happens to be
+ * plugged in. Identities, keys and values are single words. Whoever learns a
+ * value sets it; the file is rewritten (to a temporary file, then renamed into
+ * place) only by display_db_flush(), and only if something changed.
+ *
+ * One database per process. Every function may be called from any thread. */
+
+/* Most monitors remembered, and most keys per monitor; past these, sets are
+ * dropped. */
+#define DISPLAY_DB_MAX_ENTRIES 64
+#define DISPLAY_DB_MAX_KEYS    16
+#define DISPLAY_DB_ID_MAX      96
+#define DISPLAY_DB_VALUE_MAX   64
+
+/* Load `path` (a missing file is an empty database). NULL or "" keeps the
+ * database in memory only. Returns 0, or -1 if the file exists but can't be
+ * read (the database is then empty, and flushes still try to write it). Lines
+ * that don't parse are skipped. */
+int  display_db_open(const char *path);
+
+/* Look up `key` for `identity`. Returns 1 and copies the value, or 0. */
+int  display_db_get(const char *identity, const char *key, char *value, size_t len);
+int  display_db_get_long(const char *identity, const char *key, long *value);
+
+/* Set `key` for `identity` (in memory; see display_db_flush). A value with
+ * whitespace in it is refused. */
+void display_db_set(const char *identity, const char *key, const char *value);
+void display_db_set_long(const char *identity, const char *key, long value);
+
+/* Write the database out if anything changed since the last flush. Returns 0,
+ * or -1 if it couldn't be written (it stays dirty, to be tried again). The
+ * file is written from a copy, so gets and sets meanwhile don't wait on it. */
+int  display_db_flush(void);
+
+/* Flush, then forget everything. */
+void display_db_close(void);
+
+/* Build an identity from a monitor's maker, model and serial (maker and model
+ * may be NULL or empty): joined with ':', with whitespace and anything
+ * unprintable turned into '_'. Returns 0, or -1 (and "") if the serial is
+ * missing, blank or zero -- two of the same model would then be one identity,
+ * so such a monitor goes without, as if anonymous. */
+int  display_db_identity(char *out, size_t len, const char *maker, const char *model,
+                         const char *serial);
+
+/* The same, from a raw EDID (at least its 128-byte base block): the maker's
+ * three letters, the name and serial text descriptors (as libddcutil reports
+ * them, so every provider agrees), or the numeric serial if there's no text
+ * one. Returns -1 (and "") if `edid` isn't one. */
+int  display_db_identity_from_edid(char *out, size_t len, const unsigned char *edid,
+                                   size_t edid_len);
+
+#endif /* DISPLAY_DB_H */
@@ -0,0 +1,33 @@
+#ifndef DIMMIT_PLATFORM_BACKLIGHT_H
+#define DIMMIT_PLATFORM_BACKLIGHT_H
+
+#include "brightness.h"   /* brightness_source */
+
+/* The OS's own backlight devices as brightness sources, next to DDC: on Linux,
+ * /sys/class/backlight, which covers internal panels and monitors driven by the
+ * ddcci kernel driver. A step there is a write to an already-open file rather
+ * than a DDC/CI exchange. Backends without such a class enumerate nothing.
+ *
+ * Same contract as ddc_enumerate_sources(): displays already in `known` are
+ * kept, not reopened, and when the devices listed are exactly the known ones,
+ * *changed is 0 and nothing is returned. Ids start with "backlight:". */
+int  backlight_enumerate_sources(const brightness_source *known, int known_count,
+                                 brightness_source **out, int *count, int *changed);
+
+/* A device that can't be opened is passed over until BACKLIGHT_RETRY_MS later,
+ * then tried again, the wait doubling with each further failure up to
+ * BACKLIGHT_RETRY_MAX_MS -- as DDC probes are (platform/ddc/abstraction.h).
+ * backlight_retry_due() says whether any such retry has come due;
+ * backlight_set_retry_base() changes the first wait (tests shorten it; <= 0
+ * restores the default). Call both from the enumerating thread. */
+#define BACKLIGHT_RETRY_MS 2000
+#define BACKLIGHT_RETRY_MAX_MS 64000
+int  backlight_retry_due(void);
+void backlight_set_retry_base(int ms);
+
+/* Where sysfs is (default "/sys"). Tests point this at a fake tree; "" turns
+ * the provider off (as the tests and the benchmark do, so a laptop's real panel
+ * stays out of them). A no-op on backends without sysfs. */
+void backlight_set_sysfs_root(const char *root);
+
+#endif /* DIMMIT_PLATFORM_BACKLIGHT_H */
@@ -0,0 +1,303 @@
+/* Linux backlight provider: /sys/class/backlight/<name>, which covers internal
+ * panels (intel_backlight, amdgpu_bl0, ...) and monitors driven by the ddcci
+ * kernel driver (ddcci<N>). Each device's brightness file is opened once, when
+ * the device is found, and kept open: a step is one pwrite() of the new value
+ * and a read one pread(), with no path lookup and no DDC/CI exchange. A device
+ * the daemon can't open for writing (permissions, a read-only driver, one not
+ * set up yet) is passed over, and retried after a backoff. */
+#define _GNU_SOURCE   /* O_CLOEXEC, pread/pwrite, realpath */
+#include "platform/backlight/backlight.h"
+#include "display_db.h"
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BACKLIGHT_MAX_DEVICES 16
+
+/* Device names longer than this are passed over, so "backlight:<name>" always
+ * fits a source id (brightness_source.id, 64 bytes) and "backlight <name>" its
+ * label. */
+#define BACKLIGHT_NAME_MAX (64 - (int)sizeof "backlight:")
+
+typedef struct {
+    int fd;       /* <device>/brightness, O_RDWR */
+    int max;      /* <device>/max_brightness, read once: it doesn't change */
+} backlight_ctx;
+
+static char g_root[PATH_MAX] = "/sys";
+
+void backlight_set_sysfs_root(const char *root) {
+    snprintf(g_root, sizeof(g_root), "%s", root ? root : "/sys");
+}
+
+/* Format a path into `path` (PATH_MAX); 0 if it fit. */
+static int make_path(char *path, const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(path, PATH_MAX, fmt, ap);
+    va_end(ap);
+    return n >= 0 && n < PATH_MAX ? 0 : -1;
+}
+
+/* Parse the integer a sysfs attribute holds. */
+static int parse_int(const char *buf, int *value) {
+    char *end;
+    long v = strtol(buf, &end, 10);
+    if (end == buf || v < 0 || v > INT_MAX) return -1;
+    *value = (int)v;
+    return 0;
+}
+
+static int pread_int(int fd, int *value) {
+    char buf[32];
+    ssize_t n = pread(fd, buf, sizeof(buf) - 1, 0);
+    if (n <= 0) return -1;
+    buf[n] = '\0';
+    return parse_int(buf, value);
+}
+
+static int read_int_file(const char *path, int *value) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return -1;
+    int rc = pread_int(fd, value);
+    close(fd);
+    return rc;
+}
+
+static int bl_get(void *ctx, int *current, int *max) {
+    backlight_ctx *b = (backlight_ctx*)ctx;
+    if (pread_int(b->fd, current) != 0) return -1;
+    *max = b->max;
+    return 0;
+}
+
+static int bl_set(void *ctx, int value) {
+    backlight_ctx *b = (backlight_ctx*)ctx;
+    char buf[16];
+    int n = snprintf(buf, sizeof(buf), "%d\n", value);
+    return pwrite(b->fd, buf, (size_t)n, 0) == n ? 0 : -1;
+}
+
+static void bl_close(void *ctx) {
+    backlight_ctx *b = (backlight_ctx*)ctx;
+    close(b->fd);
+    free(b);
+}
+
+static const brightness_ops BACKLIGHT_OPS = { bl_get, bl_set, bl_close, NULL, NULL };   /* brightness only */
+
+/* The identity in the EDID file at `path`; 0 if there was one. */
+static int edid_file_identity(const char *path, char *out, size_t len) {
+    unsigned char edid[256];
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return -1;
+    ssize_t n = pread(fd, edid, sizeof(edid), 0);
+    close(fd);
+    return n > 0 ? display_db_identity_from_edid(out, len, edid, (size_t)n) : -1;
+}
+
+/* The monitor behind backlight device `name`, by its EDID (see display_db.h),
+ * so it's remembered like any other display -- and so the DDC provider can
+ * leave a ddcci-driven monitor to us. An internal panel's device is its DRM
+ * connector, which has the EDID; a ddcci-driven monitor's sits on an I2C bus,
+ * whose connector is the one whose `ddc` link points at that bus. "" if
+ * neither gives one. */
+static void device_identity(const char *name, char *out, size_t len) {
+    char path[PATH_MAX], dev[PATH_MAX], link[PATH_MAX];
+    out[0] = '\0';
+    if (make_path(path, "%s/class/backlight/%s/device", g_root, name) != 0 ||
+        !realpath(path, dev)) return;
+    if (make_path(path, "%s/edid", dev) == 0 && edid_file_identity(path, out, len) == 0) return;
+
+    /* The last i2c-<n> in the device's path is its bus. */
+    const char *bus = NULL;
+    for (const char *p = strstr(dev, "/i2c-"); p; p = strstr(p + 1, "/i2c-"))
+        if (p[5] >= '0' && p[5] <= '9') bus = p + 1;
+    if (!bus) return;
+    size_t bus_len = strcspn(bus, "/");
+
+    DIR *drm = make_path(path, "%s/class/drm", g_root) == 0 ? opendir(path) : NULL;
+    if (!drm) return;
+    for (struct dirent *e; (e = readdir(drm)) != NULL; ) {
+        if (e->d_name[0] == '.') continue;
+        if (make_path(path, "%s/class/drm/%s/ddc", g_root, e->d_name) != 0 ||
+            !realpath(path, link)) continue;
+        const char *base = strrchr(link, '/');
+        if (!base || strlen(base + 1) != bus_len || strncmp(base + 1, bus, bus_len) != 0) continue;
+        if (make_path(path, "%s/class/drm/%s/edid", g_root, e->d_name) == 0 &&
+            edid_file_identity(path, out, len) == 0) break;
+    }
+    closedir(drm);
+}
+
+/* Devices that couldn't be opened, so the idle reconcile doesn't retry them
+ * every tick. A device the driver isn't done setting up at boot (amdgpu and
+ * nouveau are often late) opens fine a moment later, though, so each is retried
+ * once its backoff runs out, as the DDC provider's rejects are; and all are
+ * forgotten when the set listed changes. */
+typedef struct {
+    char id[64];
+    long long retry_at_us;     /* try to open it again from then on */
+    int tries;                 /* failed opens so far */
+} backlight_reject;
+static backlight_reject g_rejected[BACKLIGHT_MAX_DEVICES];
+static int g_rejected_n = 0;
+static uint32_t g_listed_hash = 0;
+static int g_retry_ms = BACKLIGHT_RETRY_MS;
+
+void backlight_set_retry_base(int ms) {
+    g_retry_ms = ms > 0 ? ms : BACKLIGHT_RETRY_MS;
+}
+
+static long long monotonic_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+static backlight_reject *find_rejected(const char *id) {
+    for (int i = 0; i < g_rejected_n; i++)
+        if (strcmp(g_rejected[i].id, id) == 0) return &g_rejected[i];
+    return NULL;
+}
+
+/* Rejected, and not yet due for another try? */
+static int is_rejected(const char *id, long long now_us) {
+    const backlight_reject *r = find_rejected(id);
+    return r && now_us < r->retry_at_us;
+}
+
+static void reject(const char *id, long long now_us) {
+    backlight_reject *r = find_rejected(id);
+    if (!r) {
+        if (g_rejected_n == BACKLIGHT_MAX_DEVICES) return;
+        r = &g_rejected[g_rejected_n++];
+        snprintf(r->id, sizeof(r->id), "%s", id);
+        r->tries = 0;
+    }
+    long long ms = g_retry_ms;
+    for (int i = 0; i < r->tries && ms < BACKLIGHT_RETRY_MAX_MS; i++) ms *= 2;
+    if (ms > BACKLIGHT_RETRY_MAX_MS) ms = BACKLIGHT_RETRY_MAX_MS;
+    r->tries++;
+    r->retry_at_us = now_us + ms * 1000;
+}
+
+static void forget_rejected(const char *id) {
+    backlight_reject *r = find_rejected(id);
+    if (r) *r = g_rejected[--g_rejected_n];
+}
+
+int backlight_retry_due(void) {
+    long long now = monotonic_us();
+    for (int i = 0; i < g_rejected_n; i++)
+        if (now >= g_rejected[i].retry_at_us) return 1;
+    return 0;
+}
+
+static const brightness_source *find_known(const brightness_source *known, int n, const char *id) {
+    for (int i = 0; i < n; i++) if (strcmp(known[i].id, id) == 0) return &known[i];
+    return NULL;
+}
+
+static int cmp_name(const void *a, const void *b) {
+    return strcmp((const char*)a, (const char*)b);
+}
+
+/* Open device `name` as a source into *src; 0 on success. */
+static int open_device(const char *name, brightness_source *src) {
+    char path[PATH_MAX];
+    long long start = monotonic_us();
+    int max = 0, cur = 0;
+    if (make_path(path, "%s/class/backlight/%s/max_brightness", g_root, name) != 0 ||
+        read_int_file(path, &max) != 0 || max <= 0) return -1;
+    if (make_path(path, "%s/class/backlight/%s/brightness", g_root, name) != 0) return -1;
+    int fd = open(path, O_RDWR | O_CLOEXEC);
+    if (fd < 0) return -1;
+    backlight_ctx *b = (backlight_ctx*)malloc(sizeof(*b));
+    if (!b || pread_int(fd, &cur) != 0) {
+        free(b);
+        close(fd);
+        return -1;
+    }
+    b->fd = fd;
+    b->max = max;
+    src->ops = &BACKLIGHT_OPS;
+    src->ctx = b;
+    snprintf(src->label, sizeof(src->label), "backlight %.*s", BACKLIGHT_NAME_MAX, name);
+    device_identity(name, src->identity, sizeof(src->identity));
+    src->open_us = monotonic_us() - start;
+    return 0;
+}
+
+int backlight_enumerate_sources(const brightness_source *known, int known_count,
+                                brightness_source **out, int *count, int *changed) {
+    *out = NULL; *count = 0; *changed = known_count > 0;
+    if (!g_root[0]) return 0;
+
+    /* In name order, so a device keeps its place across enumerations. */
+    char names[BACKLIGHT_MAX_DEVICES][BACKLIGHT_NAME_MAX + 1];
+    int listed = 0;
+    char dir[PATH_MAX];
+    DIR *d = make_path(dir, "%s/class/backlight", g_root) == 0 ? opendir(dir) : NULL;
+    if (!d) return 0;
+    for (struct dirent *e; (e = readdir(d)) != NULL && listed < BACKLIGHT_MAX_DEVICES; ) {
+        size_t len = strlen(e->d_name);
+        if (e->d_name[0] == '.' || len >= sizeof(names[0])) continue;
+        memcpy(names[listed++], e->d_name, len + 1);
+    }
+    closedir(d);
+    qsort(names, (size_t)listed, sizeof(names[0]), cmp_name);
+
+    /* Cheap pass, as the DDC provider's: nothing new (but rejects not yet due a
+     * retry) and nothing gone is no change at all. */
+    long long now = monotonic_us();
+    uint32_t hash = 2166136261u;
+    int matched = 0, unknown = 0;
+    for (int i = 0; i < listed; i++) {
+        char id[64];
+        snprintf(id, sizeof(id), "backlight:%.*s", BACKLIGHT_NAME_MAX, names[i]);
+        for (const char *p = id; *p; p++) hash = (hash ^ (uint8_t)*p) * 16777619u;
+        if (find_known(known, known_count, id)) matched++;
+        else unknown++;
+    }
+    if (hash != g_listed_hash) { g_listed_hash = hash; g_rejected_n = 0; }
+    for (int i = 0; i < listed; i++) {
+        char id[64];
+        snprintf(id, sizeof(id), "backlight:%.*s", BACKLIGHT_NAME_MAX, names[i]);
+        if (!find_known(known, known_count, id) && is_rejected(id, now)) unknown--;
+    }
+    if (unknown == 0 && matched == known_count) {
+        *changed = 0;
+        return 0;
+    }
+    *changed = 1;
+
+    brightness_source *arr = (brightness_source*)calloc((size_t)(listed ? listed : 1), sizeof(*arr));
+    if (!arr) return -1;
+    int n = 0;
+    for (int i = 0; i < listed; i++) {
+        char id[64];
+        snprintf(id, sizeof(id), "backlight:%.*s", BACKLIGHT_NAME_MAX, names[i]);
+        const brightness_source *k = find_known(known, known_count, id);
+        if (k) { arr[n++] = *k; continue; }
+        if (is_rejected(id, now)) continue;
+        if (open_device(names[i], &arr[n]) != 0) {
+            reject(id, monotonic_us());
+            memset(&arr[n], 0, sizeof(arr[n]));
+            continue;
+        }
+        forget_rejected(id);
+        snprintf(arr[n].id, sizeof(arr[n].id), "%s", id);
+        n++;
+    }
+    if (n == 0) { free(arr); return 0; }
+    *out = arr; *count = n;
+    return 0;
+}
@@ -0,0 +1,17 @@
+#include "platform/backlight/backlight.h"
+#include <stddef.h>
+
+/* No backlight class on Windows: DDC is the only provider. */
+int backlight_enumerate_sources(const brightness_source *known, int known_count,
+                                brightness_source **out, int *count, int *changed) {
+    (void)known;
+    *out = NULL;
+    *count = 0;
+    *changed = known_count > 0;
+    return 0;
+}
+
+void backlight_set_sysfs_root(const char *root) { (void)root; }
+
+int  backlight_retry_due(void) { return 0; }
+void backlight_set_retry_base(int ms) { (void)ms; }
@@ -4,14 +4,25 @@
 
 #include <sys/time.h>
 #include <errno.h>
+#include <mach/mach_time.h>
 
 /*
  * CLOCK_REALTIME via gettimeofday(): wall-clock seconds + microseconds, the
- * same quantity 10.12's clock_gettime(CLOCK_REALTIME) reports. dimmit uses no
- * other clock id; reject them rather than silently return wrong values. The
- * header renames callers' clock_gettime() to this symbol.
+ * same quantity 10.12's clock_gettime(CLOCK_REALTIME) reports. CLOCK_MONOTONIC
+ * (brightness ramps) via mach_absolute_time(), scaled by the timebase; it
+ * doesn't count sleep, which is all a ramp needs. dimmit uses no other clock
+ * id; reject them rather than silently return wrong values. The header renames
+ * callers' clock_gettime() to this symbol.
  */
 int dimmit_clock_gettime(clockid_t clk_id, struct timespec *ts) {
+    if (clk_id == CLOCK_MONOTONIC) {
+        static mach_timebase_info_data_t tb;
+        if (tb.denom == 0) mach_timebase_info(&tb);
+        uint64_t ns = mach_absolute_time() * tb.numer / tb.denom;
+        ts->tv_sec = (time_t)(ns / 1000000000u);
+        ts->tv_nsec = (long)(ns % 1000000000u);
+        return 0;
+    }
     if (clk_id != CLOCK_REALTIME) {
         errno = EINVAL;
         return -1;
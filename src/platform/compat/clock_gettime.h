@@ -17,9 +17,10 @@
  * clock_gettime is gated on the *SDK* version (__MPLS_SDK_SUPPORT_GETTIME__)
  * and so never activates on a newer-SDK build.
  *
- * We only ever use CLOCK_REALTIME, which is wall-clock time -- exactly what
+ * We use CLOCK_REALTIME, which is wall-clock time -- exactly what
  * gettimeofday() returns and what both libSystem and legacy-support report for
- * CLOCK_REALTIME -- so behaviour is identical for our use.
+ * CLOCK_REALTIME -- so behaviour is identical for our use; and CLOCK_MONOTONIC
+ * for brightness ramps, from mach_absolute_time().
  */
 #include <AvailabilityMacros.h>
 
@@ -31,6 +32,9 @@
 typedef int clockid_t;
 #define CLOCK_REALTIME 0
 #endif
+#ifndef CLOCK_MONOTONIC
+#define CLOCK_MONOTONIC 6   /* 10.12's value */
+#endif
 
 int dimmit_clock_gettime(clockid_t clk_id, struct timespec *ts);
 #define clock_gettime dimmit_clock_gettime
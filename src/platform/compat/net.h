@@ -5,7 +5,9 @@
  * Windows (10 1803+) supports AF_UNIX through Winsock with <afunix.h>, but the
  * socket is a SOCKET (unsigned) handle, needs WSAStartup, and closes with
  * closesocket(). recv()/send() are spelled directly at call sites -- they exist
- * on both platforms -- so this header only abstracts what actually differs. */
+ * on both platforms -- so this header only abstracts what actually differs.
+ * Readiness is poll() on POSIX and its Winsock twin WSAPoll() (Vista+), which
+ * takes the same struct pollfd. */
 
 #ifdef _WIN32
   #include <winsock2.h>
@@ -18,15 +20,37 @@
   }
   static inline void net_cleanup(void) { WSACleanup(); }
   static inline int  net_close(dimmit_sock_t s) { return closesocket(s); }
+  static inline int  net_set_nonblocking(dimmit_sock_t s) {
+      u_long on = 1;
+      return ioctlsocket(s, FIONBIO, &on) == 0 ? 0 : -1;
+  }
+  static inline int  net_poll(struct pollfd *fds, unsigned n, int timeout_ms) {
+      return WSAPoll(fds, (ULONG)n, timeout_ms);
+  }
+  /* The last socket call failed only because it would have blocked. */
+  static inline int  net_would_block(void) { return WSAGetLastError() == WSAEWOULDBLOCK; }
+  static inline int  net_interrupted(void) { return WSAGetLastError() == WSAEINTR; }
 #else
   #include <sys/socket.h>
   #include <sys/un.h>
   #include <unistd.h>
+  #include <fcntl.h>
+  #include <poll.h>
+  #include <errno.h>
   typedef int dimmit_sock_t;
   #define DIMMIT_BAD_SOCK (-1)
   static inline int  net_startup(void) { return 0; }
   static inline void net_cleanup(void) { }
   static inline int  net_close(dimmit_sock_t s) { return close(s); }
+  static inline int  net_set_nonblocking(dimmit_sock_t s) {
+      int flags = fcntl(s, F_GETFL, 0);
+      return (flags < 0 || fcntl(s, F_SETFL, flags | O_NONBLOCK) < 0) ? -1 : 0;
+  }
+  static inline int  net_poll(struct pollfd *fds, unsigned n, int timeout_ms) {
+      return poll(fds, (nfds_t)n, timeout_ms);
+  }
+  static inline int  net_would_block(void) { return errno == EAGAIN || errno == EWOULDBLOCK; }
+  static inline int  net_interrupted(void) { return errno == EINTR; }
 #endif
 
 #endif /* DIMMIT_PLATFORM_COMPAT_NET_H */
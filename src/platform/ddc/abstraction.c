@@ -1,57 +1,347 @@
+#define _POSIX_C_SOURCE 200809L   /* clock_gettime */
 #include "platform/ddc/abstraction.h"
 #include "platform/ddc/implementation.h"
+#include "display_db.h"
+#include <errno.h>
+#include <pthread.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
 
 /* ctx for a DDC-backed brightness source: the opened implementation handle. */
-static int ddc_src_get(void *ctx, int *current, int *max) {
+static int ddc_src_get_vcp(void *ctx, uint8_t code, int *current, int *max) {
     DDC_Display_Handle h = (DDC_Display_Handle)ctx;
     DDC_Non_Table_Vcp_Value v;
-    if (ddc_implementation_get_non_table_vcp_value(h, VCP_BRIGHTNESS, &v) != DDC_OK) return -1;
+    if (ddc_implementation_get_non_table_vcp_value(h, code, &v) != DDC_OK) return -1;
     *current = (v.sh << 8) | v.sl;
     *max     = (v.mh << 8) | v.ml;
     return 0;
 }
-static int ddc_src_set(void *ctx, int value) {
+static int ddc_src_set_vcp(void *ctx, uint8_t code, int value) {
     DDC_Display_Handle h = (DDC_Display_Handle)ctx;
     uint8_t hi = (uint8_t)((value >> 8) & 0xFF), lo = (uint8_t)(value & 0xFF);
-    return ddc_implementation_set_non_table_vcp_value(h, VCP_BRIGHTNESS, hi, lo) == DDC_OK ? 0 : -1;
+    return ddc_implementation_set_non_table_vcp_value(h, code, hi, lo) == DDC_OK ? 0 : -1;
+}
+static int ddc_src_get(void *ctx, int *current, int *max) {
+    return ddc_src_get_vcp(ctx, VCP_BRIGHTNESS, current, max);
+}
+static int ddc_src_set(void *ctx, int value) {
+    return ddc_src_set_vcp(ctx, VCP_BRIGHTNESS, value);
+}
+static const uint8_t FEATURE_VCP[BRIGHTNESS_FEATURES] = { [BRIGHTNESS_CONTRAST] = VCP_CONTRAST };
+static int ddc_src_get_feature(void *ctx, brightness_feature f, int *current, int *max) {
+    return ddc_src_get_vcp(ctx, FEATURE_VCP[f], current, max);
+}
+static int ddc_src_set_feature(void *ctx, brightness_feature f, int value) {
+    return ddc_src_set_vcp(ctx, FEATURE_VCP[f], value);
 }
 static void ddc_src_close(void *ctx) {
     ddc_implementation_close_display((DDC_Display_Handle)ctx);
 }
-static const brightness_ops DDC_OPS = { ddc_src_get, ddc_src_set, ddc_src_close };
+static const brightness_ops DDC_OPS = { ddc_src_get, ddc_src_set, ddc_src_close,
+                                         ddc_src_get_feature, ddc_src_set_feature };
+
+/* The reconcile key. Provisional: the list index makes it shift when an earlier
+ * display goes away, which reconcile then sees as a replug. */
+static void ddc_source_id(const DDC_Display_Info *info, int i, char *buf, size_t len) {
+    snprintf(buf, len, "ddc:%04x:%04x:%d", info->vendor_id, info->product_id, i);
+}
+
+static const brightness_source *find_known(const brightness_source *known, int n, const char *id) {
+    for (int i = 0; i < n; i++) if (strcmp(known[i].id, id) == 0) return &known[i];
+    return NULL;
+}
+
+/* Displays that failed the controllability probe, so the idle reconcile doesn't
+ * re-probe them every tick. A monitor that was asleep or slow to wake may well
+ * answer later, though, so each is retried once its backoff runs out
+ * (g_retry_ms, doubling on every further failure up to DDC_RETRY_MAX_MS); and
+ * all are forgotten whenever the set of ids the backend lists changes (a hotplug
+ * may have fixed them). Only touched from the enumerating thread (startup, then
+ * the reconciler). */
+#define DDC_MAX_REJECTED 16
+typedef struct {
+    char id[64];
+    long long retry_at_us;     /* probe it again from then on */
+    int tries;                 /* failed probes so far */
+} ddc_reject;
+static ddc_reject g_rejected[DDC_MAX_REJECTED];
+static int g_rejected_n = 0;
+static uint32_t g_listed_hash = 0;
+static int g_retry_ms = DDC_RETRY_MS;
+
+void ddc_set_retry_base(int ms) {
+    g_retry_ms = ms > 0 ? ms : DDC_RETRY_MS;
+}
+
+static long long monotonic_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+static ddc_reject *find_rejected(const char *id) {
+    for (int i = 0; i < g_rejected_n; i++)
+        if (strcmp(g_rejected[i].id, id) == 0) return &g_rejected[i];
+    return NULL;
+}
+
+/* Rejected, and not yet due for another try? */
+static int is_rejected(const char *id, long long now_us) {
+    const ddc_reject *r = find_rejected(id);
+    return r && now_us < r->retry_at_us;
+}
+
+static void reject(const char *id, long long now_us) {
+    ddc_reject *r = find_rejected(id);
+    if (!r) {
+        if (g_rejected_n == DDC_MAX_REJECTED) return;
+        r = &g_rejected[g_rejected_n++];
+        snprintf(r->id, sizeof(r->id), "%s", id);
+        r->tries = 0;
+    }
+    long long ms = g_retry_ms;
+    for (int i = 0; i < r->tries && ms < DDC_RETRY_MAX_MS; i++) ms *= 2;
+    if (ms > DDC_RETRY_MAX_MS) ms = DDC_RETRY_MAX_MS;
+    r->tries++;
+    r->retry_at_us = now_us + ms * 1000;
+}
+
+static void forget_rejected(const char *id) {
+    ddc_reject *r = find_rejected(id);
+    if (r) *r = g_rejected[--g_rejected_n];
+}
+
+int ddc_retry_due(void) {
+    long long now = monotonic_us();
+    for (int i = 0; i < g_rejected_n; i++)
+        if (now >= g_rejected[i].retry_at_us) return 1;
+    return 0;
+}
+
+/* Probing. Each display sits on its own bus, so every new display is opened
+ * and probed on a thread of its own and enumeration costs about the slowest
+ * probe rather than the sum -- but no more than g_probe_deadline_ms: a probe
+ * still running then is given up on (the display counts as rejected), so one
+ * wedged monitor can't hold up the rest. Its thread finishes on its own and
+ * closes what it opened; the batch, and the display list its refs point into,
+ * are freed by whichever of it and the enumerator lets go last. */
+static int g_probe_deadline_ms = DDC_PROBE_DEADLINE_MS;
+
+void ddc_set_probe_deadline(int ms) {
+    g_probe_deadline_ms = ms > 0 ? ms : DDC_PROBE_DEADLINE_MS;
+}
+
+typedef struct probe_batch probe_batch;
+
+typedef struct {
+    probe_batch *batch;
+    int index;                 /* into batch->dlist */
+    int run;                   /* new: open and probe it */
+    DDC_Display_Handle h;      /* the result, once done: open and controllable, or NULL */
+    long long took_us;         /* ... and how long it took */
+} probe_job;
+
+struct probe_batch {
+    pthread_mutex_t lock;
+    pthread_cond_t done;
+    int pending;               /* jobs started and not finished */
+    int refs;                  /* the enumerator, plus every job not finished */
+    int abandoned;             /* the enumerator stopped waiting */
+    DDC_Display_Info_List *dlist;
+    probe_job *jobs;           /* one per dlist entry */
+};
+
+static probe_batch *probe_batch_new(DDC_Display_Info_List *dlist) {
+    probe_batch *b = (probe_batch*)calloc(1, sizeof(*b));
+    if (!b) return NULL;
+    b->jobs = (probe_job*)calloc((size_t)(dlist->ct ? dlist->ct : 1), sizeof(probe_job));
+    if (!b->jobs) { free(b); return NULL; }
+    for (int i = 0; i < dlist->ct; i++) {
+        b->jobs[i].batch = b;
+        b->jobs[i].index = i;
+    }
+    pthread_mutex_init(&b->lock, NULL);
+    pthread_cond_init(&b->done, NULL);
+    b->refs = 1;
+    b->dlist = dlist;
+    return b;
+}
+
+/* Drop one reference (under b->lock); the last frees the batch and the list. */
+static void probe_batch_unref_locked(probe_batch *b) {
+    int last = --b->refs == 0;
+    pthread_mutex_unlock(&b->lock);
+    if (!last) return;
+    ddc_implementation_free_display_info_list(b->dlist);
+    pthread_cond_destroy(&b->done);
+    pthread_mutex_destroy(&b->lock);
+    free(b->jobs);
+    free(b);
+}
+
+static void probe_batch_release(probe_batch *b) {
+    pthread_mutex_lock(&b->lock);
+    probe_batch_unref_locked(b);
+}
+
+static void *probe_run(void *arg) {
+    probe_job *job = (probe_job*)arg;
+    probe_batch *b = job->batch;
+    const DDC_Display_Info *info = &b->dlist->info[job->index];
+    long long start = monotonic_us();
+    DDC_Display_Handle h = NULL;
+    if (ddc_implementation_open_display(info->dref, 0, &h) != DDC_OK) h = NULL;
 
-int ddc_enumerate_sources(brightness_source **out, int *count) {
-    *out = NULL; *count = 0;
+    /* Controllability rule: keep only displays that answer an initial read --
+     * or that have before, by the display database, in which case the read
+     * is left to the controller (controller_verify), off the startup path. */
+    long controllable = 0;
+    if (h && (!info->identity[0] || !display_db_get_long(info->identity, "controllable", &controllable) ||
+              controllable != 1)) {
+        DDC_Non_Table_Vcp_Value probe;
+        if (ddc_implementation_get_non_table_vcp_value(h, VCP_BRIGHTNESS, &probe) != DDC_OK) {
+            ddc_implementation_close_display(h);
+            h = NULL;
+        } else if (info->identity[0]) {
+            display_db_set_long(info->identity, "controllable", 1);
+        }
+    }
+
+    pthread_mutex_lock(&b->lock);
+    if (b->abandoned) {
+        if (h) ddc_implementation_close_display(h);   /* too late: nobody will take it */
+    } else {
+        job->h = h;
+        job->took_us = monotonic_us() - start;
+    }
+    b->pending--;
+    pthread_cond_signal(&b->done);
+    probe_batch_unref_locked(b);
+    return NULL;
+}
+
+/* Run every job marked `run`, and wait for them until the deadline. */
+static void probe_all(probe_batch *b) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += g_probe_deadline_ms / 1000;
+    deadline.tv_nsec += (long)(g_probe_deadline_ms % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    for (int i = 0; i < b->dlist->ct; i++) {
+        if (!b->jobs[i].run) continue;
+        pthread_mutex_lock(&b->lock);
+        b->pending++;
+        b->refs++;
+        pthread_mutex_unlock(&b->lock);
+        pthread_t t;
+        if (pthread_create(&t, NULL, probe_run, &b->jobs[i]) == 0) pthread_detach(t);
+        else probe_run(&b->jobs[i]);   /* no thread to be had: probe it here */
+    }
+
+    pthread_mutex_lock(&b->lock);
+    while (b->pending > 0)
+        if (pthread_cond_timedwait(&b->done, &b->lock, &deadline) == ETIMEDOUT) break;
+    b->abandoned = 1;
+    pthread_mutex_unlock(&b->lock);
+}
+
+/* Is list entry `info` one to pass over: the internal panel (the OS owns it), or
+ * a monitor another provider already drives (same identity as a `claimed`
+ * source)? Passed over entries are treated as if not listed at all. */
+static int passed_over(const DDC_Display_Info *info, const brightness_source *claimed,
+                       int claimed_count) {
+    if (info->is_builtin) return 1;
+    if (!info->identity[0]) return 0;
+    for (int i = 0; i < claimed_count; i++)
+        if (strcmp(claimed[i].identity, info->identity) == 0) return 1;
+    return 0;
+}
+
+int ddc_enumerate_sources(const brightness_source *known, int known_count,
+                          const brightness_source *claimed, int claimed_count,
+                          brightness_source **out, int *count, int *changed) {
+    *out = NULL; *count = 0; *changed = known_count > 0;
     DDC_Display_Info_List *dlist = NULL;
     if (ddc_implementation_get_display_info_list(0, &dlist) != DDC_OK || !dlist) return 0;
 
-    brightness_source *arr = (brightness_source*)calloc((size_t)dlist->ct, sizeof(*arr));
+    /* Cheap pass: ids only, no probes. (The listing itself is the backend's and
+     * may touch the bus -- libddcutil's detection, the i2c backend's EDID reads.)
+     * If every candidate is known (or a reject not yet due a retry) and every
+     * known display is still listed, nothing changed. */
+    long long now = monotonic_us();
+    uint32_t hash = 2166136261u;   /* FNV-1a over the listed ids */
+    int candidates = 0, matched = 0, unknown = 0;
+    for (int i = 0; i < dlist->ct; i++) {
+        if (passed_over(&dlist->info[i], claimed, claimed_count)) continue;
+        char id[64];
+        ddc_source_id(&dlist->info[i], i, id, sizeof(id));
+        for (const char *p = id; *p; p++) hash = (hash ^ (uint8_t)*p) * 16777619u;
+        candidates++;
+        if (find_known(known, known_count, id)) matched++;
+        else unknown++;
+    }
+    if (hash != g_listed_hash) { g_listed_hash = hash; g_rejected_n = 0; }
+    for (int i = 0; i < dlist->ct && unknown > 0; i++) {
+        char id[64];
+        ddc_source_id(&dlist->info[i], i, id, sizeof(id));
+        if (!passed_over(&dlist->info[i], claimed, claimed_count) &&
+            !find_known(known, known_count, id) && is_rejected(id, now))
+            unknown--;
+    }
+    if (unknown == 0 && matched == known_count) {
+        ddc_implementation_free_display_info_list(dlist);
+        *changed = 0;
+        return 0;
+    }
+    *changed = 1;
+
+    brightness_source *arr = (brightness_source*)calloc((size_t)(candidates ? candidates : 1), sizeof(*arr));
     if (!arr) { ddc_implementation_free_display_info_list(dlist); return -1; }
 
+    /* Open and probe every new display at once, then take them in list order. */
+    probe_batch *b = probe_batch_new(dlist);
+    if (!b) { free(arr); ddc_implementation_free_display_info_list(dlist); return -1; }
+    for (int i = 0; i < dlist->ct; i++) {
+        if (passed_over(&dlist->info[i], claimed, claimed_count)) continue;
+        char id[64];
+        ddc_source_id(&dlist->info[i], i, id, sizeof(id));
+        b->jobs[i].run = !find_known(known, known_count, id) && !is_rejected(id, now);
+    }
+    probe_all(b);
+
     int n = 0;
     for (int i = 0; i < dlist->ct; i++) {
-        if (dlist->info[i].is_builtin) continue;   /* OS owns the internal panel */
-        DDC_Display_Handle h = NULL;
-        if (ddc_implementation_open_display(dlist->info[i].dref, 0, &h) != DDC_OK) continue;
+        if (passed_over(&dlist->info[i], claimed, claimed_count)) continue;
+        char id[64];
+        ddc_source_id(&dlist->info[i], i, id, sizeof(id));
 
-        /* Controllability rule: keep only displays that answer an initial read. */
-        DDC_Non_Table_Vcp_Value probe;
-        if (ddc_implementation_get_non_table_vcp_value(h, VCP_BRIGHTNESS, &probe) != DDC_OK) {
-            ddc_implementation_close_display(h);
+        /* Already open: keep the caller's handle rather than reopen + reprobe. */
+        const brightness_source *k = find_known(known, known_count, id);
+        if (k) { arr[n++] = *k; continue; }
+        if (!b->jobs[i].run) continue;   /* a known reject */
+
+        DDC_Display_Handle h = b->jobs[i].h;
+        if (!h) {   /* failed its probe, or didn't finish it in time */
+            reject(id, monotonic_us());
             continue;
         }
+        forget_rejected(id);
         arr[n].ops = &DDC_OPS;
         arr[n].ctx = h;
-        snprintf(arr[n].id, sizeof(arr[n].id), "ddc:%04x:%04x:%d",
-                 dlist->info[i].vendor_id, dlist->info[i].product_id, i);
+        snprintf(arr[n].id, sizeof(arr[n].id), "%s", id);
         snprintf(arr[n].label, sizeof(arr[n].label), "DDC display %d (%04x:%04x)",
                  i, dlist->info[i].vendor_id, dlist->info[i].product_id);
+        memcpy(arr[n].identity, dlist->info[i].identity, sizeof(arr[n].identity));
+        arr[n].open_us = b->jobs[i].took_us;
         n++;
     }
-    ddc_implementation_free_display_info_list(dlist);
+    probe_batch_release(b);   /* and with it dlist, once no late probe still uses it */
 
     if (n == 0) { free(arr); return 0; }
     *out = arr; *count = n;
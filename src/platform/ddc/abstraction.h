@@ -4,9 +4,33 @@
 #include "brightness.h"   /* brightness_source */
 
 /* Enumerate every controllable DDC display (non-built-in and answering an initial
- * brightness read) as generic brightness sources. Contract matches
- * brightness_enumerate(). VCP packing lives in abstraction.c. */
-int ddc_enumerate_sources(brightness_source **out, int *count);
+ * brightness read in time, or remembered in the display database as having
+ * answered one) as generic brightness sources. Contract matches
+ * brightness_enumerate_changes(): displays already in `known` are not reopened or
+ * probed. A monitor with the same identity as one of `claimed` (sources another
+ * provider has already taken, e.g. through the ddcci kernel driver) is left to
+ * that provider, as if not listed. VCP packing lives in abstraction.c. */
+int ddc_enumerate_sources(const brightness_source *known, int known_count,
+                          const brightness_source *claimed, int claimed_count,
+                          brightness_source **out, int *count, int *changed);
+
+/* New displays are opened and probed concurrently, and each probe gets this
+ * long; one that hasn't answered by then is treated as having failed (see
+ * abstraction.c). ddc_set_probe_deadline() changes it (tests shorten it; <= 0
+ * restores the default). */
+#define DDC_PROBE_DEADLINE_MS 2000
+void ddc_set_probe_deadline(int ms);
+
+/* A display that fails its probe is passed over until DDC_RETRY_MS later, then
+ * probed again, the wait doubling with each further failure up to
+ * DDC_RETRY_MAX_MS. ddc_retry_due() says whether any such retry has come due
+ * (so an event-driven reconciler knows to run a pass); ddc_set_retry_base()
+ * changes the first wait (tests shorten it; <= 0 restores the default). Call
+ * both from the enumerating thread. */
+#define DDC_RETRY_MS 2000
+#define DDC_RETRY_MAX_MS 64000
+int  ddc_retry_due(void);
+void ddc_set_retry_base(int ms);
 
 /* VCP (VESA Control Panel) Feature Codes */
 #define VCP_BRIGHTNESS 0x10
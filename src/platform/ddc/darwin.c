@@ -2,6 +2,7 @@
 #include "platform/ddc/darwin/arch.h"
 #include <unistd.h>
 #include <CoreGraphics/CoreGraphics.h>
+#include <stdio.h>
 #include <stdlib.h>
 
 uint8_t ddc_arch_checksum(uint8_t chk, uint8_t *data, int start, int end) {
@@ -49,6 +50,14 @@ DDC_Status ddc_implementation_get_display_info_list(int flags, DDC_Display_Info_
         list->info[list->ct].vendor_id = dref->vendor_id;
         list->info[list->ct].product_id = dref->product_id;
         list->info[list->ct].is_builtin = dref->is_builtin;
+        /* CoreGraphics' serial is the EDID's numeric one; 0 (none) gives no
+         * identity (display_db_identity). */
+        char maker[12], model[12], sn[12];
+        snprintf(maker, sizeof(maker), "%04x", dref->vendor_id);
+        snprintf(model, sizeof(model), "%04x", dref->product_id);
+        snprintf(sn, sizeof(sn), "%u", (unsigned)CGDisplaySerialNumber(displays[i]));
+        display_db_identity(list->info[list->ct].identity,
+                            sizeof(list->info[list->ct].identity), maker, model, sn);
         list->ct++;
     }
 
@@ -0,0 +1,123 @@
+#include "platform/ddc/ddcci.h"
+#include <string.h>
+
+#define DDCCI_HOST_SEED   0x6E   /* host -> display: XOR starts from the destination */
+#define DDCCI_REPLY_SEED  0x50   /* display -> host: from the virtual host address */
+
+static uint8_t checksum(uint8_t seed, const uint8_t *data, int len) {
+    uint8_t chk = seed;
+    for (int i = 0; i < len; i++) chk ^= data[i];
+    return chk;
+}
+
+void ddcci_init(ddcci_bus *b, const ddcci_transport *io, int pct, int floor_pct) {
+    memset(b, 0, sizeof(*b));
+    b->io = *io;
+    sleep_tuner_init(&b->tuner, pct, floor_pct);
+}
+
+void ddcci_build_get(uint8_t out[DDCCI_GET_REQUEST_LEN], uint8_t code) {
+    out[0] = 0x51;          /* source: the host */
+    out[1] = 0x82;          /* 0x80 | two bytes follow */
+    out[2] = 0x01;          /* Get VCP Feature */
+    out[3] = code;
+    out[4] = checksum(DDCCI_HOST_SEED, out, 4);
+}
+
+void ddcci_build_set(uint8_t out[DDCCI_SET_REQUEST_LEN], uint8_t code, uint16_t value) {
+    out[0] = 0x51;
+    out[1] = 0x84;          /* four bytes follow */
+    out[2] = 0x03;          /* Set VCP Feature */
+    out[3] = code;
+    out[4] = (uint8_t)(value >> 8);
+    out[5] = (uint8_t)(value & 0xFF);
+    out[6] = checksum(DDCCI_HOST_SEED, out, 6);
+}
+
+ddcci_result ddcci_parse_get_reply(const uint8_t *r, int len, uint8_t code,
+                                   uint16_t *max, uint16_t *cur) {
+    if (len >= 3 && r[0] == DDCCI_HOST_SEED && r[1] == 0x80)   /* no payload: a null message */
+        return checksum(DDCCI_REPLY_SEED, r, 2) == r[2] ? DDCCI_NULL : DDCCI_INVALID;
+    if (len < DDCCI_GET_REPLY_LEN || r[0] != DDCCI_HOST_SEED || r[1] != 0x88 || r[2] != 0x02 ||
+        checksum(DDCCI_REPLY_SEED, r, 10) != r[10])
+        return DDCCI_INVALID;
+    if (r[3] == 0x01) return DDCCI_UNSUPPORTED;
+    if (r[3] != 0x00 || r[4] != code) return DDCCI_INVALID;
+    if (max) *max = (uint16_t)(r[6] << 8 | r[7]);
+    if (cur) *cur = (uint16_t)(r[8] << 8 | r[9]);
+    return DDCCI_OK;
+}
+
+/* One of the spec's delays (ms), as paced by the tuner, in us. */
+static long long paced_us(const ddcci_bus *b, int ms) {
+    return (long long)ms * 10LL * b->tuner.pct;
+}
+
+static long long now_us(ddcci_bus *b) {
+    return b->io.now_us(b->io.ctx);
+}
+
+static void wait_until(ddcci_bus *b, long long at) {
+    long long left = at - now_us(b);
+    if (left > 0) b->io.sleep_us(b->io.ctx, left);
+}
+
+static void tuned(ddcci_bus *b, int ok) {
+    if (ok ? sleep_tuner_success(&b->tuner) : sleep_tuner_failure(&b->tuner)) b->tuner_changed = 1;
+}
+
+ddcci_result ddcci_get(ddcci_bus *b, uint8_t code, uint16_t *max, uint16_t *cur) {
+    uint8_t req[DDCCI_GET_REQUEST_LEN], reply[DDCCI_GET_REPLY_LEN];
+    ddcci_build_get(req, code);
+    ddcci_result last = DDCCI_NAK;
+    for (int t = 0; t < DDCCI_TRIES; t++) {
+        if (t > 0) b->retries++;
+        wait_until(b, b->ready_at);
+        if (b->io.write(b->io.ctx, req, (int)sizeof(req)) != 0) {
+            last = DDCCI_NAK;
+        } else {
+            /* Poll from the paced wait on, at growing intervals, until twice
+             * the spec's wait (or the paced one, if the tuner has backed off
+             * past it). */
+            long long sent = now_us(b), wait = paced_us(b, DDCCI_REPLY_WAIT_MS);
+            long long spec = DDCCI_REPLY_WAIT_MS * 1000LL;
+            long long deadline = sent + 2 * (wait > spec ? wait : spec);
+            long long at = sent + wait, step = DDCCI_FIRST_POLL_STEP_MS * 1000LL;
+            for (;;) {
+                wait_until(b, at);
+                b->polls++;
+                last = b->io.read(b->io.ctx, reply, (int)sizeof(reply)) == 0
+                     ? ddcci_parse_get_reply(reply, (int)sizeof(reply), code, max, cur)
+                     : DDCCI_NAK;
+                if (last == DDCCI_OK || last == DDCCI_UNSUPPORTED) {
+                    b->ready_at = now_us(b);
+                    tuned(b, 1);
+                    return last;
+                }
+                long long now = now_us(b);
+                if (last == DDCCI_INVALID || now >= deadline) break;   /* garbled, or out of time: ask again */
+                at = now + step < deadline ? now + step : deadline;
+                step *= 2;
+            }
+        }
+        tuned(b, 0);
+        b->ready_at = now_us(b) + paced_us(b, DDCCI_SETTLE_MS);
+    }
+    return last;
+}
+
+ddcci_result ddcci_set(ddcci_bus *b, uint8_t code, uint16_t value) {
+    uint8_t cmd[DDCCI_SET_REQUEST_LEN];
+    ddcci_build_set(cmd, code, value);
+    for (int t = 0; t < DDCCI_TRIES; t++) {
+        if (t > 0) b->retries++;
+        wait_until(b, b->ready_at);
+        int ok = b->io.write(b->io.ctx, cmd, (int)sizeof(cmd)) == 0;
+        tuned(b, ok);
+        /* Either way the display needs its settle time before the next message;
+         * after an ACK, that's waited out only if the next one comes sooner. */
+        b->ready_at = now_us(b) + paced_us(b, DDCCI_SETTLE_MS);
+        if (ok) return DDCCI_OK;
+    }
+    return DDCCI_NAK;
+}
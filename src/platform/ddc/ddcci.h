@@ -0,0 +1,82 @@
+#ifndef DDC_DDCCI_H
+#define DDC_DDCCI_H
+
+#include "sleep_tuner.h"
+#include <stdint.h>
+
+/* The DDC/CI wire protocol (VESA DDC/CI 1.1) for VCP get and set, for backends
+ * that reach the display's I2C bus themselves (linux_i2c.c, netbsd.c). The
+ * backend supplies a transport -- one I2C write or read to the display's
+ * DDC/CI address, and a clock -- and this builds the packets, checks the
+ * replies, and paces and retries the exchanges. No allocation, no globals:
+ * one ddcci_bus per open display.
+ *
+ * Pacing. The spec gives a display up to DDCCI_REPLY_WAIT_MS to have a reply
+ * ready and DDCCI_SETTLE_MS to settle after a set, and most answer well inside
+ * both. So a reply is polled for -- first after a tuned fraction of the spec's
+ * wait, then again at growing intervals -- and a settle is only waited out if
+ * the next message comes sooner. The fraction is a sleep_tuner: each failed
+ * try doubles it before the retry, and runs of successes tighten it again.
+ *
+ * Replies are classified rather than just accepted or not: a null message (the
+ * display isn't ready yet) or a read it won't ACK means poll again; a reply
+ * with a bad checksum or the wrong shape means ask again; "unsupported VCP
+ * code" ends the exchange, as no retry will change it. */
+
+#define DDCCI_ADDR_7BIT        0x37    /* the display's DDC/CI address (0x6E/0x6F on the wire) */
+#define DDCCI_GET_REQUEST_LEN  5
+#define DDCCI_SET_REQUEST_LEN  7
+#define DDCCI_GET_REPLY_LEN    11
+#define DDCCI_REPLY_WAIT_MS    40
+#define DDCCI_SETTLE_MS        50
+#define DDCCI_TRIES            3
+#define DDCCI_FIRST_POLL_STEP_MS 2     /* between polls, doubling from here */
+
+typedef struct {
+    int  (*write)(void *ctx, const uint8_t *buf, int len);  /* one I2C write; 0 if ACKed */
+    int  (*read)(void *ctx, uint8_t *buf, int len);         /* one I2C read; 0 if ACKed */
+    long long (*now_us)(void *ctx);                          /* monotonic */
+    void (*sleep_us)(void *ctx, long long us);
+    void *ctx;
+} ddcci_transport;
+
+/* How a reply parsed, or how an exchange ended (its last try's outcome). */
+typedef enum {
+    DDCCI_OK = 0,
+    DDCCI_NAK,          /* a write or read the display didn't ACK */
+    DDCCI_NULL,         /* a null message: the display has nothing for us (yet) */
+    DDCCI_UNSUPPORTED,  /* a well-formed reply saying the VCP code isn't supported */
+    DDCCI_INVALID       /* bad checksum, wrong opcode or feature, wrong length */
+} ddcci_result;
+
+typedef struct {
+    ddcci_transport io;
+    sleep_tuner tuner;       /* pacing, in percent of the spec's delays */
+    int tuner_changed;       /* set when the tuner moves; the backend clears it
+                                once it has persisted tuner.pct/floor_pct */
+    long long ready_at;      /* not before this (io's clock): the display may still be busy */
+    unsigned long polls;     /* reads tried, all exchanges */
+    unsigned long retries;   /* tries after the first, all exchanges */
+} ddcci_bus;
+
+/* Set up a bus over `io`, paced at `pct` with `floor_pct` (as last persisted;
+ * 0 for either: unknown, see sleep_tuner_init). */
+void ddcci_init(ddcci_bus *b, const ddcci_transport *io, int pct, int floor_pct);
+
+/* The packets, byte for byte: a Get VCP Feature request and a Set VCP Feature
+ * command as written to the display (without the 0x6E address byte, which the
+ * I2C write puts on the wire, but with the checksum that covers it). */
+void ddcci_build_get(uint8_t out[DDCCI_GET_REQUEST_LEN], uint8_t code);
+void ddcci_build_set(uint8_t out[DDCCI_SET_REQUEST_LEN], uint8_t code, uint16_t value);
+
+/* Classify `len` bytes read back after a get request for `code`; on DDCCI_OK,
+ * *max and *cur are the feature's maximum and current value. */
+ddcci_result ddcci_parse_get_reply(const uint8_t *r, int len, uint8_t code,
+                                   uint16_t *max, uint16_t *cur);
+
+/* One paced, retried exchange: read VCP feature `code` / set it to `value`.
+ * Up to DDCCI_TRIES tries; returns DDCCI_OK or how the last one failed. */
+ddcci_result ddcci_get(ddcci_bus *b, uint8_t code, uint16_t *max, uint16_t *cur);
+ddcci_result ddcci_set(ddcci_bus *b, uint8_t code, uint16_t value);
+
+#endif /* DDC_DDCCI_H */
@@ -2,6 +2,7 @@
 #define DDC_IMPLEMENTATION_H
 
 #include <stdint.h>
+#include "display_db.h"   /* DISPLAY_DB_ID_MAX */
 
 typedef struct DDC_Display_Ref_s *DDC_Display_Ref;
 typedef struct DDC_Display_Handle_s *DDC_Display_Handle;
@@ -19,6 +20,7 @@ typedef struct {
     uint32_t vendor_id;
     uint32_t product_id;
     int is_builtin;
+    char identity[DISPLAY_DB_ID_MAX];   /* the monitor's own (display_db_identity); "" if unknown */
 } DDC_Display_Info;
 
 typedef struct {
@@ -1,9 +1,17 @@
 /* In-memory mock DDC backend for unit tests: a configurable set of simulated
  * external displays. Implements platform/ddc/implementation.h with no hardware. */
+#define _POSIX_C_SOURCE 200809L   /* nanosleep, clock_gettime */
 #include "platform/ddc/implementation.h"
 #include "platform/ddc/abstraction.h"
 #include "platform/ddc/in_memory_mock.h"
+#include <pthread.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#ifdef _WIN32
+#include <windows.h>
+#endif
 
 struct DDC_Display_Ref_s    { int index; };
 struct DDC_Display_Handle_s { int index; };
@@ -12,8 +20,24 @@ static struct DDC_Display_Ref_s g_refs[MOCK_MAX_DISPLAYS];
 static struct DDC_Display_Handle_s g_handles[MOCK_MAX_DISPLAYS];
 static int g_current[MOCK_MAX_DISPLAYS];
 static int g_max[MOCK_MAX_DISPLAYS];
+static int g_contrast[MOCK_MAX_DISPLAYS];
+static int g_contrast_max[MOCK_MAX_DISPLAYS];          /* 0: no contrast control */
 static int g_fail[MOCK_MAX_DISPLAYS];
+static int g_quantum[MOCK_MAX_DISPLAYS];              /* mock_set_quantum(); 0: none */
+static mock_timing g_timing[MOCK_MAX_DISPLAYS][2];   /* [display][mock_op] */
+static long long g_gone_at[MOCK_MAX_DISPLAYS];       /* monotonic ms; 0 = here for good (atomic) */
+static char g_identity[MOCK_MAX_DISPLAYS][DISPLAY_DB_ID_MAX];
+static unsigned long long g_rng = 0;                 /* mock_seed(); atomic */
+static int g_open_handles = 0;   /* atomic */
+static int g_reads = 0;          /* atomic */
 static int g_count = 1;   /* default: one display, matches historic behavior */
+
+/* mock_set_gate(): calls held at the bus, and how many calls are on it. */
+static pthread_mutex_t g_bus_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_bus_opened = PTHREAD_COND_INITIALIZER;
+static int g_gate[MOCK_MAX_DISPLAYS][2];   /* under g_bus_lock */
+static int g_in_flight[2];                 /* under g_bus_lock */
+static int g_peak_in_flight[2];            /* under g_bus_lock */
 static int g_inited = 0;  /* has the mock been configured (default or mock_reset)? */
 
 /* Default single display (current=50,max=100) so any test that doesn't call
@@ -37,34 +61,175 @@ void mock_reset(int n, const int *currents, const int *maxes) {
         g_current[i] = currents[i];
         g_max[i] = maxes[i];
         g_fail[i] = 0;
+        g_quantum[i] = 0;
+        g_contrast[i] = g_contrast_max[i] = 0;
+        memset(g_timing[i], 0, sizeof(g_timing[i]));
+        __atomic_store_n(&g_gone_at[i], 0, __ATOMIC_SEQ_CST);
+        g_identity[i][0] = '\0';
     }
+    pthread_mutex_lock(&g_bus_lock);
+    memset(g_gate, 0, sizeof(g_gate));
+    for (int op = 0; op < 2; op++) g_peak_in_flight[op] = g_in_flight[op];
+    pthread_cond_broadcast(&g_bus_opened);
+    pthread_mutex_unlock(&g_bus_lock);
+}
+
+void mock_set_gate(int index, mock_op op, int closed) {
+    if (index < 0 || index >= MOCK_MAX_DISPLAYS) return;
+    pthread_mutex_lock(&g_bus_lock);
+    g_gate[index][op] = closed;
+    if (!closed) pthread_cond_broadcast(&g_bus_opened);
+    pthread_mutex_unlock(&g_bus_lock);
+}
+
+int mock_in_flight(mock_op op) {
+    pthread_mutex_lock(&g_bus_lock);
+    int n = g_in_flight[op];
+    pthread_mutex_unlock(&g_bus_lock);
+    return n;
+}
+
+int mock_peak_in_flight(mock_op op) {
+    pthread_mutex_lock(&g_bus_lock);
+    int n = g_peak_in_flight[op];
+    pthread_mutex_unlock(&g_bus_lock);
+    return n;
+}
+
+void mock_set_identity(int index, const char *identity) {
+    if (index < 0 || index >= MOCK_MAX_DISPLAYS) return;
+    snprintf(g_identity[index], sizeof(g_identity[index]), "%s", identity ? identity : "");
 }
 
 void mock_set_fail(int index, int fail) {
     if (index >= 0 && index < MOCK_MAX_DISPLAYS) g_fail[index] = fail;
 }
 
+void mock_set_latency(int index, int ms) {
+    const mock_timing t = { ms, ms, 0, 0, 0 };
+    mock_set_timing(index, MOCK_SET, &t);
+}
+
+void mock_set_timing(int index, mock_op op, const mock_timing *t) {
+    if (index >= 0 && index < MOCK_MAX_DISPLAYS) g_timing[index][op] = *t;
+}
+
+static long long mock_now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000LL + ts.tv_nsec / 1000000L;
+}
+
+void mock_set_disappear(int index, int after_ms) {
+    if (index < 0 || index >= MOCK_MAX_DISPLAYS) return;
+    long long at = after_ms < 0 ? 0 : mock_now_ms() + after_ms;
+    __atomic_store_n(&g_gone_at[index], at, __ATOMIC_SEQ_CST);
+}
+
+static int mock_gone(int index) {
+    long long at = __atomic_load_n(&g_gone_at[index], __ATOMIC_SEQ_CST);
+    return at != 0 && mock_now_ms() >= at;
+}
+
+void mock_seed(unsigned long long seed) {
+    __atomic_store_n(&g_rng, seed, __ATOMIC_SEQ_CST);
+}
+
+/* A draw in [0, n): splitmix64 over an atomic counter, so concurrent writers
+ * each get their own draw without a lock. */
+static int mock_roll(int n) {
+    unsigned long long z = __atomic_add_fetch(&g_rng, 0x9E3779B97F4A7C15ULL, __ATOMIC_RELAXED);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    z ^= z >> 31;
+    return n > 0 ? (int)(z % (unsigned long long)n) : 0;
+}
+
+static void mock_sleep_ms(int ms) {
+    if (ms <= 0) return;
+#ifdef _WIN32
+    Sleep((DWORD)ms);
+#else
+    struct timespec ts = { ms / 1000, (long)(ms % 1000) * 1000000L };
+    nanosleep(&ts, NULL);
+#endif
+}
+
+/* Play out one call's scripted timing and faults on display `index` (see
+ * mock_timing). */
+static DDC_Status mock_play(int index, mock_op op) {
+    const mock_timing *t = &g_timing[index][op];
+    if (mock_gone(index)) return DDC_ERROR;
+    if (t->hang_pct > 0 && mock_roll(100) < t->hang_pct) {
+        mock_sleep_ms(t->hang_ms);
+        return DDC_ERROR;
+    }
+    int ms = t->min_ms;
+    if (t->max_ms > t->min_ms) ms += mock_roll(t->max_ms - t->min_ms + 1);
+    mock_sleep_ms(ms);
+    if (mock_gone(index)) return DDC_ERROR;   /* unplugged while we waited */
+    if (t->fail_pct > 0 && mock_roll(100) < t->fail_pct) return DDC_ERROR;
+    return DDC_OK;
+}
+
+/* One call on the bus: counted in flight from here until it returns, held
+ * first at its display's gate if that is closed (mock_set_gate). */
+static DDC_Status mock_call(int index, mock_op op) {
+    pthread_mutex_lock(&g_bus_lock);
+    if (++g_in_flight[op] > g_peak_in_flight[op]) g_peak_in_flight[op] = g_in_flight[op];
+    while (g_gate[index][op]) pthread_cond_wait(&g_bus_opened, &g_bus_lock);
+    pthread_mutex_unlock(&g_bus_lock);
+    DDC_Status st = mock_play(index, op);
+    pthread_mutex_lock(&g_bus_lock);
+    g_in_flight[op]--;
+    pthread_mutex_unlock(&g_bus_lock);
+    return st;
+}
+
+void mock_set_quantum(int index, int quantum) {
+    if (index < 0 || index >= MOCK_MAX_DISPLAYS) return;
+    g_quantum[index] = quantum > 1 ? quantum : 0;
+}
+
+void mock_set_contrast(int index, int current, int max) {
+    if (index < 0 || index >= MOCK_MAX_DISPLAYS) return;
+    g_contrast[index] = current;
+    g_contrast_max[index] = max;
+}
+
+int mock_contrast(int index) {
+    if (index < 0 || index >= g_count || !g_contrast_max[index]) return -1;
+    return g_contrast[index];
+}
+
 int mock_current(int index) {
     if (index < 0 || index >= g_count) return -1;
     return g_current[index];
 }
 
+int mock_open_handles(void) { return __atomic_load_n(&g_open_handles, __ATOMIC_SEQ_CST); }
+int mock_read_count(void)   { return __atomic_load_n(&g_reads, __ATOMIC_SEQ_CST); }
+
 DDC_Status ddc_implementation_get_display_info_list(int flags, DDC_Display_Info_List **list_out) {
     (void)flags;
     ensure_default();
     if (!list_out || g_count == 0) return DDC_ERROR;
     DDC_Display_Info_List *list = (DDC_Display_Info_List*)malloc(sizeof(*list));
     if (!list) return DDC_ERROR;
-    list->ct = g_count;
     list->info = (DDC_Display_Info*)calloc((size_t)g_count, sizeof(DDC_Display_Info));
     if (!list->info) { free(list); return DDC_ERROR; }
+    int n = 0;
     for (int i = 0; i < g_count; i++) {
+        if (mock_gone(i)) continue;   /* unplugged: later ones move up, as on a real bus list */
         g_refs[i].index = i;
-        list->info[i].dref = (DDC_Display_Ref)&g_refs[i];
-        list->info[i].vendor_id = 0x1234;
-        list->info[i].product_id = (uint32_t)(0x5678 + i);
-        list->info[i].is_builtin = 0;
+        list->info[n].dref = (DDC_Display_Ref)&g_refs[i];
+        list->info[n].vendor_id = 0x1234;
+        list->info[n].product_id = (uint32_t)(0x5678 + i);
+        list->info[n].is_builtin = 0;
+        memcpy(list->info[n].identity, g_identity[i], sizeof(list->info[n].identity));
+        n++;
     }
+    list->ct = n;
     *list_out = list;
     return DDC_OK;
 }
@@ -79,33 +244,51 @@ DDC_Status ddc_implementation_open_display(DDC_Display_Ref dref, int flags, DDC_
     (void)flags;
     if (!dref || !handle_out) return DDC_ERROR;
     struct DDC_Display_Ref_s *r = (struct DDC_Display_Ref_s*)dref;
+    if (mock_gone(r->index)) return DDC_ERROR;
     g_handles[r->index].index = r->index;
     *handle_out = (DDC_Display_Handle)&g_handles[r->index];
+    __atomic_fetch_add(&g_open_handles, 1, __ATOMIC_SEQ_CST);
     return DDC_OK;
 }
 
 DDC_Status ddc_implementation_close_display(DDC_Display_Handle handle) {
-    (void)handle;   /* handles are static; nothing to free */
+    (void)handle;   /* handles are static; nothing to free, only count */
+    __atomic_fetch_sub(&g_open_handles, 1, __ATOMIC_SEQ_CST);
     return DDC_OK;
 }
 
 DDC_Status ddc_implementation_get_non_table_vcp_value(DDC_Display_Handle handle, uint8_t feature_code, DDC_Non_Table_Vcp_Value *value_out) {
     struct DDC_Display_Handle_s *h = (struct DDC_Display_Handle_s*)handle;
     if (!h || !value_out) return DDC_ERROR;
-    if (feature_code != VCP_BRIGHTNESS) return DDC_ERROR;
     int i = h->index;
-    value_out->mh = (uint8_t)((g_max[i] >> 8) & 0xFF);
-    value_out->ml = (uint8_t)(g_max[i] & 0xFF);
-    value_out->sh = (uint8_t)((g_current[i] >> 8) & 0xFF);
-    value_out->sl = (uint8_t)(g_current[i] & 0xFF);
+    if (feature_code != VCP_BRIGHTNESS && !(feature_code == VCP_CONTRAST && g_contrast_max[i]))
+        return DDC_ERROR;
+    __atomic_fetch_add(&g_reads, 1, __ATOMIC_SEQ_CST);
+    if (mock_call(i, MOCK_GET) != DDC_OK) return DDC_ERROR;
+    int cur = feature_code == VCP_CONTRAST ? g_contrast[i] : g_current[i];
+    int max = feature_code == VCP_CONTRAST ? g_contrast_max[i] : g_max[i];
+    value_out->mh = (uint8_t)((max >> 8) & 0xFF);
+    value_out->ml = (uint8_t)(max & 0xFF);
+    value_out->sh = (uint8_t)((cur >> 8) & 0xFF);
+    value_out->sl = (uint8_t)(cur & 0xFF);
     return DDC_OK;
 }
 
 DDC_Status ddc_implementation_set_non_table_vcp_value(DDC_Display_Handle handle, uint8_t feature_code, uint8_t hi_byte, uint8_t lo_byte) {
     struct DDC_Display_Handle_s *h = (struct DDC_Display_Handle_s*)handle;
     if (!h) return DDC_ERROR;
-    if (feature_code != VCP_BRIGHTNESS) return DDC_ERROR;
-    if (g_fail[h->index]) return DDC_ERROR;
-    g_current[h->index] = (hi_byte << 8) | lo_byte;
+    int i = h->index;
+    if (feature_code != VCP_BRIGHTNESS && !(feature_code == VCP_CONTRAST && g_contrast_max[i]))
+        return DDC_ERROR;
+    if (mock_call(i, MOCK_SET) != DDC_OK) return DDC_ERROR;
+    if (g_fail[i]) return DDC_ERROR;
+    int value = (hi_byte << 8) | lo_byte;
+    if (feature_code == VCP_CONTRAST) {
+        g_contrast[i] = value;
+    } else {
+        if (g_quantum[i] && value < g_max[i])
+            value = (value + g_quantum[i] / 2) / g_quantum[i] * g_quantum[i];
+        g_current[i] = value;
+    }
     return DDC_OK;
 }
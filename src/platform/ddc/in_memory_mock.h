@@ -2,9 +2,12 @@
 #define DDC_IN_MEMORY_MOCK_H
 
 /* Test-only controls for the in-memory mock DDC backend. Let a test stand up an
- * arbitrary set of simulated displays and inject a write failure on one of them. */
+ * arbitrary set of simulated displays, inject a write failure on one of them, and
+ * give each a simulated bus latency -- or script a misbehaving bus: per display
+ * and per operation, a latency range, a chance of a NAK, a chance of hanging
+ * until a timeout, and a time at which the display goes away altogether. */
 
-#define MOCK_MAX_DISPLAYS 8
+#define MOCK_MAX_DISPLAYS 64
 
 /* Configure `n` displays with the given per-display current/max. Clears any
  * previously injected failures. Safe to call repeatedly between tests. */
@@ -13,7 +16,76 @@ void mock_reset(int n, const int *currents, const int *maxes);
 /* Make ddc_implementation_set_* fail (return DDC_ERROR) for display `index`. */
 void mock_set_fail(int index, int fail);
 
+/* Make ddc_implementation_set_* on display `index` sleep `ms` milliseconds before
+ * completing, like a real DDC round trip. Cleared by mock_reset(). (Shorthand
+ * for mock_set_timing() of MOCK_SET with min_ms = max_ms = ms and no faults.) */
+void mock_set_latency(int index, int ms);
+
+/* How one kind of call behaves on one display. Each call sleeps a latency drawn
+ * uniformly from [min_ms, max_ms] and then fails (a NAK) with probability
+ * fail_pct/100; or, with probability hang_pct/100, it instead sleeps hang_ms
+ * and fails (a bus that stopped answering until the provider's timeout). A
+ * zeroed mock_timing is the default: instant and reliable. */
+typedef enum { MOCK_GET, MOCK_SET } mock_op;
+
+typedef struct {
+    int min_ms, max_ms;
+    int fail_pct;
+    int hang_pct;
+    int hang_ms;
+} mock_timing;
+
+void mock_set_timing(int index, mock_op op, const mock_timing *t);
+
+/* Hold calls of kind `op` on display `index` at the bus: one that starts while
+ * the gate is closed waits there (counted in flight) until it is opened, then
+ * plays out its timing as usual. For a test that needs a call to be on the bus
+ * at a given moment -- or several at once -- without timing anything. Opened
+ * again by mock_reset(). */
+void mock_set_gate(int index, mock_op op, int closed);
+
+/* Calls of kind `op` on the bus right now, across every display (held at a
+ * gate or sleeping out their latency), and the most at once since mock_reset(). */
+int  mock_in_flight(mock_op op);
+int  mock_peak_in_flight(mock_op op);
+
+/* Display `index` goes away `after_ms` from now (real time; 0 = now): from then
+ * on it is missing from the display list, and every call on a handle to it
+ * fails -- including one already sleeping out its latency, so a write can lose
+ * its display mid-flight. after_ms < 0 cancels. Cleared by mock_reset(). */
+void mock_set_disappear(int index, int after_ms);
+
+/* Give display `index` an identity (as from its EDID; see display_db.h), so it
+ * is looked up in and remembered by the display database. NULL or "" (the
+ * default, and after mock_reset()) leaves it anonymous. */
+void mock_set_identity(int index, const char *identity);
+
+/* Reseed the generator behind the latency draws and fault chances, so a run
+ * can be repeated. (Concurrent calls still take draws in whatever order they
+ * race in.) */
+void mock_seed(unsigned long long seed);
+
+/* Make display `index` store brightness only in multiples of `quantum`, as a
+ * monitor with coarse internal steps does: a write below max is rounded to the
+ * nearest, and reads report that. 0 or 1 (the default, and after mock_reset()):
+ * every level. */
+void mock_set_quantum(int index, int quantum);
+
+/* Give display `index` a contrast control (VCP_CONTRAST) at `current` of `max`;
+ * max 0 (the default, and after mock_reset()) takes it away again. Writes to it
+ * fail, hang and take their time as brightness writes do. */
+void mock_set_contrast(int index, int current, int max);
+
+/* Its simulated contrast (-1 if out of range or it has none). */
+int  mock_contrast(int index);
+
 /* Read the simulated current brightness of display `index` (-1 if out of range). */
 int  mock_current(int index);
 
+/* Handles currently open (opens minus closes) and VCP reads issued so far. Both
+ * are cumulative across mock_reset(), so a test compares before/after to see
+ * exactly what an enumerate or reconcile touched. */
+int  mock_open_handles(void);
+int  mock_read_count(void);
+
 #endif /* DDC_IN_MEMORY_MOCK_H */
@@ -1,14 +1,52 @@
 #include "platform/ddc/implementation.h"
 #include "platform/ddc/abstraction.h"
+#include "display_db.h"
+#include "sleep_tuner.h"
 #include <ddcutil_c_api.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
 #include <ctype.h>
 
-/* Wrap libddcutil types inside our opaque structs */
-struct DDC_Display_Ref_s { DDCA_Display_Ref dref; };
-struct DDC_Display_Handle_s { DDCA_Display_Handle dh; };
+/* Wrap libddcutil types inside our opaque structs. Each display carries its
+ * identity (maker:model:serial, see display_db.h) and, once open, the tuner
+ * for its sleep multiplier: libddcutil sleeps the spec's worst-case delays
+ * between messages unless told a monitor needs less, so every open display
+ * starts from the multiplier learned for that monitor last time, tightens it
+ * while exchanges succeed and backs off when they fail (sleep_tuner.h). What it
+ * learns goes to the display database, flushed by the daemon. */
+struct DDC_Display_Ref_s {
+    DDCA_Display_Ref dref;
+    char identity[DISPLAY_DB_ID_MAX];   /* "" if the EDID gave nothing to go on */
+};
+struct DDC_Display_Handle_s {
+    DDCA_Display_Handle dh;
+    DDCA_Display_Ref dref;
+    char identity[DISPLAY_DB_ID_MAX];
+    sleep_tuner tuner;
+    int tuning;         /* 0 once libddcutil refused a multiplier: its default stays */
+};
+
+/* Hand the tuner's current multiplier to libddcutil, and remember it. If
+ * libddcutil won't take it, tuning stops for this display: the tuner goes back
+ * to the default (which is what libddcutil is still using) and stays there. */
+static void apply_sleep(struct DDC_Display_Handle_s *h) {
+    if (ddca_set_display_sleep_multiplier(h->dref, h->tuner.pct / 100.0) != 0) {
+        sleep_tuner_init(&h->tuner, 0, 0);
+        h->tuning = 0;
+        return;
+    }
+    if (!h->identity[0]) return;
+    display_db_set_long(h->identity, "sleep_pct", h->tuner.pct);
+    display_db_set_long(h->identity, "sleep_floor_pct", h->tuner.floor_pct);
+}
+
+/* Feed an exchange's outcome to the tuner; returns `st` for chaining. */
+static DDCA_Status tune_sleep(struct DDC_Display_Handle_s *h, DDCA_Status st) {
+    if (h->tuning && (st == 0 ? sleep_tuner_success(&h->tuner) : sleep_tuner_failure(&h->tuner)))
+        apply_sleep(h);
+    return st;
+}
 
 /* Convert a 3-letter manufacturer code (e.g., "DEL") to the 16-bit EISA ID.
  * Returns 0 on invalid input. */
@@ -40,11 +78,14 @@ DDC_Status ddc_implementation_get_display_info_list(int flags, DDC_Display_Info_
             free(out->info); free(out); ddca_free_display_info_list(dl); return DDC_ERROR;
         }
         wr->dref = dl->info[i].dref;
+        display_db_identity(wr->identity, sizeof(wr->identity), dl->info[i].mfg_id,
+                            dl->info[i].model_name, dl->info[i].sn);
         out->info[i].dref = (DDC_Display_Ref)wr;
         /* Map 3-letter manufacturer code to EISA ID for vendor_id */
         out->info[i].vendor_id = eisa_id_from_mfg(dl->info[i].mfg_id);
         out->info[i].product_id = dl->info[i].product_code;
         out->info[i].is_builtin = 0; /* libddcutil does not expose this; assume external */
+        memcpy(out->info[i].identity, wr->identity, sizeof(out->info[i].identity));
     }
     /* A DDCA_Display_Ref returned in the info list stays valid until
      * ddca_redetect_displays() is called; freeing the info list does not
@@ -75,6 +116,16 @@ DDC_Status ddc_implementation_open_display(DDC_Display_Ref dref, int flags, DDC_
     struct DDC_Display_Handle_s *h = (struct DDC_Display_Handle_s*)malloc(sizeof(*h));
     if (!h) { ddca_close_display(dh); return DDC_ERROR; }
     h->dh = dh;
+    h->dref = wr->dref;
+    memcpy(h->identity, wr->identity, sizeof(h->identity));
+    long pct = 0, floor_pct = 0;
+    if (h->identity[0]) {
+        display_db_get_long(h->identity, "sleep_pct", &pct);
+        display_db_get_long(h->identity, "sleep_floor_pct", &floor_pct);
+    }
+    sleep_tuner_init(&h->tuner, (int)pct, (int)floor_pct);
+    h->tuning = 1;
+    if (pct > 0) apply_sleep(h);   /* unknown monitors keep libddcutil's default to start */
     *handle_out = (DDC_Display_Handle)h;
     return DDC_OK;
 }
@@ -91,7 +142,7 @@ DDC_Status ddc_implementation_get_non_table_vcp_value(DDC_Display_Handle handle,
     if (!handle || !value_out) return DDC_ERROR;
     struct DDC_Display_Handle_s *h = (struct DDC_Display_Handle_s*)handle;
     DDCA_Non_Table_Vcp_Value v;
-    DDCA_Status st = ddca_get_non_table_vcp_value(h->dh, feature_code, &v);
+    DDCA_Status st = tune_sleep(h, ddca_get_non_table_vcp_value(h->dh, feature_code, &v));
     if (st != 0) return DDC_ERROR;
     value_out->mh = v.mh; value_out->ml = v.ml; value_out->sh = v.sh; value_out->sl = v.sl;
     return DDC_OK;
@@ -100,6 +151,6 @@ DDC_Status ddc_implementation_get_non_table_vcp_value(DDC_Display_Handle handle,
 DDC_Status ddc_implementation_set_non_table_vcp_value(DDC_Display_Handle handle, uint8_t feature_code, uint8_t hi_byte, uint8_t lo_byte) {
     if (!handle) return DDC_ERROR;
     struct DDC_Display_Handle_s *h = (struct DDC_Display_Handle_s*)handle;
-    DDCA_Status st = ddca_set_non_table_vcp_value(h->dh, feature_code, hi_byte, lo_byte);
+    DDCA_Status st = tune_sleep(h, ddca_set_non_table_vcp_value(h->dh, feature_code, hi_byte, lo_byte));
     return (st == 0) ? DDC_OK : DDC_ERROR;
 }
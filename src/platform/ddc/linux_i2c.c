@@ -0,0 +1,249 @@
+/* Linux DDC/CI over /dev/i2c-* directly, without libddcutil: the alternative to
+ * linux.c, chosen at build time with -DDIMMIT_DDC_I2C_DEV=ON.
+ *
+ * libddcutil is thorough but slow per step: fixed worst-case sleeps after every
+ * message, optional read-back verification, and its own setup. Here each
+ * message is one I2C_RDWR ioctl, and the protocol engine (ddcci.h) paces them:
+ * a set returns as soon as the display has ACKed it, a reply is polled for
+ * rather than slept on, and a message the display NAKs (or answers with
+ * garbage) is retried on that display alone -- each display is its own bus.
+ * The engine's pacing is remembered per monitor in the display database, under
+ * the same keys linux.c uses for libddcutil's sleep multiplier. */
+#define _GNU_SOURCE   /* struct i2c_msg flags, O_CLOEXEC, nanosleep, clock_gettime */
+#include "platform/ddc/implementation.h"
+#include "platform/ddc/abstraction.h"
+#include "platform/ddc/ddcci.h"
+#include "display_db.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+
+#define EDID_ADDR_7BIT  0x50
+#define DDC_MAX_BUSES   32
+
+struct DDC_Display_Ref_s {
+    char device_path[32];
+    char identity[DISPLAY_DB_ID_MAX];   /* "" if the EDID gave nothing to go on */
+};
+
+struct DDC_Display_Handle_s {
+    int       fd;
+    ddcci_bus bus;
+    char      identity[DISPLAY_DB_ID_MAX];
+};
+
+static int i2c_transfer(int fd, struct i2c_msg *msgs, int n) {
+    struct i2c_rdwr_ioctl_data data = { msgs, (__u32)n };
+    int rc;
+    do rc = ioctl(fd, I2C_RDWR, &data); while (rc < 0 && errno == EINTR);
+    return rc == n ? 0 : -1;
+}
+
+/* The engine's transport: one message to or from the display's DDC/CI
+ * address, on the handle's bus. */
+static int bus_write(void *ctx, const uint8_t *buf, int len) {
+    struct i2c_msg m = { DDCCI_ADDR_7BIT, 0, (__u16)len, (__u8*)buf };
+    return i2c_transfer(*(int*)ctx, &m, 1);
+}
+
+static int bus_read(void *ctx, uint8_t *buf, int len) {
+    struct i2c_msg m = { DDCCI_ADDR_7BIT, I2C_M_RD, (__u16)len, buf };
+    return i2c_transfer(*(int*)ctx, &m, 1);
+}
+
+static long long bus_now_us(void *ctx) {
+    (void)ctx;
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+static void bus_sleep_us(void *ctx, long long us) {
+    for (long long until = bus_now_us(ctx) + us, left = us; left > 0; left = until - bus_now_us(ctx)) {
+        struct timespec ts = { (time_t)(left / 1000000), (long)(left % 1000000) * 1000L };
+        nanosleep(&ts, NULL);
+    }
+}
+
+/* Remember the engine's pacing for this monitor, if it moved. */
+static void remember_pacing(DDC_Display_Handle h) {
+    if (!h->bus.tuner_changed) return;
+    h->bus.tuner_changed = 0;
+    if (!h->identity[0]) return;
+    display_db_set_long(h->identity, "sleep_pct", h->bus.tuner.pct);
+    display_db_set_long(h->identity, "sleep_floor_pct", h->bus.tuner.floor_pct);
+}
+
+/* The bus's EDID, if a display answers there (offset 0, then 128 bytes). */
+static int read_edid(int fd, uint8_t edid[128]) {
+    static const uint8_t header[8] = { 0x00, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x00 };
+    uint8_t offset = 0;
+    struct i2c_msg msgs[2] = {
+        { EDID_ADDR_7BIT, 0, 1, &offset },
+        { EDID_ADDR_7BIT, I2C_M_RD, 128, edid },
+    };
+    if (i2c_transfer(fd, msgs, 2) < 0) return -1;
+    return memcmp(edid, header, sizeof(header)) == 0 ? 0 : -1;
+}
+
+static int cmp_int(const void *a, const void *b) {
+    return *(const int*)a - *(const int*)b;
+}
+
+static int add_bus(int *buses, int n, int bus) {
+    for (int i = 0; i < n; i++) if (buses[i] == bus) return n;
+    if (n < DDC_MAX_BUSES) buses[n++] = bus;
+    return n;
+}
+
+/* The buses a DRM connector names as its DDC channel (its `ddc` link, to
+ * .../i2c-N): where monitors are, and nowhere else. */
+static int drm_ddc_buses(int *buses) {
+    int n = 0;
+    DIR *drm = opendir("/sys/class/drm");
+    if (!drm) return 0;
+    for (struct dirent *e; (e = readdir(drm)) != NULL; ) {
+        if (e->d_name[0] == '.') continue;
+        char link[320], target[256];
+        snprintf(link, sizeof(link), "/sys/class/drm/%s/ddc", e->d_name);
+        ssize_t len = readlink(link, target, sizeof(target) - 1);
+        if (len <= 0) continue;
+        target[len] = '\0';
+        const char *base = strrchr(target, '/');
+        int bus;
+        char tail;
+        if (sscanf(base ? base + 1 : target, "i2c-%d%c", &bus, &tail) == 1)
+            n = add_bus(buses, n, bus);
+    }
+    closedir(drm);
+    return n;
+}
+
+/* An adapter that can't be a display's: the chipset's SMBus (memory SPD, sensors),
+ * where an EDID-address read is at best wasted and at worst wakes something. */
+static int is_smbus(int bus) {
+    char path[64], name[64] = "";
+    snprintf(path, sizeof(path), "/sys/bus/i2c/devices/i2c-%d/name", bus);
+    FILE *f = fopen(path, "r");
+    if (!f) return 0;
+    if (!fgets(name, sizeof(name), f)) name[0] = '\0';
+    fclose(f);
+    return strstr(name, "SMBus") || strstr(name, "smbus");
+}
+
+DDC_Status ddc_implementation_get_display_info_list(int flags, DDC_Display_Info_List **list_out) {
+    (void)flags;
+    if (!list_out) return DDC_ERROR;
+
+    /* Only the buses DRM connectors point at, where the driver says; otherwise
+     * (a driver with no `ddc` links) every /dev/i2c-N but the SMBus ones. In
+     * number order, so a display keeps its list position (part of its id)
+     * across enumerations while nothing is plugged or unplugged. */
+    int buses[DDC_MAX_BUSES];
+    int nbuses = drm_ddc_buses(buses);
+    if (nbuses == 0) {
+        DIR *dev = opendir("/dev");
+        if (!dev) return DDC_ERROR;
+        for (struct dirent *e; (e = readdir(dev)) != NULL; ) {
+            int n;
+            char tail;
+            if (sscanf(e->d_name, "i2c-%d%c", &n, &tail) == 1 && !is_smbus(n))
+                nbuses = add_bus(buses, nbuses, n);
+        }
+        closedir(dev);
+    }
+    qsort(buses, (size_t)nbuses, sizeof(buses[0]), cmp_int);
+
+    DDC_Display_Info_List *list = (DDC_Display_Info_List*)calloc(1, sizeof(*list));
+    if (!list) return DDC_ERROR;
+    list->info = (DDC_Display_Info*)calloc((size_t)(nbuses ? nbuses : 1), sizeof(DDC_Display_Info));
+    if (!list->info) { free(list); return DDC_ERROR; }
+
+    for (int i = 0; i < nbuses; i++) {
+        char path[32];
+        snprintf(path, sizeof(path), "/dev/i2c-%d", buses[i]);
+        int fd = open(path, O_RDWR | O_CLOEXEC);
+        if (fd < 0) continue;
+        uint8_t edid[128];
+        int found = read_edid(fd, edid) == 0;
+        close(fd);
+        if (!found) continue;   /* no display on this bus (or not one that talks) */
+
+        DDC_Display_Ref dref = (DDC_Display_Ref)malloc(sizeof(*dref));
+        if (!dref) { ddc_implementation_free_display_info_list(list); return DDC_ERROR; }
+        snprintf(dref->device_path, sizeof(dref->device_path), "%s", path);
+        DDC_Display_Info *info = &list->info[list->ct++];
+        info->dref = dref;
+        info->vendor_id = (uint32_t)((edid[8] << 8) | edid[9]);     /* packed EISA id, as linux.c */
+        info->product_id = (uint32_t)(edid[10] | (edid[11] << 8));
+        info->is_builtin = 0;   /* a panel that won't speak DDC/CI fails the probe instead */
+        display_db_identity_from_edid(info->identity, sizeof(info->identity), edid, sizeof(edid));
+        memcpy(dref->identity, info->identity, sizeof(dref->identity));
+    }
+
+    if (list->ct == 0) { ddc_implementation_free_display_info_list(list); return DDC_ERROR; }
+    *list_out = list;
+    return DDC_OK;
+}
+
+void ddc_implementation_free_display_info_list(DDC_Display_Info_List *list) {
+    if (!list) return;
+    for (int i = 0; i < list->ct; i++) free(list->info[i].dref);
+    free(list->info);
+    free(list);
+}
+
+DDC_Status ddc_implementation_open_display(DDC_Display_Ref dref, int flags, DDC_Display_Handle *handle_out) {
+    (void)flags;
+    if (!dref || !handle_out) return DDC_ERROR;
+    int fd = open(dref->device_path, O_RDWR | O_CLOEXEC);
+    if (fd < 0) return DDC_ERROR;
+    DDC_Display_Handle h = (DDC_Display_Handle)calloc(1, sizeof(*h));
+    if (!h) { close(fd); return DDC_ERROR; }
+    h->fd = fd;
+    memcpy(h->identity, dref->identity, sizeof(h->identity));
+    long pct = 0, floor_pct = 0;
+    if (h->identity[0]) {
+        display_db_get_long(h->identity, "sleep_pct", &pct);
+        display_db_get_long(h->identity, "sleep_floor_pct", &floor_pct);
+    }
+    const ddcci_transport io = { bus_write, bus_read, bus_now_us, bus_sleep_us, &h->fd };
+    ddcci_init(&h->bus, &io, (int)pct, (int)floor_pct);
+    *handle_out = h;
+    return DDC_OK;
+}
+
+DDC_Status ddc_implementation_close_display(DDC_Display_Handle handle) {
+    if (!handle) return DDC_ERROR;
+    close(handle->fd);
+    free(handle);
+    return DDC_OK;
+}
+
+DDC_Status ddc_implementation_get_non_table_vcp_value(DDC_Display_Handle h, uint8_t feature_code, DDC_Non_Table_Vcp_Value *value_out) {
+    if (!h || !value_out) return DDC_ERROR;
+    uint16_t max = 0, cur = 0;
+    ddcci_result r = ddcci_get(&h->bus, feature_code, &max, &cur);
+    remember_pacing(h);
+    if (r != DDCCI_OK) return DDC_ERROR;
+    value_out->mh = (uint8_t)(max >> 8);
+    value_out->ml = (uint8_t)(max & 0xFF);
+    value_out->sh = (uint8_t)(cur >> 8);
+    value_out->sl = (uint8_t)(cur & 0xFF);
+    return DDC_OK;
+}
+
+DDC_Status ddc_implementation_set_non_table_vcp_value(DDC_Display_Handle h, uint8_t feature_code, uint8_t hi_byte, uint8_t lo_byte) {
+    if (!h) return DDC_ERROR;
+    ddcci_result r = ddcci_set(&h->bus, feature_code, (uint16_t)(hi_byte << 8 | lo_byte));
+    remember_pacing(h);
+    return r == DDCCI_OK ? DDC_OK : DDC_ERROR;
+}
@@ -1,34 +1,59 @@
+/* NetBSD DDC/CI over iic(4): each message is one I2C_IOCTL_EXEC on the bus's
+ * device, and the protocol engine (ddcci.h) builds, paces and retries them. */
 #include "platform/ddc/implementation.h"
 #include "platform/ddc/abstraction.h"
+#include "platform/ddc/ddcci.h"
 #include <fcntl.h>
+#include <time.h>
 #include <unistd.h>
 #include <sys/ioctl.h>
 #include <dev/i2c/i2c_io.h>
 #include <stdlib.h>
 #include <string.h>
 
-/* DDC/CI I2C wire addresses. These are bus-level details specific to this
- * raw-ioctl NetBSD backend, so they live here rather than in the public API. */
-#define DDC_ADDR       0x6E         /* host -> display write address */
-#define DDC_REPLY_ADDR 0x6F         /* display -> host reply address */
-#define DDC_ADDR_7BIT  (DDC_ADDR >> 1)  /* 0x37, for 7-bit addressing */
-
 struct DDC_Display_Ref_s {
     char device_path[64];
 };
 
 struct DDC_Display_Handle_s {
     int fd;
-    int max_brightness;
-    int current_brightness;
+    ddcci_bus bus;
 };
 
-static uint8_t ddc_checksum(uint8_t init, const uint8_t *data, int len) {
-    uint8_t chk = init;
-    for (int i = 0; i < len; i++) {
-        chk ^= data[i];
+/* The engine's transport: one message to or from the display's DDC/CI
+ * address, on the bus `ctx` (an int fd) points to. */
+static int bus_write(void *ctx, const uint8_t *buf, int len) {
+    i2c_ioctl_exec_t iie;
+    memset(&iie, 0, sizeof(iie));
+    iie.iie_op = I2C_OP_WRITE_WITH_STOP;
+    iie.iie_addr = DDCCI_ADDR_7BIT;
+    iie.iie_cmd = buf;
+    iie.iie_cmdlen = (size_t)len;
+    return ioctl(*(int*)ctx, I2C_IOCTL_EXEC, &iie) == 0 ? 0 : -1;
+}
+
+static int bus_read(void *ctx, uint8_t *buf, int len) {
+    i2c_ioctl_exec_t iie;
+    memset(&iie, 0, sizeof(iie));
+    iie.iie_op = I2C_OP_READ_WITH_STOP;
+    iie.iie_addr = DDCCI_ADDR_7BIT;
+    iie.iie_buf = buf;
+    iie.iie_buflen = (size_t)len;
+    return ioctl(*(int*)ctx, I2C_IOCTL_EXEC, &iie) == 0 ? 0 : -1;
+}
+
+static long long bus_now_us(void *ctx) {
+    (void)ctx;
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+static void bus_sleep_us(void *ctx, long long us) {
+    for (long long until = bus_now_us(ctx) + us, left = us; left > 0; left = until - bus_now_us(ctx)) {
+        struct timespec ts = { (time_t)(left / 1000000), (long)(left % 1000000) * 1000L };
+        nanosleep(&ts, NULL);
     }
-    return chk;
 }
 
 DDC_Status ddc_implementation_get_display_info_list(int flags, DDC_Display_Info_List **list_out) {
@@ -49,17 +74,10 @@ DDC_Status ddc_implementation_get_display_info_list(int flags, DDC_Display_Info_
         int fd = open(paths[i], O_RDWR);
         if (fd < 0) continue;
 
-        uint8_t test_cmd[] = {0x51, 0x82, 0x01, VCP_BRIGHTNESS, 0x00, 0x00};
-        test_cmd[5] = ddc_checksum(DDC_ADDR, test_cmd, (int)sizeof(test_cmd) - 1);
-
-        i2c_ioctl_exec_t iie;
-        memset(&iie, 0, sizeof(iie));
-        iie.iie_op = I2C_OP_WRITE_WITH_STOP;
-        iie.iie_addr = DDC_ADDR_7BIT;
-        iie.iie_cmd = test_cmd;
-        iie.iie_cmdlen = sizeof(test_cmd);
-
-        if (ioctl(fd, I2C_IOCTL_EXEC, &iie) == 0) {
+        /* Something at the DDC/CI address ACKs a get request: a display. */
+        uint8_t probe[DDCCI_GET_REQUEST_LEN];
+        ddcci_build_get(probe, VCP_BRIGHTNESS);
+        if (bus_write(&fd, probe, (int)sizeof(probe)) == 0) {
             DDC_Display_Info *newinfo = (DDC_Display_Info*)realloc(list->info, (size_t)(list->ct + 1) * sizeof(DDC_Display_Info));
             if (!newinfo) { close(fd); free(list->info); free(list); return DDC_ERROR; }
             list->info = newinfo;
@@ -73,6 +91,7 @@ DDC_Status ddc_implementation_get_display_info_list(int flags, DDC_Display_Info_
             list->info[list->ct].vendor_id = 0;
             list->info[list->ct].product_id = 0;
             list->info[list->ct].is_builtin = 0;
+            list->info[list->ct].identity[0] = '\0';   /* no EDID read here */
             list->ct++;
         }
 
@@ -97,7 +116,11 @@ DDC_Status ddc_implementation_open_display(DDC_Display_Ref dref, int flags, DDC_
     if (fd < 0) return DDC_ERROR;
     DDC_Display_Handle h = (DDC_Display_Handle)malloc(sizeof(*h));
     if (!h) { close(fd); return DDC_ERROR; }
-    h->fd = fd; h->max_brightness = 100; h->current_brightness = 50; *handle_out = h; return DDC_OK;
+    h->fd = fd;
+    const ddcci_transport io = { bus_write, bus_read, bus_now_us, bus_sleep_us, &h->fd };
+    ddcci_init(&h->bus, &io, 0, 0);   /* no EDID read here, so no identity to remember pacing under */
+    *handle_out = h;
+    return DDC_OK;
 }
 
 DDC_Status ddc_implementation_close_display(DDC_Display_Handle handle) {
@@ -109,28 +132,14 @@ DDC_Status ddc_implementation_close_display(DDC_Display_Handle handle) {
 
 DDC_Status ddc_implementation_get_non_table_vcp_value(DDC_Display_Handle h, uint8_t feature_code, DDC_Non_Table_Vcp_Value *value_out) {
     if (!h || !value_out) return DDC_ERROR;
-    uint8_t cmd[] = {0x51, 0x82, 0x01, feature_code, 0x00, 0x00};
-    cmd[5] = ddc_checksum(DDC_ADDR, cmd, (int)sizeof(cmd) - 1);
-    i2c_ioctl_exec_t iie; memset(&iie, 0, sizeof(iie));
-    iie.iie_op = I2C_OP_WRITE_WITH_STOP; iie.iie_addr = DDC_ADDR_7BIT; iie.iie_cmd = cmd; iie.iie_cmdlen = sizeof(cmd);
-    if (ioctl(h->fd, I2C_IOCTL_EXEC, &iie) < 0) return DDC_ERROR;
-    usleep(40000);
-    uint8_t reply[12]; memset(&iie, 0, sizeof(iie));
-    iie.iie_op = I2C_OP_READ_WITH_STOP; iie.iie_addr = DDC_ADDR_7BIT; iie.iie_buf = reply; iie.iie_buflen = sizeof(reply);
-    if (ioctl(h->fd, I2C_IOCTL_EXEC, &iie) < 0) return DDC_ERROR;
-    if (reply[0] != DDC_REPLY_ADDR || reply[2] != 0x02 || reply[4] != feature_code) return DDC_ERROR;
-    value_out->mh = reply[6]; value_out->ml = reply[7]; value_out->sh = reply[8]; value_out->sl = reply[9];
-    h->max_brightness = (reply[6] << 8) | reply[7]; h->current_brightness = (reply[8] << 8) | reply[9];
+    uint16_t max = 0, cur = 0;
+    if (ddcci_get(&h->bus, feature_code, &max, &cur) != DDCCI_OK) return DDC_ERROR;
+    value_out->mh = (uint8_t)(max >> 8); value_out->ml = (uint8_t)(max & 0xFF);
+    value_out->sh = (uint8_t)(cur >> 8); value_out->sl = (uint8_t)(cur & 0xFF);
     return DDC_OK;
 }
 
 DDC_Status ddc_implementation_set_non_table_vcp_value(DDC_Display_Handle h, uint8_t feature_code, uint8_t hi_byte, uint8_t lo_byte) {
     if (!h) return DDC_ERROR;
-    uint8_t cmd[] = {0x51, 0x84, 0x03, feature_code, hi_byte, lo_byte, 0x00};
-    cmd[6] = ddc_checksum(DDC_ADDR, cmd, (int)sizeof(cmd) - 1);
-    i2c_ioctl_exec_t iie; memset(&iie, 0, sizeof(iie));
-    iie.iie_op = I2C_OP_WRITE_WITH_STOP; iie.iie_addr = DDC_ADDR_7BIT; iie.iie_cmd = cmd; iie.iie_cmdlen = sizeof(cmd);
-    if (ioctl(h->fd, I2C_IOCTL_EXEC, &iie) < 0) return DDC_ERROR;
-    h->current_brightness = (hi_byte << 8) | lo_byte;
-    return DDC_OK;
+    return ddcci_set(&h->bus, feature_code, (uint16_t)(hi_byte << 8 | lo_byte)) == DDCCI_OK ? DDC_OK : DDC_ERROR;
 }
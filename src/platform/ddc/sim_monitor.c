@@ -0,0 +1,135 @@
+#include "platform/ddc/sim_monitor.h"
+#include <string.h>
+
+#define SIM_HOST_SEED   0x6E   /* requests: XOR from the monitor's address */
+#define SIM_REPLY_SEED  0x50   /* replies: from the virtual host address */
+
+static uint8_t checksum(uint8_t seed, const uint8_t *data, int len) {
+    uint8_t chk = seed;
+    for (int i = 0; i < len; i++) chk ^= data[i];
+    return chk;
+}
+
+/* Percent chances, from a small LCG seeded at init, so runs repeat. */
+static int chance(sim_monitor *m, int pct) {
+    if (pct <= 0) return 0;
+    m->rng = m->rng * 6364136223846793005ULL + 1442695040888963407ULL;
+    return (int)((m->rng >> 33) % 100) < pct;
+}
+
+void sim_monitor_init(sim_monitor *m, const sim_timing *t) {
+    memset(m, 0, sizeof(*m));
+    if (t) m->timing = *t;
+    if (m->timing.us_per_byte <= 0) m->timing.us_per_byte = SIM_MONITOR_US_PER_BYTE;
+    m->rng = 1;
+}
+
+void sim_monitor_add_feature(sim_monitor *m, uint8_t code, uint16_t max, uint16_t cur) {
+    if (m->nvcp == SIM_MONITOR_MAX_FEATURES) return;
+    m->vcp[m->nvcp].code = code;
+    m->vcp[m->nvcp].max = max;
+    m->vcp[m->nvcp].cur = cur > max ? max : cur;
+    m->nvcp++;
+}
+
+static int find_feature(const sim_monitor *m, uint8_t code) {
+    for (int i = 0; i < m->nvcp; i++) if (m->vcp[i].code == code) return i;
+    return -1;
+}
+
+int sim_monitor_value(const sim_monitor *m, uint8_t code) {
+    int i = find_feature(m, code);
+    return i < 0 ? -1 : m->vcp[i].cur;
+}
+
+/* The bus time of a message: its address byte and `len` more. */
+static void on_the_wire(sim_monitor *m, int len) {
+    m->now_us += (long long)(len + 1) * m->timing.us_per_byte;
+}
+
+static int sim_write(void *ctx, const uint8_t *buf, int len) {
+    sim_monitor *m = (sim_monitor*)ctx;
+    m->writes++;
+    if (m->now_us < m->busy_until) {   /* still settling: not even the address is ACKed */
+        on_the_wire(m, 0);
+        m->naks++;
+        return -1;
+    }
+    on_the_wire(m, len);
+    /* Framing: source 0x51, 0x80 | payload length, payload, checksum. A monitor
+     * ignores what doesn't add up (and forgets any reply it had ready). */
+    m->has_reply = 0;
+    if (len < 4 || buf[0] != 0x51 || !(buf[1] & 0x80) || (buf[1] & 0x7F) != len - 3 ||
+        checksum(SIM_HOST_SEED, buf, len - 1) != buf[len - 1]) {
+        m->bad_packets++;
+        return 0;
+    }
+    int f = find_feature(m, buf[3]);
+    if (buf[2] == 0x01 && len == DDCCI_GET_REQUEST_LEN) {   /* Get VCP Feature */
+        m->gets++;
+        uint8_t *r = m->reply;
+        memset(r, 0, sizeof(m->reply));
+        r[0] = 0x6E;
+        r[1] = 0x88;
+        r[2] = 0x02;
+        r[3] = f < 0 ? 0x01 : 0x00;   /* result: unsupported, or no error */
+        r[4] = buf[3];
+        if (f >= 0) {
+            r[6] = (uint8_t)(m->vcp[f].max >> 8);
+            r[7] = (uint8_t)(m->vcp[f].max & 0xFF);
+            r[8] = (uint8_t)(m->vcp[f].cur >> 8);
+            r[9] = (uint8_t)(m->vcp[f].cur & 0xFF);
+        }
+        r[10] = checksum(SIM_REPLY_SEED, r, 10);
+        m->has_reply = 1;
+        m->reply_at = m->now_us + m->timing.reply_ready_ms * 1000LL;
+    } else if (buf[2] == 0x03 && len == DDCCI_SET_REQUEST_LEN) {   /* Set VCP Feature */
+        m->sets++;
+        if (f >= 0) {
+            uint16_t v = (uint16_t)(buf[4] << 8 | buf[5]);
+            m->vcp[f].cur = v > m->vcp[f].max ? m->vcp[f].max : v;
+        }
+        m->busy_until = m->now_us + m->timing.settle_ms * 1000LL;
+    } else {
+        m->bad_packets++;
+    }
+    return 0;
+}
+
+static int sim_read(void *ctx, uint8_t *buf, int len) {
+    sim_monitor *m = (sim_monitor*)ctx;
+    m->reads++;
+    if (m->now_us < m->busy_until || (m->has_reply && m->now_us < m->reply_at && m->timing.early_read_nak)) {
+        on_the_wire(m, 0);
+        m->naks++;
+        return -1;
+    }
+    on_the_wire(m, len);
+    memset(buf, 0, (size_t)len);
+    if (!m->has_reply || m->now_us < m->reply_at) {   /* nothing for the host (yet) */
+        static const uint8_t null_msg[3] = { 0x6E, 0x80, 0xBE };
+        memcpy(buf, null_msg, (size_t)(len < 3 ? len : 3));
+        m->nulls++;
+        return 0;
+    }
+    memcpy(buf, m->reply, (size_t)(len < DDCCI_GET_REPLY_LEN ? len : DDCCI_GET_REPLY_LEN));
+    if (len > 9 && chance(m, m->timing.garble_pct)) {
+        buf[9] ^= 0x01;
+        m->garbled++;
+    }
+    m->has_reply = 0;
+    return 0;
+}
+
+static long long sim_now(void *ctx) {
+    return ((sim_monitor*)ctx)->now_us;
+}
+
+static void sim_sleep(void *ctx, long long us) {
+    if (us > 0) ((sim_monitor*)ctx)->now_us += us;
+}
+
+ddcci_transport sim_monitor_transport(sim_monitor *m) {
+    ddcci_transport io = { sim_write, sim_read, sim_now, sim_sleep, m };
+    return io;
+}
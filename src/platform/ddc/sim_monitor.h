@@ -0,0 +1,64 @@
+#ifndef DDC_SIM_MONITOR_H
+#define DDC_SIM_MONITOR_H
+
+#include "platform/ddc/ddcci.h"
+#include <stdint.h>
+
+/* Test-only: a monitor simulated at the DDC/CI byte level, for everything the
+ * in-memory mock skips (it stops at implementation.h). It answers the raw I2C
+ * messages a backend sends through the protocol engine -- so it plugs in as a
+ * ddcci_transport, exactly where linux_i2c.c and netbsd.c put the bus -- and
+ * keeps a virtual clock that the engine's sleeps advance. Framing, pacing,
+ * polling and retries can then be tested, and timed, with no monitor and no
+ * real waits.
+ *
+ * It holds a monitor to the rules a real one enforces in its own way:
+ *   - a request must be framed right (source, length, checksum), or it is
+ *     ignored, as monitors do;
+ *   - a Get VCP Feature reply is only ready reply_ready_ms after the request;
+ *     a read before then gets a null message (or, with early_read_nak, no ACK);
+ *   - after a Set VCP Feature the monitor is busy for settle_ms, and NAKs any
+ *     message sooner;
+ *   - every byte costs bus time, at us_per_byte (DDC runs at 100 kHz: about
+ *     90 us for a byte and its ACK);
+ *   - with garble_pct, that share of replies arrive with a bit flipped. */
+
+#define SIM_MONITOR_MAX_FEATURES 8
+#define SIM_MONITOR_US_PER_BYTE  90
+
+typedef struct {
+    int reply_ready_ms;
+    int early_read_nak;
+    int settle_ms;
+    int us_per_byte;     /* 0: SIM_MONITOR_US_PER_BYTE */
+    int garble_pct;
+} sim_timing;
+
+typedef struct {
+    sim_timing timing;
+    struct { uint8_t code; uint16_t max, cur; } vcp[SIM_MONITOR_MAX_FEATURES];
+    int nvcp;
+    long long now_us;                  /* the virtual clock */
+    long long busy_until;              /* settling after a set: NAK until then */
+    uint8_t reply[DDCCI_GET_REPLY_LEN];
+    int has_reply;                     /* a get is waiting to be read */
+    long long reply_at;                /* ... from then on */
+    unsigned long long rng;
+    /* What went over the bus. */
+    unsigned long writes, reads, naks, nulls, garbled, bad_packets, gets, sets;
+} sim_monitor;
+
+/* A monitor with no features yet, at virtual time 0. */
+void sim_monitor_init(sim_monitor *m, const sim_timing *t);
+
+/* Give it VCP feature `code` (non-table), currently `cur` of `max`. A get for
+ * a code it doesn't have is answered "unsupported". */
+void sim_monitor_add_feature(sim_monitor *m, uint8_t code, uint16_t max, uint16_t cur);
+
+/* Feature `code`'s current value as the monitor has it, or -1. */
+int  sim_monitor_value(const sim_monitor *m, uint8_t code);
+
+/* The monitor as an engine transport: ddcci_init(&bus, &io, ...) over it. */
+ddcci_transport sim_monitor_transport(sim_monitor *m);
+
+#endif /* DDC_SIM_MONITOR_H */
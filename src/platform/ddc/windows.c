@@ -19,7 +19,9 @@
  * ignores DDC -- an acceptable, expected outcome for the feasibility pass. */
 
 /* A ref carries the physical-monitor description we enumerated; the handle is
- * the live HANDLE used for VCP I/O. */
+ * the live HANDLE used for VCP I/O. Opening moves the HANDLE from the ref to the
+ * handle; freeing the info list destroys any the caller didn't open (reconcile
+ * lists every monitor but opens only new ones). */
 struct DDC_Display_Ref_s    { HANDLE hmon; };
 struct DDC_Display_Handle_s { HANDLE hmon; };
 
@@ -95,7 +97,10 @@ void ddc_implementation_free_display_info_list(DDC_Display_Info_List *list) {
     if (!list) return;
     if (list->info) {
         for (int i = 0; i < list->ct; i++) {
-            if (list->info[i].dref) free(list->info[i].dref);
+            struct DDC_Display_Ref_s *wr = (struct DDC_Display_Ref_s *)list->info[i].dref;
+            if (!wr) continue;
+            if (wr->hmon) DestroyPhysicalMonitor(wr->hmon);
+            free(wr);
         }
         free(list->info);
     }
@@ -109,6 +114,7 @@ DDC_Status ddc_implementation_open_display(DDC_Display_Ref dref, int flags, DDC_
     struct DDC_Display_Handle_s *h = (struct DDC_Display_Handle_s *)malloc(sizeof(*h));
     if (!h) return DDC_ERROR;
     h->hmon = wr->hmon;
+    wr->hmon = NULL;   /* now owned by the handle */
     *handle_out = (DDC_Display_Handle)h;
     return DDC_OK;
 }
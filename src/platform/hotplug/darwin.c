@@ -0,0 +1,6 @@
+#include "platform/hotplug/hotplug.h"
+
+/* No display-change events wired up on macOS yet (the candidate is
+ * CGDisplayRegisterReconfigurationCallback; see TODO.md) -- the daemon polls. */
+int  hotplug_start(hotplug_fn on_change, hotplug_fn on_lost) { (void)on_change; (void)on_lost; return -1; }
+void hotplug_stop(void) {}
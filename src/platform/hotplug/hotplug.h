@@ -0,0 +1,17 @@
+#ifndef DIMMIT_PLATFORM_HOTPLUG_H
+#define DIMMIT_PLATFORM_HOTPLUG_H
+
+/* Optional display-change notification, so the daemon reconciles only when a
+ * connector actually changes instead of re-enumerating on a timer. on_change is
+ * called from the backend's own thread, once per settled burst of events (a dock
+ * attach fires several). Backends with no event source are no-ops -- the daemon
+ * falls back to polling. If the event source fails later, on_lost is called
+ * once (from the same thread, which then exits) and no more on_change follow:
+ * the daemon goes back to polling then too. */
+typedef void (*hotplug_fn)(void);
+
+/* 0 = event-driven; <0 = unsupported/failed */
+int  hotplug_start(hotplug_fn on_change, hotplug_fn on_lost);
+void hotplug_stop(void);
+
+#endif /* DIMMIT_PLATFORM_HOTPLUG_H */
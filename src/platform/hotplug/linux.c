@@ -0,0 +1,80 @@
+/* _GNU_SOURCE: pipe2/SOCK_CLOEXEC and the netlink headers' types. */
+#define _GNU_SOURCE
+#include "platform/hotplug/hotplug.h"
+#include "platform/hotplug/uevent.h"
+
+#include <fcntl.h>
+#include <linux/netlink.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+/* Kernel uevents arrive on a NETLINK_KOBJECT_UEVENT socket (multicast group 1,
+ * the raw kernel feed that udev itself listens to; no udev dependency). DRM
+ * emits ACTION=change/HOTPLUG=1 on its card device whenever a connector's
+ * state changes. A dock attach fires a handful of them across a few hundred ms,
+ * so we wait for the feed to go quiet before asking for one reconcile. */
+#define HOTPLUG_SETTLE_MS 300
+
+static hotplug_fn g_on_change = NULL;
+static hotplug_fn g_on_lost = NULL;
+static int        g_sock = -1;
+static int        g_stop[2] = { -1, -1 };   /* self-pipe: write end wakes the thread */
+static pthread_t  g_thread;
+static int        g_thread_started = 0;
+
+static void *hotplug_thread(void *arg) {
+    (void)arg;
+    int r;
+    while ((r = uevent_wait_hotplug(g_sock, g_stop[0], HOTPLUG_SETTLE_MS)) > 0)
+        g_on_change();
+    if (r < 0) {
+        perror("hotplug: uevent socket");
+        g_on_lost();
+    }
+    return NULL;
+}
+
+static void close_all(void) {
+    if (g_sock >= 0) { close(g_sock); g_sock = -1; }
+    for (int i = 0; i < 2; i++) if (g_stop[i] >= 0) { close(g_stop[i]); g_stop[i] = -1; }
+}
+
+int hotplug_start(hotplug_fn on_change, hotplug_fn on_lost) {
+    g_on_change = on_change;
+    g_on_lost = on_lost;
+    g_sock = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_KOBJECT_UEVENT);
+    if (g_sock < 0) { perror("hotplug: socket"); return -1; }
+
+    struct sockaddr_nl addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.nl_family = AF_NETLINK;
+    addr.nl_groups = 1;   /* kernel uevents */
+    if (bind(g_sock, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        perror("hotplug: bind");
+        close_all();
+        return -1;
+    }
+    if (pipe2(g_stop, O_CLOEXEC) < 0) {
+        perror("hotplug: pipe");
+        close_all();
+        return -1;
+    }
+    if (pthread_create(&g_thread, NULL, hotplug_thread, NULL) != 0) {
+        close_all();
+        return -1;
+    }
+    g_thread_started = 1;
+    return 0;
+}
+
+void hotplug_stop(void) {
+    if (g_thread_started) {
+        if (write(g_stop[1], "x", 1) < 0) perror("hotplug: stop");
+        pthread_join(g_thread, NULL);
+        g_thread_started = 0;
+    }
+    close_all();
+}
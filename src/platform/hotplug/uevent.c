@@ -0,0 +1,62 @@
+#define _POSIX_C_SOURCE 200809L
+#include "platform/hotplug/uevent.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/socket.h>
+
+/* Large enough for any uevent; the kernel caps the environment at 2 KiB. */
+#define UEVENT_BUF 4096
+
+int uevent_is_drm_hotplug(const char *msg, size_t len) {
+    int change = 0, drm = 0, hotplug = 0;
+    size_t i = 0;
+    /* Skip the "action@devpath" header, then walk the KEY=VALUE fields. */
+    while (i < len && msg[i] != '\0') i++;
+    while (++i < len) {
+        const char *field = msg + i;
+        size_t n = strnlen(field, len - i);
+        if (n == strlen("ACTION=change") && memcmp(field, "ACTION=change", n) == 0) change = 1;
+        else if (n == strlen("SUBSYSTEM=drm") && memcmp(field, "SUBSYSTEM=drm", n) == 0) drm = 1;
+        else if (n == strlen("HOTPLUG=1") && memcmp(field, "HOTPLUG=1", n) == 0) hotplug = 1;
+        i += n;
+    }
+    return change && drm && hotplug;
+}
+
+/* Consume every datagram queued on fd. Returns how many were DRM hotplugs (an
+ * overrun counting as one: what the kernel dropped is unknown, so resync), or
+ * -1 on a read error. */
+static int drain(int fd) {
+    char buf[UEVENT_BUF];
+    int hits = 0;
+    for (;;) {
+        ssize_t n = recv(fd, buf, sizeof(buf), MSG_DONTWAIT);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return hits;
+            if (errno == EINTR) continue;
+            if (errno == ENOBUFS) { hits++; continue; }
+            return -1;
+        }
+        if (n == 0) { errno = ECONNRESET; return -1; }
+        hits += uevent_is_drm_hotplug(buf, (size_t)n);
+    }
+}
+
+int uevent_wait_hotplug(int fd, int stop_fd, int settle_ms) {
+    int seen = 0;
+    for (;;) {
+        struct pollfd p[2] = { { fd, POLLIN, 0 }, { stop_fd, POLLIN, 0 } };
+        int r = poll(p, 2, seen ? settle_ms : -1);
+        if (r < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        if (p[1].revents) return 0;
+        if (r == 0) return 1;          /* quiet for settle_ms after a hotplug */
+        int hits = drain(fd);
+        if (hits < 0) return -1;
+        if (hits > 0) seen = 1;        /* (re)start the settle window */
+    }
+}
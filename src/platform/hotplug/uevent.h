@@ -0,0 +1,23 @@
+#ifndef DIMMIT_PLATFORM_HOTPLUG_UEVENT_H
+#define DIMMIT_PLATFORM_HOTPLUG_UEVENT_H
+
+#include <stddef.h>
+
+/* Kernel uevent handling for the Linux hotplug backend, kept apart from the
+ * netlink socket so it can be driven from any datagram fd (a socketpair in the
+ * tests). A uevent is one datagram: "action@devpath" followed by NUL-separated
+ * KEY=VALUE fields. */
+
+/* 1 if the message is a DRM connector change (ACTION=change, SUBSYSTEM=drm,
+ * HOTPLUG=1), else 0. */
+int uevent_is_drm_hotplug(const char *msg, size_t len);
+
+/* Block until a DRM hotplug arrives on `fd`, then keep draining until the fd has
+ * been quiet for `settle_ms`, so a burst collapses into one return. Other uevents
+ * are consumed and ignored; so are overruns (ENOBUFS), except that the events
+ * lost might have been hotplugs, so one counts as a hotplug. Returns 1 for a
+ * settled burst, 0 once `stop_fd` becomes readable, or -1 (errno set) on a
+ * read error the fd won't recover from. */
+int uevent_wait_hotplug(int fd, int stop_fd, int settle_ms);
+
+#endif /* DIMMIT_PLATFORM_HOTPLUG_UEVENT_H */
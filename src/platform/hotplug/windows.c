@@ -0,0 +1,6 @@
+#include "platform/hotplug/hotplug.h"
+
+/* No display-change events wired up on Windows yet (WM_DISPLAYCHANGE needs a
+ * message window) -- the daemon polls. */
+int  hotplug_start(hotplug_fn on_change, hotplug_fn on_lost) { (void)on_change; (void)on_lost; return -1; }
+void hotplug_stop(void) {}
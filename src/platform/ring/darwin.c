@@ -0,0 +1,18 @@
+#include "platform/ring/ring.h"
+
+#include <stddef.h>
+
+/* No shared command ring here yet (macOS has no eventfd or memfd; a POSIX shm
+ * object and a pipe doorbell would do) -- clients use the socket. */
+ring_host *ring_host_open(void) { return NULL; }
+int  ring_host_doorbell(const ring_host *h) { (void)h; return -1; }
+int  ring_host_drain(ring_host *h, unsigned long (*apply)(int dir)) { (void)h; (void)apply; return 0; }
+int  ring_host_hand_out(ring_host *h, dimmit_sock_t client, const char *reply) {
+    (void)h; (void)client; (void)reply;
+    return -1;
+}
+void ring_host_close(ring_host *h) { (void)h; }
+
+ring_client *ring_client_attach(dimmit_sock_t sock) { (void)sock; return NULL; }
+int  ring_client_post(ring_client *c, int dir) { (void)c; (void)dir; return -1; }
+void ring_client_close(ring_client *c) { (void)c; }
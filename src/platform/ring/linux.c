@@ -0,0 +1,161 @@
+/* _GNU_SOURCE: memfd_create, its sealing fcntls, and eventfd. */
+#define _GNU_SOURCE
+#include "platform/ring/ring.h"
+#include "command_ring.h"
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+/* The ring lives in a memfd sized once and then sealed, so no client can shrink
+ * it under the daemon's mapping (which would fault the daemon on its next pop).
+ * The doorbell is an eventfd: clients add 1 after each push, the daemon polls it
+ * and reads it back to zero before draining. */
+
+struct ring_host {
+    int           memfd;
+    int           bell;
+    command_ring *ring;
+    unsigned      pos;        /* the daemon's own read position */
+};
+
+struct ring_client {
+    int           bell;
+    command_ring *ring;
+};
+
+ring_host *ring_host_open(void) {
+    ring_host *h = calloc(1, sizeof(*h));
+    if (!h) return NULL;
+    h->memfd = memfd_create("dimmit-ring", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    h->bell = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (h->memfd < 0 || h->bell < 0 ||
+        ftruncate(h->memfd, sizeof(command_ring)) < 0 ||
+        fcntl(h->memfd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) < 0)
+        goto fail;
+    h->ring = mmap(NULL, sizeof(command_ring), PROT_READ | PROT_WRITE, MAP_SHARED, h->memfd, 0);
+    if (h->ring == MAP_FAILED) {
+        h->ring = NULL;
+        goto fail;
+    }
+    command_ring_init(h->ring);
+    return h;
+fail:
+    ring_host_close(h);
+    return NULL;
+}
+
+int ring_host_doorbell(const ring_host *h) {
+    return h ? h->bell : -1;
+}
+
+/* At most a ring's worth of pops per call: a client pushing as fast as the
+ * daemon pops would otherwise hold it here, with every other fd unserved. If
+ * that many were popped there may be more, so the doorbell is rung again and
+ * the caller's next poll() comes straight back for them. */
+int ring_host_drain(ring_host *h, unsigned long (*apply)(int dir)) {
+    uint64_t rung;
+    if (read(h->bell, &rung, sizeof(rung)) < 0) { /* not rung: drain anyway */ }
+    int n = 0, popped = 0, dir;
+    while (popped < COMMAND_RING_SLOTS && command_ring_pop(h->ring, &h->pos, &dir)) {
+        popped++;
+        if (dir == 0) continue;
+        apply(dir);
+        n++;
+    }
+    if (popped == COMMAND_RING_SLOTS) {
+        uint64_t one = 1;
+        if (write(h->bell, &one, sizeof(one)) < 0) { /* counter saturated: already rung */ }
+    }
+    return n;
+}
+
+int ring_host_hand_out(ring_host *h, dimmit_sock_t client, const char *reply) {
+    int fds[2] = { h->memfd, h->bell };
+    char cbuf[CMSG_SPACE(sizeof(fds))];
+    memset(cbuf, 0, sizeof(cbuf));
+    struct iovec iov = { (void*)reply, strlen(reply) };
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cbuf;
+    msg.msg_controllen = sizeof(cbuf);
+    struct cmsghdr *cm = CMSG_FIRSTHDR(&msg);
+    cm->cmsg_level = SOL_SOCKET;
+    cm->cmsg_type = SCM_RIGHTS;
+    cm->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cm), fds, sizeof(fds));
+    return sendmsg(client, &msg, MSG_NOSIGNAL) == (ssize_t)iov.iov_len ? 0 : -1;
+}
+
+void ring_host_close(ring_host *h) {
+    if (!h) return;
+    if (h->ring) munmap(h->ring, sizeof(command_ring));
+    if (h->memfd >= 0) close(h->memfd);
+    if (h->bell >= 0) close(h->bell);
+    free(h);
+}
+
+ring_client *ring_client_attach(dimmit_sock_t sock) {
+    static const char ask[] = "v1 0 ring\n";
+    if (send(sock, ask, sizeof(ask) - 1, MSG_NOSIGNAL) != (ssize_t)(sizeof(ask) - 1))
+        return NULL;
+
+    /* The reply is one short line carrying both descriptors. */
+    char line[64];
+    int fds[2] = { -1, -1 };
+    char cbuf[CMSG_SPACE(sizeof(fds))];
+    struct iovec iov = { line, sizeof(line) - 1 };
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cbuf;
+    msg.msg_controllen = sizeof(cbuf);
+    ssize_t n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+    if (n <= 0) return NULL;
+    line[n] = '\0';
+    struct cmsghdr *cm = CMSG_FIRSTHDR(&msg);
+    if (cm && cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_RIGHTS &&
+        cm->cmsg_len == CMSG_LEN(sizeof(fds)))
+        memcpy(fds, CMSG_DATA(cm), sizeof(fds));
+    if (strcmp(line, "v1 0 ok ring\n") != 0 || fds[0] < 0 || fds[1] < 0)
+        goto fail;
+
+    ring_client *c = calloc(1, sizeof(*c));
+    if (!c) goto fail;
+    c->ring = mmap(NULL, sizeof(command_ring), PROT_READ | PROT_WRITE, MAP_SHARED, fds[0], 0);
+    close(fds[0]);   /* the mapping keeps the memory */
+    if (c->ring == MAP_FAILED || c->ring->magic != COMMAND_RING_MAGIC) {
+        if (c->ring != MAP_FAILED) munmap(c->ring, sizeof(command_ring));
+        free(c);
+        close(fds[1]);
+        return NULL;
+    }
+    c->bell = fds[1];
+    return c;
+fail:
+    if (fds[0] >= 0) close(fds[0]);
+    if (fds[1] >= 0) close(fds[1]);
+    return NULL;
+}
+
+int ring_client_post(ring_client *c, int dir) {
+    if (command_ring_push(c->ring, dir) < 0) return -1;
+    uint64_t one = 1;
+    if (write(c->bell, &one, sizeof(one)) < 0) { /* counter saturated: already rung */ }
+    return 0;
+}
+
+void ring_client_close(ring_client *c) {
+    if (!c) return;
+    munmap(c->ring, sizeof(command_ring));
+    close(c->bell);
+    free(c);
+}
@@ -0,0 +1,41 @@
+#ifndef DIMMIT_PLATFORM_RING_H
+#define DIMMIT_PLATFORM_RING_H
+
+#include "platform/compat/net.h"  /* dimmit_sock_t */
+
+/* Optional zero-connect fast path: the daemon shares one command_ring (see
+ * command_ring.h) plus a doorbell with its local clients. A client asks for them
+ * once, over an already-authorized socket connection ("v1 <seq> ring", see
+ * command.h); after that each step is a lock-free enqueue and a doorbell ring,
+ * with no connect, accept, or authorization per press. Access control applies
+ * where the ring is handed out: only a connection that passed
+ * access_control_is_authorized() can ask for it. A client keeps the mapping until
+ * it exits, so revoking access takes effect at its next attach.
+ *
+ * Linux: a sealed memfd and an eventfd, passed with SCM_RIGHTS. Elsewhere this is
+ * unsupported (ring_host_open() returns NULL) and clients use the socket. */
+
+/* Daemon side. */
+typedef struct ring_host ring_host;
+
+ring_host *ring_host_open(void);                  /* NULL = unsupported/failed */
+int  ring_host_doorbell(const ring_host *h);      /* poll() for POLLIN */
+/* After the doorbell: clear it, then hand the queued steps to apply(dir), up to
+ * COMMAND_RING_SLOTS of them; if that many were there, the doorbell is left
+ * rung for the rest. Returns the number applied. */
+int  ring_host_drain(ring_host *h, unsigned long (*apply)(int dir));
+/* Send `reply` (one line) to `client` with the ring and doorbell attached.
+ * Returns 0, or -1 if it couldn't be sent whole. */
+int  ring_host_hand_out(ring_host *h, dimmit_sock_t client, const char *reply);
+void ring_host_close(ring_host *h);
+
+/* Client side. */
+typedef struct ring_client ring_client;
+
+/* Ask for the ring on a connected, otherwise idle blocking socket (which may be
+ * closed afterwards). NULL if the daemon or platform doesn't offer one. */
+ring_client *ring_client_attach(dimmit_sock_t sock);
+int  ring_client_post(ring_client *c, int dir);   /* 0, or -1 if the ring is full */
+void ring_client_close(ring_client *c);
+
+#endif /* DIMMIT_PLATFORM_RING_H */
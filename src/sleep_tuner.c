@@ -0,0 +1,48 @@
+#include "sleep_tuner.h"
+
+static int clamp_pct(int pct) {
+    if (pct < SLEEP_TUNER_MIN_PCT) return SLEEP_TUNER_MIN_PCT;
+    if (pct > SLEEP_TUNER_MAX_PCT) return SLEEP_TUNER_MAX_PCT;
+    return pct;
+}
+
+void sleep_tuner_init(sleep_tuner *t, int pct, int floor_pct) {
+    t->pct = pct > 0 ? clamp_pct(pct) : SLEEP_TUNER_DEFAULT_PCT;
+    t->floor_pct = floor_pct > 0 ? clamp_pct(floor_pct) : 0;
+    t->streak = 0;
+    t->held = 0;
+}
+
+int sleep_tuner_success(sleep_tuner *t) {
+    if (++t->streak < SLEEP_TUNER_TIGHTEN_AFTER) return 0;
+    t->streak = 0;
+    int limit = SLEEP_TUNER_MIN_PCT;
+    if (t->floor_pct) {
+        int above = t->floor_pct + (t->floor_pct + 3) / 4;
+        if (above > limit) limit = above;
+    }
+    int next = t->pct - t->pct / 10;
+    if (next == t->pct) next--;
+    if (next < limit) next = limit;
+    if (next < t->pct) {
+        t->pct = next;
+        return 1;
+    }
+    /* Held at the floor: after long enough without a failure, lower it. */
+    if (!t->floor_pct || ++t->held < SLEEP_TUNER_FORGET_AFTER) return 0;
+    t->held = 0;
+    t->floor_pct -= (t->floor_pct + 9) / 10;
+    if (t->floor_pct < SLEEP_TUNER_MIN_PCT) t->floor_pct = 0;
+    return 1;
+}
+
+int sleep_tuner_failure(sleep_tuner *t) {
+    t->streak = 0;
+    t->held = 0;
+    int floor = t->pct > t->floor_pct ? t->pct : t->floor_pct;
+    int next = clamp_pct(t->pct * 2);
+    if (next == t->pct && floor == t->floor_pct) return 0;
+    t->pct = next;
+    t->floor_pct = floor;
+    return 1;
+}
@@ -0,0 +1,40 @@
+#ifndef SLEEP_TUNER_H
+#define SLEEP_TUNER_H
+
+/* Calibrates how long a backend waits between the messages of a DDC exchange
+ * with one monitor, as a percentage of the spec's worst-case delays (libddcutil's
+ * sleep multiplier, times 100). Many monitors answer well inside the spec's
+ * delays, and every millisecond shaved there comes off each brightness step.
+ *
+ * Errors back off hard and success tightens slowly: every failure doubles the
+ * percentage and remembers the value that failed (the floor), and each run of
+ * SLEEP_TUNER_TIGHTEN_AFTER successes in a row takes a tenth off it -- but never
+ * to within a quarter of the floor, so a monitor isn't walked into the same
+ * failure over and over. A floor that has held the tuner back for
+ * SLEEP_TUNER_FORGET_AFTER runs is lowered a little, since one bad exchange (a
+ * monitor waking from standby, say) shouldn't pin it forever.
+ *
+ * Pure state: the caller applies pct and persists pct and floor_pct. */
+#define SLEEP_TUNER_DEFAULT_PCT  100
+#define SLEEP_TUNER_MIN_PCT      10
+#define SLEEP_TUNER_MAX_PCT      400
+#define SLEEP_TUNER_TIGHTEN_AFTER 16
+#define SLEEP_TUNER_FORGET_AFTER  16
+
+typedef struct {
+    int pct;          /* the delay to use now, in percent of the spec's */
+    int floor_pct;    /* the highest delay known to fail; 0 if none has */
+    int streak;       /* successes since the last change or failure */
+    int held;         /* runs the floor has kept from tightening */
+} sleep_tuner;
+
+/* Start at `pct` with `floor_pct` (as last persisted), clamped to range; 0 for
+ * either means unknown (SLEEP_TUNER_DEFAULT_PCT, no floor). */
+void sleep_tuner_init(sleep_tuner *t, int pct, int floor_pct);
+
+/* An exchange succeeded / failed at the current pct. Each returns 1 if pct or
+ * floor_pct changed (so it's time to apply and persist them), else 0. */
+int sleep_tuner_success(sleep_tuner *t);
+int sleep_tuner_failure(sleep_tuner *t);
+
+#endif /* SLEEP_TUNER_H */
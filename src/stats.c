@@ -0,0 +1,71 @@
+#define _POSIX_C_SOURCE 200809L   /* clock_gettime */
+#include "stats.h"
+
+#include <stdio.h>
+#include <time.h>
+
+long long stats_now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+/* Bucket for `us`: its bit length, capped to the last bucket. */
+static int bucket_of(unsigned long long us) {
+    int b = 0;
+    while (us && b < STATS_BUCKETS - 1) {
+        us >>= 1;
+        b++;
+    }
+    return b;
+}
+
+void stats_record(stats_histogram *h, long long us) {
+    unsigned long v = us > 0 ? (unsigned long)us : 0;
+    __atomic_fetch_add(&h->count[bucket_of(v)], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&h->n, 1, __ATOMIC_RELAXED);
+    unsigned long max = __atomic_load_n(&h->max_us, __ATOMIC_RELAXED);
+    while (v > max &&
+           !__atomic_compare_exchange_n(&h->max_us, &max, v, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {}
+}
+
+void stats_snapshot(const stats_histogram *from, stats_histogram *to) {
+    for (int i = 0; i < STATS_BUCKETS; i++)
+        to->count[i] = __atomic_load_n(&from->count[i], __ATOMIC_RELAXED);
+    to->n = __atomic_load_n(&from->n, __ATOMIC_RELAXED);
+    to->max_us = __atomic_load_n(&from->max_us, __ATOMIC_RELAXED);
+}
+
+void stats_add(stats_histogram *to, const stats_histogram *from) {
+    for (int i = 0; i < STATS_BUCKETS; i++) to->count[i] += from->count[i];
+    to->n += from->n;
+    if (from->max_us > to->max_us) to->max_us = from->max_us;
+}
+
+unsigned long stats_percentile(const stats_histogram *h, int pct) {
+    unsigned long total = 0;
+    for (int i = 0; i < STATS_BUCKETS; i++) total += h->count[i];
+    if (total == 0) return 0;
+    /* The rank of the value wanted, rounded up: p50 of 3 values is the 2nd. */
+    unsigned long rank = (total * (unsigned long)pct + 99) / 100;
+    if (rank == 0) rank = 1;
+    unsigned long seen = 0;
+    for (int i = 0; i < STATS_BUCKETS; i++) {
+        seen += h->count[i];
+        if (seen < rank) continue;
+        unsigned long upper = i == 0 ? 0 : (1UL << i) - 1;
+        return (i == STATS_BUCKETS - 1 || upper > h->max_us) ? h->max_us : upper;
+    }
+    return h->max_us;
+}
+
+int stats_format(char *buf, size_t len, const stats_histogram *h) {
+    int n = snprintf(buf, len, "n=%lu p50=%lu p90=%lu p99=%lu max=%lu buckets=",
+                     h->n, stats_percentile(h, 50), stats_percentile(h, 90),
+                     stats_percentile(h, 99), h->max_us);
+    for (int i = 0; i < STATS_BUCKETS; i++) {
+        size_t at = (size_t)n < len ? (size_t)n : len;   /* truncated: keep counting */
+        n += snprintf(buf + at, len - at, "%s%lu", i ? "," : "", h->count[i]);
+    }
+    return n;
+}
@@ -0,0 +1,46 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stddef.h>
+
+/* Fixed-bucket latency histograms, cheap enough for the hot path: recording is
+ * a bucket index (a bit scan) and two relaxed atomic adds, with no allocation
+ * and no lock, so any thread may record into a histogram any other thread is
+ * recording into. Buckets are powers of two in microseconds: bucket 0 counts
+ * values under 1 us, bucket i (i >= 1) those in [2^(i-1), 2^i), and the last
+ * bucket everything from 2^(STATS_BUCKETS-2) us (about 4 s) up. Percentiles are
+ * read back as the upper bound of the bucket they fall in -- so within a factor
+ * of two, which is plenty to tell a 40 ms monitor from a 400 ms one -- and never
+ * above the largest value recorded. */
+#define STATS_BUCKETS 24
+
+typedef struct {
+    unsigned long count[STATS_BUCKETS];
+    unsigned long n;           /* values recorded */
+    unsigned long max_us;      /* largest value recorded */
+} stats_histogram;
+
+/* Monotonic microseconds, for timing what gets recorded. */
+long long stats_now_us(void);
+
+/* Any thread: add one value (negative counts as 0). */
+void stats_record(stats_histogram *h, long long us);
+
+/* Copy `from` into `to` with atomic loads, for a reader on another thread. The
+ * copy is consistent per counter, not across them (n may run one ahead of the
+ * buckets); fine for statistics. */
+void stats_snapshot(const stats_histogram *from, stats_histogram *to);
+
+/* Fold `from` into `to`, bucket by bucket (neither may be recorded into
+ * meanwhile). */
+void stats_add(stats_histogram *to, const stats_histogram *from);
+
+/* The `pct`th percentile (0-100) in us, as described above; 0 if empty. */
+unsigned long stats_percentile(const stats_histogram *h, int pct);
+
+/* Format as "n=<n> p50=<us> p90=<us> p99=<us> max=<us> buckets=<c0>,<c1>,..."
+ * (every bucket, so a collector can merge histograms across hosts). Returns
+ * the length written, as snprintf. */
+int stats_format(char *buf, size_t len, const stats_histogram *h);
+
+#endif /* STATS_H */
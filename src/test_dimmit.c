@@ -1,22 +1,45 @@
 /* Unit tests for the daemon's logic, exercised through the modules it now links
- * normally: the pure brightness state machine (dimmer.{c,h}), the
- * command parser (command.{c,h}), the ddc abstraction driven by the in-memory
- * mock backend (platform/ddc/in_memory_mock.c), and the access-control mock
- * (platform/access-control/mock.c). No #include of dimmitd.c, and no real
- * clock, sockets, or worker thread are involved. */
+ * normally: the pure brightness state machine (dimmer.{c,h}), the command
+ * parser (command.{c,h}) and its poll() server (command_server.{c,h}), the ddc
+ * abstraction driven by the in-memory mock backend
+ * (platform/ddc/in_memory_mock.c), and the access-control mock
+ * (platform/access-control/mock.c). No #include of dimmitd.c, and no daemon
+ * worker thread is involved. The concurrency tests start threads and some
+ * tests wait on the real clock, but none asserts how fast anything ran: that
+ * is dimmit_bench's (bench_dimmit.c). */
+#define _POSIX_C_SOURCE 200809L   /* clock_gettime */
 #include "dimmer.h"
 #include "command.h"
+#include "command_server.h"
+#include "command_ring.h"
+#include "stats.h"
+#include "sleep_tuner.h"
+#include "display_db.h"
 #include "brightness.h"
 #include "display_controller.h"
+#include "platform/backlight/backlight.h"
 #include "platform/ddc/abstraction.h"
+#include "platform/ddc/ddcci.h"
+#include "platform/ddc/implementation.h"
 #include "platform/ddc/in_memory_mock.h"
+#include "platform/ddc/sim_monitor.h"
 #include "platform/access-control/access-control.h"
+#include "platform/ring/ring.h"
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
-#ifndef _WIN32
+#include <pthread.h>   /* clock_gettime on MinGW comes with winpthreads */
+#include <time.h>
+#ifdef _WIN32
+#include <windows.h>   /* Sleep */
+#else
 #include <unistd.h>
+#include <sched.h>
 #include <sys/socket.h>
+#include <sys/time.h>   /* struct timeval for SO_RCVTIMEO */
+#include <sys/stat.h>   /* mkdir, for the fake sysfs tree */
+#include "platform/hotplug/uevent.h"
 #endif
 
 extern int access_control_mock_authorized; /* from platform/access-control/mock.c */
@@ -32,6 +55,29 @@ static int failures = 0;
     } \
 } while (0)
 
+/* Monotonic milliseconds, for the timing tests only. */
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1000.0 + (double)ts.tv_nsec / 1e6;
+}
+
+static void sleep_ms(int ms) {
+#ifdef _WIN32
+    Sleep((DWORD)ms);
+#else
+    struct timespec ts = { ms / 1000, (long)(ms % 1000) * 1000000L };
+    nanosleep(&ts, NULL);
+#endif
+}
+
+/* Wait until `n` calls of kind `op` are on the mock's bus; 0 if that takes
+ * longer than a few seconds, which means they never all got there. */
+static int wait_in_flight(mock_op op, int n) {
+    for (int i = 0; i < 5000 && mock_in_flight(op) != n; i++) sleep_ms(1);
+    return mock_in_flight(op) == n;
+}
+
 static void test_parse_command(void) {
     CHECK(parse_command("up") == 1);
     CHECK(parse_command("down") == -1);
@@ -39,6 +85,22 @@ static void test_parse_command(void) {
     CHECK(parse_command("") == 0);
 }
 
+static void test_parse_request(void) {
+    command_request r;
+    CHECK(parse_request("up", &r) == 1 && r.version == 0 && r.dir == 1 && !r.ack);
+    CHECK(parse_request("bogus", &r) == 0 && r.version == 0 && r.error == NULL);
+    CHECK(parse_request("v1 42 down ack", &r) == 1);
+    CHECK(r.version == 1 && r.seq == 42 && r.dir == -1 && r.ack == 1 && r.error == NULL);
+    CHECK(parse_request("v1 7 up", &r) == 1 && r.seq == 7 && r.ack == 0);
+    CHECK(parse_request("v1 7 sideways ack", &r) == 0 && r.seq == 7 && strcmp(r.error, "bad-request") == 0);
+    CHECK(parse_request("v1 7 up please", &r) == 0 && strcmp(r.error, "bad-request") == 0);
+    CHECK(parse_request("v1 x up", &r) == 0 && r.seq == 0 && strcmp(r.error, "bad-request") == 0);
+    CHECK(parse_request("v1", &r) == 0 && strcmp(r.error, "bad-request") == 0);
+    CHECK(parse_request("v2 9 up ack", &r) == 0 && r.seq == 9 && strcmp(r.error, "version") == 0);
+    CHECK(parse_request("v1 3 stats", &r) == 1 && r.stats == 1 && r.dir == 0 && r.seq == 3);
+    CHECK(parse_request("v1 3 stats ack", &r) == 0 && strcmp(r.error, "bad-request") == 0);
+}
+
 static void test_dimmer_accumulates(void) {
     dimmer_t d;
     const int STEP = 5;
@@ -140,6 +202,642 @@ static void test_dimmer_coalesces_during_write(void) {
     CHECK(dimmer_due(&d, &target) == 0);
 }
 
+/* The inbox sums raw posts; draining applies them with the usual clamp. */
+static void test_dimmer_post_and_drain(void) {
+    dimmer_t d;
+    int target = -1;
+
+    dimmer_init(&d, 50, 100);
+    dimmer_post(&d, -5);
+    dimmer_post(&d, -5);
+    CHECK(d.pending_delta == 0);              /* not visible until drained */
+    CHECK(dimmer_due(&d, &target) == 0);
+    CHECK(dimmer_drain(&d) == 1);
+    CHECK(d.inbox == 0);
+    CHECK(d.pending_delta == -10);
+    CHECK(dimmer_drain(&d) == 0);             /* empty inbox */
+
+    dimmer_post(&d, -100);                    /* drain clamps at the floor */
+    dimmer_drain(&d);
+    CHECK(d.pending_delta == -50);
+    CHECK(dimmer_due(&d, &target) == 1);
+    CHECK(target == 0);
+}
+
+/* Ramps, on an injected clock: frames paced by the measured write latency, each
+ * aimed at where the ramp should be when it lands, ending exactly on target. */
+static void test_dimmer_ramp(void) {
+    dimmer_t d;
+    int target;
+    long wait;
+
+    dimmer_init(&d, 0, 100);
+    dimmer_observe_latency(&d, 20);
+    CHECK(d.srtt_ms == 20 && d.rttvar_ms == 10);
+    dimmer_set_ramp(&d, 100);
+    dimmer_adjust(&d, 50);
+
+    CHECK(dimmer_frame(&d, 0, &target, &wait) == 1 && target == 10);
+    dimmer_commit(&d, target);
+    CHECK(dimmer_frame(&d, 5, &target, &wait) == 0 && wait == 15);   /* too soon */
+    const int expect[] = { 20, 30, 40, 50 };
+    for (int i = 0; i < 4; i++) {
+        CHECK(dimmer_frame(&d, 20 * (i + 1), &target, &wait) == 1 && target == expect[i]);
+        dimmer_commit(&d, target);
+    }
+    CHECK(dimmer_frame(&d, 100, &target, &wait) == 0 && wait == -1); /* done */
+
+    /* Smoothed: a slower write nudges the estimate rather than replacing it. */
+    dimmer_observe_latency(&d, 40);
+    CHECK(d.srtt_ms == 23 && d.rttvar_ms == 13);
+}
+
+static void test_dimmer_ramp_retarget(void) {
+    dimmer_t d;
+    int target;
+    long wait;
+
+    dimmer_init(&d, 0, 100);
+    dimmer_observe_latency(&d, 20);
+    dimmer_set_ramp(&d, 100);
+    dimmer_adjust(&d, 50);
+    CHECK(dimmer_frame(&d, 0, &target, &wait) == 1 && target == 10);
+    dimmer_commit(&d, target);
+    CHECK(dimmer_frame(&d, 20, &target, &wait) == 1 && target == 20);
+    dimmer_commit(&d, target);
+
+    /* A press down mid-ramp: the goal is now 30, and the ramp restarts from 20
+     * toward it -- no frame toward the old 50 is ever produced. */
+    dimmer_adjust(&d, -20);
+    CHECK(dimmer_frame(&d, 40, &target, &wait) == 1 && target == 22);
+    dimmer_commit(&d, target);
+    CHECK(dimmer_frame(&d, 60, &target, &wait) == 1 && target == 24);
+    dimmer_commit(&d, target);
+    for (long now = 80; dimmer_frame(&d, now, &target, &wait); now += 20) {
+        CHECK(target > 24 && target <= 30);
+        dimmer_commit(&d, target);
+    }
+    CHECK(d.current == 30);
+
+    /* A display too slow to animate (a frame >= the ramp) just jumps. */
+    dimmer_init(&d, 0, 100);
+    dimmer_observe_latency(&d, 200);
+    dimmer_set_ramp(&d, 100);
+    dimmer_adjust(&d, 50);
+    CHECK(dimmer_frame(&d, 0, &target, &wait) == 1 && target == 50);
+
+    /* And with no ramp set, dimmer_frame is dimmer_due. */
+    dimmer_init(&d, 0, 100);
+    dimmer_adjust(&d, 50);
+    CHECK(dimmer_frame(&d, 0, &target, &wait) == 1 && target == 50);
+}
+
+/* A failing display is backed off for a retry timeout that grows with each
+ * consecutive failure; presses meanwhile wait and go out as one write. */
+static void test_dimmer_failure_backoff(void) {
+    dimmer_t d;
+    int target;
+    long wait;
+
+    dimmer_init(&d, 50, 100);
+    dimmer_observe_latency(&d, 20);          /* srtt 20, rttvar 10: timeout 60 */
+    dimmer_adjust(&d, 10);
+    CHECK(dimmer_frame(&d, 0, &target, &wait) == 1 && target == 60);
+    dimmer_failed(&d, 0);
+    CHECK(d.pending_delta == 0 && d.failures == 1 && d.retry_at == 60);
+
+    dimmer_adjust(&d, 5);
+    dimmer_adjust(&d, 5);
+    CHECK(dimmer_frame(&d, 10, &target, &wait) == 0 && wait == 50);
+    CHECK(dimmer_frame(&d, 60, &target, &wait) == 1 && target == 60);   /* both, once */
+    dimmer_failed(&d, 60);
+    CHECK(d.retry_at == 60 + 120);            /* doubled */
+
+    dimmer_adjust(&d, 5);
+    CHECK(dimmer_frame(&d, 180, &target, &wait) == 1 && target == 55);
+    dimmer_commit(&d, target);
+    CHECK(d.failures == 0);                   /* recovered */
+}
+
+static void test_dimmer_resync(void) {
+    dimmer_t d;
+    int target;
+    dimmer_init(&d, 40, 100);
+    dimmer_seed_latency(&d, 30, 8);
+    CHECK(d.srtt_ms == 30 && d.rttvar_ms == 8 && d.samples == 1);
+    dimmer_observe_latency(&d, 38);
+    CHECK(d.srtt_ms == 31);                   /* smoothed in, not replaced */
+
+    CHECK(dimmer_resync(&d, 25, 200) == 1 && d.current == 25 && dimmer_max(&d) == 200);
+    CHECK(dimmer_due(&d, &target) == 0);
+    dimmer_adjust(&d, 10);
+    CHECK(dimmer_resync(&d, 90, 100) == 0 && d.current == 25 && dimmer_max(&d) == 200);
+    CHECK(dimmer_due(&d, &target) == 1 && target == 35);
+}
+
+/* A coarse display: targets snap to its step (max counting as one), a change
+ * that wouldn't reach the next level isn't due -- its presses wait until enough
+ * add up -- and a ramp's frames land on the grid too. */
+static void test_dimmer_step(void) {
+    dimmer_t d;
+    int target;
+    long wait;
+    dimmer_init(&d, 50, 100);
+    dimmer_set_step(&d, 10);
+    dimmer_adjust(&d, 3);
+    CHECK(dimmer_due(&d, &target) == 0);      /* 53: still 50 */
+    dimmer_adjust(&d, 3);
+    CHECK(dimmer_due(&d, &target) == 1 && target == 60);
+    dimmer_commit(&d, 60);
+    CHECK(d.pending_delta == -4 && dimmer_due(&d, &target) == 0);   /* 56 is 60 */
+    dimmer_adjust(&d, -6);
+    CHECK(dimmer_due(&d, &target) == 1 && target == 50);
+
+    dimmer_init(&d, 60, 100);
+    dimmer_set_step(&d, 30);
+    dimmer_adjust(&d, 36);
+    CHECK(dimmer_due(&d, &target) == 1 && target == 100);   /* 96: nearer max than 90 */
+    dimmer_adjust(&d, -15);
+    CHECK(dimmer_due(&d, &target) == 1 && target == 90);    /* 81 */
+    dimmer_set_step(&d, 0);
+    CHECK(dimmer_due(&d, &target) == 1 && target == 81);    /* every level again */
+
+    dimmer_init(&d, 0, 100);
+    dimmer_set_step(&d, 10);
+    dimmer_set_ramp(&d, 100);
+    dimmer_adjust(&d, 50);
+    int on_grid = 1, frames = 0;
+    for (long now = 1000; d.current != 50 && frames < 20; now += 16) {
+        if (!dimmer_frame(&d, now, &target, &wait)) continue;
+        on_grid &= target % 10 == 0;
+        dimmer_commit(&d, target);
+        frames++;
+    }
+    CHECK(d.current == 50 && on_grid && frames >= 2 && frames <= 6);
+
+    /* Off the grid (read back there, say): an up press never snaps down. */
+    dimmer_init(&d, 53, 100);
+    d.step = 25;                              /* as if set before that read */
+    dimmer_adjust(&d, 6);
+    CHECK(dimmer_due(&d, &target) == 0);      /* 59: nearest is 50, the wrong way */
+    dimmer_adjust(&d, 6);
+    CHECK(dimmer_due(&d, &target) == 1 && target == 75);
+    dimmer_settled(&d);
+    dimmer_adjust(&d, -2);
+    CHECK(dimmer_due(&d, &target) == 1 && target == 50);   /* 51: down is down */
+    dimmer_settled(&d);
+    dimmer_adjust(&d, -16);
+    CHECK(dimmer_due(&d, &target) == 1 && target == 25);
+    dimmer_settled(&d);
+    /* ... and a ramp up from there has no frame below it. */
+    dimmer_set_ramp(&d, 200);
+    dimmer_adjust(&d, 47);
+    int rising = 1, last = d.current;
+    frames = 0;
+    for (long now = 1000; d.current != 100 && frames < 20; now += 16) {
+        if (!dimmer_frame(&d, now, &target, &wait)) continue;
+        rising &= target > last;
+        last = target;
+        dimmer_commit(&d, target);
+        frames++;
+    }
+    CHECK(d.current == 100 && rising);
+
+    /* Adopting a step puts the level on the grid, keeping the target. */
+    dimmer_init(&d, 53, 100);
+    dimmer_adjust(&d, 20);
+    dimmer_set_step(&d, 25);
+    CHECK(d.current == 50 && dimmer_due(&d, &target) == 1 && target == 75);
+
+    /* A read-back between presses keeps what they've added up to. */
+    dimmer_init(&d, 50, 100);
+    dimmer_set_step(&d, 10);
+    dimmer_adjust(&d, 3);
+    CHECK(dimmer_due(&d, &target) == 0);
+    CHECK(dimmer_resync(&d, 50, 100) == 1);
+    dimmer_adjust(&d, 3);
+    CHECK(dimmer_due(&d, &target) == 1 && target == 60);
+}
+
+static void test_stats_histogram(void) {
+    stats_histogram h;
+    memset(&h, 0, sizeof(h));
+    CHECK(stats_percentile(&h, 50) == 0);
+    stats_record(&h, 0);        /* bucket 0 */
+    stats_record(&h, -5);       /* a clock step back counts as 0 */
+    stats_record(&h, 1);        /* [1, 2) */
+    stats_record(&h, 3);        /* [2, 4) */
+    stats_record(&h, 40000);    /* [32768, 65536) */
+    CHECK(h.n == 5 && h.count[0] == 2 && h.count[1] == 1 && h.count[2] == 1 && h.count[16] == 1);
+    CHECK(h.max_us == 40000);
+    CHECK(stats_percentile(&h, 40) == 0);
+    CHECK(stats_percentile(&h, 60) == 1);
+    CHECK(stats_percentile(&h, 80) == 3);
+    CHECK(stats_percentile(&h, 99) == 40000);   /* its bucket's bound, capped at the max */
+    stats_record(&h, 1LL << 30);                /* off the top: the last bucket */
+    CHECK(h.count[STATS_BUCKETS - 1] == 1 && stats_percentile(&h, 100) == h.max_us);
+
+    stats_histogram copy;
+    stats_snapshot(&h, &copy);
+    CHECK(memcmp(&copy, &h, sizeof(h)) == 0);
+    char buf[256];
+    int n = stats_format(buf, sizeof(buf), &copy);
+    CHECK(n > 0 && n < (int)sizeof(buf) && (size_t)n == strlen(buf));
+    CHECK(strncmp(buf, "n=6 p50=1 p90=1073741824 p99=1073741824 ", 40) == 0);
+    CHECK(strstr(buf, " buckets=2,1,1,0,") != NULL);
+    char small[16];
+    CHECK(stats_format(small, sizeof(small), &copy) == n && strlen(small) == sizeof(small) - 1);
+}
+
+/* The sleep tuner tightens after runs of successes, doubles on failure, and
+ * then keeps clear of the value that failed until the floor has held it back
+ * long enough to be forgotten a little. */
+static void test_sleep_tuner(void) {
+    sleep_tuner t;
+    sleep_tuner_init(&t, 0, 0);
+    CHECK(t.pct == SLEEP_TUNER_DEFAULT_PCT && t.floor_pct == 0);
+    sleep_tuner_init(&t, 5000, 1);
+    CHECK(t.pct == SLEEP_TUNER_MAX_PCT && t.floor_pct == SLEEP_TUNER_MIN_PCT);
+
+    sleep_tuner_init(&t, 100, 0);
+    int changed = 0;
+    for (int i = 0; i < SLEEP_TUNER_TIGHTEN_AFTER - 1; i++) changed += sleep_tuner_success(&t);
+    CHECK(changed == 0 && t.pct == 100);
+    CHECK(sleep_tuner_success(&t) == 1 && t.pct == 90);
+
+    /* Down to the minimum, and no further. */
+    for (int i = 0; i < 100 * SLEEP_TUNER_TIGHTEN_AFTER; i++) sleep_tuner_success(&t);
+    CHECK(t.pct == SLEEP_TUNER_MIN_PCT);
+
+    sleep_tuner_init(&t, 40, 0);
+    CHECK(sleep_tuner_failure(&t) == 1 && t.pct == 80 && t.floor_pct == 40);
+    for (int i = 0; i < 5 * SLEEP_TUNER_TIGHTEN_AFTER; i++) sleep_tuner_success(&t);
+    CHECK(t.pct == 50);   /* 72, 65, 59, 54, then a quarter above the failure */
+
+    /* Held there, the floor gives way slowly. */
+    for (int i = 0; i < (SLEEP_TUNER_FORGET_AFTER - 1) * SLEEP_TUNER_TIGHTEN_AFTER; i++)
+        sleep_tuner_success(&t);
+    CHECK(t.floor_pct == 40 && t.pct == 50);
+    for (int i = 0; i < SLEEP_TUNER_TIGHTEN_AFTER; i++) sleep_tuner_success(&t);
+    CHECK(t.floor_pct == 36 && t.pct == 50);
+    for (int i = 0; i < SLEEP_TUNER_TIGHTEN_AFTER; i++) sleep_tuner_success(&t);
+    CHECK(t.pct == 45);
+
+    /* A failure resets the run, and the ceiling holds. */
+    sleep_tuner_init(&t, SLEEP_TUNER_MAX_PCT, SLEEP_TUNER_MAX_PCT);
+    CHECK(sleep_tuner_failure(&t) == 0 && t.pct == SLEEP_TUNER_MAX_PCT);
+    sleep_tuner_init(&t, 100, 0);
+    for (int i = 0; i < SLEEP_TUNER_TIGHTEN_AFTER - 1; i++) sleep_tuner_success(&t);
+    sleep_tuner_failure(&t);
+    CHECK(sleep_tuner_success(&t) == 0 && t.pct == 200 && t.floor_pct == 100);
+}
+
+/* The display database round-trips through its file, skips lines it can't
+ * parse, refuses values that wouldn't survive the format, and only writes when
+ * something changed. */
+static void test_display_db(void) {
+    const char *path = "test_display_db.tmp";
+    char id[DISPLAY_DB_ID_MAX], buf[DISPLAY_DB_VALUE_MAX];
+    long v = 0;
+
+    CHECK(display_db_identity(id, sizeof(id), "DEL", "DELL U2720Q", "AB 12") == 0);
+    CHECK(strcmp(id, "DEL:DELL_U2720Q:AB_12") == 0);
+    CHECK(display_db_identity(id, sizeof(id), "", NULL, "") == -1 && id[0] == '\0');
+    /* No serial: none of its own, so no identity at all. */
+    CHECK(display_db_identity(id, sizeof(id), "DEL", "DELL U2720Q", NULL) == -1 && id[0] == '\0');
+    CHECK(display_db_identity(id, sizeof(id), "DEL", "DELL U2720Q", "  ") == -1);
+    CHECK(display_db_identity(id, sizeof(id), "DEL", "DELL U2720Q", "0") == -1);
+
+    FILE *f = fopen(path, "w");
+    CHECK(f != NULL);
+    if (!f) return;
+    fputs("# a comment\n"
+          "GSM:LG_HDR:1 sleep_pct=40 junk max=100\n"
+          "\n"
+          "   \n"
+          "BNQ:BenQ:9 sleep_pct=x =7 sleep_floor_pct=20\n", f);
+    fclose(f);
+
+    CHECK(display_db_open(path) == 0);
+    CHECK(display_db_get_long("GSM:LG_HDR:1", "sleep_pct", &v) == 1 && v == 40);
+    CHECK(display_db_get_long("GSM:LG_HDR:1", "max", &v) == 1 && v == 100);
+    CHECK(display_db_get_long("BNQ:BenQ:9", "sleep_pct", &v) == 0);   /* not a number */
+    CHECK(display_db_get("BNQ:BenQ:9", "sleep_pct", buf, sizeof(buf)) == 1 && strcmp(buf, "x") == 0);
+    CHECK(display_db_get_long("BNQ:BenQ:9", "sleep_floor_pct", &v) == 1 && v == 20);
+    CHECK(display_db_get_long("nobody", "sleep_pct", &v) == 0);
+
+    display_db_set("GSM:LG_HDR:1", "caps", "two words");   /* refused */
+    display_db_set("has space", "sleep_pct", "1");         /* refused */
+    display_db_set_long("GSM:LG_HDR:1", "sleep_pct", 36);
+    display_db_set("DEL:U2720Q:2", "caps", "(prot(monitor)vcp(10))");
+    CHECK(display_db_get("GSM:LG_HDR:1", "caps", buf, sizeof(buf)) == 0);
+    CHECK(display_db_get("has space", "sleep_pct", buf, sizeof(buf)) == 0);
+    CHECK(display_db_flush() == 0);
+    display_db_close();
+
+    CHECK(display_db_open(path) == 0);
+    CHECK(display_db_get_long("GSM:LG_HDR:1", "sleep_pct", &v) == 1 && v == 36);
+    CHECK(display_db_get("DEL:U2720Q:2", "caps", buf, sizeof(buf)) == 1 &&
+          strcmp(buf, "(prot(monitor)vcp(10))") == 0);
+    CHECK(display_db_get_long("BNQ:BenQ:9", "sleep_floor_pct", &v) == 1 && v == 20);
+
+    /* Nothing changed: no write (the file stays as replaced by hand). */
+    f = fopen(path, "w");
+    if (f) fclose(f);
+    display_db_set_long("GSM:LG_HDR:1", "sleep_pct", 36);
+    CHECK(display_db_flush() == 0);
+    display_db_close();
+    CHECK(display_db_open(path) == 0);
+    CHECK(display_db_get_long("GSM:LG_HDR:1", "sleep_pct", &v) == 0);
+    display_db_close();
+    remove(path);
+
+    /* In memory only: sets stick, flushes write nothing. */
+    CHECK(display_db_open(NULL) == 0);
+    display_db_set_long("a:b:c", "sleep_pct", 50);
+    CHECK(display_db_get_long("a:b:c", "sleep_pct", &v) == 1 && v == 50);
+    CHECK(display_db_flush() == 0);
+    display_db_close();
+
+#ifndef _WIN32
+    /* The file is written aside under a fresh name, never through one planted
+     * where it would be (the old fixed "<db>.tmp"), and into a state directory
+     * created if it's missing. */
+    const char *victim = "test_display_db_victim.tmp";
+    f = fopen(victim, "w");
+    if (f) { fputs("keep\n", f); fclose(f); }
+    mkdir("test_display_db_dir", 0755);
+    CHECK(symlink("../test_display_db_victim.tmp", "test_display_db_dir/displays.db.tmp") == 0);
+    CHECK(display_db_open("test_display_db_dir/displays.db") == 0);
+    display_db_set_long("a:b:c", "sleep_pct", 50);
+    CHECK(display_db_flush() == 0);
+    display_db_close();
+    f = fopen(victim, "r");
+    CHECK(f != NULL && fgets(buf, sizeof(buf), f) && strcmp(buf, "keep\n") == 0);
+    if (f) fclose(f);
+    CHECK(display_db_open("test_display_db_dir/displays.db") == 0);
+    CHECK(display_db_get_long("a:b:c", "sleep_pct", &v) == 1 && v == 50);
+    display_db_close();
+    remove("test_display_db_dir/displays.db.tmp");
+    remove("test_display_db_dir/displays.db");
+    rmdir("test_display_db_dir");
+    remove(victim);
+
+    CHECK(display_db_open("test_display_db_new/displays.db") == 0);
+    display_db_set_long("a:b:c", "sleep_pct", 50);
+    CHECK(display_db_flush() == 0);
+    display_db_close();
+    CHECK(remove("test_display_db_new/displays.db") == 0);
+    CHECK(rmdir("test_display_db_new") == 0);
+#endif
+}
+
+/* A scripted I2C bus for the DDC/CI engine: it records what is written,
+ * answers each read from a script (NULL: NAK the read), and keeps a clock of
+ * its own that only sleeping advances -- so pacing is checked to the
+ * microsecond with no real waits. */
+typedef struct {
+    uint8_t written[8][DDCCI_SET_REQUEST_LEN];
+    long long written_at[8];
+    int writes;
+    int write_naks;                /* NAK this many writes first */
+    const uint8_t *replies[16];
+    long long read_at[16];
+    int reads;
+    long long now;
+} fake_bus;
+
+static int fake_write(void *ctx, const uint8_t *buf, int len) {
+    fake_bus *f = (fake_bus*)ctx;
+    if (f->write_naks > 0) { f->write_naks--; return -1; }
+    if (f->writes < 8) {
+        memcpy(f->written[f->writes], buf, (size_t)len);
+        f->written_at[f->writes] = f->now;
+    }
+    f->writes++;
+    return 0;
+}
+
+static int fake_read(void *ctx, uint8_t *buf, int len) {
+    fake_bus *f = (fake_bus*)ctx;
+    int i = f->reads++;
+    if (i >= 16) return -1;
+    f->read_at[i] = f->now;
+    if (!f->replies[i]) return -1;
+    memset(buf, 0, (size_t)len);
+    memcpy(buf, f->replies[i], f->replies[i][1] == 0x80 ? 3 : DDCCI_GET_REPLY_LEN);
+    return 0;
+}
+
+static long long fake_now(void *ctx) { return ((fake_bus*)ctx)->now; }
+static void fake_sleep(void *ctx, long long us) { ((fake_bus*)ctx)->now += us; }
+
+static void fake_bus_open(fake_bus *f, ddcci_bus *b, int pct) {
+    memset(f, 0, sizeof(*f));
+    f->now = 1000000;
+    const ddcci_transport io = { fake_write, fake_read, fake_now, fake_sleep, f };
+    ddcci_init(b, &io, pct, 0);
+}
+
+/* Packets and replies, byte for byte. */
+static void test_ddcci_packets(void) {
+    uint8_t get[DDCCI_GET_REQUEST_LEN], set[DDCCI_SET_REQUEST_LEN];
+    ddcci_build_get(get, VCP_BRIGHTNESS);
+    CHECK(memcmp(get, (uint8_t[]){0x51, 0x82, 0x01, 0x10, 0xAC}, sizeof(get)) == 0);
+    ddcci_build_set(set, VCP_BRIGHTNESS, 0x0132);
+    CHECK(memcmp(set, (uint8_t[]){0x51, 0x84, 0x03, 0x10, 0x01, 0x32, 0x9B}, sizeof(set)) == 0);
+
+    const uint8_t ok[] = {0x6E, 0x88, 0x02, 0x00, 0x10, 0x00, 0x00, 0x64, 0x00, 0x32, 0xF2};
+    const uint8_t unsupported[] = {0x6E, 0x88, 0x02, 0x01, 0x10, 0x00, 0x00, 0x00, 0x00, 0x00, 0xA5};
+    const uint8_t other_code[] = {0x6E, 0x88, 0x02, 0x00, 0x12, 0x00, 0x00, 0x64, 0x00, 0x32, 0xF0};
+    const uint8_t null_msg[] = {0x6E, 0x80, 0xBE};
+    uint16_t max = 0, cur = 0;
+    CHECK(ddcci_parse_get_reply(ok, sizeof(ok), 0x10, &max, &cur) == DDCCI_OK && max == 100 && cur == 50);
+    CHECK(ddcci_parse_get_reply(ok, sizeof(ok) - 1, 0x10, &max, &cur) == DDCCI_INVALID);
+    CHECK(ddcci_parse_get_reply(unsupported, sizeof(unsupported), 0x10, &max, &cur) == DDCCI_UNSUPPORTED);
+    CHECK(ddcci_parse_get_reply(other_code, sizeof(other_code), 0x10, &max, &cur) == DDCCI_INVALID);
+    CHECK(ddcci_parse_get_reply(other_code, sizeof(other_code), 0x12, &max, &cur) == DDCCI_OK);
+    CHECK(ddcci_parse_get_reply(null_msg, sizeof(null_msg), 0x10, &max, &cur) == DDCCI_NULL);
+    uint8_t bad[sizeof(ok)];
+    memcpy(bad, ok, sizeof(ok));
+    bad[9] ^= 0x01;   /* one bit off: the checksum catches it */
+    CHECK(ddcci_parse_get_reply(bad, sizeof(bad), 0x10, &max, &cur) == DDCCI_INVALID);
+    const uint8_t bad_null[] = {0x6E, 0x80, 0xBF};
+    CHECK(ddcci_parse_get_reply(bad_null, sizeof(bad_null), 0x10, &max, &cur) == DDCCI_INVALID);
+}
+
+/* Exchanges over the scripted bus: replies are polled for from the paced wait
+ * on, at growing intervals; null and NAK'd reads poll again, a garbled reply
+ * asks again, "unsupported" ends it; and a set's settle time is only waited
+ * out by the next message. */
+static void test_ddcci_exchanges(void) {
+    static const uint8_t ok[] = {0x6E, 0x88, 0x02, 0x00, 0x10, 0x00, 0x00, 0x64, 0x00, 0x32, 0xF2};
+    static const uint8_t unsupported[] = {0x6E, 0x88, 0x02, 0x01, 0x10, 0x00, 0x00, 0x00, 0x00, 0x00, 0xA5};
+    static const uint8_t null_msg[] = {0x6E, 0x80, 0xBE};
+    static const uint8_t garbled[] = {0x6E, 0x88, 0x02, 0x00, 0x10, 0x00, 0x00, 0x64, 0x00, 0x33, 0xF2};
+    fake_bus f;
+    ddcci_bus b;
+    uint16_t max = 0, cur = 0;
+
+    /* Not ready, NAK'd, then there: polled at 40, 42 and 46 ms. */
+    fake_bus_open(&f, &b, 100);
+    f.replies[0] = null_msg;
+    f.replies[2] = ok;
+    long long t0 = f.now;
+    CHECK(ddcci_get(&b, VCP_BRIGHTNESS, &max, &cur) == DDCCI_OK && max == 100 && cur == 50);
+    CHECK(f.writes == 1 && memcmp(f.written[0], (uint8_t[]){0x51, 0x82, 0x01, 0x10, 0xAC}, 5) == 0);
+    CHECK(f.reads == 3 && b.polls == 3 && b.retries == 0);
+    CHECK(f.read_at[0] - t0 == 40000 && f.read_at[1] - t0 == 42000 && f.read_at[2] - t0 == 46000);
+
+    /* A monitor tuned to a quarter of the spec's delays: first poll at 10 ms. */
+    fake_bus_open(&f, &b, 25);
+    f.replies[0] = ok;
+    t0 = f.now;
+    CHECK(ddcci_get(&b, VCP_BRIGHTNESS, &max, &cur) == DDCCI_OK);
+    CHECK(f.read_at[0] - t0 == 10000);
+
+    /* Unsupported: one reply, no retry. */
+    fake_bus_open(&f, &b, 100);
+    f.replies[0] = unsupported;
+    CHECK(ddcci_get(&b, VCP_BRIGHTNESS, &max, &cur) == DDCCI_UNSUPPORTED);
+    CHECK(f.writes == 1 && f.reads == 1);
+
+    /* Garbled: asked again after the settle time, and the tuner backs off. */
+    fake_bus_open(&f, &b, 100);
+    f.replies[0] = garbled;
+    f.replies[1] = ok;
+    CHECK(ddcci_get(&b, VCP_BRIGHTNESS, &max, &cur) == DDCCI_OK);
+    CHECK(f.writes == 2 && b.retries == 1 && b.tuner_changed && b.tuner.pct == 200);
+    CHECK(f.written_at[1] - f.read_at[0] == 2 * DDCCI_SETTLE_MS * 1000);
+
+    /* Never answers: every read NAK'd, polls until twice the wait, three tries. */
+    fake_bus_open(&f, &b, 100);
+    t0 = f.now;
+    CHECK(ddcci_get(&b, VCP_BRIGHTNESS, &max, &cur) == DDCCI_NAK);
+    CHECK(f.writes == DDCCI_TRIES && b.retries == DDCCI_TRIES - 1);
+    CHECK(f.read_at[5] - t0 == 2 * DDCCI_REPLY_WAIT_MS * 1000);   /* 40, 42, 46, 54, 70, 80 */
+
+    /* A set returns on the ACK; the next message waits out its settle time. */
+    fake_bus_open(&f, &b, 100);
+    t0 = f.now;
+    CHECK(ddcci_set(&b, VCP_BRIGHTNESS, 0x0132) == DDCCI_OK);
+    CHECK(f.now == t0 && f.writes == 1);
+    CHECK(memcmp(f.written[0], (uint8_t[]){0x51, 0x84, 0x03, 0x10, 0x01, 0x32, 0x9B}, 7) == 0);
+    f.now += 20000;
+    CHECK(ddcci_set(&b, VCP_BRIGHTNESS, 0x0100) == DDCCI_OK);
+    CHECK(f.written_at[1] - t0 == DDCCI_SETTLE_MS * 1000);
+
+    /* A NAK'd set is retried; past DDCCI_TRIES it fails. */
+    fake_bus_open(&f, &b, 100);
+    f.write_naks = 1;
+    CHECK(ddcci_set(&b, VCP_BRIGHTNESS, 7) == DDCCI_OK && b.retries == 1);
+    f.write_naks = DDCCI_TRIES;
+    CHECK(ddcci_set(&b, VCP_BRIGHTNESS, 7) == DDCCI_NAK);
+}
+
+/* The engine against a simulated monitor, byte for byte: framing it rejects,
+ * features it doesn't have, sets it clamps. */
+static void test_sim_monitor_protocol(void) {
+    sim_monitor mon;
+    sim_monitor_init(&mon, &(sim_timing){ .reply_ready_ms = 10, .settle_ms = 20 });
+    sim_monitor_add_feature(&mon, VCP_BRIGHTNESS, 100, 40);
+    ddcci_transport io = sim_monitor_transport(&mon);
+    ddcci_bus b;
+    ddcci_init(&b, &io, 100, 0);
+    uint16_t max = 0, cur = 0;
+
+    CHECK(ddcci_get(&b, VCP_BRIGHTNESS, &max, &cur) == DDCCI_OK && max == 100 && cur == 40);
+    CHECK(mon.gets == 1 && mon.bad_packets == 0 && mon.nulls == 0);
+    CHECK(ddcci_get(&b, VCP_CONTRAST, &max, &cur) == DDCCI_UNSUPPORTED);
+    CHECK(ddcci_set(&b, VCP_BRIGHTNESS, 70) == DDCCI_OK && sim_monitor_value(&mon, VCP_BRIGHTNESS) == 70);
+    CHECK(ddcci_set(&b, VCP_BRIGHTNESS, 500) == DDCCI_OK && sim_monitor_value(&mon, VCP_BRIGHTNESS) == 100);
+    CHECK(mon.naks == 0);   /* the engine waited out each settle */
+
+    /* A request with a bad checksum is ignored; its read gets a null message. */
+    uint8_t req[DDCCI_GET_REQUEST_LEN], reply[DDCCI_GET_REPLY_LEN];
+    ddcci_build_get(req, VCP_BRIGHTNESS);
+    req[4] ^= 0xFF;
+    mon.now_us = mon.busy_until;
+    CHECK(io.write(io.ctx, req, sizeof(req)) == 0 && mon.bad_packets == 1);
+    mon.now_us += 50000;
+    CHECK(io.read(io.ctx, reply, sizeof(reply)) == 0);
+    CHECK(ddcci_parse_get_reply(reply, sizeof(reply), VCP_BRIGHTNESS, &max, &cur) == DDCCI_NULL);
+    /* Bus time: a 5-byte request is six bytes on the wire. */
+    ddcci_build_get(req, VCP_BRIGHTNESS);
+    long long t0 = mon.now_us;
+    io.write(io.ctx, req, sizeof(req));
+    CHECK(mon.now_us - t0 == 6 * SIM_MONITOR_US_PER_BYTE);
+}
+
+/* Timing rules, and what the engine makes of them: a reply polled for too
+ * early, a monitor that NAKs early reads, one that settles slower than the
+ * spec allows, and one whose replies arrive garbled. */
+static void test_sim_monitor_timing(void) {
+    sim_monitor mon;
+    ddcci_transport io;
+    ddcci_bus b;
+    uint16_t max = 0, cur = 0;
+
+    /* Ready at 45 ms, early reads NAK'd: polls at 40 and 42 miss, 46 lands. */
+    sim_monitor_init(&mon, &(sim_timing){ .reply_ready_ms = 45, .early_read_nak = 1 });
+    sim_monitor_add_feature(&mon, VCP_BRIGHTNESS, 100, 40);
+    io = sim_monitor_transport(&mon);
+    ddcci_init(&b, &io, 100, 0);
+    CHECK(ddcci_get(&b, VCP_BRIGHTNESS, &max, &cur) == DDCCI_OK && cur == 40);
+    CHECK(b.polls == 3 && mon.naks == 2 && b.retries == 0);
+
+    /* Settles in 60 ms, past the spec's 50: a set right after a set is NAK'd
+     * once, and the retry comes after the backed-off settle time. */
+    sim_monitor_init(&mon, &(sim_timing){ .settle_ms = 60 });
+    sim_monitor_add_feature(&mon, VCP_BRIGHTNESS, 100, 40);
+    io = sim_monitor_transport(&mon);
+    ddcci_init(&b, &io, 100, 0);
+    CHECK(ddcci_set(&b, VCP_BRIGHTNESS, 50) == DDCCI_OK);
+    CHECK(ddcci_set(&b, VCP_BRIGHTNESS, 60) == DDCCI_OK);
+    CHECK(mon.naks == 1 && b.retries == 1 && b.tuner.pct == 200);
+    CHECK(sim_monitor_value(&mon, VCP_BRIGHTNESS) == 60);
+
+    /* Every reply garbled: three tries, then the engine gives up. */
+    sim_monitor_init(&mon, &(sim_timing){ .reply_ready_ms = 5, .garble_pct = 100 });
+    sim_monitor_add_feature(&mon, VCP_BRIGHTNESS, 100, 40);
+    io = sim_monitor_transport(&mon);
+    ddcci_init(&b, &io, 100, 0);
+    CHECK(ddcci_get(&b, VCP_BRIGHTNESS, &max, &cur) == DDCCI_INVALID);
+    CHECK(mon.garbled == DDCCI_TRIES && mon.gets == DDCCI_TRIES);
+}
+
+/* Benchmark, in virtual time: a monitor that has its reply ready in 8 ms and
+ * settles in 10, stepped the way a held key steps it (a set, then a read-back
+ * every fourth step). As the engine's pacing tightens, an exchange costs
+ * about what the monitor needs rather than the spec's worst case. */
+static void test_sim_monitor_pacing_benchmark(void) {
+    sim_monitor mon;
+    sim_monitor_init(&mon, &(sim_timing){ .reply_ready_ms = 8, .settle_ms = 10 });
+    sim_monitor_add_feature(&mon, VCP_BRIGHTNESS, 1000, 0);
+    ddcci_transport io = sim_monitor_transport(&mon);
+    ddcci_bus b;
+    ddcci_init(&b, &io, 0, 0);
+    const int steps = 800, window = 100;
+    long long first = 0, last = 0;
+    int failed = 0;
+    for (int i = 0; i < steps; i++) {
+        long long t0 = mon.now_us;
+        uint16_t max = 0, cur = 0;
+        failed += ddcci_set(&b, VCP_BRIGHTNESS, (uint16_t)(i + 1)) != DDCCI_OK;
+        if (i % 4 == 3)
+            failed += ddcci_get(&b, VCP_BRIGHTNESS, &max, &cur) != DDCCI_OK || cur != i + 1;
+        long long took = mon.now_us - t0;
+        if (i < window) first += took;
+        if (i >= steps - window) last += took;
+    }
+    printf("bench: simulated monitor (reply 8 ms, settle 10 ms): %.1f ms/step at first, "
+           "%.1f ms/step tuned (pacing %d%%, %lu nulls, %lu naks)\n",
+           first / 1000.0 / window, last / 1000.0 / window, b.tuner.pct, mon.nulls, mon.naks);
+    CHECK(failed == 0);
+    CHECK(sim_monitor_value(&mon, VCP_BRIGHTNESS) == steps);
+    CHECK(last * 2 < first);
+}
+
 static void test_dimmer_fraction(void) {
     dimmer_t d;
     dimmer_init(&d, 50, 90);
@@ -188,6 +886,461 @@ static void test_command_loop_end_to_end(void) {
 #endif
 }
 
+/* Streaming reads: a command split across recv() calls, several coalesced into
+ * one, CRLF endings, an overlong line, and a final line with no newline. */
+static void test_command_reader_streaming(void) {
+#ifdef _WIN32
+    fprintf(stderr, "SKIP test_command_reader_streaming on Windows (no socketpair)\n");
+#else
+    int sv[2];
+    CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+    command_reader r;
+    char line[COMMAND_LINE_MAX];
+    command_reader_init(&r);
+
+    CHECK(write(sv[0], "up\ndo", 5) == 5);
+    CHECK(command_reader_fill(&r, sv[1]) == 5);
+    CHECK(command_reader_next(&r, line) == 1 && strcmp(line, "up") == 0);
+    CHECK(command_reader_next(&r, line) == 0);          /* "do" is incomplete */
+
+    CHECK(write(sv[0], "wn\r\nup\n\n", 8) == 8);
+    CHECK(command_reader_fill(&r, sv[1]) == 8);
+    CHECK(command_reader_next(&r, line) == 1 && strcmp(line, "down") == 0);
+    CHECK(command_reader_next(&r, line) == 1 && strcmp(line, "up") == 0);
+    CHECK(command_reader_next(&r, line) == 1 && strcmp(line, "") == 0);
+    CHECK(command_reader_next(&r, line) == 0);
+
+    char big[3 * COMMAND_LINE_MAX];
+    memset(big, 'x', sizeof(big));
+    CHECK(write(sv[0], big, sizeof(big)) == (ssize_t)sizeof(big));
+    CHECK(command_reader_fill(&r, sv[1]) > 0);
+    CHECK(command_reader_next(&r, line) == 0);          /* overlong: being dropped */
+    CHECK(write(sv[0], "xxx\ndown", 8) == 8);
+    close(sv[0]);                                       /* last line unterminated */
+    while (command_reader_fill(&r, sv[1]) > 0) {}
+    CHECK(r.eof == 1);
+    CHECK(command_reader_next(&r, line) == 1 && strcmp(line, "down") == 0);
+    CHECK(command_reader_next(&r, line) == 0);
+
+    close(sv[1]);
+#endif
+}
+
+/* The multiplexed command server: with idle clients connected -- some silent,
+ * some stalled mid-line -- every one of an active client's commands is still
+ * applied, none stuck behind an idle client, and connections over the cap are
+ * refused rather than queued. (How long a command takes to apply is
+ * dimmit_bench's scenario=server.) */
+#define SERVER_IDLE_CLIENTS 16
+#define SERVER_SAMPLES 300
+
+static int server_applied = 0;   /* commands applied (atomic) */
+static int server_stop = 0;      /* serving thread should finish (atomic) */
+
+static int server_denied = 0;    /* authorize refuses everyone (atomic) */
+
+static int server_authorize(dimmit_sock_t client) {
+    (void)client;
+    return !__atomic_load_n(&server_denied, __ATOMIC_SEQ_CST);
+}
+
+static unsigned long server_apply(int dir) {
+    (void)dir;
+    return (unsigned long)__atomic_add_fetch(&server_applied, 1, __ATOMIC_SEQ_CST);
+}
+
+static void *server_run(void *arg) {
+    command_server *s = arg;
+    while (!__atomic_load_n(&server_stop, __ATOMIC_SEQ_CST))
+        command_server_poll(s, 10);
+    return NULL;
+}
+
+#ifndef _WIN32
+/* A listening socket at a fresh per-process path (written to `path`). */
+static dimmit_sock_t server_listen(char *path, size_t len) {
+    snprintf(path, len, "/tmp/dimmit-test-%ld.sock", (long)getpid());
+    unlink(path);
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    dimmit_sock_t fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd != DIMMIT_BAD_SOCK &&
+        (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(fd, 32) < 0)) {
+        net_close(fd);
+        fd = DIMMIT_BAD_SOCK;
+    }
+    return fd;
+}
+
+static dimmit_sock_t server_connect(const char *path) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    dimmit_sock_t fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd != DIMMIT_BAD_SOCK && connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        net_close(fd);
+        fd = DIMMIT_BAD_SOCK;
+    }
+    return fd;
+}
+
+/* SERVER_SAMPLES round trips: send "up", wait until it's applied. 0 if one
+ * isn't applied within a second, which means it is stuck, not slow. */
+static int server_round_trips(dimmit_sock_t fd) {
+    for (int i = 0; i < SERVER_SAMPLES; i++) {
+        int before = __atomic_load_n(&server_applied, __ATOMIC_SEQ_CST);
+        double t0 = now_ms();
+        if (send(fd, "up\n", 3, 0) != 3) return 0;
+        while (__atomic_load_n(&server_applied, __ATOMIC_SEQ_CST) == before) {
+            if (now_ms() - t0 > 1000.0) return 0;
+            sched_yield();
+        }
+    }
+    return 1;
+}
+#endif
+
+static void test_command_server_idle_clients(void) {
+#ifdef _WIN32
+    fprintf(stderr, "SKIP test_command_server_idle_clients on Windows\n");
+#else
+    char path[64];
+    dimmit_sock_t listener = server_listen(path, sizeof(path));
+    CHECK(listener != DIMMIT_BAD_SOCK);
+
+    const int cap = SERVER_IDLE_CLIENTS + 1;   /* the idle ones plus the active one */
+    const command_handlers h = { server_authorize, server_apply, NULL, NULL };
+    command_server *s = command_server_open(listener, cap, &h);
+    CHECK(s != NULL);
+    __atomic_store_n(&server_stop, 0, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&server_applied, 0, __ATOMIC_SEQ_CST);
+    pthread_t t;
+    pthread_create(&t, NULL, server_run, s);
+
+    dimmit_sock_t active = server_connect(path);
+    CHECK(active != DIMMIT_BAD_SOCK);
+    CHECK(server_round_trips(active));
+
+    /* Half never write; half stall partway through a command. */
+    dimmit_sock_t idle[SERVER_IDLE_CLIENTS];
+    for (int i = 0; i < SERVER_IDLE_CLIENTS; i++) {
+        idle[i] = server_connect(path);
+        CHECK(idle[i] != DIMMIT_BAD_SOCK);
+        if (i % 2) CHECK(send(idle[i], "do", 2, 0) == 2);
+    }
+    double t0 = now_ms();
+    while (command_server_clients(s) < cap && now_ms() - t0 < 1000.0) sleep_ms(1);
+    CHECK(command_server_clients(s) == cap);
+
+    CHECK(server_round_trips(active));               /* never stalled behind an idle client */
+    CHECK(__atomic_load_n(&server_applied, __ATOMIC_SEQ_CST) == 2 * SERVER_SAMPLES);
+
+    /* Over the cap: refused (closed by the server), not left hanging. */
+    dimmit_sock_t extra = server_connect(path);
+    CHECK(extra != DIMMIT_BAD_SOCK);
+    char b;
+    CHECK(recv(extra, &b, 1, 0) == 0);
+    net_close(extra);
+
+    /* A stalled client that finishes its line and hangs up is still applied. */
+    int before = __atomic_load_n(&server_applied, __ATOMIC_SEQ_CST);
+    CHECK(send(idle[1], "wn", 2, 0) == 2);
+    net_close(idle[1]);
+    t0 = now_ms();
+    while (command_server_clients(s) == cap && now_ms() - t0 < 1000.0) sleep_ms(1);
+    CHECK(command_server_clients(s) == cap - 1);
+    CHECK(__atomic_load_n(&server_applied, __ATOMIC_SEQ_CST) == before + 1);
+
+    __atomic_store_n(&server_stop, 1, __ATOMIC_SEQ_CST);
+    pthread_join(t, NULL);
+    command_server_close(s);
+    for (int i = 0; i < SERVER_IDLE_CLIENTS; i++)
+        if (i != 1) net_close(idle[i]);
+    net_close(active);
+    net_close(listener);
+    unlink(path);
+#endif
+}
+
+/* Acknowledged requests, end to end through a real controller on the mock: an
+ * ack arrives only after the write it covers has landed (not on receipt), carries
+ * every display's new level, and replies come back in request order -- errors
+ * included -- while bare text commands still apply silently. */
+static display_controller *ack_ctrl;
+static pthread_mutex_t ack_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned long ack_ticket;       /* under ack_lock */
+static char ack_levels[64];            /* under ack_lock */
+static command_server *ack_server;
+
+static unsigned long ack_apply(int dir) {
+    return controller_adjust(ack_ctrl, dir * (1.0/16.0));
+}
+
+static unsigned long ack_committed(char *levels, size_t len) {
+    pthread_mutex_lock(&ack_lock);
+    unsigned long t = ack_ticket;
+    snprintf(levels, len, "%s", ack_levels);
+    pthread_mutex_unlock(&ack_lock);
+    return t;
+}
+
+static int ack_stats(char *report, size_t len) {
+    return snprintf(report, len, "input lock_wait_us n=0\ndisplay 0 write_us n=0\n");
+}
+
+/* Stands in for dimmitd's worker: service, then announce what committed. */
+static void *ack_worker(void *arg) {
+    (void)arg;
+    while (!__atomic_load_n(&server_stop, __ATOMIC_SEQ_CST)) {
+        int applied = controller_service(ack_ctrl);
+        int cur[2], max[2];
+        controller_levels(ack_ctrl, cur, max, 2);
+        pthread_mutex_lock(&ack_lock);
+        ack_ticket = controller_committed(ack_ctrl);
+        snprintf(ack_levels, sizeof(ack_levels), "%d/%d %d/%d", cur[0], max[0], cur[1], max[1]);
+        pthread_mutex_unlock(&ack_lock);
+        command_server_wake(ack_server);
+        if (!applied) sleep_ms(1);
+    }
+    return NULL;
+}
+
+#ifndef _WIN32
+/* Next reply line from a (blocking, receive-timeout) client socket. */
+static int ack_read(dimmit_sock_t fd, command_reader *r, char *line) {
+    while (!command_reader_next(r, line))
+        if (command_reader_fill(r, fd) <= 0) return 0;
+    return 1;
+}
+#endif
+
+static void test_command_server_acks(void) {
+#ifdef _WIN32
+    fprintf(stderr, "SKIP test_command_server_acks on Windows\n");
+#else
+    mock_reset(2, (int[]){50, 20}, (int[]){100, 50});
+    mock_set_latency(0, 20);
+    ack_ctrl = controller_open();
+    ack_ticket = controller_committed(ack_ctrl);
+    snprintf(ack_levels, sizeof(ack_levels), "50/100 20/50");
+
+    char path[64];
+    dimmit_sock_t listener = server_listen(path, sizeof(path));
+    CHECK(listener != DIMMIT_BAD_SOCK);
+    const command_handlers h = { server_authorize, ack_apply, ack_committed, ack_stats };
+    ack_server = command_server_open(listener, 4, &h);
+    __atomic_store_n(&server_stop, 0, __ATOMIC_SEQ_CST);
+    pthread_t st, wt;
+    pthread_create(&st, NULL, server_run, ack_server);
+    pthread_create(&wt, NULL, ack_worker, NULL);
+
+    dimmit_sock_t fd = server_connect(path);
+    CHECK(fd != DIMMIT_BAD_SOCK);
+    struct timeval tv = {2, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    command_reader r;
+    command_reader_init(&r);
+    char line[COMMAND_LINE_MAX];
+
+    /* Acked once written: not before the 20 ms write, and with both levels. */
+    double t0 = now_ms();
+    CHECK(send(fd, "v1 7 up ack\n", 12, 0) == 12);
+    CHECK(ack_read(fd, &r, line) && strcmp(line, "v1 7 ok 56/100 23/50") == 0);
+    CHECK(now_ms() - t0 >= 19.0);
+
+    /* Pipelined, with errors and a bare and an un-acked command in between. */
+    const char *batch = "v1 8 up ack\nv1 9 down ack\nv1 x up\nup\nv2 10 up ack\n"
+                        "v1 11 sideways ack\nv1 12 down\nv1 13 down ack\n";
+    CHECK(send(fd, batch, strlen(batch), 0) == (ssize_t)strlen(batch));
+    CHECK(ack_read(fd, &r, line) && strncmp(line, "v1 8 ok ", 8) == 0);
+    CHECK(ack_read(fd, &r, line) && strncmp(line, "v1 9 ok ", 8) == 0);
+    CHECK(ack_read(fd, &r, line) && strcmp(line, "v1 0 err bad-request") == 0);
+    CHECK(ack_read(fd, &r, line) && strcmp(line, "v1 10 err version") == 0);
+    CHECK(ack_read(fd, &r, line) && strcmp(line, "v1 11 err bad-request") == 0);
+    /* up, down, up (bare), down (un-acked), down: net one step down from 7. */
+    CHECK(ack_read(fd, &r, line) && strcmp(line, "v1 13 ok 50/100 20/50") == 0);
+
+    /* The stats report, headed by its line count, in order with the acks. */
+    CHECK(send(fd, "v1 14 up ack\nv1 15 stats\n", 25, 0) == 25);
+    CHECK(ack_read(fd, &r, line) && strncmp(line, "v1 14 ok ", 9) == 0);
+    CHECK(ack_read(fd, &r, line) && strcmp(line, "v1 15 ok stats 2") == 0);
+    CHECK(ack_read(fd, &r, line) && strcmp(line, "input lock_wait_us n=0") == 0);
+    CHECK(ack_read(fd, &r, line) && strcmp(line, "display 0 write_us n=0") == 0);
+    CHECK(send(fd, "v1 16 down ack\n", 15, 0) == 15);
+    CHECK(ack_read(fd, &r, line) && strcmp(line, "v1 16 ok 50/100 20/50") == 0);
+
+    __atomic_store_n(&server_stop, 1, __ATOMIC_SEQ_CST);
+    pthread_join(st, NULL);
+    pthread_join(wt, NULL);
+    CHECK(controller_current(ack_ctrl, 0) == 50 && controller_current(ack_ctrl, 1) == 20);
+    command_server_close(ack_server);
+    controller_close(ack_ctrl);
+    net_close(fd);
+    net_close(listener);
+    unlink(path);
+#endif
+}
+
+/* The command ring on its own: FIFO, full at COMMAND_RING_SLOTS, and with
+ * several producers racing one consumer nothing is lost or duplicated. */
+#define RING_PRODUCERS 4
+#define RING_PUSHES 20000
+
+static command_ring ring_under_test;
+
+static void *ring_produce(void *arg) {
+    int dir = *(int*)arg;
+    for (int i = 0; i < RING_PUSHES; i++)
+        while (command_ring_push(&ring_under_test, dir) < 0) sched_yield();
+    return NULL;
+}
+
+static void test_command_ring(void) {
+    command_ring *r = &ring_under_test;
+    unsigned pos = 0;
+    int dir;
+    command_ring_init(r);
+    CHECK(command_ring_pop(r, &pos, &dir) == 0);
+    for (int i = 0; i < COMMAND_RING_SLOTS; i++)
+        CHECK(command_ring_push(r, i % 2 ? -1 : 1) == 0);
+    CHECK(command_ring_push(r, 1) == -1);                /* full */
+    CHECK(command_ring_pop(r, &pos, &dir) == 1 && dir == 1);
+    CHECK(command_ring_pop(r, &pos, &dir) == 1 && dir == -1);
+    CHECK(command_ring_push(r, 1) == 0);                 /* room again */
+    r->slots[pos % COMMAND_RING_SLOTS].dir = 7;          /* scribbled on: clamped */
+    CHECK(command_ring_pop(r, &pos, &dir) == 1 && dir == 1);
+
+    command_ring_init(r);
+    pos = 0;
+    int dirs[RING_PRODUCERS];
+    pthread_t t[RING_PRODUCERS];
+    for (int i = 0; i < RING_PRODUCERS; i++) {
+        dirs[i] = i % 2 ? -1 : 1;
+        pthread_create(&t[i], NULL, ring_produce, &dirs[i]);
+    }
+    long popped = 0, sum = 0;
+    double t0 = now_ms();
+    while (popped < (long)RING_PRODUCERS * RING_PUSHES && now_ms() - t0 < 5000.0) {
+        if (command_ring_pop(r, &pos, &dir)) { popped++; sum += dir; }
+        else sched_yield();
+    }
+    for (int i = 0; i < RING_PRODUCERS; i++) pthread_join(t[i], NULL);
+    CHECK(popped == (long)RING_PRODUCERS * RING_PUSHES);
+    CHECK(sum == 0);
+    CHECK(command_ring_pop(r, &pos, &dir) == 0);
+}
+
+#ifdef __linux__
+/* A client that pushes a step for every step the daemon applies. */
+static ring_client *ring_echo;
+static unsigned long ring_echo_apply(int dir) {
+    if (ring_echo) CHECK(ring_client_post(ring_echo, dir) == 0);
+    return 0;
+}
+#endif
+
+/* One drain pops at most a ring's worth, however fast a client refills it, and
+ * leaves the doorbell rung for the rest. */
+static void test_ring_drain_bounded(void) {
+#ifndef __linux__
+    fprintf(stderr, "SKIP test_ring_drain_bounded (no ring on this platform)\n");
+#else
+    int sv[2];
+    CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+    ring_host *host = ring_host_open();
+    CHECK(host != NULL);
+    CHECK(ring_host_hand_out(host, sv[1], "v1 0 ok ring\n") == 0);
+    ring_client *rc = ring_client_attach(sv[0]);
+    CHECK(rc != NULL);
+    if (host && rc) {
+        struct pollfd bell = { ring_host_doorbell(host), POLLIN, 0 };
+        CHECK(ring_client_post(rc, 1) == 0);
+        ring_echo = rc;
+        CHECK(ring_host_drain(host, ring_echo_apply) == COMMAND_RING_SLOTS);
+        CHECK(poll(&bell, 1, 0) == 1);   /* more to come: still rung */
+        ring_echo = NULL;
+        CHECK(ring_host_drain(host, ring_echo_apply) == 1);
+        CHECK(poll(&bell, 1, 0) == 0);   /* empty: quiet */
+    }
+    ring_client_close(rc);
+    ring_host_close(host);
+    close(sv[0]); close(sv[1]);
+#endif
+}
+
+/* The ring through the daemon's front end: a client attaches over an authorized
+ * connection and then posts with no connection per step, and every step is
+ * applied; one the server doesn't authorize gets no ring. (Per-step cost
+ * against the socket path is dimmit_bench's scenario=ring.) */
+#define RING_STEPS 300
+
+static void test_command_server_ring(void) {
+#ifdef _WIN32
+    fprintf(stderr, "SKIP test_command_server_ring on Windows\n");
+#else
+    char path[64];
+    dimmit_sock_t listener = server_listen(path, sizeof(path));
+    CHECK(listener != DIMMIT_BAD_SOCK);
+    const command_handlers h = { server_authorize, server_apply, NULL, NULL };
+    command_server *s = command_server_open(listener, 4, &h);
+    __atomic_store_n(&server_stop, 0, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&server_applied, 0, __ATOMIC_SEQ_CST);
+    ring_host *host = ring_host_open();
+    command_server_set_ring(s, host);   /* NULL where unsupported */
+    pthread_t st;
+    pthread_create(&st, NULL, server_run, s);
+
+    /* Not authorized: closed at accept, so no ring. */
+    __atomic_store_n(&server_denied, 1, __ATOMIC_SEQ_CST);
+    dimmit_sock_t fd = server_connect(path);
+    CHECK(fd != DIMMIT_BAD_SOCK);
+    CHECK(ring_client_attach(fd) == NULL);
+    net_close(fd);
+    __atomic_store_n(&server_denied, 0, __ATOMIC_SEQ_CST);
+
+    fd = server_connect(path);
+    CHECK(fd != DIMMIT_BAD_SOCK);
+    ring_client *rc = ring_client_attach(fd);
+    net_close(fd);
+#ifdef __linux__
+    CHECK(host != NULL && rc != NULL);
+#else
+    CHECK(host == NULL && rc == NULL);   /* no ring here: the socket it is */
+#endif
+    if (rc) {
+        for (int i = 0; i < RING_STEPS; i++) {
+            int before = __atomic_load_n(&server_applied, __ATOMIC_SEQ_CST);
+            CHECK(ring_client_post(rc, i % 2 ? -1 : 1) == 0);
+            while (__atomic_load_n(&server_applied, __ATOMIC_SEQ_CST) == before) sched_yield();
+        }
+        CHECK(__atomic_load_n(&server_applied, __ATOMIC_SEQ_CST) == RING_STEPS);
+        ring_client_close(rc);
+    }
+
+    __atomic_store_n(&server_stop, 1, __ATOMIC_SEQ_CST);
+    pthread_join(st, NULL);
+
+    /* A server with no ring says so. */
+    command_server_set_ring(s, NULL);
+    fd = server_connect(path);
+    CHECK(send(fd, "v1 5 ring\n", 10, 0) == 10);
+    for (int i = 0; i < 3; i++) command_server_poll(s, 50);   /* accept, read, reply */
+    command_reader r;
+    char line[COMMAND_LINE_MAX];
+    command_reader_init(&r);
+    CHECK(ack_read(fd, &r, line) && strcmp(line, "v1 5 err unsupported") == 0);
+    net_close(fd);
+
+    command_server_close(s);
+    ring_host_close(host);
+    net_close(listener);
+    unlink(path);
+#endif
+}
+
 static void test_authorization(void) {
     access_control_mock_authorized = 1;
     CHECK(access_control_is_authorized(0) == 1);
@@ -219,26 +1372,319 @@ static void test_brightness_enumerate_multi(void) {
     mock_reset(1, (int[]){50}, (int[]){100});  /* restore default for other tests */
 }
 
-static void test_controller_lockstep_preserves_offset(void) {
-    /* Two displays, different starting levels + different max. */
-    mock_reset(2, (int[]){50, 20}, (int[]){100, 100});
-    display_controller *c = controller_open();
-    CHECK(c != NULL);
-    CHECK(controller_count(c) == 2);
+/* New displays are probed concurrently -- with the bus holding every probe,
+ * all four are on it at once -- and come back in list order; one that doesn't
+ * answer by the probe deadline is left out without holding up the rest (its
+ * probe closes what it opened once it does finish). */
+typedef struct { brightness_source *s; int n; int ret; } enumeration;
 
-    controller_adjust(c, -1.0/16.0);      /* -6 on each (fraction of own max=100) */
-    CHECK(controller_service(c) == 2);
-    CHECK(controller_current(c, 0) == 44);
-    CHECK(controller_current(c, 1) == 14);  /* 30-point offset preserved */
+static void *enumerate_run(void *arg) {
+    enumeration *e = (enumeration*)arg;
+    e->ret = brightness_enumerate(&e->s, &e->n);
+    return NULL;
+}
 
-    controller_close(c);
+static void test_brightness_enumerate_concurrent(void) {
+    mock_reset(4, (int[]){10, 20, 30, 40}, (int[]){100, 100, 100, 100});
+    for (int i = 0; i < 4; i++) mock_set_gate(i, MOCK_GET, 1);
+    int handles = mock_open_handles();
+
+    enumeration e = { NULL, -1, -1 };
+    pthread_t t;
+    CHECK(pthread_create(&t, NULL, enumerate_run, &e) == 0);
+    CHECK(wait_in_flight(MOCK_GET, 4));
+    for (int i = 0; i < 4; i++) mock_set_gate(i, MOCK_GET, 0);
+    pthread_join(t, NULL);
+    CHECK(mock_peak_in_flight(MOCK_GET) == 4);
+    CHECK(e.ret == 0 && e.n == 4);
+    for (int i = 0; i < e.n; i++) {
+        char label[64];
+        snprintf(label, sizeof(label), "DDC display %d (1234:%04x)", i, 0x5678 + i);
+        CHECK(strcmp(e.s[i].label, label) == 0);
+    }
+    brightness_free(e.s, e.n);
+    CHECK(mock_open_handles() == handles);
+
+    /* Display 1's probe is held past the deadline: enumeration returns the
+     * other two while it is still on the bus. */
+    ddc_set_probe_deadline(50);
+    mock_reset(3, (int[]){10, 20, 30}, (int[]){100, 100, 100});
+    mock_set_gate(1, MOCK_GET, 1);
+    brightness_source *s = NULL; int n = -1;
+    CHECK(brightness_enumerate(&s, &n) == 0);
+    CHECK(mock_in_flight(MOCK_GET) == 1);
+    CHECK(n == 2 && strstr(s[0].label, "display 0") && strstr(s[1].label, "display 2"));
+    brightness_free(s, n);
+    mock_set_gate(1, MOCK_GET, 0);
+    for (int i = 0; i < 200 && mock_open_handles() != handles; i++) sleep_ms(10);
+    CHECK(mock_open_handles() == handles);
+    ddc_set_probe_deadline(0);
     mock_reset(1, (int[]){50}, (int[]){100});
 }
 
-static void test_controller_clamps_at_rails(void) {
-    mock_reset(2, (int[]){3, 98}, (int[]){100, 100});
-    display_controller *c = controller_open();
-    controller_adjust(c, -1.0/16.0);      /* both want -6 */
+/* A display that fails its probe (asleep, or slow to wake) is passed over by
+ * the idle reconcile, but tried again once its backoff runs out -- which doubles
+ * on each further failure -- and taken when it finally answers. */
+static void test_brightness_reject_retry(void) {
+    ddc_set_retry_base(50);
+    mock_reset(2, (int[]){10, 20}, (int[]){100, 100});
+    mock_set_timing(1, MOCK_GET, &(mock_timing){ 0, 0, 100, 0, 0 });
+
+    brightness_source *s = NULL; int n = -1;
+    CHECK(brightness_enumerate(&s, &n) == 0);
+    CHECK(n == 1);
+    CHECK(!brightness_retry_due());
+    brightness_source *again = NULL; int m = -1, changed = -1;
+    int reads = mock_read_count();
+    CHECK(brightness_enumerate_changes(s, n, &again, &m, &changed) == 0);
+    CHECK(changed == 0 && again == NULL);
+    CHECK(mock_read_count() == reads);   /* not due: not probed */
+
+    sleep_ms(60);
+    CHECK(brightness_retry_due());
+    CHECK(brightness_enumerate_changes(s, n, &again, &m, &changed) == 0);
+    CHECK(mock_read_count() == reads + 1);   /* probed again, and failed again */
+    CHECK(changed == 1 && m == 1 && again && again[0].ctx == s[0].ctx);
+    free(again);
+    again = NULL;
+    sleep_ms(60);
+    CHECK(!brightness_retry_due());   /* the second wait is twice the first */
+
+    mock_set_timing(1, MOCK_GET, &(mock_timing){ 0, 0, 0, 0, 0 });
+    sleep_ms(60);
+    CHECK(brightness_retry_due());
+    CHECK(brightness_enumerate_changes(s, n, &again, &m, &changed) == 0);
+    CHECK(changed == 1 && m == 2);
+    if (changed == 1 && m == 2) {
+        CHECK(again[0].ctx == s[0].ctx);
+        free(s);   /* again now holds every ctx */
+        s = again; n = m;
+    } else {
+        free(again);
+    }
+    CHECK(!brightness_retry_due());
+    CHECK(brightness_enumerate_changes(s, n, &again, &m, &changed) == 0);
+    CHECK(changed == 0);
+
+    brightness_free(s, n);
+    ddc_set_retry_base(0);
+    mock_reset(1, (int[]){50}, (int[]){100});
+}
+
+#ifdef __linux__
+/* A fake sysfs tree for the backlight provider, under a temp directory: every
+ * path made is remembered, so it can all be removed again, newest first. */
+typedef struct {
+    char root[64];
+    char made[32][160];
+    int n;
+} fake_sysfs;
+
+static const char *sysfs_path(fake_sysfs *fs, const char *rel) {
+    char path[sizeof(fs->made[0])];
+    snprintf(path, sizeof(path), "%s/%s", fs->root, rel);
+    memcpy(fs->made[fs->n], path, sizeof(path));
+    return fs->made[fs->n++];
+}
+
+static void sysfs_dir(fake_sysfs *fs, const char *rel) {
+    mkdir(sysfs_path(fs, rel), 0755);
+}
+
+static void sysfs_file(fake_sysfs *fs, const char *rel, const void *data, size_t len) {
+    FILE *f = fopen(sysfs_path(fs, rel), "wb");
+    if (f) { fwrite(data, 1, len, f); fclose(f); }
+}
+
+static void sysfs_link(fake_sysfs *fs, const char *rel, const char *target) {
+    CHECK(symlink(target, sysfs_path(fs, rel)) == 0);
+}
+
+static void sysfs_remove(fake_sysfs *fs) {
+    while (fs->n > 0) remove(fs->made[--fs->n]);
+    rmdir(fs->root);
+}
+
+/* A 128-byte EDID base block for maker "DEL" with a name and serial. */
+static void make_edid(unsigned char edid[128], const char *name, const char *serial) {
+    static const unsigned char header[8] = { 0x00, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x00 };
+    memset(edid, 0, 128);
+    memcpy(edid, header, sizeof(header));
+    edid[8] = 0x10; edid[9] = 0xAC;   /* D E L, five bits each */
+    const unsigned char tags[2] = { 0xFC, 0xFF };
+    const char *text[2] = { name, serial };
+    for (int d = 0; d < 2; d++) {
+        unsigned char *p = edid + 54 + 18 * d;
+        p[3] = tags[d];
+        memset(p + 5, ' ', 13);
+        size_t n = strlen(text[d]);
+        memcpy(p + 5, text[d], n);
+        p[5 + n] = 0x0A;
+    }
+}
+
+/* Two monitors of the same model with no serial (text or numeric) in their
+ * EDIDs get no identity, rather than one between them: each would boot from
+ * the other's remembered level and timing. */
+static void test_identity_without_serial(void) {
+    unsigned char a[128], b[128];
+    char ida[DISPLAY_DB_ID_MAX] = "x", idb[DISPLAY_DB_ID_MAX] = "x";
+    make_edid(a, "U2720Q", "");
+    make_edid(b, "U2720Q", "");
+    CHECK(display_db_identity_from_edid(ida, sizeof(ida), a, sizeof(a)) == -1 && ida[0] == '\0');
+    CHECK(display_db_identity_from_edid(idb, sizeof(idb), b, sizeof(b)) == -1 && idb[0] == '\0');
+    b[12] = 42;   /* a numeric serial tells it apart */
+    CHECK(display_db_identity_from_edid(idb, sizeof(idb), b, sizeof(b)) == 0);
+    CHECK(strcmp(idb, "DEL:U2720Q:42") == 0);
+
+    display_db_open(NULL);
+    display_db_set_long(ida, "level", 10);   /* no identity: nothing remembered */
+    long v = 0;
+    CHECK(display_db_get_long(ida, "level", &v) == 0);
+    display_db_close();
+}
+
+static int read_file_int(const char *path) {
+    int v = -1;
+    FILE *f = fopen(path, "r");
+    if (f) { if (fscanf(f, "%d", &v) != 1) v = -1; fclose(f); }
+    return v;
+}
+
+/* /sys/class/backlight devices come before DDC, each identified by its EDID:
+ * an internal panel's from its DRM connector, a ddcci-driven monitor's from the
+ * connector on its I2C bus -- and that monitor's DDC listing is then left alone.
+ * Steps are plain writes to the brightness file, and a reconcile that finds the
+ * same devices changes nothing. */
+static void test_brightness_backlight_sysfs(void) {
+    fake_sysfs fs = { .n = 0 };
+    snprintf(fs.root, sizeof(fs.root), "/tmp/dimmit-sysfs-XXXXXX");
+    CHECK(mkdtemp(fs.root) != NULL);
+    unsigned char panel[128], dell[128], other[128];
+    make_edid(panel, "Panel", "P1");
+    make_edid(dell, "U2720Q", "ABC123");
+    make_edid(other, "P2419H", "XYZ");
+
+    sysfs_dir(&fs, "devices");
+    sysfs_dir(&fs, "devices/card0-eDP-1");
+    sysfs_file(&fs, "devices/card0-eDP-1/edid", panel, sizeof(panel));
+    sysfs_dir(&fs, "devices/i2c-5");
+    sysfs_dir(&fs, "devices/i2c-5/5-0037");
+    sysfs_dir(&fs, "devices/i2c-6");
+    sysfs_dir(&fs, "class");
+    sysfs_dir(&fs, "class/drm");
+    sysfs_dir(&fs, "class/drm/card0-DP-1");
+    sysfs_link(&fs, "class/drm/card0-DP-1/ddc", "../../../devices/i2c-6");
+    sysfs_file(&fs, "class/drm/card0-DP-1/edid", other, sizeof(other));
+    sysfs_dir(&fs, "class/drm/card0-DP-2");
+    sysfs_link(&fs, "class/drm/card0-DP-2/ddc", "../../../devices/i2c-5");
+    sysfs_file(&fs, "class/drm/card0-DP-2/edid", dell, sizeof(dell));
+    sysfs_dir(&fs, "class/backlight");
+    sysfs_dir(&fs, "class/backlight/intel_backlight");
+    sysfs_file(&fs, "class/backlight/intel_backlight/brightness", "120\n", 4);
+    sysfs_file(&fs, "class/backlight/intel_backlight/max_brightness", "400\n", 4);
+    sysfs_link(&fs, "class/backlight/intel_backlight/device", "../../../devices/card0-eDP-1");
+    sysfs_dir(&fs, "class/backlight/ddcci5");
+    sysfs_file(&fs, "class/backlight/ddcci5/brightness", "30\n", 3);
+    sysfs_file(&fs, "class/backlight/ddcci5/max_brightness", "100\n", 4);
+    sysfs_link(&fs, "class/backlight/ddcci5/device", "../../../devices/i2c-5/5-0037");
+
+    /* DDC lists the ddcci-driven monitor too, and one more. */
+    mock_reset(2, (int[]){50, 60}, (int[]){100, 100});
+    mock_set_identity(0, "DEL:U2720Q:ABC123");
+    mock_set_identity(1, "DEL:P2419H:XYZ");
+    backlight_set_sysfs_root(fs.root);
+
+    brightness_source *s = NULL; int n = -1;
+    CHECK(brightness_enumerate(&s, &n) == 0);
+    CHECK(n == 3);
+    if (n == 3) {
+        CHECK(strcmp(s[0].id, "backlight:ddcci5") == 0);
+        CHECK(strcmp(s[0].identity, "DEL:U2720Q:ABC123") == 0);
+        CHECK(strcmp(s[1].id, "backlight:intel_backlight") == 0);
+        CHECK(strcmp(s[1].label, "backlight intel_backlight") == 0);
+        CHECK(strcmp(s[1].identity, "DEL:Panel:P1") == 0);
+        CHECK(strncmp(s[2].id, "ddc:", 4) == 0 && strstr(s[2].label, "display 1"));
+
+        int cur = -1, max = -1;
+        CHECK(s[1].ops->get(s[1].ctx, &cur, &max) == 0 && cur == 120 && max == 400);
+        CHECK(s[1].ops->set(s[1].ctx, 200) == 0);
+        char path[128];
+        snprintf(path, sizeof(path), "%s/class/backlight/intel_backlight/brightness", fs.root);
+        CHECK(read_file_int(path) == 200);
+        CHECK(s[1].ops->get(s[1].ctx, &cur, &max) == 0 && cur == 200);
+        CHECK(s[0].ops->set(s[0].ctx, 7) == 0);
+        snprintf(path, sizeof(path), "%s/class/backlight/ddcci5/brightness", fs.root);
+        CHECK(read_file_int(path) == 7);
+    }
+
+    /* The same devices again: no change, no I/O. */
+    brightness_source *again = NULL; int m = -1, changed = -1;
+    CHECK(brightness_enumerate_changes(s, n, &again, &m, &changed) == 0);
+    CHECK(changed == 0 && again == NULL);
+
+    /* A device that can't be opened (no usable max) is a change once, then
+     * passed over; the known sources come back as they were. Once its backoff
+     * runs out it is tried again, and taken when it opens (a driver that was
+     * still setting it up). */
+    backlight_set_retry_base(50);
+    sysfs_dir(&fs, "class/backlight/acpi_video0");
+    sysfs_file(&fs, "class/backlight/acpi_video0/brightness", "1\n", 2);
+    sysfs_file(&fs, "class/backlight/acpi_video0/max_brightness", "0\n", 2);
+    CHECK(brightness_enumerate_changes(s, n, &again, &m, &changed) == 0);
+    CHECK(changed == 1 && m == n);
+    for (int i = 0; i < m && m == n; i++) CHECK(again[i].ctx == s[i].ctx);
+    free(again);   /* copies: s still owns every ctx */
+    again = NULL;
+    CHECK(brightness_enumerate_changes(s, n, &again, &m, &changed) == 0);
+    CHECK(changed == 0 && again == NULL);
+    CHECK(!brightness_retry_due());
+    char max_path[128];
+    snprintf(max_path, sizeof(max_path), "%s/class/backlight/acpi_video0/max_brightness", fs.root);
+    FILE *mf = fopen(max_path, "w");
+    CHECK(mf != NULL);
+    if (mf) { fputs("10\n", mf); fclose(mf); }
+    sleep_ms(60);
+    CHECK(brightness_retry_due());
+    CHECK(brightness_enumerate_changes(s, n, &again, &m, &changed) == 0);
+    CHECK(changed == 1 && m == n + 1);
+    if (changed == 1 && m == n + 1) {
+        free(s);   /* again holds every ctx now */
+        s = again; n = m;
+    } else {
+        free(again);
+    }
+    again = NULL;
+    CHECK(!brightness_retry_due());
+    backlight_set_retry_base(0);
+
+    brightness_free(s, n);
+    backlight_set_sysfs_root("");
+    sysfs_remove(&fs);
+    mock_reset(1, (int[]){50}, (int[]){100});
+}
+#endif
+
+static void test_controller_lockstep_preserves_offset(void) {
+    /* Two displays, different starting levels + different max. */
+    mock_reset(2, (int[]){50, 20}, (int[]){100, 100});
+    display_controller *c = controller_open();
+    CHECK(c != NULL);
+    CHECK(controller_count(c) == 2);
+
+    controller_adjust(c, -1.0/16.0);      /* -6 on each (fraction of own max=100) */
+    CHECK(controller_service(c) == 2);
+    CHECK(controller_current(c, 0) == 44);
+    CHECK(controller_current(c, 1) == 14);  /* 30-point offset preserved */
+
+    controller_close(c);
+    mock_reset(1, (int[]){50}, (int[]){100});
+}
+
+static void test_controller_clamps_at_rails(void) {
+    mock_reset(2, (int[]){3, 98}, (int[]){100, 100});
+    display_controller *c = controller_open();
+    controller_adjust(c, -1.0/16.0);      /* both want -6 */
     controller_service(c);
     CHECK(controller_current(c, 0) == 0);   /* clamped at floor */
     CHECK(controller_current(c, 1) == 92);
@@ -280,6 +1726,906 @@ static void test_controller_reconcile_add_and_keep(void) {
     mock_reset(1, (int[]){50}, (int[]){100});
 }
 
+/* A ramp through the controller on a fake clock: the first pass writes only the
+ * first frame, passes between frames write nothing and say when the next is due,
+ * the ack ticket isn't committed until the last frame lands, and the display
+ * ends exactly on target. */
+static long fake_clock_ms;
+static long fake_clock(void) { return __atomic_load_n(&fake_clock_ms, __ATOMIC_SEQ_CST); }
+
+static void test_controller_ramp(void) {
+    mock_reset(1, (int[]){0}, (int[]){100});
+    display_controller *c = controller_open();
+    controller_set_clock(c, fake_clock);
+    controller_set_ramp(c, 100);
+    fake_clock_ms = 1000;
+
+    unsigned long ticket = controller_adjust(c, 0.5);
+    CHECK(controller_service(c) == 1);
+    CHECK(controller_current(c, 0) == 8);          /* one 16 ms frame ahead of 0..50 over 100 ms */
+    CHECK(controller_committed(c) != ticket);
+    CHECK(controller_service(c) == 0);             /* same instant: not yet */
+    CHECK(controller_next_frame(c) == DIMMER_MIN_FRAME_MS);
+
+    int frames = 1, last = controller_current(c, 0), monotonic = 1;
+    while (controller_current(c, 0) != 50 && frames < 50) {
+        long wait = controller_next_frame(c);
+        fake_clock_ms += wait > 0 ? wait : 1;
+        if (controller_service(c)) {
+            frames++;
+            monotonic &= controller_current(c, 0) > last;
+            last = controller_current(c, 0);
+        }
+    }
+    CHECK(controller_current(c, 0) == 50);
+    CHECK(monotonic);
+    CHECK(frames >= 5 && frames <= 7);             /* ~100 ms / 16 ms */
+    CHECK(controller_committed(c) == ticket);
+    CHECK(controller_service(c) == 0 && controller_next_frame(c) == -1);   /* at rest */
+    controller_close(c);
+}
+
+/* The controller learns each display's round trip from its own writes, so the
+ * slow one stands out through controller_latency(); and a failing display is
+ * left alone for its retry timeout while the others carry on. */
+static void test_controller_latency(void) {
+    mock_reset(2, (int[]){50, 50}, (int[]){100, 100});
+    mock_set_latency(0, 5);
+    mock_set_latency(1, 40);
+    display_controller *c = controller_open();
+    for (int i = 0; i < 8; i++) {
+        controller_adjust(c, i % 2 ? 1.0/16.0 : -1.0/16.0);
+        controller_service(c);
+    }
+    display_latency fast, slow;
+    CHECK(controller_latency(c, 0, &fast) == 0 && controller_latency(c, 1, &slow) == 0);
+    CHECK(controller_latency(c, 2, &slow) == -1);
+    CHECK(fast.id[0] != '\0' && strcmp(fast.id, slow.id) != 0);
+    CHECK(fast.samples == 9 && slow.samples == 9);   /* the initial read + eight writes */
+    CHECK(fast.srtt_ms < 15);
+    CHECK(slow.srtt_ms >= 20 && slow.srtt_ms < 100);   /* converging on 40 from the instant read */
+    CHECK(slow.srtt_ms > fast.srtt_ms);
+    controller_close(c);
+
+    mock_reset(2, (int[]){50, 50}, (int[]){100, 100});
+    c = controller_open();
+    controller_set_clock(c, fake_clock);
+    fake_clock_ms = 5000;
+    mock_set_fail(0, 1);
+    controller_adjust(c, -1.0/16.0);
+    CHECK(controller_service(c) == 1);             /* display 1 only */
+    display_latency lat;
+    controller_latency(c, 0, &lat);
+    CHECK(lat.failures == 1);
+
+    mock_set_fail(0, 0);
+    controller_adjust(c, -1.0/16.0);
+    CHECK(controller_service(c) == 1);             /* display 0 still backing off */
+    CHECK(mock_current(0) == 50 && mock_current(1) == 38);
+    long wait = controller_next_frame(c);
+    CHECK(wait > 0 && wait <= DIMMER_MAX_BACKOFF_MS);
+    fake_clock_ms += wait;
+    CHECK(controller_service(c) == 1);             /* the held press, once it's over */
+    CHECK(mock_current(0) == 44);
+    controller_latency(c, 0, &lat);
+    CHECK(lat.failures == 0);
+    controller_close(c);
+    mock_reset(1, (int[]){50}, (int[]){100});
+}
+
+static void test_controller_stats(void) {
+    mock_reset(2, (int[]){50, 100}, (int[]){100, 100});
+    mock_set_latency(0, 5);
+    display_controller *c = controller_open();
+    display_stats st;
+    CHECK(controller_stats(c, 2, &st) == -1);
+
+    /* Three presses coalesce into one write per display; display 1 is at the
+     * rail, so its presses are never written and don't count as waiting. */
+    for (int i = 0; i < 3; i++) controller_adjust(c, 1.0/16.0);
+    CHECK(controller_service(c) == 1);
+    CHECK(controller_stats(c, 0, &st) == 0);
+    CHECK(st.id[0] != '\0');
+    CHECK(st.presses == 3 && st.writes == 1 && st.failures == 0);
+    CHECK(st.write_us.n == 1 && st.write_us.max_us >= 4000);
+    CHECK(st.press_to_write_us.n == 1 && st.press_to_write_us.max_us >= st.write_us.max_us);
+    CHECK(controller_stats(c, 1, &st) == 0);
+    CHECK(st.presses == 3 && st.writes == 0 && st.press_to_write_us.n == 0);
+
+    /* A failure is timed and counted, and the next write's wait starts from its
+     * own press, not the failed one's. */
+    controller_adjust(c, -1.0/16.0);
+    CHECK(controller_service(c) == 2);   /* display 1 comes off the rail */
+    mock_set_fail(0, 1);
+    controller_adjust(c, -1.0/16.0);
+    controller_service(c);
+    controller_stats(c, 0, &st);
+    CHECK(st.presses == 5 && st.writes == 2 && st.failures == 1);
+    CHECK(st.write_us.n == 3 && st.press_to_write_us.n == 2);
+
+    /* Counters survive a reconcile that keeps the display. */
+    mock_set_fail(0, 0);
+    controller_reconcile(c);
+    controller_stats(c, 0, &st);
+    CHECK(st.presses == 5 && st.failures == 1);
+    controller_stats(c, 1, &st);
+    CHECK(st.presses == 5 && st.writes == 2 && st.press_to_write_us.n == 2);
+    controller_close(c);
+    mock_reset(1, (int[]){50}, (int[]){100});
+}
+
+/* A display the database remembers starts from its remembered level, max and
+ * round trip without a single read, and controller_verify() reads it back
+ * afterwards, one display per call. */
+static void test_controller_display_db(void) {
+    long v = 0;
+    display_db_open(NULL);
+    mock_reset(3, (int[]){30, 60, 50}, (int[]){100, 200, 100});
+    mock_set_identity(0, "MCK:a:1");
+    mock_set_identity(1, "MCK:b:2");   /* display 2 stays anonymous */
+    mock_set_latency(0, 5);
+    mock_set_timing(0, MOCK_GET, &(mock_timing){ 5, 5, 0, 0, 0 });
+
+    /* First run: probed and read as ever, and remembered. */
+    int reads = mock_read_count();
+    display_controller *c = controller_open();
+    CHECK(controller_count(c) == 3);
+    CHECK(mock_read_count() - reads == 6);   /* a probe and a read each */
+    CHECK(display_db_get_long("MCK:a:1", "controllable", &v) == 1 && v == 1);
+    CHECK(display_db_get_long("MCK:b:2", "max", &v) == 1 && v == 200);
+    controller_adjust(c, 1.0/10.0);
+    CHECK(controller_service(c) == 3);
+    CHECK(display_db_get_long("MCK:a:1", "level", &v) == 1 && v == 40);
+    CHECK(display_db_get_long("MCK:a:1", "srtt_ms", &v) == 1 && v >= 4);
+    /* Nothing started from the database; each write is read back, though, to
+     * learn the display's step. */
+    for (int i = 0; i < 3; i++) CHECK(controller_verify(c) == 1);
+    CHECK(controller_verify(c) == 0);
+    controller_close(c);
+
+    /* Meanwhile someone turns display 0 down on its own buttons. */
+    mock_reset(3, (int[]){10, 80, 50}, (int[]){100, 200, 100});
+    mock_set_identity(0, "MCK:a:1");
+    mock_set_identity(1, "MCK:b:2");
+    mock_set_timing(1, MOCK_GET, &(mock_timing){ 0, 0, 100, 0, 0 });
+
+    /* Second run: only the anonymous display is read; the others start where
+     * they were left, with their learned latency. */
+    reads = mock_read_count();
+    c = controller_open();
+    CHECK(controller_count(c) == 3);
+    CHECK(mock_read_count() - reads == 2);
+    CHECK(controller_current(c, 0) == 40 && controller_current(c, 1) == 80);
+    display_latency lat;
+    CHECK(controller_latency(c, 0, &lat) == 0 && lat.samples == 1 && lat.srtt_ms >= 4);
+
+    /* Read back lazily: display 0 is where its buttons left it. Display 1
+     * doesn't answer; after CONTROLLER_VERIFY_TRIES it's left as remembered and
+     * marked to be probed afresh next time. */
+    CHECK(controller_verify(c) == 1 && controller_current(c, 0) == 10);
+    CHECK(display_db_get_long("MCK:a:1", "level", &v) == 1 && v == 10);
+    for (int i = 0; i < CONTROLLER_VERIFY_TRIES; i++) CHECK(controller_verify(c) == 1);
+    CHECK(controller_verify(c) == 0);
+    CHECK(controller_current(c, 1) == 80);
+    CHECK(display_db_get_long("MCK:b:2", "controllable", &v) == 1 && v == 0);
+    controller_close(c);
+
+    /* A press posted before the read-back lands relative to the level read. */
+    mock_reset(1, (int[]){70}, (int[]){100});
+    mock_set_identity(0, "MCK:a:1");
+    c = controller_open();
+    CHECK(controller_current(c, 0) == 10);
+    controller_adjust(c, 1.0/10.0);
+    CHECK(controller_verify(c) == 1 && controller_current(c, 0) == 70);
+    CHECK(controller_service(c) == 1 && mock_current(0) == 80);
+    controller_close(c);
+
+    display_db_close();
+    mock_reset(1, (int[]){50}, (int[]){100});
+}
+
+/* A display's step, told through the display database or learned from
+ * read-backs of what was written: writes that wouldn't change what it shows
+ * are skipped, and what was learned is remembered. */
+static void test_controller_step(void) {
+    long v = 0;
+    display_stats st;
+    display_db_open(NULL);
+
+    /* Told: 2-point presses against a step of 10 write every fifth... */
+    mock_reset(1, (int[]){50}, (int[]){100});
+    mock_set_identity(0, "MCK:s:1");
+    display_db_set_long("MCK:s:1", "step", 10);
+    display_controller *c = controller_open();
+    int written = 0;
+    unsigned long ticket = 0;
+    for (int i = 0; i < 10; i++) {
+        ticket = controller_adjust(c, 1.0/50.0);
+        written += controller_service(c);
+    }
+    CHECK(mock_current(0) == 70 && written == 2);
+    CHECK(controller_committed(c) == ticket);   /* skipped presses still finish */
+    CHECK(controller_verify(c) == 0);            /* nothing to learn */
+    controller_close(c);
+
+    /* Learned: a display that only keeps multiples of 10 reports, on read-back,
+     * the level it actually took. */
+    mock_reset(2, (int[]){50, 50}, (int[]){100, 100});
+    mock_set_identity(0, "MCK:s:2");
+    mock_set_identity(1, "MCK:s:3");
+    mock_set_quantum(0, 10);
+    c = controller_open();
+    for (int i = 0; i < CONTROLLER_STEP_SAMPLES; i++) {
+        controller_adjust(c, 7.0/100.0);
+        CHECK(controller_service(c) == 2);
+        CHECK(controller_verify(c) == 1 && controller_verify(c) == 1 && controller_verify(c) == 0);
+    }
+    CHECK(mock_current(0) == 90 && controller_current(c, 0) == 90);   /* 57 -> 60, 67 -> 70 ... */
+    CHECK(mock_current(1) == 78);
+    CHECK(display_db_get_long("MCK:s:2", "step", &v) == 1 && v == 10);
+    CHECK(display_db_get_long("MCK:s:3", "step", &v) == 1 && v == 1);
+
+    /* From here on, small presses only reach the coarse display once they add
+     * up to a step; the other takes every one. */
+    for (int i = 0; i < 4; i++) {
+        controller_adjust(c, -2.0/100.0);
+        controller_service(c);
+    }
+    CHECK(controller_stats(c, 0, &st) == 0 && st.writes == CONTROLLER_STEP_SAMPLES + 1);
+    CHECK(controller_stats(c, 1, &st) == 0 && st.writes == CONTROLLER_STEP_SAMPLES + 4);
+    CHECK(mock_current(0) == 80 && mock_current(1) == 70);
+    CHECK(controller_verify(c) == 0);
+    controller_close(c);
+
+    /* Presses short of a step survive a read-back in between. */
+    mock_reset(1, (int[]){50}, (int[]){100});
+    mock_set_identity(0, "MCK:s:4");
+    display_db_set_long("MCK:s:4", "level", 50);
+    display_db_set_long("MCK:s:4", "max", 100);
+    display_db_set_long("MCK:s:4", "step", 10);
+    c = controller_open();
+    controller_adjust(c, 3.0/100.0);
+    CHECK(controller_service(c) == 0);
+    CHECK(controller_verify(c) == 1);            /* the remembered display's read-back */
+    controller_adjust(c, 3.0/100.0);
+    CHECK(controller_service(c) == 1 && mock_current(0) == 60);
+    controller_close(c);
+
+    /* Next time it's known from the start. */
+    mock_reset(1, (int[]){80}, (int[]){100});
+    mock_set_identity(0, "MCK:s:2");
+    c = controller_open();
+    controller_adjust(c, 3.0/100.0);
+    CHECK(controller_service(c) == 0 && mock_current(0) == 80);
+    controller_close(c);
+    display_db_close();
+    mock_reset(1, (int[]){50}, (int[]){100});
+}
+
+/* A deferred controller takes presses before it has any display, keeps them as
+ * fractions, and replays them onto each display of its first set -- holding
+ * their tickets uncommitted until then. */
+static void test_controller_deferred_boot(void) {
+    mock_reset(2, (int[]){50, 100}, (int[]){100, 200});
+    display_controller *c = controller_open_deferred();
+    CHECK(c != NULL && controller_booting(c) && controller_count(c) == 0);
+    controller_adjust(c, 1.0/10.0);
+    controller_adjust(c, 1.0/10.0);
+    controller_adjust(c, -1.0/10.0);
+    CHECK(controller_service(c) == 0);
+    CHECK(controller_committed(c) == 0);    /* nothing has landed yet */
+
+    display_set *next = controller_reconcile_prepare(c);
+    CHECK(next != NULL);
+    unsigned long last = controller_adjust(c, 1.0/10.0);   /* mid-enumeration */
+    controller_reconcile_publish(c, next);
+    CHECK(!controller_booting(c) && controller_count(c) == 2);
+    CHECK(controller_service(c) == 2);
+    CHECK(mock_current(0) == 70 && mock_current(1) == 140);   /* +2 tenths of each range */
+    CHECK(controller_committed(c) == last);
+    display_latency l;
+    CHECK(controller_latency(c, 0, &l) == 0 && l.remembered == 0);
+
+    /* Only the boot set replays: a display plugged in later starts afresh. */
+    controller_adjust(c, 1.0/10.0);
+    controller_service(c);
+    mock_reset(3, (int[]){80, 160, 30}, (int[]){100, 200, 100});
+    controller_reconcile(c);
+    CHECK(controller_count(c) == 3);
+    CHECK(controller_service(c) == 0 && mock_current(2) == 30);
+    controller_close(c);
+
+    /* No displays at all still ends the boot, and releases its tickets. */
+    mock_reset(0, NULL, NULL);
+    c = controller_open_deferred();
+    last = controller_adjust(c, 1.0/10.0);
+    controller_reconcile(c);
+    CHECK(!controller_booting(c) && controller_count(c) == 0);
+    controller_service(c);
+    CHECK(controller_committed(c) == last);
+    controller_close(c);
+    mock_reset(1, (int[]){50}, (int[]){100});
+}
+
+/* Concurrent mode fans the writes out but keeps the sequential bookkeeping: every
+ * display lands on its target and a failing one is still isolated. */
+static void test_controller_concurrent_partial_failure(void) {
+    mock_reset(3, (int[]){50, 50, 20}, (int[]){100, 100, 100});
+    mock_set_fail(1, 1);
+    display_controller *c = controller_open();
+    controller_set_concurrent(c, 1);
+    controller_adjust(c, -1.0/16.0);
+    CHECK(controller_service(c) == 2);
+    CHECK(controller_current(c, 0) == 44);
+    CHECK(controller_current(c, 1) == 50);  /* failed: batch dropped, level kept */
+    CHECK(controller_current(c, 2) == 14);
+    CHECK(mock_current(1) == 50);
+    CHECK(controller_service(c) == 0);      /* nothing left pending */
+    controller_close(c);
+    mock_set_fail(1, 0);
+    mock_reset(1, (int[]){50}, (int[]){100});
+}
+
+/* A pass on its own thread, for tests that hold its writes at the mock's bus
+ * (mock_set_gate) and look at the controller while they are there. */
+typedef struct { display_controller *c; int applied; } service_pass;
+
+static void *service_pass_run(void *arg) {
+    service_pass *p = (service_pass*)arg;
+    p->applied = controller_service(p->c);
+    return NULL;
+}
+
+/* A concurrent pass starts every display's write before it waits on any: with
+ * the bus holding each one, all three are on it at once. A sequential pass
+ * never has more than one there. (How long either takes is dimmit_bench's.) */
+static void test_controller_concurrent_service(void) {
+    for (int mode = 0; mode < 2; mode++) {
+        mock_reset(3, (int[]){50, 50, 50}, (int[]){100, 100, 100});
+        display_controller *c = controller_open();
+        controller_set_concurrent(c, mode);
+        unsigned long ticket = controller_adjust(c, -1.0/16.0);
+        if (mode) {
+            for (int i = 0; i < 3; i++) mock_set_gate(i, MOCK_SET, 1);
+            service_pass p = { c, 0 };
+            pthread_t t;
+            CHECK(pthread_create(&t, NULL, service_pass_run, &p) == 0);
+            CHECK(wait_in_flight(MOCK_SET, 3));
+            for (int i = 0; i < 3; i++) mock_set_gate(i, MOCK_SET, 0);
+            pthread_join(t, NULL);
+        }
+        /* Writes held past the pass's budget land on a later one. */
+        for (int pass = 0; pass < 1000 && controller_committed(c) != ticket; pass++) {
+            controller_service(c);
+            sleep_ms(1);
+        }
+        CHECK(controller_committed(c) == ticket);
+        for (int i = 0; i < 3; i++) CHECK(mock_current(i) == 44);
+        CHECK(mock_peak_in_flight(MOCK_SET) == (mode ? 3 : 1));
+        controller_close(c);
+    }
+    mock_reset(1, (int[]){50}, (int[]){100});
+}
+
+/* Contrast linked to brightness: each step moves it by its share of its own
+ * range, presses coalesce per control, and both land in the display's one
+ * slot -- one write per pass, and a ramp with as many slots as brightness alone
+ * would take. A display without the control, or with the link off, is left be. */
+static void test_controller_linked_contrast(void) {
+    mock_reset(2, (int[]){50, 50}, (int[]){100, 100});
+    mock_set_contrast(0, 80, 100);
+    display_controller *c = controller_open();
+    controller_set_clock(c, fake_clock);
+    fake_clock_ms = 1000;
+    controller_link_feature(c, BRIGHTNESS_CONTRAST, 0.5);
+    controller_adjust(c, -1.0/10.0);
+    controller_adjust(c, -1.0/10.0);
+    unsigned long ticket = controller_adjust(c, -1.0/10.0);
+    CHECK(controller_service(c) == 2);
+    CHECK(mock_current(0) == 20 && mock_contrast(0) == 65);
+    CHECK(mock_current(1) == 20 && mock_contrast(1) == -1);
+    display_stats st;
+    CHECK(controller_stats(c, 0, &st) == 0 && st.presses == 3 && st.writes == 1);
+    CHECK(controller_service(c) == 0 && controller_committed(c) == ticket);
+
+    /* Ramped: the two move frame by frame, together. */
+    controller_set_ramp(c, 100);
+    ticket = controller_adjust(c, 4.0/10.0);
+    int slots = 0, together = 1;
+    for (int pass = 0; pass < 50 && controller_committed(c) != ticket; pass++) {
+        int level = mock_current(0), contrast = mock_contrast(0);
+        if (controller_service(c)) {
+            slots++;
+            together &= (mock_current(0) != level) == (mock_contrast(0) != contrast);
+        }
+        long wait = controller_next_frame(c);
+        fake_clock_ms += wait > 0 ? wait : 1;
+    }
+    CHECK(mock_current(0) == 60 && mock_contrast(0) == 85);
+    CHECK(together);
+    CHECK(slots >= 5 && slots <= 7);
+    CHECK(controller_stats(c, 0, &st) == 0 && st.writes == 1 + (unsigned long)slots);
+
+    /* Unlinked: contrast stays where it is. */
+    controller_set_ramp(c, 0);
+    controller_link_feature(c, BRIGHTNESS_CONTRAST, 0);
+    controller_adjust(c, -1.0/10.0);
+    controller_service(c);
+    CHECK(mock_current(0) == 50 && mock_contrast(0) == 85);
+    controller_close(c);
+
+    /* Linked before the displays are found: steps taken while booting replay
+     * onto contrast too, and concurrent passes write both. */
+    mock_reset(1, (int[]){50}, (int[]){100});
+    mock_set_contrast(0, 50, 100);
+    c = controller_open_deferred();
+    controller_set_concurrent(c, 1);
+    controller_link_feature(c, BRIGHTNESS_CONTRAST, -1.0);
+    controller_adjust(c, 1.0/10.0);
+    controller_reconcile(c);
+    CHECK(controller_service(c) == 1);
+    CHECK(mock_current(0) == 60 && mock_contrast(0) == 40);
+    controller_close(c);
+    mock_reset(1, (int[]){50}, (int[]){100});
+}
+
+/* Sequential passes serve the most overdue display first and stop starting
+ * writes once the pass has used its budget: a slow display at the front of the
+ * set doesn't go first again while the others still wait. */
+static void test_controller_service_order(void) {
+    mock_reset(3, (int[]){50, 50, 50}, (int[]){100, 100, 100});
+    mock_set_latency(0, CONTROLLER_WRITE_BUDGET_MS + 20);
+    mock_set_latency(1, 5);
+    mock_set_latency(2, 5);
+    display_controller *c = controller_open();
+    controller_adjust(c, 1.0/10.0);
+    CHECK(controller_service(c) == 1);          /* display 0 used the whole budget */
+    CHECK(mock_current(0) == 60 && mock_current(1) == 50 && mock_current(2) == 50);
+    CHECK(controller_next_frame(c) == 0);       /* the rest are ready now */
+
+    controller_adjust(c, 1.0/10.0);             /* display 0 is due again, but last */
+    double t0 = now_ms();
+    CHECK(controller_service(c) == 3);
+    CHECK(now_ms() - t0 >= CONTROLLER_WRITE_BUDGET_MS);
+    CHECK(mock_current(0) == 70 && mock_current(1) == 70 && mock_current(2) == 70);
+    controller_close(c);
+    mock_reset(1, (int[]){50}, (int[]){100});
+}
+
+/* A held key (30 presses a second, on the fake clock) across three displays,
+ * one of whose writes stays on the bus the whole time. Every press still lands
+ * on the fast displays in the pass after it, not behind the slow write; the slow
+ * display catches up in one more write once its bus lets go; and all three end
+ * up at the same level. (Press-to-write times are dimmit_bench's.) */
+static void test_controller_held_key_bounded_lag(void) {
+    mock_reset(3, (int[]){0, 0, 0}, (int[]){1000, 1000, 1000});
+    display_controller *c = controller_open();
+    controller_set_concurrent(c, 1);
+    controller_set_clock(c, fake_clock);
+    __atomic_store_n(&fake_clock_ms, 1000, __ATOMIC_SEQ_CST);   /* write threads read it */
+    mock_set_gate(0, MOCK_SET, 1);
+
+    unsigned long last = 0;
+    int kept_up = 1;
+    for (int i = 0; i < 45; i++) {              /* 1.5 s of autorepeat */
+        last = controller_adjust(c, 1.0/1000.0);
+        __atomic_add_fetch(&fake_clock_ms, 33, __ATOMIC_SEQ_CST);
+        controller_service(c);
+        kept_up &= mock_current(1) == i + 1 && mock_current(2) == i + 1;
+    }
+    CHECK(kept_up);
+    CHECK(mock_in_flight(MOCK_SET) == 1 && mock_current(0) == 0);
+
+    mock_set_gate(0, MOCK_SET, 0);
+    for (int pass = 0; pass < 1000 && controller_committed(c) != last; pass++) {
+        controller_service(c);
+        long wait = controller_next_frame(c);
+        __atomic_add_fetch(&fake_clock_ms, wait > 0 ? wait : 1, __ATOMIC_SEQ_CST);
+        sleep_ms(1);                            /* the released write's thread */
+    }
+    CHECK(controller_committed(c) == last);
+    for (int i = 0; i < 3; i++) {
+        display_stats st;
+        CHECK(controller_stats(c, i, &st) == 0);
+        CHECK(st.writes == (i == 0 ? 2UL : 45UL));
+        CHECK(controller_current(c, i) == 45 && mock_current(i) == 45);
+    }
+    controller_close(c);
+    mock_reset(1, (int[]){50}, (int[]){100});
+}
+
+/* The mock's scripted bus, through the implementation API the providers use:
+ * latency ranges per operation, a NAK rate, hangs, and unplugging. */
+static void test_mock_scripted_faults(void) {
+    mock_reset(3, (int[]){50, 50, 50}, (int[]){100, 100, 100});
+    mock_seed(1);
+    DDC_Display_Info_List *list = NULL;
+    CHECK(ddc_implementation_get_display_info_list(0, &list) == DDC_OK && list->ct == 3);
+    DDC_Display_Handle h[3];
+    for (int i = 0; i < 3; i++)
+        CHECK(ddc_implementation_open_display(list->info[i].dref, 0, &h[i]) == DDC_OK);
+    ddc_implementation_free_display_info_list(list);
+    DDC_Non_Table_Vcp_Value v;
+
+    const mock_timing slow_get = { 10, 20, 0, 0, 0 };
+    mock_set_timing(0, MOCK_GET, &slow_get);
+    double t0 = now_ms();
+    CHECK(ddc_implementation_get_non_table_vcp_value(h[0], VCP_BRIGHTNESS, &v) == DDC_OK);
+    double took = now_ms() - t0;
+    CHECK(took >= 9.0 && took < 100.0);
+    t0 = now_ms();
+    CHECK(ddc_implementation_set_non_table_vcp_value(h[0], VCP_BRIGHTNESS, 0, 40) == DDC_OK);
+    CHECK(now_ms() - t0 < 9.0);   /* only the get was slowed */
+
+    const mock_timing flaky = { 0, 0, 50, 0, 0 };
+    mock_set_timing(1, MOCK_SET, &flaky);
+    int naks = 0;
+    for (int i = 0; i < 400; i++)
+        naks += ddc_implementation_set_non_table_vcp_value(h[1], VCP_BRIGHTNESS, 0, 40) != DDC_OK;
+    CHECK(naks > 120 && naks < 280);
+
+    const mock_timing stuck = { 0, 0, 0, 100, 30 };
+    mock_set_timing(2, MOCK_SET, &stuck);
+    t0 = now_ms();
+    CHECK(ddc_implementation_set_non_table_vcp_value(h[2], VCP_BRIGHTNESS, 0, 40) != DDC_OK);
+    CHECK(now_ms() - t0 >= 29.0);
+    CHECK(mock_current(2) == 50);
+
+    mock_set_disappear(2, 0);
+    CHECK(ddc_implementation_get_display_info_list(0, &list) == DDC_OK && list->ct == 2);
+    ddc_implementation_free_display_info_list(list);
+    CHECK(ddc_implementation_get_non_table_vcp_value(h[2], VCP_BRIGHTNESS, &v) != DDC_OK);
+    mock_set_disappear(2, -1);
+    CHECK(ddc_implementation_get_non_table_vcp_value(h[2], VCP_BRIGHTNESS, &v) == DDC_OK);
+
+    for (int i = 0; i < 3; i++) ddc_implementation_close_display(h[i]);
+    mock_reset(1, (int[]){50}, (int[]){100});
+}
+
+/* A display unplugged while its write is on the bus: that write fails without
+ * holding up the other display's, and the next reconcile drops it. */
+static void test_controller_display_vanishes_mid_write(void) {
+    mock_reset(2, (int[]){50, 50}, (int[]){100, 100});
+    mock_set_latency(0, 10);
+    mock_set_latency(1, 40);
+    display_controller *c = controller_open();
+    controller_set_concurrent(c, 1);
+    mock_set_disappear(1, 15);
+    controller_adjust(c, -1.0/16.0);
+    CHECK(controller_service(c) == 1);
+    CHECK(mock_current(0) == 44 && mock_current(1) == 50);
+    CHECK(controller_current(c, 1) == 50);
+    controller_reconcile(c);
+    CHECK(controller_count(c) == 1 && controller_current(c, 0) == 44);
+    controller_close(c);
+    mock_reset(1, (int[]){50}, (int[]){100});
+}
+
+/* Scaling: MOCK_MAX_DISPLAYS displays with jittery 15-25 ms buses, written
+ * concurrently. Every one of them gets the press. (What a pass costs at this
+ * size is dimmit_bench's scenario=pass.) */
+static void test_controller_many_displays(void) {
+    int cur[MOCK_MAX_DISPLAYS], max[MOCK_MAX_DISPLAYS];
+    const mock_timing jitter = { 15, 25, 0, 0, 0 };
+    for (int i = 0; i < MOCK_MAX_DISPLAYS; i++) { cur[i] = 50; max[i] = 100; }
+    mock_reset(MOCK_MAX_DISPLAYS, cur, max);
+    for (int i = 0; i < MOCK_MAX_DISPLAYS; i++) mock_set_timing(i, MOCK_SET, &jitter);
+    display_controller *c = controller_open();
+    CHECK(controller_count(c) == MOCK_MAX_DISPLAYS);
+    controller_set_concurrent(c, 1);
+    unsigned long ticket = controller_adjust(c, 1.0/16.0);
+    int applied = 0;
+    for (int pass = 0; pass < 1000 && controller_committed(c) != ticket; pass++)
+        applied += controller_service(c);
+    CHECK(applied == MOCK_MAX_DISPLAYS);
+    int moved = 0;
+    for (int i = 0; i < MOCK_MAX_DISPLAYS; i++) moved += mock_current(i) == 56;
+    CHECK(moved == MOCK_MAX_DISPLAYS);
+    controller_close(c);
+    mock_reset(1, (int[]){50}, (int[]){100});
+}
+
+/* Stress: several input threads hammer controller_adjust() while a service
+ * thread writes to displays whose set sleeps. No press may be lost: the final
+ * level accounts for every one of them. */
+#define STRESS_PRODUCERS 4
+#define STRESS_POSTS     2000
+typedef struct { display_controller *c; } stress_producer;
+static int stress_stop = 0;       /* service thread should finish (atomic) */
+static int stress_finished = 0;   /* producers done (atomic) */
+
+static void *stress_produce(void *arg) {
+    stress_producer *p = (stress_producer*)arg;
+    for (int i = 0; i < STRESS_POSTS; i++) {
+        controller_adjust(p->c, 1.0/60000.0);   /* +1 on a 60000-step display */
+        if (i % 20 == 19) sleep_ms(1);          /* spread the posts over many writes */
+    }
+    __atomic_fetch_add(&stress_finished, 1, __ATOMIC_SEQ_CST);
+    return NULL;
+}
+
+static void *stress_service(void *arg) {
+    display_controller *c = (display_controller*)arg;
+    while (!__atomic_load_n(&stress_stop, __ATOMIC_SEQ_CST)) controller_service(c);
+    while (controller_service(c) > 0) {}       /* final drain */
+    return NULL;
+}
+
+/* One post from its own thread; `done` once controller_adjust() has returned. */
+typedef struct { display_controller *c; unsigned long ticket; int done; } lone_post;
+
+static void *lone_post_run(void *arg) {
+    lone_post *p = (lone_post*)arg;
+    p->ticket = controller_adjust(p->c, 1.0/10.0);
+    __atomic_store_n(&p->done, 1, __ATOMIC_SEQ_CST);
+    return NULL;
+}
+
+/* A post is an atomic add, never a wait on the write: with the display's write
+ * held on the bus, a post from another thread returns, and its press is counted
+ * while that write is still there. It lands on the next write. */
+static void test_controller_adjust_never_waits_on_writes(void) {
+    mock_reset(1, (int[]){50}, (int[]){100});
+    display_controller *c = controller_open();
+    controller_set_concurrent(c, 1);
+    controller_adjust(c, 1.0/10.0);
+    mock_set_gate(0, MOCK_SET, 1);
+    service_pass pass = { c, 0 };
+    pthread_t service, poster;
+    CHECK(pthread_create(&service, NULL, service_pass_run, &pass) == 0);
+    CHECK(wait_in_flight(MOCK_SET, 1));
+
+    lone_post post = { c, 0, 0 };
+    CHECK(pthread_create(&poster, NULL, lone_post_run, &post) == 0);
+    for (int i = 0; i < 5000 && !__atomic_load_n(&post.done, __ATOMIC_SEQ_CST); i++) sleep_ms(1);
+    CHECK(__atomic_load_n(&post.done, __ATOMIC_SEQ_CST));
+    CHECK(mock_in_flight(MOCK_SET) == 1);      /* the write is still held */
+    display_stats st;
+    CHECK(controller_stats(c, 0, &st) == 0 && st.presses == 2);
+    CHECK(controller_committed(c) < post.ticket);
+    CHECK(mock_current(0) == 50);
+
+    mock_set_gate(0, MOCK_SET, 0);
+    pthread_join(poster, NULL);
+    pthread_join(service, NULL);
+    for (int i = 0; i < 1000 && controller_committed(c) != post.ticket; i++) {
+        controller_service(c);
+        sleep_ms(1);
+    }
+    CHECK(controller_committed(c) == post.ticket);
+    CHECK(controller_current(c, 0) == 70 && mock_current(0) == 70);
+    controller_close(c);
+
+    mock_reset(2, (int[]){1000, 1000}, (int[]){60000, 60000});
+    mock_set_latency(0, 20);
+    mock_set_latency(1, 10);
+    c = controller_open();
+    controller_set_concurrent(c, 1);
+    stress_producer p[STRESS_PRODUCERS];
+    pthread_t producers[STRESS_PRODUCERS];
+    __atomic_store_n(&stress_stop, 0, __ATOMIC_SEQ_CST);
+    CHECK(pthread_create(&service, NULL, stress_service, c) == 0);
+    for (int i = 0; i < STRESS_PRODUCERS; i++) {
+        p[i].c = c;
+        CHECK(pthread_create(&producers[i], NULL, stress_produce, &p[i]) == 0);
+    }
+    for (int i = 0; i < STRESS_PRODUCERS; i++) pthread_join(producers[i], NULL);
+    __atomic_store_n(&stress_stop, 1, __ATOMIC_SEQ_CST);
+    pthread_join(service, NULL);
+
+    const int expect = 1000 + STRESS_PRODUCERS * STRESS_POSTS;
+    CHECK(controller_current(c, 0) == expect);
+    CHECK(controller_current(c, 1) == expect);
+    CHECK(mock_current(0) == expect);
+    CHECK(mock_current(1) == expect);
+    controller_close(c);
+    mock_reset(1, (int[]){50}, (int[]){100});
+}
+
+/* Background reconcile: a prepared set is invisible until published, and presses
+ * posted to the old set in between (drained or not) carry over to the new one. */
+static void test_controller_reconcile_prepare_publish(void) {
+    mock_reset(1, (int[]){50}, (int[]){100});
+    display_controller *c = controller_open();
+    controller_adjust(c, -1.0/16.0);
+    controller_service(c);                   /* 50 -> 44 */
+    controller_adjust(c, -1.0/16.0);         /* posted, not yet drained */
+
+    mock_reset(2, (int[]){44, 70}, (int[]){100, 100});
+    display_set *next = controller_reconcile_prepare(c);
+    CHECK(next != NULL);
+    CHECK(controller_count(c) == 1);         /* old set still live */
+    controller_adjust(c, -1.0/16.0);         /* lands in the old set */
+
+    controller_reconcile_publish(c, next);
+    CHECK(controller_count(c) == 2);
+    CHECK(controller_current(c, 0) == 44);
+    CHECK(controller_current(c, 1) == 70);
+    controller_service(c);
+    CHECK(controller_current(c, 0) == 32);   /* both carried-over presses applied */
+    CHECK(controller_current(c, 1) == 70);   /* arrived after them: untouched */
+
+    /* A prepared set can also be dropped without publishing. */
+    controller_reconcile_discard(controller_reconcile_prepare(c));
+    CHECK(controller_count(c) == 2);
+    controller_close(c);
+    mock_reset(1, (int[]){50}, (int[]){100});
+}
+
+/* RCU stress: producers post while the servicing thread keeps swapping in newly
+ * reconciled sets. Every press must survive the swaps. */
+static void test_controller_reconcile_under_input(void) {
+    mock_reset(2, (int[]){1000, 1000}, (int[]){60000, 60000});
+    display_controller *c = controller_open();
+
+    pthread_t producers[STRESS_PRODUCERS];
+    stress_producer p[STRESS_PRODUCERS];
+    stress_finished = 0;
+    for (int i = 0; i < STRESS_PRODUCERS; i++) {
+        p[i].c = c;
+        CHECK(pthread_create(&producers[i], NULL, stress_produce, &p[i]) == 0);
+    }
+    int swaps = 0;
+    while (__atomic_load_n(&stress_finished, __ATOMIC_SEQ_CST) < STRESS_PRODUCERS) {
+        /* A third display comes and goes, so every pass publishes a new set. */
+        mock_reset(2 + (swaps % 2), (int[]){1000, 1000, 500}, (int[]){60000, 60000, 60000});
+        controller_reconcile(c);
+        controller_service(c);
+        swaps++;
+    }
+    for (int i = 0; i < STRESS_PRODUCERS; i++) pthread_join(producers[i], NULL);
+    CHECK(swaps > 1);
+    mock_reset(2, (int[]){1000, 1000}, (int[]){60000, 60000});
+    controller_reconcile(c);
+    while (controller_service(c) > 0) {}
+
+    const int expect = 1000 + STRESS_PRODUCERS * STRESS_POSTS;
+    CHECK(controller_current(c, 0) == expect);
+    CHECK(controller_current(c, 1) == expect);
+    controller_close(c);
+    mock_reset(1, (int[]){50}, (int[]){100});
+}
+
+/* Publishes back to back, with no pass between them, while presses are being
+ * posted: a press that read the epoch just before one flip must not end up in
+ * a set the next publish frees. Every press lands exactly once. */
+static void test_controller_back_to_back_publish(void) {
+    mock_reset(2, (int[]){1000, 1000}, (int[]){60000, 60000});
+    display_controller *c = controller_open();
+
+    pthread_t producers[STRESS_PRODUCERS];
+    stress_producer p[STRESS_PRODUCERS];
+    stress_finished = 0;
+    for (int i = 0; i < STRESS_PRODUCERS; i++) {
+        p[i].c = c;
+        CHECK(pthread_create(&producers[i], NULL, stress_produce, &p[i]) == 0);
+    }
+    int publishes = 0;
+    while (__atomic_load_n(&stress_finished, __ATOMIC_SEQ_CST) < STRESS_PRODUCERS) {
+        mock_reset(3 - (publishes % 2), (int[]){1000, 1000, 500}, (int[]){60000, 60000, 60000});
+        display_set *next = controller_reconcile_prepare(c);
+        if (next) { controller_reconcile_publish(c, next); publishes++; }
+    }
+    for (int i = 0; i < STRESS_PRODUCERS; i++) pthread_join(producers[i], NULL);
+    CHECK(publishes > 2);
+    mock_reset(2, (int[]){1000, 1000}, (int[]){60000, 60000});
+    controller_reconcile(c);
+    while (controller_service(c) > 0) {}
+
+    const int expect = 1000 + STRESS_PRODUCERS * STRESS_POSTS;
+    CHECK(controller_current(c, 0) == expect);
+    CHECK(controller_current(c, 1) == expect);
+    controller_close(c);
+    mock_reset(1, (int[]){50}, (int[]){100});
+}
+
+/* Incremental reconcile: an unchanged set costs no I/O, and a hotplug opens and
+ * probes only the new display -- survivors keep their handle. */
+static void test_controller_reconcile_incremental(void) {
+    mock_reset(2, (int[]){50, 60}, (int[]){100, 100});
+    int handles0 = mock_open_handles();
+    display_controller *c = controller_open();
+    CHECK(mock_open_handles() == handles0 + 2);
+
+    int reads = mock_read_count();
+    CHECK(controller_reconcile_prepare(c) == NULL);   /* nothing changed */
+    controller_reconcile(c);
+    CHECK(mock_read_count() == reads);                /* idle tick: no probe reads */
+    CHECK(mock_open_handles() == handles0 + 2);       /* and no reopen */
+
+    mock_reset(3, (int[]){50, 60, 70}, (int[]){100, 100, 100});
+    display_set *next = controller_reconcile_prepare(c);
+    CHECK(next != NULL);
+    CHECK(mock_open_handles() == handles0 + 3);       /* only the new one opened */
+    CHECK(mock_read_count() == reads + 2);            /* its probe + initial read */
+    controller_reconcile_discard(next);
+    CHECK(mock_open_handles() == handles0 + 2);       /* discard closed only its own */
+
+    controller_reconcile(c);
+    CHECK(controller_count(c) == 3);
+    CHECK(controller_current(c, 2) == 70);
+
+    mock_reset(1, (int[]){50}, (int[]){100});        /* two unplugged */
+    controller_reconcile(c);
+    CHECK(controller_count(c) == 1);
+    CHECK(mock_open_handles() == handles0 + 1);       /* vanished ones closed */
+
+    controller_close(c);
+    CHECK(mock_open_handles() == handles0);
+}
+
+#ifndef _WIN32
+/* Build a kernel-style uevent ("header\0KEY=VALUE\0...") and send it as one
+ * datagram, the way the netlink socket delivers it. */
+static void send_uevent(int fd, const char *subsystem, int hotplug) {
+    char msg[256];
+    int n = snprintf(msg, sizeof(msg), "change@/devices/x/%s/card0", subsystem) + 1;
+    n += snprintf(msg + n, sizeof(msg) - (size_t)n, "ACTION=change") + 1;
+    n += snprintf(msg + n, sizeof(msg) - (size_t)n, "SUBSYSTEM=%s", subsystem) + 1;
+    if (hotplug) n += snprintf(msg + n, sizeof(msg) - (size_t)n, "HOTPLUG=1") + 1;
+    CHECK(send(fd, msg, (size_t)n, 0) == n);
+}
+#endif
+
+static void test_uevent_parse(void) {
+#ifdef _WIN32
+    fprintf(stderr, "SKIP test_uevent_parse on Windows (Linux hotplug only)\n");
+#else
+    static const char drm[] = "change@/devices/pci0000:00/drm/card0\0ACTION=change\0"
+                              "DEVPATH=/devices/pci0000:00/drm/card0\0SUBSYSTEM=drm\0"
+                              "HOTPLUG=1\0CONNECTOR=95\0SEQNUM=4321";
+    static const char usb[] = "add@/devices/usb1\0ACTION=add\0SUBSYSTEM=usb";
+    static const char noplug[] = "change@/drm/card0\0ACTION=change\0SUBSYSTEM=drm";
+    static const char tricky[] = "change@/drm/card0\0ACTION=change\0SUBSYSTEM=drmx\0HOTPLUG=1";
+    CHECK(uevent_is_drm_hotplug(drm, sizeof(drm)) == 1);
+    CHECK(uevent_is_drm_hotplug(usb, sizeof(usb)) == 0);
+    CHECK(uevent_is_drm_hotplug(noplug, sizeof(noplug)) == 0);
+    CHECK(uevent_is_drm_hotplug(tricky, sizeof(tricky)) == 0);
+    CHECK(uevent_is_drm_hotplug(drm, 10) == 0);   /* truncated: header only */
+#endif
+}
+
+/* A burst of DRM events (with unrelated noise) collapses into one wakeup once the
+ * feed goes quiet; noise alone never wakes; the stop fd ends the wait, and a
+ * read error ends it differently. A datagram socketpair stands in for the
+ * netlink socket. */
+static void test_uevent_debounce(void) {
+#ifdef _WIN32
+    fprintf(stderr, "SKIP test_uevent_debounce on Windows (no socketpair)\n");
+#else
+    int ev[2], stop[2];
+    CHECK(socketpair(AF_UNIX, SOCK_DGRAM, 0, ev) == 0);
+    CHECK(socketpair(AF_UNIX, SOCK_DGRAM, 0, stop) == 0);
+
+    for (int i = 0; i < 5; i++) {
+        send_uevent(ev[0], "drm", 1);
+        send_uevent(ev[0], "usb", 0);
+    }
+    double t0 = now_ms();
+    CHECK(uevent_wait_hotplug(ev[1], stop[1], 30) == 1);
+    CHECK(now_ms() - t0 >= 25.0);                         /* waited out the quiet period */
+
+    /* The whole burst was consumed: only noise left, then a stop request. */
+    send_uevent(ev[0], "usb", 0);
+    send_uevent(ev[0], "drm", 0);                         /* drm without HOTPLUG=1 */
+    CHECK(write(stop[0], "x", 1) == 1);
+    CHECK(uevent_wait_hotplug(ev[1], stop[1], 30) == 0);
+
+    /* A feed that can't be read any more is an error, not a stop, so the
+     * daemon knows to go back to polling. (A pipe: readable, but no socket.) */
+    char c;
+    CHECK(read(stop[1], &c, 1) == 1);   /* take back the stop request */
+    int bad[2];
+    CHECK(pipe(bad) == 0);
+    CHECK(write(bad[1], "x", 1) == 1);
+    CHECK(uevent_wait_hotplug(bad[0], stop[1], 30) == -1);
+    close(bad[0]); close(bad[1]);
+
+    close(ev[0]); close(ev[1]);
+    close(stop[0]); close(stop[1]);
+#endif
+}
+
 static void test_controller_roundtrip(void) {
     mock_reset(1, (int[]){50}, (int[]){100});
     display_controller *c = controller_open();
@@ -292,21 +2638,70 @@ static void test_controller_roundtrip(void) {
 }
 
 int main(void) {
+    backlight_set_sysfs_root("");   /* the mock's displays only, not this machine's */
     test_parse_command();
+    test_parse_request();
     test_dimmer_accumulates();
     test_dimmer_clamps();
     test_dimmer_due();
     test_dimmer_not_due_without_pending();
     test_dimmer_commit_and_settled();
     test_dimmer_coalesces_during_write();
+    test_dimmer_post_and_drain();
+    test_dimmer_ramp();
+    test_dimmer_ramp_retarget();
+    test_dimmer_failure_backoff();
+    test_dimmer_resync();
+    test_dimmer_step();
+    test_stats_histogram();
+    test_sleep_tuner();
+    test_display_db();
+    test_ddcci_packets();
+    test_ddcci_exchanges();
+    test_sim_monitor_protocol();
+    test_sim_monitor_timing();
+    test_sim_monitor_pacing_benchmark();
     test_dimmer_fraction();
     test_command_loop_end_to_end();
+    test_command_reader_streaming();
+    test_command_server_idle_clients();
+    test_command_server_acks();
+    test_command_ring();
+    test_ring_drain_bounded();
+    test_command_server_ring();
     test_authorization();
     test_brightness_enumerate_multi();
+    test_brightness_enumerate_concurrent();
+    test_brightness_reject_retry();
+#ifdef __linux__
+    test_identity_without_serial();
+    test_brightness_backlight_sysfs();
+#endif
     test_controller_lockstep_preserves_offset();
     test_controller_clamps_at_rails();
     test_controller_partial_failure_isolated();
     test_controller_reconcile_add_and_keep();
+    test_controller_ramp();
+    test_controller_latency();
+    test_controller_stats();
+    test_controller_display_db();
+    test_controller_step();
+    test_controller_deferred_boot();
+    test_controller_concurrent_partial_failure();
+    test_controller_concurrent_service();
+    test_controller_service_order();
+    test_controller_linked_contrast();
+    test_controller_held_key_bounded_lag();
+    test_mock_scripted_faults();
+    test_controller_display_vanishes_mid_write();
+    test_controller_many_displays();
+    test_controller_adjust_never_waits_on_writes();
+    test_controller_reconcile_prepare_publish();
+    test_controller_reconcile_under_input();
+    test_controller_back_to_back_publish();
+    test_controller_reconcile_incremental();
+    test_uevent_parse();
+    test_uevent_debounce();
     test_controller_roundtrip();
 
     if (failures) {